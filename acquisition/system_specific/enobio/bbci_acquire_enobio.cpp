@@ -7,6 +7,11 @@
   2. [data] = bbci_acquire_en(state);
   3. [data, marker_time] = bbci_acquire_en(state);
   4. [data, marker_time, marker_descr,state] = bbci_acquire_en(state);
+
+  With state.fs (the sampling rate of the enobio is 500 Hz) or
+  state.filt_resample the calls 3. and 4. resample the data with the
+  polyphase filter of filter.c by fs / 500. The anti-alias filter is
+  state.filt_resample (default: a lowpass like the one of resample).
 */
 
 #include <stdio.h>
@@ -30,6 +35,9 @@ using std::string;
 #pragma comment(lib,"enobio_api\\Enobio3GAPI.lib")
 
 #include "mex.h"
+extern "C" {
+	#include "../../../online/acquisition/lib/filter.h"
+}
 
 /*
 	GLOBAL VARIABLES
@@ -55,6 +63,8 @@ static const char* FIELD_IP = "hostIP";
 static const char* FIELD_MAC = "hostMAC";
 static const char* FIELD_Channels = "numChan";
 static const char* FIELD_Freq = "freq";
+static const char* FIELD_Fs = "fs";
+static const char* FIELD_FiltResample = "filt_resample";
 struct chData
 {
   int channels[20];
@@ -76,6 +86,7 @@ static HANDLE ghMutexCount;
 static HANDLE  hServerThread;
 static unsigned long long g_CurCount=0;
 static unsigned int g_numCh=8;
+static struct filterState *g_Filter=NULL; // the resampler for state.fs, else NULL
 
 //
 // Definition of the consumers to receive both data and status from Enobio
@@ -218,6 +229,71 @@ DWORD WINAPI threadMarkerServer( LPVOID lpParam )
 }
 
 
+/*
+	Creates the polyphase resampler of filter.c for the rate fs: the
+	samples are upsampled by L, filtered with the anti-alias filter
+	filt_resample of the state and downsampled by M, L/M = fs/Fs. Only
+	the output samples are computed. Without filt_resample (or if it is
+	empty) the filter is a lowpass like the one of resample of matlab.
+*/
+void createResampler(const mxArray *pState, double fs) {
+	double one = 1.0;
+	const double *taps = NULL;
+	int size = 0;
+	int up, down;
+	mxArray *filt = mxGetField(pState, 0, FIELD_FiltResample);
+
+	if(filt && !mxIsEmpty(filt)) {
+		if(!mxIsDouble(filt) || mxGetM(filt) != 1)
+			mexErrMsgTxt("bbci_acquire_en: filt_resample has to be a vector");
+		taps = mxGetPr(filt);
+		size = (int)mxGetN(filt);
+	}
+	if(fs <= 0 || fs != (int)fs)
+		mexErrMsgTxt("bbci_acquire_en: state.fs has to be a positive integer");
+
+	filterResampleFactors(Fs, (int)fs, &up, &down);
+	filterDestroy(g_Filter);
+	g_Filter = filterCreate(NULL, NULL, 1, &one, 1, g_numCh);
+	if(!g_Filter || !filterSetResample(g_Filter, taps, size, up, down)) {
+		filterDestroy(g_Filter);
+		g_Filter = NULL;
+		mexErrMsgTxt("bbci_acquire_en: Out of memory");
+	}
+}
+
+/*
+	Runs the queued samples through the resampler, count output samples
+	go to output (count x g_numCh, column major) in the units of the
+	calls 3. and 4. dataTime gets the time of each output sample: the
+	resampler compensates the delay of its filter, so it is the time
+	stamp of the sample which completed it minus that delay.
+*/
+void resampleQueue(double *output, int count, unsigned long long *dataTime) {
+	double x[20];
+	double chanSel[20];
+	double scale[20];
+	int pos = 0;
+
+	for(int j=0;j<g_numCh;j++) {
+		chanSel[j] = j + 1;
+		scale[j] = 1.0 / 1000.0;
+	}
+	while(pos < count && !gDataQueue.empty()) {
+		chData temp = gDataQueue.front();
+		for(int j=0;j<g_numCh;j++)
+			x[j] = temp.channels[j];
+		// the position of this sample in output samples and output samples per input sample
+		double t0 = filterInputTime(g_Filter, 0);
+		double step = filterInputTime(g_Filter, 1) - t0;
+		int written = filterData(g_Filter, x, 1, output + pos, count, chanSel, g_numCh, scale);
+		for(int i=0;i<written;i++)
+			dataTime[pos + i] = (unsigned long long)((double)temp.timeStamp + (i - t0) / step * 1000.0 / Fs);
+		pos += written;
+		gDataQueue.pop();
+	}
+}
+
 SOCKET initConnection()
 {
   SOCKET s;
@@ -278,6 +354,13 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 					double* t= (double*)mxGetData(numChannels);
 					g_numCh = *t;
 				}
+				filterDestroy(g_Filter);
+				g_Filter = NULL;
+				mxArray* fs = mxGetField(prhs[1], 0,FIELD_Fs);
+				if((fs && mxGetScalar(fs) != Fs) || mxGetField(prhs[1], 0,FIELD_FiltResample))
+				{
+					createResampler(prhs[1], fs ? mxGetScalar(fs) : Fs);
+				}
 				if(hostMac) {
 				    int maclen = (mxGetM(hostMac) * mxGetN(hostMac)) + 1;
 					char* macbuff = new char[18];
@@ -350,6 +433,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 				else if((!strcmp(cPi,"quit"))||(!strcmp(cPi,"close"))) {
 					g_bIsConnected = false;
 					g_numCh = 8;
+					filterDestroy(g_Filter);
+					g_Filter = NULL;
 					//fclose(g_Fp);
 					gDataQueue = queue<chData>();
 					gMarkerQueue = queue<markerData>();
@@ -430,6 +515,10 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 			int preCount=gDataQueue.size();
 			ReleaseMutex( ghMutexData);
 			
+			// the resampler needs enough samples for one output sample
+			if(g_Filter && filterOutputCount(g_Filter, preCount) == 0)
+				preCount = 0;
+			
 			if(preCount>0)
 			{
 				WaitForSingleObject(ghMutexMarkers, INFINITE );
@@ -450,7 +539,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 					//mexPrintf("%s\n",output3[i]);
 				}
 
-				int count = gDataQueue.size();
+				int count = g_Filter ? filterOutputCount(g_Filter, gDataQueue.size()) : gDataQueue.size();
 				
 				double* output = new double[count*g_numCh];
 
@@ -458,8 +547,10 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 				unsigned long long* dataTime = new unsigned long long[count];
 				
 
+				if(g_Filter)
+					resampleQueue(output, count, dataTime);
 				
-				for(int i=0;i<count;i++) {
+				for(int i=0;i<count && !g_Filter;i++) {
 					chData newData = gDataQueue.front();
 					
 					for(int j=0;j<g_numCh;j++)
@@ -573,6 +664,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 	{
 		g_bIsConnected = false;
 		g_numCh = 8;
+		filterDestroy(g_Filter);
+		g_Filter = NULL;
 		//fclose(g_Fp);
 		gDataQueue = queue<chData>();
 		gMarkerQueue = queue<markerData>();
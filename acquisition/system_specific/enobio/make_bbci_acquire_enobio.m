@@ -4,7 +4,7 @@ clear functions
 
 params = {'enobio_api\Enobio3GAPI.lib'};
 
-params = ['bbci_acquire_enobio.cpp' params];
+params = ['bbci_acquire_enobio.cpp' '../../../online/acquisition/lib/filter.c' params];
 
 if nargin>= 1 && 1 == debug
   params = ['-g' '-v' params];
@@ -7,6 +7,12 @@
   2. [data] = bbci_acquire_en(state);
   3. [data, marker_time] = bbci_acquire_en(state);
   4. [data, marker_time, marker_descr,state] = bbci_acquire_en(state);
+
+  With state.subsamplePolicy 'resample', or a state.fs which does not
+  divide the base frequency, the calls 3. and 4. resample the data with
+  the polyphase filter of filter.c by fs / base frequency. The anti-alias
+  filter is state.filt_resample (default: a lowpass like the one of
+  resample).
 */
 
 #include <stdio.h>
@@ -33,6 +39,9 @@ using std::string;
 
 #include "mex.h"
 #include "TmsiSDK.h" 
+extern "C" {
+	#include "../../../online/acquisition/lib/filter.h"
+}
 
 #define NUM_CHAN 34
 #define FREQ 1000
@@ -71,6 +80,11 @@ static const char* FIELD_Channels = "numChan";
 static const char* FIELD_Freq = "fs";
 static const char* FIELD_Ref = "commonAverageRef";
 static const char* FIELD_Policy = "subsamplePolicy";
+static const char* FIELD_FiltResample = "filt_resample";
+static const char* FIELD_RtPriority = "rt_priority";
+static const char* FIELD_CpuAffinity = "cpu_affinity";
+static const char* FIELD_RtPriorityApplied = "rt_priority_applied";
+static const char* FIELD_CpuAffinityApplied = "cpu_affinity_applied";
 
 
 struct chData
@@ -99,8 +113,15 @@ static unsigned long long g_CurCount=0;
 static unsigned int g_numCh=8;
 static unsigned int g_Ref=1;
 static unsigned int g_PolicyMean=1;
+static int g_RtPriority=0; // 0: normal priority of the obtain thread
+static int g_CpuAffinity=-1; // -1: the obtain thread runs on any cpu
+static bool g_RtPriorityApplied=false;
+static bool g_CpuAffinityApplied=false;
 
 static double g_Fs=FREQ;
+static struct filterState *g_Filter=NULL; // the resampler of subsamplePolicy 'resample', else NULL
+static int g_ResampleUp=1; // fs = FREQ * g_ResampleUp / g_ResampleDown
+static int g_ResampleDown=1;
 static bool bTerminate=false;
 
 static POPEN fpOpen;
@@ -234,6 +255,103 @@ DWORD WINAPI threadObtain( LPVOID lpParam )
 	return 0;
 }
 
+/*
+	Raises the priority of the thread, a rt_priority above 50 is time
+	critical, and pins it to the cpu of cpu_affinity. Windows has no
+	real-time policies, so this is the closest to SCHED_FIFO.
+*/
+void setThreadOptions(HANDLE hThread) {
+	g_RtPriorityApplied = false;
+	g_CpuAffinityApplied = false;
+
+	if(g_RtPriority > 0) {
+		g_RtPriorityApplied = 0 != SetThreadPriority(hThread, 
+			g_RtPriority > 50 ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST);
+		mexPrintf("Thread priority %s\n", g_RtPriorityApplied ? "raised" : "could NOT be raised");
+	}
+	if(g_CpuAffinity >= 0) {
+		g_CpuAffinityApplied = g_CpuAffinity < (int)(8 * sizeof(DWORD_PTR)) &&
+			0 != SetThreadAffinityMask(hThread, (DWORD_PTR)1 << g_CpuAffinity);
+		mexPrintf("Thread %s to cpu %d\n", g_CpuAffinityApplied ? "pinned" : "could NOT be pinned", g_CpuAffinity);
+	}
+}
+
+/* sets a logical field of the state, which may exist already */
+void setStateFlag(mxArray *pState, const char *fieldname, bool value) {
+	mxArray *pOld = mxGetField(pState, 0, fieldname);
+
+	if(pOld) 
+		mxDestroyArray(pOld);
+	else
+		mxAddField(pState, fieldname);
+	mxSetField(pState, 0, fieldname, mxCreateLogicalScalar(value));
+}
+
+/*
+	Creates the polyphase resampler of filter.c for the rate g_Fs: the
+	samples are upsampled by L, filtered with the anti-alias filter
+	filt_resample of the state and downsampled by M, L/M = fs/FREQ. Only
+	the output samples are computed. Without filt_resample (or if it is
+	empty) the filter is a lowpass like the one of resample of matlab.
+*/
+void createResampler(const mxArray *pState) {
+	double one = 1.0;
+	const double *taps = NULL;
+	int size = 0;
+	mxArray *filt = mxGetField(pState, 0, FIELD_FiltResample);
+
+	if(filt && !mxIsEmpty(filt)) {
+		if(!mxIsDouble(filt) || mxGetM(filt) != 1)
+			mexErrMsgTxt("bbci_acquire_tmsi: filt_resample has to be a vector");
+		taps = mxGetPr(filt);
+		size = (int)mxGetN(filt);
+	}
+	if(g_Fs <= 0 || g_Fs != (int)g_Fs)
+		mexErrMsgTxt("bbci_acquire_tmsi: state.fs has to be a positive integer for the resampling");
+
+	filterResampleFactors(FREQ, (int)g_Fs, &g_ResampleUp, &g_ResampleDown);
+	filterDestroy(g_Filter);
+	g_Filter = filterCreate(NULL, NULL, 1, &one, 1, g_numCh);
+	if(!g_Filter || !filterSetResample(g_Filter, taps, size, g_ResampleUp, g_ResampleDown)) {
+		filterDestroy(g_Filter);
+		g_Filter = NULL;
+		mexErrMsgTxt("bbci_acquire_tmsi: Out of memory");
+	}
+	mexPrintf("RESAMPLING BY %d/%d\n", g_ResampleUp, g_ResampleDown);
+}
+
+/*
+	Runs the queued samples through the resampler, count output samples
+	go to output (count x g_numCh, column major). dataTime gets the time
+	of each output sample: the resampler compensates the delay of its
+	filter, so it is the time stamp of the sample which completed it
+	minus that delay.
+*/
+void resampleQueue(double *output, int count, unsigned long long *dataTime) {
+	double x[34];
+	double chanSel[34];
+	double scale[34];
+	int pos = 0;
+
+	for(int j=0;j<g_numCh;j++) {
+		chanSel[j] = j + 1;
+		scale[j] = 1.0;
+	}
+	while(pos < count && !gDataQueue.empty()) {
+		chData temp = gDataQueue.front();
+		for(int j=0;j<g_numCh;j++)
+			x[j] = temp.channels[j];
+		// the position of this sample in output samples and output samples per input sample
+		double t0 = filterInputTime(g_Filter, 0);
+		double step = filterInputTime(g_Filter, 1) - t0;
+		int written = filterData(g_Filter, x, 1, output + pos, count, chanSel, g_numCh, scale);
+		for(int i=0;i<written;i++)
+			dataTime[pos + i] = (unsigned long long)((double)temp.timeStamp + (i - t0) / step * 1000.0 / FREQ);
+		pos += written;
+		gDataQueue.pop();
+	}
+}
+
 char **DeviceList = NULL;
 int NrOfDevices=0;
 
@@ -401,6 +519,7 @@ int initTMSI() {
 						NULL,          // argument to thread function 
 						0,                      // use default creation flags 
 						&dummy);   // returns the thread identifier 
+		setThreadOptions(hObtainThread);
 		g_bIsConnected = true;
 
 		return 0;
@@ -545,6 +664,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 			}
 			mexPrintf("STARTING\n");
 			g_PolicyMean=1;
+			filterDestroy(g_Filter);
+			g_Filter = NULL;
 				gMarkerQueue = queue<markerData>();
 				gDataQueue = queue<chData>();	
 				g_numCh=8;
@@ -570,6 +691,21 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 					g_Fs = *t;	
 				}
 				
+				g_RtPriority=0;
+				mxArray* rtPriority = mxGetField(prhs[1], 0,FIELD_RtPriority);
+				if(rtPriority) 
+				{
+					double* t= (double*)mxGetData(rtPriority);
+					g_RtPriority = (int)*t;
+				}
+				g_CpuAffinity=-1;
+				mxArray* cpuAffinity = mxGetField(prhs[1], 0,FIELD_CpuAffinity);
+				if(cpuAffinity) 
+				{
+					double* t= (double*)mxGetData(cpuAffinity);
+					g_CpuAffinity = (int)*t;
+				}
+				
 				mxArray* policy = mxGetField(prhs[1], 0,FIELD_Policy);
 				
 				g_PolicyMean = 1;
@@ -585,6 +721,11 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 						mexPrintf("SUBSAMPLING BY LAG\n");
 						g_PolicyMean = 0;
 					}
+					else if(!strcmpi("resample",polbuff)) 
+					{
+						g_PolicyMean = 0;
+						createResampler(prhs[1]);
+					}
 					else 
 					{
 						mexPrintf("SUBSAMPLING BY MEAN\n");
@@ -594,6 +735,12 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 				{
 						mexPrintf("SUBSAMPLING BY MEAN\n");
 				}
+				// a rate which does not divide the base frequency is resampled
+				if(!g_Filter && g_Fs >= 1 && g_Fs < FREQ && FREQ % (int)g_Fs != 0) 
+				{
+					g_PolicyMean = 0;
+					createResampler(prhs[1]);
+				}
 				
 
 				ghMutexData = CreateMutex(NULL,              // default security attributes
@@ -620,7 +767,9 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 									NULL,          // argument to thread function 
 									0,                      // use default creation flags 
 									&dummy);   // returns the thread identifier 
-								
+					
+					setStateFlag(OUT_STATE, FIELD_RtPriorityApplied, g_RtPriorityApplied);
+					setStateFlag(OUT_STATE, FIELD_CpuAffinityApplied, g_CpuAffinityApplied);
 				}
 				
 			
@@ -682,7 +831,13 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 			}
 			
 			int factor=1;
-			if(g_Fs<FREQ) {
+			if(g_Filter) {
+				// the resampler has the rate of init, it needs preCount samples
+				// for at least one output sample
+				if(filterOutputCount(g_Filter, preCount) == 0)
+					preCount = 0;
+			}
+			else if(g_Fs<FREQ) {
 				
 				if(FREQ%((int)g_Fs)!=0)
 					mexErrMsgTxt("Base Frequency not dividable by state.fs");
@@ -712,7 +867,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 					//mexmexPrintf("%s\n",output3[i]);
 				}
 
-				int count = gDataQueue.size()/factor;
+				int count = g_Filter ? filterOutputCount(g_Filter, gDataQueue.size()) : gDataQueue.size()/factor;
 				
 				double* output = new double[count*g_numCh];
 
@@ -721,7 +876,10 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 				
 
 				
-				for(int i=0;i<count;i++) {
+				if(g_Filter)
+					resampleQueue(output, count, dataTime);
+				
+				for(int i=0;i<count && !g_Filter;i++) {
 					
 
 					chData newData;
@@ -769,7 +927,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 				
 				unsigned long long startTime = dataTime[0];
 				
-				if(g_PolicyMean) 
+				if(g_PolicyMean || g_Filter) 
 				{
 					for(int i=0;i<count_markers;i++)
 					{
@@ -784,7 +942,10 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 						if(allMarkers[i].timeStamp > dataTime[count-1])
 							diff = dataTime[count-1];
 						
-						diff=diff/factor;
+						if(g_Filter)
+							diff=diff*g_ResampleUp/g_ResampleDown;
+						else
+							diff=diff/factor;
 						if(diff > (count-1))
 							diff = count - 1;
 						output2[i] = diff;
@@ -891,6 +1052,8 @@ void quitTMSI() {
 		g_bIsConnected = false;
 		g_numCh = 8;
 		g_PolicyMean=1;
+		filterDestroy(g_Filter);
+		g_Filter = NULL;
 		
 		gDataQueue = queue<chData>();
 		gMarkerQueue = queue<markerData>();
@@ -3,7 +3,7 @@ function make_bbci_acquire_bv(debug, nouzz)
 clear functions
 
 params = {'WS2_32.lib'};
-params = ['bbci_acquire_tmsi.cpp' params];
+params = ['bbci_acquire_tmsi.cpp' '../../../online/acquisition/lib/filter.c' params];
 params = ['-g' params]
 %if nargin>= 1 && 1 == debug
 %  params = ['-g' '-v' params];
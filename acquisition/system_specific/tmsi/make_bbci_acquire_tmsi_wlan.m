@@ -4,7 +4,7 @@ clear functions
 
 % params = {'enobio_api\Enobio3GAPI.lib'};
 params = {'WS2_32.lib'};
-params = ['bbci_acquire_tmsi_wlan.cpp' params];
+params = ['bbci_acquire_tmsi_wlan.cpp' '../../../online/acquisition/lib/filter.c' params];
 params = ['-g' params]
 %if nargin>= 1 && 1 == debug
 %  params = ['-g' '-v' params];
@@ -17,9 +17,10 @@ function [varargout] = file_readBV(file, varargin)
 % Properties:
 %   'CLab': Channels to load (labels or indices). Default all
 %           (which can be explicitly specified by [])
-%   'Fs': Sampling interval, must be an integer divisor of the
-%         sampling interval of the raw data. fs may also be 'raw' which means 
-%         sampling rate of raw signals. Default: 'raw'.
+%   'Fs': Sampling interval. If it is no integer divisor of the
+%         sampling interval of the raw data, the data is resampled by
+%         Fs/fs of the raw data (see 'SubsamplePolicy'). fs may also be
+%         'raw' which means sampling rate of raw signals. Default: 'raw'.
 %   'Ival': Interval to read, [start end] in msec. It is not checked
 %           whether the whole interval could be loaded, or the file is shorter.
 %   'IvalSa': Same as 'ival' but [start end] in samples of the downsampled data.
@@ -27,14 +28,26 @@ function [varargout] = file_readBV(file, varargin)
 %   'MaxLen': Maximum length [msec] to be read.
 %   'Filt': Filter to be applied to raw data before subsampling.
 %           opt.Filt must be a struct with fields 'b' and 'a' (as used for
-%           the Matlab function filter).
+%           the Matlab function filter), or with the field 'sos' with
+%           second order sections [nSections 6], each row b0 b1 b2 a0 a1 a2
+%           (as returned by zp2sos), which are stable for high orders.
 %           Note that using opt.Filt may slow down loading considerably.
 %   'SubsamplePolicy': Function that is used for subsampling after filtering, 
 %           specified as as string or a vector.
-%           Default 'subsampleByMean'. Other 'subsampleByLag'
-%           If you specify a vector it has to be the same size as lag.
+%           Default 'subsampleByMean'. Other 'subsampleByLag' and
+%           'resample', which resamples with a lowpass like the one of the
+%           Matlab function resample (always used if Fs is no divisor).
+%           A vector of the same size as lag is a filter for the blocks of
+%           lag samples, a vector of any other size is a linear phase
+%           anti-alias filter for the polyphase resampling (like upfirdn),
+%           for which only the output samples are computed. Like in
+%           resample the delay of the filter is compensated, so the data
+%           stays aligned with the markers.
 %   'LinearDerivation' : for creating bipolar channels (see
 %   procutil_biplist2projection for details)
+%   'OutputClass': 'double' or 'single', the class of cnt.x. Single
+%           halves the memory, the filters still compute in double.
+%           Default 'double'.
 %
 % Remark: 
 %   Properties 'Ival' and 'Start'+'MaxLen' are exclusive, i.e., you may only
@@ -76,6 +89,11 @@ function [varargout] = file_readBV(file, varargin)
 %               - the iir filter was not properly send to read_bv
 %   2010/09/09  - Max Sagebaum
 %               - There was an bug in the check for the lag
+%   2026/10/17  - Jonas Reiter
+%               - OutputClass, cnt.x can be single
+%               - Filt can have second order sections in the field sos
+%               - Fs does not have to be a divisor of the raw sampling rate,
+%                 SubsamplePolicy 'resample' or an anti-alias filter
 
 
 %% check if the mex file is present
@@ -98,10 +116,11 @@ props= {'CLab'               ''       'CHAR|CELL{CHAR}'
         'Prec'               0        'DOUBLE[1]'
         'Ival'               []       'DOUBLE[2]'
         'IvalSa'             []       'DOUBLE[2]'
-        'SubsamplePolicy'    'mean'   'CHAR(mean lag)|DOUBLE'
-        'Filt'               []       'STRUCT(a b)'
+        'SubsamplePolicy'    'mean'   'CHAR(mean lag resample)|DOUBLE'
+        'Filt'               []       'STRUCT(a b)|STRUCT(sos)'
         'LinearDerivation'   []       'STRUCT'
         'TargetFormat'       'bbci'   'CHAR'
+        'OutputClass'        'double' 'CHAR(double single)'
         'Verbose'            1        'BOOL'
        };
 
@@ -198,11 +217,11 @@ for filePos = 1:length(fileNames)
       error('inconsistent sampling rate');
     end
   else
-    % if we have a specific fs check if for each file we have a positive
-    % lag
+    % if we have a specific fs check if it is positive, read_bv
+    % resamples if it is no divisor
     lag = hdr{filePos}.fs/opt.Fs;
-    if lag~=round(lag) || lag<1,
-      error('fs must be a positive integer divisor of every file''s fs');
+    if opt.Fs<=0 || (lag~=round(lag) && opt.Fs~=round(opt.Fs)),
+      error('fs must be positive and an integer if it is no divisor of every file''s fs');
     end
   end
 end
@@ -285,9 +304,8 @@ for filePos = 1:length(fileNames)
   fclose(fid);
   
   curChannels = length(hdr{filePos}.clab);
-  curLag = hdr{filePos}.fs/opt.Fs;
   samples_in_file = floor(fileLen/(cellSize*curChannels));
-  samples_after_subsample = floor(samples_in_file / curLag);
+  samples_after_subsample = floor(samples_in_file * opt.Fs / hdr{filePos}.fs);
   dataSize(filePos) = samples_after_subsample;
   
   % set the new first file and the first data in this file
@@ -317,7 +335,7 @@ end
 %% reading the data
 %create the data block for all samples
 chosen_clab = cnt.clab;
-cnt.x = zeros(dataSamples,nChans);
+cnt.x = zeros(dataSamples,nChans,opt.OutputClass);
 cnt.T = dataSize;
 
 dataOffset = 0; % the offset for the current file
@@ -328,18 +346,31 @@ for filePos = firstFileToRead:lastFileToRead
   read_opt = struct('fs',cnt.fs, 'chanidx',chanids);
 
   if ~isempty(opt.Filt)
-    read_opt.filt_b = opt.Filt.b;
-    read_opt.filt_a = opt.Filt.a;
+    if isfield(opt.Filt, 'sos')
+      read_opt.filt_sos = opt.Filt.sos;
+    else
+      read_opt.filt_b = opt.Filt.b;
+      read_opt.filt_a = opt.Filt.a;
+    end
   end
   % set the subsample filter 
   lag = hdr{filePos}.fs/opt.Fs;
-  switch opt.SubsamplePolicy,
-    case 'mean',
-      read_opt.filt_subsample = ones(1,lag)/lag;
-    case 'lag',
-      read_opt.filt_subsample = [zeros(1,lag-1) 1];
-    otherwise,
-      read_opt.filt_subsample = opt.SubsamplePolicy;
+  if isnumeric(opt.SubsamplePolicy) && ...
+        (lag~=round(lag) || length(opt.SubsamplePolicy)~=lag),
+    % an anti-alias filter for the polyphase resampling
+    read_opt.filt_resample = opt.SubsamplePolicy(:)';
+  elseif lag~=round(lag) || isequal(opt.SubsamplePolicy, 'resample'),
+    % the default lowpass of read_bv
+    read_opt.filt_resample = [];
+  else
+    switch opt.SubsamplePolicy,
+      case 'mean',
+        read_opt.filt_subsample = ones(1,lag)/lag;
+      case 'lag',
+        read_opt.filt_subsample = [zeros(1,lag-1) 1];
+      otherwise,
+        read_opt.filt_subsample = opt.SubsamplePolicy;
+    end
   end
 
   read_hdr = struct('fs',hdr{filePos}.fs, ...
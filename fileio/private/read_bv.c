@@ -16,12 +16,31 @@
         .endian - Byte ordering: 'l' little or 'b' big
       OPT   - Struct with following fields
         .chanidx         - Indices of the channels that are to be read
-        .fs              - Down sample to this sampling rate
+        .fs              - Down sample to this sampling rate. If it is
+                           no divisor of HDR.fs the data is resampled
+                           by OPT.fs / HDR.fs, see filt_resample.
         .filt_b          - Filter coefficients of IIR filter applied to raw data (b part) (optional)
         .filt_a          - Filter coefficients of IIR filter applied to raw data (a part) (optional)
         .filt_subsample  - Filter coefficients of FIR filter used for sub sampling (optional)
+        .filt_sos        - Second order sections [nSections 6], each row
+                           b0 b1 b2 a0 a1 a2, used instead of filt_a and
+                           filt_b (optional)
+        .filt_resample   - The taps of a linear phase anti-alias filter
+                           of any length used instead of filt_subsample:
+                           the data is upsampled by L, filtered and
+                           downsampled by M, L/M = OPT.fs/HDR.fs, like
+                           upfirdn, but the delay of the taps is
+                           compensated like in resample: output sample k
+                           is at the time k/OPT.fs like input sample k at
+                           k/HDR.fs, so the markers stay at their times.
+                           Only the output samples are computed. Empty
+                           for a lowpass like the one of resample
+                           (optional)
         .data            - A matrix where the data is stored (optional)
         .dataPos         - The position in the matrix[dataStart dataEnd fileStart fileend](optional)
+        .output_class    - 'double' or 'single', the class of the returned
+                           data (optional). With .data the class of .data
+                           is used.
  
  The filter parts of the OPT structure are optional fields.
  The default for the filt_subsample is a filter which takes the last value of
@@ -52,6 +71,15 @@
                 - added check that the opt.fs is a divisor of hdr.fs
   2012/02/09 - Benjamin Blankertz
                 - added 64-Bit BinaryFormats
+  2026/10/17 - Jonas Reiter
+                - added output_class, the data can be returned as single
+                - uses a filter object of filter.c, which is compiled with
+                  this file, and frees it at the end
+                - added OPT.filt_sos
+                - added OPT.filt_resample, OPT.fs does not have to be a
+                  divisor of HDR.fs any more. The delay of the resample
+                  filter is compensated, the end of the data is filtered
+                  with zeros after it.
  
 */
 
@@ -62,8 +90,10 @@
 #include <stdint.h>
 #endif
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
 #include "mex.h"
 #include "../../online/acquisition/lib/filter.h"
 
@@ -79,8 +109,11 @@ const char *CHAN_ID_X_FIELD = "chanidx";
 const char *FILT_A_FIELD = "filt_a";
 const char *FILT_B_FIELD = "filt_b";
 const char *FILT_SUBSAMPLE_FIELD = "filt_subsample";
+const char *FILT_SOS_FIELD = "filt_sos";
+const char *FILT_RESAMPLE_FIELD = "filt_resample";
 const char *DATA = "data";
 const char *DATA_POS = "dataPos";
+const char *OUTPUT_CLASS_FIELD = "output_class";
 
 /* the handle for the eeg-file */
 static FILE *eegFile;
@@ -98,12 +131,17 @@ static int rawDataPoints;
 static double *optChannelSelect;
 static int optChannelSelectCount;
 static int optSamplingRate;
+static int optOutputClass;   /* FILTER_FLOAT64 (double) or FILTER_FLOAT32 (single) */
+
+static struct filterState *rbvFilter; /* the IIR and the resample filter */
 
 static int lag; /* the difference between the sampling rate of the raw data and
               and the sampling rate of the requested data */
+static int resampleUp;   /* the output rate is the rate of the raw data */
+static int resampleDown; /* * resampleUp / resampleDown */
 
 /* the positions of the samples when we write in a matrix*/
-static double* dataPtr;
+static void* dataPtr;
 static int dataPtrSize;         /* the number of rows in the data */
 static int dataStart;           /* the position of the first sample in the data*/
 static int dataEnd;             /* the position of the last sample in the data*/
@@ -186,6 +224,13 @@ static void rbv_init(int nrhs, const mxArray *prhs[])
   mxArray *aFilter;
   mxArray *bFilter;
   bool isAFilter, isBFilter; /* to check if filt_a and filt_b was set  */
+  double *aFilterPtr = NULL, *bFilterPtr = NULL; /* NULL for the default IIR filter */
+  mxArray *sosFilter = NULL; /* the second order sections if filt_sos was set */
+  int iirFilterSize = 1;
+  double* filter;           /* the FIR filter */
+  bool resample;            /* true for the polyphase filter of filt_resample */
+  double *resampleFilter = NULL; /* its taps, NULL for the default lowpass */
+  int resampleSize = 0;
   
   int i;  /* temp counting value  */
   double* tempDataPtr; /* pointer for OPT.dataPos */
@@ -334,16 +379,48 @@ static void rbv_init(int nrhs, const mxArray *prhs[])
 	   "OPT.fs argument must be real scalar.");
   optSamplingRate = (int)mxGetScalar(tempPointer);
   
+  rbv_assert(optSamplingRate > 0, "OPT.fs must be positive.");
+  
   /* calculate lag see the value creation for more details */
   lag = (int) ((double)rawDataSamplingRate / (double)optSamplingRate);
   
-  rbv_assert(lag * optSamplingRate == rawDataSamplingRate," The base frequency has to be a multiple of the requested frequency.");
+  /* if the base frequency is no multiple of the requested frequency, or
+   * with filt_resample, the polyphase filter resamples the data */
+  resample = mxGetFieldNumber(OPT,FILT_RESAMPLE_FIELD) != -1 || lag * optSamplingRate != rawDataSamplingRate;
+  if(resample) {
+    filterResampleFactors(rawDataSamplingRate, optSamplingRate, &resampleUp, &resampleDown);
+    lag = 1; /* the FIR filter of filterCreate, replaced by filterSetResample */
+  } else {
+    resampleUp = 1;
+    resampleDown = lag;
+  }
+
+  /*
+   * load the field OPT.output_class
+   */
+  optOutputClass = FILTER_FLOAT64;
+  if(mxGetFieldNumber(OPT,OUTPUT_CLASS_FIELD) != -1) {
+    tempPointer = mxGetField(OPT,0,OUTPUT_CLASS_FIELD);
+    rbv_assert(mxIsChar(tempPointer), "OPT.output_class must be 'double' or 'single'.");
+    charBufLength = mxGetNumberOfElements(tempPointer) + 1;
+    charBuf = malloc(charBufLength * sizeof(char));
+    mxGetString(tempPointer, charBuf, charBufLength);
+    if(0 == strcmp(charBuf, "single")) {
+      optOutputClass = FILTER_FLOAT32;
+    } else if(0 != strcmp(charBuf, "double")) {
+      free(charBuf); charBuf = 0;
+      rbv_assert(false, "OPT.output_class must be 'double' or 'single'.");
+    }
+    free(charBuf); charBuf = 0;
+  }
+
   /*
    * load the data field and dataPos field
    */
   if(mxGetFieldNumber(OPT,DATA) != -1) {
     tempPointer = mxGetField(OPT,0,DATA);
-    rbv_assert(mxIsNumeric(tempPointer), "OPT.data must be a real scalar matrix.");
+    rbv_assert(mxIsDouble(tempPointer) || mxIsSingle(tempPointer),
+        "OPT.data must be a real double or single matrix.");
     rbv_assert(mxGetN(tempPointer) == optChannelSelectCount,
         "OPT.data must have the same size as chanidx.");
     dataStart = 0;
@@ -353,7 +430,8 @@ static void rbv_init(int nrhs, const mxArray *prhs[])
     fileStart = -1;
     fileEnd = -1;
     
-    dataPtr = mxGetPr(tempPointer); 
+    dataPtr = mxGetData(tempPointer); 
+    optOutputClass = mxIsSingle(tempPointer) ? FILTER_FLOAT32 : FILTER_FLOAT64;
     
     if(mxGetFieldNumber(OPT,DATA_POS) != -1) {
       tempPointer = mxGetField(OPT,0,DATA_POS);
@@ -378,7 +456,16 @@ static void rbv_init(int nrhs, const mxArray *prhs[])
   isAFilter = mxGetFieldNumber(OPT,FILT_A_FIELD) != -1;
   isBFilter = mxGetFieldNumber(OPT,FILT_B_FIELD) != -1;
   
-  if(isAFilter && isBFilter) {
+  if(mxGetFieldNumber(OPT,FILT_SOS_FIELD) != -1 && !mxIsEmpty(mxGetField(OPT,0,FILT_SOS_FIELD))) {
+    /* load the second order sections from the structure */
+    sosFilter = mxGetField(OPT,0,FILT_SOS_FIELD);
+    rbv_assert(mxIsDouble(sosFilter) && !mxIsComplex(sosFilter), "OPT.filt_sos must be a real double matrix.");
+    rbv_assert(mxGetN(sosFilter) == 6, "OPT.filt_sos must have 6 columns.");
+    rbv_assert(!isAFilter && !isBFilter, "OPT.filt_sos can not be used together with OPT.filt_a and OPT.filt_b.");
+    for(i = 0; i < (int)mxGetM(sosFilter); ++i) {
+      rbv_assert(mxGetPr(sosFilter)[i + 3 * mxGetM(sosFilter)] != 0.0, "a0 of a section in OPT.filt_sos is zero.");
+    }
+  } else if(isAFilter && isBFilter) {
     /* load the filters from the structure */
     aFilter = mxGetField(OPT,0,FILT_A_FIELD);
     rbv_assert(mxIsNumeric(aFilter), "OPT.filt_a must be a real scalar vector.");
@@ -392,22 +479,35 @@ static void rbv_init(int nrhs, const mxArray *prhs[])
     rbv_assert(mxGetN(aFilter) == mxGetN(bFilter), 
         "OPT.filt_a and OPT.filt_b must have the same size.");
 
-    filterIIRCreate(mxGetPr(aFilter), mxGetPr(bFilter), mxGetN(aFilter), rawDataChannelCount);
+    aFilterPtr = mxGetPr(aFilter);
+    bFilterPtr = mxGetPr(bFilter);
+    iirFilterSize = mxGetN(aFilter);
   } else {
-    if(isAFilter == isBFilter) {
-      filterIIRCreate(NULL,NULL, 1, rawDataChannelCount);
-    } else {
+    if(isAFilter != isBFilter) {
        mexErrMsgTxt("OPT.filt_a or OPT.filt_b was not set.");
        return;
     }
   }
   
+  /*
+   * load the taps of the polyphase filter if they were set
+   */
+  if(resample && mxGetFieldNumber(OPT,FILT_RESAMPLE_FIELD) != -1
+     && !mxIsEmpty(mxGetField(OPT,0,FILT_RESAMPLE_FIELD))) {
+    tempPointer = mxGetField(OPT,0,FILT_RESAMPLE_FIELD);
+    rbv_assert(mxIsDouble(tempPointer) && !mxIsComplex(tempPointer), "OPT.filt_resample must be a real double vector.");
+    rbv_assert(mxGetM(tempPointer) == 1, "OPT.filt_resample has to be a vector.");
+    resampleFilter = mxGetPr(tempPointer);
+    resampleSize = mxGetN(tempPointer);
+  }
+  
   /* 
-   * load the FIR filter if it was set 
+   * load the FIR filter if it was set, with resample it is not used
    */
-  if(mxGetFieldNumber(OPT,FILT_SUBSAMPLE_FIELD) != -1) {
-    double* filter;
-
+  if(resample) {
+    filter = malloc(sizeof(double));
+    filter[0] = 1.0;
+  } else if(mxGetFieldNumber(OPT,FILT_SUBSAMPLE_FIELD) != -1) {
     /* load filter from the structure */
     tempPointer = mxGetField(OPT,0,FILT_SUBSAMPLE_FIELD);
     rbv_assert(mxIsNumeric(tempPointer), "OPT.filt_subsample must be a real scalar vector.");
@@ -416,11 +516,8 @@ static void rbv_init(int nrhs, const mxArray *prhs[])
     rbv_assert(mxGetN(tempPointer) == lag,"FIR filter has to correspondent with the sampling rate.");
     filter = malloc(lag * sizeof(double));
     memcpy(filter, mxGetPr(tempPointer), lag*sizeof(double));
-
-    filterFIRCreate(filter, lag,rawDataChannelCount);
   } else {
     /* the defalut filter will only take the last value from each block  */
-    double* filter;
     filter = malloc(lag * sizeof(double));
 
       
@@ -428,9 +525,20 @@ static void rbv_init(int nrhs, const mxArray *prhs[])
       filter[i] = 0.0;
     }
     filter[lag - 1] = 1.0;
-
-    filterFIRCreate(filter, lag,rawDataChannelCount);
   }
+  
+  if(NULL != sosFilter) {
+    rbvFilter = filterCreateSOS(mxGetPr(sosFilter), (int)mxGetM(sosFilter), filter, lag, rawDataChannelCount);
+  } else {
+    rbvFilter = filterCreate(aFilterPtr, bFilterPtr, iirFilterSize, filter, lag, rawDataChannelCount);
+  }
+  free(filter);
+  if(resample && NULL != rbvFilter
+     && !filterSetResample(rbvFilter, resampleFilter, resampleSize, resampleUp, resampleDown)) {
+    filterDestroy(rbvFilter);
+    rbvFilter = NULL;
+  }
+  rbv_assert(NULL != rbvFilter, "Out of memory.");
 }
 
 /*************************************************************
@@ -527,24 +635,30 @@ static char endian() {
 static void 
 rbv_readData(int nlhs, mxArray *plhs[])
 {  
-  double *outData;          /* the return data of the matlab matrix as double array  */
+  void *outData;            /* the return data of the matlab matrix, double or single  */
   int outDataPos;           /* the number of data blocks written to the outData  */
   int rawDataPos;			      /* the number of data blocks read from the file  */
   int outDataSize;          /* the number of blocks in the outdata  */
+  int outDataCount;         /* the number of blocks the file gives */
   bool swap;                /* swap the bytes of the data */
   
   double *dataBlock;        /* one data block we will read from the file */
   void  *readBuffer;       /* a temporary array we will actually read to */
   double *tempFilterData;   /* a buffer for the filtered data of one block */
-  int n;
+  int tempFilterSize;       /* the most samples one block gives */
+  int n, i, written;
   
   swap = rawDataEndian != endian();
+  tempFilterSize = (resampleUp + resampleDown - 1) / resampleDown;
   dataBlock = malloc(rawDataChannelCount * sizeof(double));
-  tempFilterData = malloc(optChannelSelectCount * sizeof(double));
+  tempFilterData = malloc(tempFilterSize * optChannelSelectCount * sizeof(double));
   readBuffer = malloc(rawDataChannelCount * rawElementSize);
   
-  /* construct the data output matrix. */
-  outDataSize = rawDataPoints / lag; 
+  /* construct the data output matrix. The output samples up to the time
+   * of the last raw sample, with the delay of the resample filter the
+   * last ones come after the data. */
+  outDataCount = rawDataPoints > 0 ? (int)floor(filterInputTime(rbvFilter, rawDataPoints - 1)) + 1 : 0;
+  outDataSize = outDataCount;
   
   if(fileStart == -1) {
     fileStart = 0;
@@ -554,27 +668,42 @@ rbv_readData(int nlhs, mxArray *plhs[])
   }
   
   if(dataPtr == 0) {
-    plhs[0] = mxCreateDoubleMatrix(outDataSize, optChannelSelectCount, mxREAL);
-    outData = mxGetPr(plhs[0]);
+    plhs[0] = mxCreateNumericMatrix(outDataSize, optChannelSelectCount,
+        FILTER_FLOAT32 == optOutputClass ? mxSINGLE_CLASS : mxDOUBLE_CLASS, mxREAL);
+    outData = mxGetData(plhs[0]);
   } else {
     outData = dataPtr;
     outDataSize = dataPtrSize;
   }
   outDataPos = 0;
   
-  for(rawDataPos = 0; rawDataPos < rawDataPoints; ++rawDataPos) {
-    rbv_readDataBlock(dataBlock,readBuffer, rawDataChannelCount,swap);
+  /* after the data of the file the filter gets zeros until it has given
+   * all output samples */
+  for(rawDataPos = 0; rawDataPos < rawDataPoints || outDataPos < outDataCount; ++rawDataPos) {
+    if(rawDataPos < rawDataPoints) {
+      rbv_readDataBlock(dataBlock,readBuffer, rawDataChannelCount,swap);
+    } else {
+      memset(dataBlock, 0, rawDataChannelCount * sizeof(double));
+    }
 
-    filterData(dataBlock, 1, tempFilterData, 1 ,optChannelSelect, optChannelSelectCount, rawDataScale);
+    written = filterData(rbvFilter, dataBlock, 1, tempFilterData, tempFilterSize ,optChannelSelect, optChannelSelectCount, rawDataScale);
    
-    /* check if the fir filter was flushed. Only if true some data was written to tempFilterData */
-    if(0 == getFIRPos()) {
+    /* only if the resample filter had output samples some data was written
+     * to tempFilterData, with upsampling more than one */
+    for(i = 0; i < written && outDataPos < outDataCount; ++i) {
 
       if(fileStart <= outDataPos && 
         outDataPos <= fileEnd &&  /*we only set the data when we are in the range*/
         dataEnd >= outDataPos + dataStart - fileStart) { /* check for the bounds of the data*/
-        for(n = 0;n < optChannelSelectCount; ++n) {
-          outData[n * outDataSize + outDataPos + dataStart - fileStart] = tempFilterData[n];
+        int pos = outDataPos + dataStart - fileStart;
+        if(FILTER_FLOAT32 == optOutputClass) {
+          for(n = 0;n < optChannelSelectCount; ++n) {
+            ((float*)outData)[n * outDataSize + pos] = (float)tempFilterData[n * tempFilterSize + i];
+          }
+        } else {
+          for(n = 0;n < optChannelSelectCount; ++n) {
+            ((double*)outData)[n * outDataSize + pos] = tempFilterData[n * tempFilterSize + i];
+          }
         }
       }
       outDataPos++;
@@ -597,6 +726,9 @@ static void rbv_cleanup()
     fclose(eegFile);
     eegFile = NULL;
   }
+  
+  filterDestroy(rbvFilter);
+  rbvFilter = NULL;
 }
 
 /************************************************************
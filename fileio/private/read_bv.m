@@ -14,7 +14,10 @@ function read_bv
 %                   .endian  - Byte ordering: 'l' little or 'b' big
 %                OPT  - Struct with following fields
 %                   .chanidx         - Indices of the channels that are to be read
-%                   .fs              - Down sample to this sampling rate
+%                   .fs              - Down sample to this sampling rate.
+%                                      If it is no divisor of HDR.fs the
+%                                      data is resampled by
+%                                      OPT.fs/HDR.fs (see filt_resample)
 %                   .filt_b          - Filter coefficients of IIR filter 
 %                                      applied to raw data (b part)
 %                                      (optional)
@@ -23,11 +26,30 @@ function read_bv
 %                                      (optional)
 %                   .filt_subsample  - Filter coefficients of FIR filter
 %                                      used for sub sampling (optional)
+%                   .filt_sos        - Second order sections [nSections 6],
+%                                      each row b0 b1 b2 a0 a1 a2, used
+%                                      instead of filt_a and filt_b
+%                                      (optional)
+%                   .filt_resample   - Taps of a linear phase anti-alias
+%                                      filter of any length, used instead
+%                                      of filt_subsample: like
+%                                      upfirdn(x, filt_resample, L, M)
+%                                      with L/M = OPT.fs/HDR.fs, but the
+%                                      delay of the taps is compensated
+%                                      like in resample, so the markers
+%                                      keep their times. Only the output
+%                                      samples are computed. Empty for a
+%                                      lowpass like the one of resample
+%                                      (optional)
 %                   .data            - A matrix where the data is stored 
 %                                      (optional)
 %                   .dataPos         - The position in the matrix   
 %                                      [dataStart dataEnd fileStart
 %                                      fileEnd](optional) 
+%                   .output_class    - 'double' or 'single', the class of
+%                                      the returned data (optional,
+%                                      default 'double'). If .data is
+%                                      given its class is used.
 %
 %      The filter parts of the OPT structure are optional fields.
 %      The default for the filt_subsample is a filter which takes the last
@@ -53,7 +75,7 @@ function read_bv
 %              BinaryFormat = INT_16
 %
 % COMPILE WITH
-%    mex read_bv.c
+%    mex read_bv.c ../../online/acquisition/lib/filter.c
 %
 % AUTHOR
 %    Max Sagebaum
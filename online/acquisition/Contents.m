@@ -36,5 +36,7 @@
 % offline: Simulate online acquisition by returning small chunks of signals
 %          from an initially given data file.
 % randomSignals: Generate random signals
+% shm:     Read the data another process acquires with bv and exports
+%          with the option 'shm_name'.
 % lsl:     Acquire data from Lab Streaming Layer(LSL). LSL itself can hold
 %           data from most common EEG and other recording devices. 
@@ -5,10 +5,15 @@ function bbci_acquire_bv
 %    state = bbci_acquire_bv('init', state)                      [init]
 %    state = bbci_acquire_sigserv('init', param1, value1, 
 %                                         param2, value2, ...)   [init]
+%    state = bbci_acquire_bv('open', ...)                        [init]
 %    
-%    [data, markertime, markerdescr, state] 
+%    [data, markertime, markerdescr, state, blocks] 
 %        = bbci_acquire_bv(state)                                [get data]
-%    bbci_acquire_bv('close')                                    [close]
+%    [ptr, markertime, markerdescr, state, blocks]
+%        = bbci_acquire_bv(state, ring, ptr)                     [into ring]
+%    bbci_acquire_bv('close')                                    [close all]
+%    bbci_acquire_bv('close', state)                             [close]
+%    stats = bbci_acquire_bv('stats', state)                     [telemetry]
 %    
 % ARGUMENTS
 %           state: The state object for the initialization
@@ -16,7 +21,9 @@ function bbci_acquire_bv
 %                  present in the struct the default value is used.
 %                  Instead of a struct as an argument you can also give the
 %                  fields of the struct as a property list.
-%                .fs : The sampling frequency
+%                .fs : The sampling frequency. If it is no divisor of
+%                      the original sampling frequency, the data is
+%                      resampled by fs / orig_fs (see .filt_resample).
 %                      (Default: Original)
 %                .host : The hostname for the brainserver
 %                        (Default: 127.0.0.1)
@@ -26,26 +33,149 @@ function bbci_acquire_bv
 %                           (Default:  No filter)
 %                .filt_subsample: The vector for the subsample filter.
 %                           (Default:  Mean value)
+%                .filt_sos: [nSections 6] second order sections, each row
+%                           b0 b1 b2 a0 a1 a2 (e.g. from zp2sos with the
+%                           gain in the first section), used instead of
+%                           filt_b and filt_a. High order filters are
+%                           stable this way. (Default:  not used)
+%                .filt_resample: The taps of an anti-alias filter of any
+%                           length, used instead of filt_subsample. The
+%                           data is upsampled by L, filtered and
+%                           downsampled by M, where L/M = fs/orig_fs, like
+%                           upfirdn(x, filt_resample, L, M); only the
+%                           returned samples are computed. The delay of
+%                           the (linear phase) taps is compensated like in
+%                           resample: the samples come that much later,
+%                           but marker_time stays at the time of the
+%                           marker in the returned data, so it may be
+%                           after its last sample. Empty for a
+%                           lowpass like the one of resample. Used
+%                           automatically if fs is no divisor of the
+%                           original sampling frequency.
+%                           (Default:  not used)
 %               
 %               We will also add the following fields to the state object:
 %                .block_no: current block number
 %                .chan_sel: channel indices
 %                .clab: channel labels
-%                .lag: original sampling freq. / sampling freq.
+%                .lag: original sampling freq. / sampling freq. (not an
+%                      integer when the data is resampled)
 %                .scale: scaling factor
 %                .orig_fs: original sampling frequency
 %                .reconnect: reconnect to the server on connection loss
-%                            (default: true(1))
+%                            (default: true(1)). The background thread
+%                            tries again with growing waiting times
+%                            (0.1 s up to 5 s). Meanwhile the data calls
+%                            return empty data at once.
+%                .wait_samples: the data call waits until at least this
+%                         many new samples (at .fs) are there
+%                         (default: 0, return at once). While the
+%                         connection is lost it returns at once.
+%                .wait_timeout: the longest time in ms the data call
+%                         waits for wait_samples (default: 1000). Values
+%                         above 5000 are capped at 5 s, since matlab can
+%                         not be interrupted during the wait; call again
+%                         to wait longer.
 %                .marker_format: The format of the marker output.
 %                         string : e.g. 'R  1', 'S123'
 %                         numeric: e.g.    -1 ,   123
 %                         (default: numeric);
+%                .output_class: 'double' or 'single', the class of the
+%                         data output. The filters always compute in
+%                         double precision. (default: 'double')
+%                .status: 'connected', 'reconnecting' or 'disconnected'
+%                .running: false(0) when the connection is gone for good
+%                .missing_samples: number of samples (at .fs) which were
+%                         lost since the last call, e.g. while the
+%                         connection was down. The count is taken from
+%                         the block numbers of the server, use it to pad
+%                         the data so the time does not shift.
+%                .buffer_seconds: size of the buffer of the background
+%                         thread in seconds (default: 10)
+%                .buffer_samples: size of the buffer in samples of the
+%                         server, used instead of buffer_seconds if not 0.
+%                         Both are rounded up to a power of two.
+%                         (default: 0)
+%                .overflow_policy: what happens to a block of the server
+%                         which does not fit into the buffer because the
+%                         data calls are late (e.g. a long GC pause):
+%                         'drop_newest': the block is lost
+%                         'drop_oldest': the oldest blocks are lost, so
+%                                        the next call gets the latest
+%                                        data, e.g. for feedback
+%                         'spill'      : the block waits in a temporary
+%                                        file (at most 1 GB) and comes
+%                                        back with the next blocks, so
+%                                        nothing is lost but it is late.
+%                                        The file is written and read by
+%                                        the thread which receives the
+%                                        data (also with rt_priority), a
+%                                        slow disk delays it.
+%                         Lost samples are counted in missing_samples.
+%                         (default: 'drop_newest')
+%                .overflow: number of blocks which were lost since the
+%                         last call because they did not fit into the
+%                         buffer, 0 if all went well
+%                .spilled: number of blocks which went to the spill file
+%                         since the last call, they are not lost
+%                .record: name of BrainVision files (.vhdr, .vmrk, .eeg) to
+%                         which the data is recorded as it comes from the
+%                         server, bit-exact and without filtering. A
+%                         thread of its own writes the files, so the
+%                         recording costs the data calls nothing.
+%                         (default: '', no recording)
+%                .record_max_size: size in MB at which a new set of files
+%                         is started, name_002.eeg, name_003.eeg, ...
+%                         0 for no limit (default: 1024)
+%                .shm_name: name of a ring in shared memory to which the
+%                         data and markers of every data call are written
+%                         as they are returned. Other processes read them
+%                         with bbci_acquire_shm. The ring holds 10 s, a
+%                         reader which falls behind loses the oldest
+%                         samples. chan_sel must not change its size.
+%                         (default: '', no export)
+%                .rt_priority: real-time priority (1-99) of the thread
+%                         which receives the data, so MATLAB can not
+%                         delay it. On linux the thread is shared by all
+%                         connections, the last one wins. Needs
+%                         CAP_SYS_NICE or an rtprio limit, on windows a
+%                         priority above 50 is time critical.
+%                         (default: 0, normal scheduling)
+%                .rt_policy: 'fifo' (SCHED_FIFO) or 'rr' (SCHED_RR)
+%                         (default: 'fifo')
+%                .cpu_affinity: the cpu, counted from 0, to which the
+%                         thread is pinned. Not on the mac.
+%                         (default: -1, any cpu)
+%                .mlock:  1 locks the buffers of the connection and of
+%                         the recording in memory, so storing a block
+%                         never waits for a page fault. Needs a memlock
+%                         limit larger than the buffers. (default: 0)
+%                         An option which can not be applied only gives
+%                         a message, see the stats.
+%                .handle: the handle of the connection. Each 'init' (or
+%                         'open') opens a new connection, so several
+%                         servers can be read at the same time. A handle
+%                         is never given again, the state of a closed
+%                         connection does not read from a newer one.
 %
 % RETURNS
 %          data: [nChans, len] the actual data
+%           ptr: with a ring instead of data: the row of the ring with
+%                the last new sample, the given ptr if there is none
 %    markertime: [1, nMarkers] marker time
 %   markerdescr: {1, nMarkers} marker descriptions
 %         state: The updated state object.
+%        blocks: The data blocks of the server in data:
+%                .block_no: [1, nBlocks] the numbers of the blocks
+%                .time    : [1, nBlocks] end of each block in ms, counted
+%                           like markertime
+%                .arrival : [1, nBlocks] time in ms at which each block
+%                           was received. On linux this is the time
+%                           stamp of the kernel.
+%                .read_time: time in ms of this call, read_time - arrival
+%                           is the time the blocks waited in the buffer.
+%                arrival and read_time are taken from a monotonic clock
+%                which only makes sense for differences.
 %
 % DESCRIPTION
 %    Conenct to a brainserver and retrieve data. bbci_acquire_bv starts
@@ -66,7 +196,63 @@ function bbci_acquire_bv
 %        If you add up to three arguments you will also get 
 %        marker information and the state. To close the connection, type
 %        
-%           bbci_acquire_bv('close')
+%           bbci_acquire_bv('close', state)
+%
+%        To read from two servers, open one connection for each:
+%
+%           state1 = bbci_acquire_bv('open', 'host', 'eeg-pc');
+%           state2 = bbci_acquire_bv('open', 'host', 'emg-pc');
+%           data1 = bbci_acquire_bv(state1);
+%           data2 = bbci_acquire_bv(state2);
+%
+%        bbci_acquire_bv('close') without a state closes all connections.
+%
+%        Instead of returning a new matrix for every call the data can
+%        be written into a ring buffer:
+%
+%           ring = zeros(1000, length(state.chan_sel));
+%           ptr = 0;
+%           ptr = bbci_acquire_bv(state, ring, ptr);
+%
+%        The new samples are stored in the rows after ptr, after the
+%        last row it goes on with the first one. ptr is the row of the
+%        last sample, 0 before the first call. The ring has a column for
+%        each channel of chan_sel and the class of output_class. Like
+%        opt.data of read_bv, the ring is changed in place: it must not
+%        share its memory with another variable (e.g. after ring2 = ring),
+%        otherwise that one changes as well.
+%
+%        stats = bbci_acquire_bv('stats', state) returns the counters of
+%        the background thread of the connection:
+%         .blocks_received : data blocks received from the server
+%         .blocks_dropped, .samples_dropped : lost because the buffer
+%                            was full
+%         .duplicate_blocks: blocks which were received twice
+%         .bad_blocks      : malformed blocks, whose sizes do not fit the
+%                            message, they are dropped
+%         .gaps, .gap_samples: gaps in the block numbers of the server
+%         .reconnects      : number of successful reconnects
+%         .bytes_received  : bytes read from the socket
+%         .fifo_high_water : most samples ever waiting in the buffer
+%         .fifo_capacity   : size of the buffer in samples
+%         .overflow_policy : see above
+%         .blocks_dropped_oldest: blocks dropped by 'drop_oldest', they
+%                            are also in blocks_dropped
+%         .blocks_spilled  : blocks which went through the spill file
+%         .spill_waiting   : blocks which wait in the spill file now
+%         .drain_latency   : histogram of the time from the arrival of a
+%                            block until it was returned by a data call
+%         .drain_latency_edges: upper edges of the bins in ms
+%         .status          : see above
+%         .rt_priority, .cpu_affinity, .mlock: 'off', 'applied' or
+%                            the reason why the option failed
+%        If the connection records, there are also
+%         .record_bytes    : bytes written to the .eeg files
+%         .record_blocks   : blocks written
+%         .record_dropped  : blocks which could not be recorded, because
+%                            the disk was too slow or a write failed
+%         .record_files    : number of .eeg files
+%         .record_error    : the error of the failed write or ''
 %
 %
 % COMPILE WITH
@@ -0,0 +1,43 @@
+function bbci_acquire_shm
+%BBCI_ACQUIRE_SHM - Online data acquisition from the shared memory ring of
+%another process
+%   Reads the data which another matlab process acquires with
+%   bbci_acquire_bv(..., 'shm_name', NAME). Any number of processes (up
+%   to 16) can read the same acquisition this way, without a connection
+%   to the server of their own. The data and the markers are the ones the
+%   other process gets, after its filters, subsampling and channel
+%   selection.
+%
+%Synopsis:
+%  STATE= bbci_acquire_shm('init', 'shm_name', NAME, <PARAM>)
+%  [CNTX, MRKTIME, MRKDESC, STATE]= bbci_acquire_shm(STATE)
+%  bbci_acquire_shm('close')
+%  bbci_acquire_shm('close', STATE)
+%
+%Arguments:
+%  PARAM - Optional arguments:
+%     'shm_name'      - the name given to bbci_acquire_bv (required)
+%     'marker_format' - 'numeric' or 'string' (default 'numeric')
+%     'output_class'  - 'double' or 'single' (default 'double')
+%
+%Output:
+%  STATE - Structure characterizing the incoming signals; fields:
+%     'fs', 'clab' of the other process, 'handle' and
+%     'lost_samples' - samples which were overwritten before this reader
+%         got them since the last call. The ring holds 10 s, the writer
+%         never waits for a reader.
+%     'running' - false after the other process has closed the
+%         connection and everything is read
+%  CNTX - 'acquired' signals [Time x Channels]
+%  The following variables hold the markers that have been 'acquired' within
+%  the current block (if any).
+%  MRKTIME - DOUBLE: [1 nMarkers] position [msec] within data block.
+%      A marker occurrence within the first sample would give
+%      MARTIME= 1/STATE.fs.
+%  MRKDESC - DOUBLE [1 nMarkers] or CELL {1 nMarkers} descriptors like
+%      'S 52', see marker_format
+%
+%  The first data call returns what was written after the init. Build
+%  the mex file with lib/make_bbci_acquire_shm.
+
+% 10-2026
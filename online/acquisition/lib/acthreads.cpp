@@ -0,0 +1,345 @@
+/*
+  acthreads.cpp
+
+  The threads, events and mutexes of acthreads.h on top of C++11.
+
+  An event is a flag and a counter of the sleeping waiters. acEventSet
+  sets the flag and only takes the mutex to notify the condition
+  variable if the counter is not zero. A waiter first tries to take the
+  flag, then increments the counter and sleeps until it gets the flag.
+  Both the flag and the counter are sequentially consistent, so either
+  the setter sees the waiter or the waiter sees the flag.
+
+  A thread ends by setting the done flag of its state, which it shares
+  with the handle. acThreadJoin waits for the flag, so the join can have
+  a timeout, which std::thread does not offer.
+
+  The real-time options work on the native handle of the thread, a
+  pthread_t or a windows HANDLE.
+
+  - 2026/10/17 - Jonas Reiter
+                 - Written.
+                 - Priority, affinity and locked memory.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef _WIN32
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#  include <sched.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif
+
+#include "acthreads.h"
+
+typedef std::chrono::steady_clock acClock;
+
+struct acEvent
+{
+  std::atomic<int> signaled;
+  std::atomic<int> waiters;
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  acEvent() : signaled(0), waiters(0) {}
+
+  bool take()
+  {
+    int expected = 1;
+    return signaled.compare_exchange_strong(expected, 0);
+  }
+};
+
+struct acMutex
+{
+  std::mutex mutex;
+};
+
+/* what the thread shares with its handle */
+struct acThreadState
+{
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool done;
+
+  acThreadState() : done(false) {}
+};
+
+struct acThread
+{
+  std::thread thread;
+  std::shared_ptr<acThreadState> state;
+};
+
+
+static void acThreadRun(acThreadFunction run, void *context, std::shared_ptr<acThreadState> state)
+{
+  run(context);
+
+  std::lock_guard<std::mutex> lock(state->mutex);
+  state->done = true;
+  state->condition.notify_all();
+}
+
+
+struct acThread *acThreadCreate(acThreadFunction run, void *context)
+{
+  acThread *pt = new (std::nothrow) acThread;
+
+  if (!pt) return NULL;
+  try {
+    pt->state = std::make_shared<acThreadState>();
+    pt->thread = std::thread(acThreadRun, run, context, pt->state);
+  } catch (...) {
+    delete pt;
+    return NULL;
+  }
+
+  return pt;
+}
+
+
+int acThreadJoin(struct acThread *pt, unsigned long timeout)
+{
+  int result = AC_WAIT_SIGNALED;
+
+  if (!pt) return AC_WAIT_SIGNALED;
+
+  {
+    std::unique_lock<std::mutex> lock(pt->state->mutex);
+    acThreadState *ps = pt->state.get();
+
+    if (AC_INFINITE == timeout) {
+      pt->state->condition.wait(lock, [ps] { return ps->done; });
+    } else if (!pt->state->condition.wait_for(lock, std::chrono::milliseconds(timeout),
+                                               [ps] { return ps->done; })) {
+      result = AC_WAIT_TIMEOUT;
+    }
+  }
+
+  /* the thread has returned from run and only unlocks, so join does not wait */
+  if (AC_WAIT_SIGNALED == result) {
+    pt->thread.join();
+  } else {
+    pt->thread.detach();
+  }
+  delete pt;
+
+  return result;
+}
+
+
+#ifdef _WIN32
+typedef HANDLE acNativeThread;
+#else
+typedef pthread_t acNativeThread;
+#endif
+
+static acNativeThread acNativeHandle(struct acThread *pt)
+{
+#ifdef _WIN32
+  return pt ? (HANDLE)pt->thread.native_handle() : GetCurrentThread();
+#else
+  return pt ? pt->thread.native_handle() : pthread_self();
+#endif
+}
+
+
+int acThreadSetPriority(struct acThread *pt, int policy, int priority)
+{
+  if (AC_SCHED_FIFO != policy && AC_SCHED_RR != policy) return EINVAL;
+
+#ifdef _WIN32
+  if (priority < 1 || priority > 99) return EINVAL;
+  if (!SetThreadPriority(acNativeHandle(pt), priority > 50 ? THREAD_PRIORITY_TIME_CRITICAL
+                                                           : THREAD_PRIORITY_HIGHEST)) {
+    return EPERM;
+  }
+  return 0;
+#else
+  struct sched_param param;
+  int posixPolicy = AC_SCHED_RR == policy ? SCHED_RR : SCHED_FIFO;
+
+  if (priority < sched_get_priority_min(posixPolicy)
+      || priority > sched_get_priority_max(posixPolicy)) {
+    return EINVAL;
+  }
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = priority;
+  return pthread_setschedparam(acNativeHandle(pt), posixPolicy, &param);
+#endif
+}
+
+
+int acThreadSetAffinity(struct acThread *pt, int cpu)
+{
+#if defined(_WIN32)
+  if (cpu < 0 || cpu >= (int)(8 * sizeof(DWORD_PTR))) return EINVAL;
+  if (!SetThreadAffinityMask(acNativeHandle(pt), (DWORD_PTR)1 << cpu)) return EINVAL;
+  return 0;
+#elif defined(__linux__)
+  cpu_set_t set;
+
+  if (cpu < 0 || cpu >= CPU_SETSIZE) return EINVAL;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(acNativeHandle(pt), sizeof(set), &set);
+#else
+  (void)pt;
+  (void)cpu;
+  return ENOTSUP;
+#endif
+}
+
+
+#ifndef _WIN32
+/* widens p and size to whole pages */
+static void acPageRange(void **p, size_t *size)
+{
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)*p & ~(page - 1);
+
+  *size = ((uintptr_t)*p + *size - start + page - 1) & ~(page - 1);
+  *p = (void *)start;
+}
+#endif
+
+
+int acLockMemory(void *p, size_t size)
+{
+  if (!p || 0 == size) return 0;
+
+#ifdef _WIN32
+  if (VirtualLock(p, size)) return 0;
+  if (ERROR_WORKING_SET_QUOTA == GetLastError()) {
+    /* the locked pages must fit into the minimum working set */
+    HANDLE process = GetCurrentProcess();
+    SIZE_T minimum, maximum;
+
+    if (GetProcessWorkingSetSize(process, &minimum, &maximum)
+        && SetProcessWorkingSetSize(process, minimum + size, maximum + size)
+        && VirtualLock(p, size)) {
+      return 0;
+    }
+  }
+  return ENOMEM;
+#else
+  /* mlock faults the pages in, also for writing */
+  acPageRange(&p, &size);
+  return 0 == mlock(p, size) ? 0 : errno;
+#endif
+}
+
+
+void acUnlockMemory(void *p, size_t size)
+{
+  if (!p || 0 == size) return;
+
+#ifdef _WIN32
+  VirtualUnlock(p, size);
+#else
+  acPageRange(&p, &size);
+  munlock(p, size);
+#endif
+}
+
+
+struct acEvent *acEventCreate(void)
+{
+  return new (std::nothrow) acEvent;
+}
+
+
+void acEventSet(struct acEvent *pe)
+{
+  if (pe->signaled.exchange(1)) return;
+
+  if (pe->waiters.load() > 0) {
+    /* the lock makes sure the waiter is either asleep or has not yet looked at the flag */
+    std::lock_guard<std::mutex> lock(pe->mutex);
+    pe->condition.notify_one();
+  }
+}
+
+
+int acEventWait(struct acEvent *pe, unsigned long timeout)
+{
+  bool taken;
+
+  if (pe->take()) return AC_WAIT_SIGNALED;
+  if (0 == timeout) return AC_WAIT_TIMEOUT;
+
+  pe->waiters.fetch_add(1);
+  {
+    std::unique_lock<std::mutex> lock(pe->mutex);
+
+    if (AC_INFINITE == timeout) {
+      pe->condition.wait(lock, [pe] { return pe->take(); });
+      taken = true;
+    } else {
+      taken = pe->condition.wait_until(lock, acClock::now() + std::chrono::milliseconds(timeout),
+                                       [pe] { return pe->take(); });
+    }
+  }
+  pe->waiters.fetch_sub(1);
+
+  return taken ? AC_WAIT_SIGNALED : AC_WAIT_TIMEOUT;
+}
+
+
+void acEventClose(struct acEvent *pe)
+{
+  delete pe;
+}
+
+
+struct acMutex *acMutexCreate(void)
+{
+  return new (std::nothrow) acMutex;
+}
+
+
+void acMutexLock(struct acMutex *pm)
+{
+  pm->mutex.lock();
+}
+
+
+void acMutexUnlock(struct acMutex *pm)
+{
+  pm->mutex.unlock();
+}
+
+
+void acMutexClose(struct acMutex *pm)
+{
+  delete pm;
+}
+
+
+void acSleep(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+
+double acTime(void)
+{
+  return std::chrono::duration<double, std::milli>(acClock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,119 @@
+/*
+  acthreads.h
+
+  Threads, events and mutexes for the acquisition code, the same on
+  every platform. The implementation in acthreads.cpp uses the threads
+  of C++11, the functions can be called from C.
+
+  An event is auto-reset: acEventWait returns when the event is set and
+  clears it, so every acEventSet wakes at most one wait. Setting an event
+  which is already set does nothing. acEventSet and a wait which finds
+  the event set only touch an atomic flag, the mutex is only taken if
+  somebody sleeps. The timeouts are measured with a monotonic clock.
+
+  There is no way to kill a thread. A thread which has to be stopped
+  must be told so and woken up, e.g. by an event it waits for or by
+  shutting down the socket it reads.
+
+  The real-time options (priority, cpu and locked memory) need rights
+  which a normal user often does not have, e.g. CAP_SYS_NICE or an
+  rtprio and a memlock limit in /etc/security/limits.conf on linux.
+  These functions return 0 or an errno value, so the caller can tell
+  the user why an option was not applied.
+
+  - 2026/10/17 - Jonas Reiter
+                 - Written, replaces winthreads.c and winevents.c.
+                 - acThreadSetPriority, acThreadSetAffinity and
+                   acLockMemory.
+*/
+
+#ifndef AC_THREADS_H
+#define AC_THREADS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the timeout of a wait without a timeout */
+#define AC_INFINITE         0xffffffffUL
+
+/* the results of acEventWait and acThreadJoin */
+#define AC_WAIT_SIGNALED    0
+#define AC_WAIT_TIMEOUT     1
+
+/* the scheduling policies of acThreadSetPriority */
+#define AC_SCHED_FIFO       1
+#define AC_SCHED_RR         2
+
+struct acThread;
+struct acEvent;
+struct acMutex;
+
+typedef int (*acThreadFunction)(void *context);
+
+/*
+  Starts a thread which calls run(context). Returns NULL if the thread
+  can not be started.
+*/
+extern struct acThread *acThreadCreate(acThreadFunction run, void *context);
+
+/*
+  Waits at most timeout ms for the thread to return and frees the
+  handle. If the thread is still running after the timeout it is left
+  alone and runs on, AC_WAIT_TIMEOUT is returned and the caller must not
+  free anything the thread uses.
+*/
+extern int acThreadJoin(struct acThread *pt, unsigned long timeout);
+
+/*
+  Runs the thread (NULL: the calling thread) with the real-time policy
+  AC_SCHED_FIFO or AC_SCHED_RR and the priority, 1 to 99 on linux. There
+  are no policies on windows, a priority above 50 is mapped to
+  THREAD_PRIORITY_TIME_CRITICAL and the others to
+  THREAD_PRIORITY_HIGHEST.
+*/
+extern int acThreadSetPriority(struct acThread *pt, int policy, int priority);
+
+/*
+  Pins the thread (NULL: the calling thread) to one cpu, counted from 0.
+  Returns ENOTSUP on the mac, which can not pin threads.
+*/
+extern int acThreadSetAffinity(struct acThread *pt, int cpu);
+
+/*
+  Keeps the size bytes at p in memory. The pages are faulted in, so the
+  first write to them does not wait for the kernel either. Memory which
+  is locked must be unlocked with acUnlockMemory before it is freed.
+*/
+extern int acLockMemory(void *p, size_t size);
+extern void acUnlockMemory(void *p, size_t size);
+
+extern struct acEvent *acEventCreate(void);
+extern void acEventSet(struct acEvent *pe);
+
+/*
+  Waits at most timeout ms (AC_INFINITE: no limit) for the event. Returns
+  AC_WAIT_SIGNALED or AC_WAIT_TIMEOUT.
+*/
+extern int acEventWait(struct acEvent *pe, unsigned long timeout);
+
+/* frees the event, nobody may wait for it any more */
+extern void acEventClose(struct acEvent *pe);
+
+extern struct acMutex *acMutexCreate(void);
+extern void acMutexLock(struct acMutex *pm);
+extern void acMutexUnlock(struct acMutex *pm);
+extern void acMutexClose(struct acMutex *pm);
+
+extern void acSleep(unsigned long ms);
+
+/* the monotonic clock of the timeouts in ms */
+extern double acTime(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,162 @@
+/*
+  acthreads_bench.c
+
+  Measures the parts of acthreads.h the acquisition depends on:
+
+  - the wake-up latency of an event, from acEventSet in one thread to the
+    return of acEventWait in the other (half of a ping-pong round trip),
+  - how long acEventWait overshoots its timeout,
+  - the time to start a thread and to join it,
+  - the time to stop a thread which sits in recv, as stopPollThread
+    does it: shutdown of the socket and join (not on windows).
+
+  Build and run:
+
+    c++ -std=c++11 -O2 -c acthreads.cpp
+    cc -O2 acthreads_bench.c acthreads.o -o acthreads_bench -lstdc++ -lpthread
+    ./acthreads_bench [rounds]
+
+  - 2026/10/17 - Jonas Reiter
+                 - Was a test of the winunix events, now a benchmark of
+                   acthreads.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#  include <unistd.h>
+#  include <sys/socket.h>
+#endif
+
+#include "acthreads.h"
+
+#define DEFAULT_ROUNDS  10000
+
+struct pingPong
+{
+  struct acEvent *ping;
+  struct acEvent *pong;
+  int rounds;
+};
+
+static int compareDouble(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* prints the median, the 99th percentile and the maximum of n times in ms as us */
+static void report(const char *what, double *times, int n)
+{
+  qsort(times, n, sizeof(double), compareDouble);
+  printf("%-28s median %8.1f us   p99 %8.1f us   max %8.1f us   (n = %d)\n", what,
+         times[n / 2] * 1000.0, times[(int)(n * 0.99)] * 1000.0, times[n - 1] * 1000.0, n);
+}
+
+static int pongThread(void *context)
+{
+  struct pingPong *pp = (struct pingPong *)context;
+  int i;
+
+  for (i = 0; i < pp->rounds; i++) {
+    acEventWait(pp->ping, AC_INFINITE);
+    acEventSet(pp->pong);
+  }
+  return 0;
+}
+
+static int emptyThread(void *context)
+{
+  (void)context;
+  return 0;
+}
+
+#ifndef _WIN32
+static int recvThread(void *context)
+{
+  char buffer[16];
+  return (int)recv(*(int *)context, buffer, sizeof(buffer), 0);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+  int rounds = DEFAULT_ROUNDS;
+  struct pingPong pp;
+  struct acThread *pt;
+  double *times;
+  int i, n;
+
+  if (argc == 2) rounds = atoi(argv[1]);
+  if (rounds < 100) rounds = 100;
+  times = (double *)malloc(rounds * sizeof(double));
+  if (!times) return 1;
+
+  /* wake-up latency */
+  pp.ping = acEventCreate();
+  pp.pong = acEventCreate();
+  pp.rounds = rounds;
+  pt = acThreadCreate(pongThread, &pp);
+  for (i = 0; i < rounds; i++) {
+    double start = acTime();
+
+    acEventSet(pp.ping);
+    acEventWait(pp.pong, AC_INFINITE);
+    times[i] = (acTime() - start) / 2.0;
+  }
+  acThreadJoin(pt, AC_INFINITE);
+  report("event wake-up", times, rounds);
+
+  /* overshoot of timed waits, a few only because each takes a ms */
+  n = rounds < 200 ? rounds : 200;
+  for (i = 0; i < n; i++) {
+    double start = acTime();
+
+    acEventWait(pp.ping, 1);
+    times[i] = acTime() - start - 1.0;
+  }
+  report("timeout overshoot (1 ms)", times, n);
+  acEventClose(pp.ping);
+  acEventClose(pp.pong);
+
+  /* thread start and join */
+  n = rounds < 2000 ? rounds : 2000;
+  for (i = 0; i < n; i++) {
+    double start = acTime();
+
+    pt = acThreadCreate(emptyThread, NULL);
+    acThreadJoin(pt, AC_INFINITE);
+    times[i] = acTime() - start;
+  }
+  report("thread start and join", times, n);
+
+#ifndef _WIN32
+  /* stop of a thread blocked in recv */
+  n = rounds < 500 ? rounds : 500;
+  for (i = 0; i < n; i++) {
+    int sockets[2];
+    double start;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+      perror("socketpair");
+      return 1;
+    }
+    pt = acThreadCreate(recvThread, &sockets[0]);
+    acSleep(1);
+
+    start = acTime();
+    shutdown(sockets[0], SHUT_RDWR);
+    acThreadJoin(pt, AC_INFINITE);
+    times[i] = acTime() - start;
+
+    close(sockets[0]);
+    close(sockets[1]);
+  }
+  report("stop of a thread in recv", times, n);
+#endif
+
+  free(times);
+  return 0;
+}
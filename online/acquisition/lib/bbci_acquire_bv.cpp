@@ -10,12 +10,23 @@
   4. [data, marker_time] = bbci_acquire_bv(state);
   5. [data, marker_time, marker_descr] = bbci_acquire_bv(state);
   6. [data, marker_time, marker_descr, state] = bbci_acquire_bv(state);
+  6b. [data, marker_time, marker_descr, state, blocks] = bbci_acquire_bv(state);
+  6c. [ptr, marker_time, marker_descr, state, blocks] = bbci_acquire_bv(state, ring, ptr);
   7. bbci_acquire_bv('close'); 
-  8. bbci_acquire_bv('close', DUMMY); 
+  8. bbci_acquire_bv('close', state); 
+  9. stats = bbci_acquire_bv('stats', state);
  
   The first and the second call creates a connection to the brainvision server.
-  The third to sixth call recevie data from the server. The last call 
-  closes the connection to the server.
+  'open' can be used instead of 'init'. Every connection is a session of
+  its own, the handle of the session is stored in state.handle. The third
+  to sixth call recevie data from the server of the session in state.
+  The fifth output of 6b has the number, the end and the arrival time of
+  every block in data. In 6c the data is not returned but written into
+  the rows of the matrix ring after the row ptr, continuing at the first
+  row after the last one. The returned ptr is the row of the last
+  sample. The seventh call closes all connections, the eighth call
+  closes the connection of the given state. The last call returns the
+  counters of the poll thread for the connection of the given state.
   
   NOTE: We observed a data loss when bbci_acquire_bv is called
         after a long period of time.
@@ -47,6 +58,53 @@
                 of the BBCI online toolbox.
               - Changed behavior for 'close' command without open connection
                 from error to warning.
+ 2026/10/17 - Jonas Reiter
+              - Several connections can be open at the same time. Each one
+                has its own session with socket, poll thread, ring buffer
+                and filter state. The state has a new field handle, which
+                is not used again after the connection was closed.
+              - The poll thread reconnects in the background. Calls during
+                the reconnect return at once with empty data. The returned
+                state tells about the connection (status, running) and the
+                samples which were lost (missing_samples).
+              - Added the 'stats' command.
+              - The data call can wait for wait_samples samples, at most
+                wait_timeout ms (capped at 5 s).
+              - The fields of the state which are used by the data call are
+                compiled into struct abvConfig at init. The data call only
+                compares the values with the config, the field numbers are
+                cached as long as the layout of the state does not change.
+              - Float32 data blocks (message type 4). The data can be
+                returned as single with output_class 'single'.
+              - The fifth output with the arrival times of the blocks.
+              - The fields record and record_max_size: the data blocks are
+                written to BrainVision files by a thread of their own.
+              - The field shm_name: the returned data and markers are also
+                written to a ring in shared memory, which other processes
+                read with bbci_acquire_shm.
+              - The threads are the ones of acthreads.cpp, which replaces
+                the winunix layer.
+              - The fields rt_priority, rt_policy, cpu_affinity and mlock:
+                real-time scheduling, a fixed cpu and locked buffers for the
+                thread which receives the data. The stats tell whether they
+                were applied.
+              - The fields buffer_seconds, buffer_samples and
+                overflow_policy set the size of the buffer of the thread and
+                what happens to the blocks which do not fit. The fields
+                overflow and spilled of the returned state count the dropped
+                and the spilled blocks.
+              - The data call can write into a ring buffer matrix of the
+                caller (path 6c) instead of creating a new matrix, like
+                OPT.data of read_bv.
+              - Each session has a filter of filter.c, which is compiled on
+                its own now.
+              - The field filt_sos: second order sections instead of filt_a
+                and filt_b.
+              - The field filt_resample: a polyphase anti-alias filter of
+                any length. fs does not have to divide the base frequency
+                any more, the data is then resampled by fs / orig_fs. The
+                delay of the filter is compensated, the marker times are
+                computed at the output rate.
 */
 
 /*
@@ -59,6 +117,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <math.h>
 #include <sys/types.h>
 #include <ctype.h>
 
@@ -72,30 +131,109 @@
 #include "mex.h"
 extern "C" {
   #include "brainserver.h"
-}
-
-#include "winthreads.h"
+  #include "recorder.h"
+  #include "shmring.h"
 
-/* All the handling for the filtering of the data */ 
-#include "filter.h"
+  /* All the handling for the filtering of the data */ 
+  #include "filter.h"
+}
 
 /*
  * DEFINES
  */
 
 #define MAX_CHARS 1024 /* maximum size of hostname */
+#define MAX_SESSIONS 16 /* maximum number of open connections */
+#define MAX_WAIT_TIMEOUT 5000.0 /* longest wait for data in ms, matlab blocks meanwhile */
+#define MAX_WAIT_SAMPLES 100000000 /* most samples a data call waits for */
+#define RECORD_DEFAULT_MAX_SIZE 1024.0 /* default size of the record files in MB */
+
+#define MARKER_NUMERIC 1 /* marker_format 'numeric' */
+#define MARKER_STRING 2  /* marker_format 'string' */
 
 /*
  * GLOBAL DATA
  */
-static int connected = 0;  /* 0 if we have no connection to the server
-                            * 1 if we have a connection to the server */
+
+/* The fields of the state which are used by the data call */
+enum {
+  CF_BLOCK_NO,
+  CF_CHAN_SEL,
+  CF_SCALE,
+  CF_FILT_SUBSAMPLE,
+  CF_MARKER_FORMAT,
+  CF_OUTPUT_CLASS,
+  CF_RECONNECT,
+  CF_WAIT_SAMPLES,
+  CF_WAIT_TIMEOUT,
+  CF_STATUS,
+  CF_RUNNING,
+  CF_MISSING_SAMPLES,
+  CF_OVERFLOW,
+  CF_SPILLED,
+  CF_COUNT
+};
+
+/*
+ * The configuration of a session, compiled from the state at init. The
+ * data call compares the fields of its state with the values in here and
+ * only does some work if something was changed. generation counts the
+ * changes.
+ */
+struct abvConfig {
+  int nFields;                          /* number of fields of the state */
+  int fieldNumbers[CF_COUNT];           /* the numbers of the fields above */
+  unsigned long generation;             /* incremented on every change */
+  
+  /* fixed at init */
+  int nChannels;
+  int lag;                              /* size of filt_subsample, 0 with filt_resample */
+  int up;                               /* the output rate is origFs * up / down */
+  int down;
+  double origFs;
+  
+  /* copies of the fields */
+  int nChansSel;
+  double *chanSel;
+  double *scale;
+  double *filtSubsample;
+  int markerFormat;                     /* MARKER_NUMERIC or MARKER_STRING */
+  int outputClass;                      /* FILTER_FLOAT64 or FILTER_FLOAT32 */
+  int reconnect;
+  double waitSamples;
+  double waitTimeout;
+};
+
+/* Everything which belongs to one connection */
+struct abvSession {
+  int connected;                        /* 0 if we have no connection to the server
+                                         * 1 if we have a connection to the server */
+  struct brainserverSession *server;    /* the connection */
+  struct acquiredData acquired;         /* reused by every getData */
+  struct filterState *filter;           /* the filters of this connection */
+  unsigned long handle;                 /* state.handle, never used again after a close */
+  unsigned long missingRest;            /* missing samples at the original rate
+                                         * which do not make a full sample yet */
+  struct abvConfig config;              /* the parsed state */
+  unsigned long filterGeneration;       /* the config the filters were set from */
+  struct shmRing *shm;                  /* the export to shared memory, NULL if none */
+};
+
+static struct abvSession sessions[MAX_SESSIONS];
+
+/* the handle of the last opened session */
+static unsigned long lastHandle = 0;
+
+/* the session of the current call, abv_assert closes it */
+static struct abvSession *current = NULL;
 
 static const char* FIELD_FS = "fs";
 static const char* FIELD_HOST = "host";
 static const char* FIELD_FILT_A = "filt_a";
 static const char* FIELD_FILT_B = "filt_b";
 static const char* FIELD_FILT_SUBSAMPLE = "filt_subsample";
+static const char* FIELD_FILT_SOS = "filt_sos";
+static const char* FIELD_FILT_RESAMPLE = "filt_resample";
 static const char* FIELD_BLOCK_NO = "block_no";
 static const char* FIELD_CHAN_SEL = "chan_sel";
 static const char* FIELD_CLAB = "clab";
@@ -104,21 +242,72 @@ static const char* FIELD_SCALE = "scale";
 static const char* FIELD_ORIG_FS = "orig_fs";
 static const char* FIELD_RECONNECT = "reconnect";
 static const char* FIELD_MARKER_FORMAT = "marker_format";
+static const char* FIELD_OUTPUT_CLASS = "output_class";
+static const char* FIELD_HANDLE = "handle";
+static const char* FIELD_STATUS = "status";
+static const char* FIELD_RUNNING = "running";
+static const char* FIELD_MISSING_SAMPLES = "missing_samples";
+static const char* FIELD_OVERFLOW = "overflow";
+static const char* FIELD_SPILLED = "spilled";
+static const char* FIELD_BUFFER_SECONDS = "buffer_seconds";
+static const char* FIELD_BUFFER_SAMPLES = "buffer_samples";
+static const char* FIELD_OVERFLOW_POLICY = "overflow_policy";
+static const char* FIELD_WAIT_SAMPLES = "wait_samples";
+static const char* FIELD_WAIT_TIMEOUT = "wait_timeout";
+static const char* FIELD_RECORD = "record";
+static const char* FIELD_RECORD_MAX_SIZE = "record_max_size";
+static const char* FIELD_SHM_NAME = "shm_name";
+static const char* FIELD_RT_PRIORITY = "rt_priority";
+static const char* FIELD_RT_POLICY = "rt_policy";
+static const char* FIELD_CPU_AFFINITY = "cpu_affinity";
+static const char* FIELD_MLOCK = "mlock";
+
+/* the names of the CF_ fields */
+static const char* CONFIG_FIELDS[CF_COUNT] = {
+  FIELD_BLOCK_NO, FIELD_CHAN_SEL, FIELD_SCALE, FIELD_FILT_SUBSAMPLE,
+  FIELD_MARKER_FORMAT, FIELD_OUTPUT_CLASS, FIELD_RECONNECT, FIELD_WAIT_SAMPLES, FIELD_WAIT_TIMEOUT,
+  FIELD_STATUS, FIELD_RUNNING, FIELD_MISSING_SAMPLES, FIELD_OVERFLOW, FIELD_SPILLED
+};
 
 /*
  * FORWARD DECLARATIONS
  */ 
 
 static void 
-abv_init(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], bool isStructInit);
+abv_init(struct abvSession *ps, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], bool isStructInit);
 
 static void 
-abv_getdata(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]);
+abv_getdata(struct abvSession *ps, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]);
 
-static double abv_filterDataIIR(double value, int channel) ;
+static void 
+abv_stats(struct abvSession *ps, mxArray *plhs[]);
 
 static void 
-abv_close();
+abv_close(struct abvSession *ps);
+
+static struct abvSession *abv_getSession(const mxArray *pState);
+
+static const char *abv_statusString(int status);
+static const char *abv_optionString(int result);
+static const char *abv_policyString(int policy);
+static void abv_bufferOptions(mxArray *pState, struct bufferOptions *pBuffer);
+static void abv_threadOptions(struct abvSession *ps, mxArray *pState);
+
+static void abv_configInit(struct abvSession *ps, const mxArray *pState,
+                           int nChannels, int lag, int up, int down, double origFs);
+static void abv_configUpdate(struct abvSession *ps, const mxArray *pState);
+static void abv_configFree(struct abvConfig *pc);
+static struct shmRing *abv_shmCreate(struct abvSession *ps, const char *name,
+                                     const struct RDA_MessageStart *pMsgStart);
+static struct shmRingMarker *abv_shmMarkers(struct abvSession *ps, double inputTime);
+static void abv_shmWrite(struct abvSession *ps, const mxArray *pData, int nPoints,
+                         struct shmRingMarker *markers);
+static mxArray *abv_createData(const struct abvConfig *pc, int nPoints);
+static int abv_checkRing(const struct abvConfig *pc, const mxArray *pRing, const mxArray *pPtr);
+static void abv_ringCopy(const mxArray *pData, mxArray *pRing, int ringPosition);
+static mxArray *abv_createBlocks(const struct acquiredData *pAcquired, int nBlocks,
+                                 double origFs, double readTime);
+static int abv_configArray(double **ppCopy, int *pSize, const mxArray *pField);
 
 static void abv_assert(bool condition,const char *text);
 
@@ -148,6 +337,10 @@ static void setStringCell(mxArray *pStruct, const char *fieldname, const char* a
                           int m, int n);
 
 static int compareString(const mxArray *pStruct, const char* compareString);
+static int matchString(const mxArray *pString, const char* value);
+
+static void setScalarByNumber(mxArray *pStruct, int fieldNumber, double value);
+static void setStringByNumber(mxArray *pStruct, int fieldNumber, const char* value);
 
 /*
  * This function will get the number of the field if the field doesn't exist
@@ -379,6 +572,58 @@ static int compareString(const mxArray *pStruct, const char* compareString) {
   return strcmp (value, compareString);
 }
 
+/*
+ * Checks if the matlab string equals value without copying it.
+ */
+static int matchString(const mxArray *pString, const char* value) {
+  const mxChar *chars;
+  size_t length, i;
+  
+  if(!mxIsChar(pString)) {
+    return 0;
+  }
+  
+  length = mxGetNumberOfElements(pString);
+  if(length != strlen(value)) {
+    return 0;
+  }
+  
+  chars = mxGetChars(pString);
+  for(i = 0; i < length; ++i) {
+    if(chars[i] != (mxChar)value[i]) {
+      return 0;
+    }
+  }
+  
+  return 1;
+}
+
+/*
+ * Sets a scalar field of a struct by the number of the field. The old
+ * value is freed.
+ */
+static void setScalarByNumber(mxArray *pStruct, int fieldNumber, double value) {
+  mxArray *pOld = mxGetFieldByNumber(pStruct, 0, fieldNumber);
+  
+  if(NULL != pOld) {
+    mxDestroyArray(pOld);
+  }
+  mxSetFieldByNumber(pStruct, 0, fieldNumber, mxCreateDoubleScalar(value));
+}
+
+/*
+ * Sets a string field of a struct by the number of the field. The old
+ * value is freed.
+ */
+static void setStringByNumber(mxArray *pStruct, int fieldNumber, const char* value) {
+  mxArray *pOld = mxGetFieldByNumber(pStruct, 0, fieldNumber);
+  
+  if(NULL != pOld) {
+    mxDestroyArray(pOld);
+  }
+  mxSetFieldByNumber(pStruct, 0, fieldNumber, mxCreateString(value));
+}
+
 /*
  * This functions adds a field to a struct. No check is performed because in 
  * mexFunction the check was done.
@@ -418,26 +663,60 @@ void printThreadState();*/
  */
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
+  current = NULL;
+  
   /* first check for execution path 7 and 8 */
   if(mxIsChar(prhs[0]) && 0 == compareString(prhs[0], "close")) { 
     /* The user wants to close the connection */
       
     if(0 == nlhs) { /* no output arguments */
-      /* Check if we have an open connection */
-      if(0 == connected) {
-        mexWarnMsgTxt("bbci_acquire_bv: no open connection to close!");
-        return;
+      if(2 <= nrhs && mxIsStruct(prhs[1]) && NULL != mxGetField(prhs[1], 0, FIELD_HANDLE)) {
+        /* close the connection of the given state */
+        struct abvSession *ps = abv_getSession(prhs[1]);
+        
+        if(NULL == ps) {
+          mexWarnMsgTxt("bbci_acquire_bv: no open connection to close!");
+        } else {
+          abv_close(ps);
+        }
       } else {
-        abv_close();
-        return;
+        /* close all connections */
+        int closed = 0;
+        
+        for(int i = 0; i < MAX_SESSIONS; ++i) {
+          if(0 != sessions[i].connected) {
+            abv_close(&sessions[i]);
+            closed++;
+          }
+        }
+        if(0 == closed) {
+          mexWarnMsgTxt("bbci_acquire_bv: no open connection to close!");
+        }
       }
+      return;
     } else {
       mexErrMsgTxt("bbci_acquire_bv: no output arguments on close connection.");
     }
   }
   
+  /* check for execution path 9 */
+  if(mxIsChar(prhs[0]) && 0 == compareString(prhs[0], "stats")) {
+    struct abvSession *ps;
+    
+    abv_assert(2 == nrhs && mxIsStruct(prhs[1]), "bbci_acquire_bv: stats needs the state as an argument.");
+    abv_assert(1 >= nlhs, "bbci_acquire_bv: only one output for stats.");
+    
+    ps = abv_getSession(prhs[1]);
+    if(NULL == ps) {
+      mexErrMsgTxt("bbci_acquire_bv: open a connection first!");
+    }
+    abv_stats(ps, plhs);
+    return;
+  }
+  
   /* check for execution path 1 and 2 */
-  if(1 <= nrhs && mxIsChar(prhs[0]) && 0 == compareString(prhs[0], "init")) {
+  if(1 <= nrhs && mxIsChar(prhs[0]) 
+     && (0 == compareString(prhs[0], "init") || 0 == compareString(prhs[0], "open"))) {
     bool isStructInit = 2 == nrhs && mxIsStruct(prhs[1]); // check if we have path 1
     if(!isStructInit) { // if we have no struct init check if it is a property list
       bool isListInit = 0 == (nrhs - 1) % 2; // number of elements in the list must be a divisor of 2
@@ -454,10 +733,14 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     }
       
     if(1 == nlhs) { /* one output argument */
-      if(0 != connected) {
-        mexErrMsgTxt("bbci_acquire_bv: close the connection first!");
+      /* find a free session */
+      int i;
+      for(i = 0; i < MAX_SESSIONS && 0 != sessions[i].connected; ++i) {}
+      
+      if(MAX_SESSIONS == i) {
+        mexErrMsgTxt("bbci_acquire_bv: too many open connections, close one first!");
       } else {
-        abv_init(nlhs, plhs, nrhs, prhs, isStructInit);
+        abv_init(&sessions[i], nlhs, plhs, nrhs, prhs, isStructInit);
         return;
       }
     } else {
@@ -465,20 +748,49 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     }
   }
   
-  /* check if we are in execution path 3 to 6 */
-  abv_assert(4 >= nlhs, "bbci_acquire_bv: Four ouput arguments are maximum.");
-  abv_assert(nrhs == 1, "bbci_acquire_bv: exactly one input argument required");
+  /* check if we are in execution path 3 to 6c */
+  abv_assert(5 >= nlhs, "bbci_acquire_bv: Five ouput arguments are maximum.");
+  abv_assert(nrhs == 1 || nrhs == 3, "bbci_acquire_bv: one input argument or three with a ring required");
   abv_assert(mxIsStruct(prhs[0]), "bbci_acquire_bv: input argument must be struct");
 
   
   /* check if we are connect to the server */
-  if(0 != connected) {
-    abv_getdata(nlhs, plhs, nrhs, prhs);
+  struct abvSession *ps = abv_getSession(prhs[0]);
+  if(NULL != ps) {
+    abv_getdata(ps, nlhs, plhs, nrhs, prhs);
   } else {
     mexErrMsgTxt("bbci_acquire_bv: open a connection first!");
   }
 }
 
+/************************************************************
+ *
+ * Returns the open session of a state or NULL if the handle in the
+ * state does not belong to an open connection. The handle is not the
+ * slot of the session, which the next open reuses after a close, so the
+ * state of a closed connection never finds another one.
+ *
+ ************************************************************/
+static struct abvSession *abv_getSession(const mxArray *pState) {
+  mxArray *pField;
+  double handle;
+  int i;
+  
+  pField = mxGetField(pState, 0, FIELD_HANDLE);
+  if(NULL == pField || 0 == mxIsDouble(pField) || 1 != mxGetNumberOfElements(pField)) {
+    return NULL;
+  }
+  
+  handle = mxGetScalar(pField);
+  for(i = 0; i < MAX_SESSIONS; ++i) {
+    if(0 != sessions[i].connected && handle == (double)sessions[i].handle) {
+      return &sessions[i];
+    }
+  }
+  
+  return NULL;
+}
+
 /************************************************************
  *
  * Initialize Connection
@@ -486,11 +798,12 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
  ************************************************************/
 
 static void 
-abv_init(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], bool isStructInit)
+abv_init(struct abvSession *ps, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], bool isStructInit)
 {
   int result;
   char *bv_hostname = 0;
   struct RDA_MessageStart *pMsgStart;
+  struct bufferOptions buffer;
   
   mxArray* OUT_STATE;
   
@@ -512,24 +825,43 @@ abv_init(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], bool isStru
    * if they don't exist we will set the default values */
   checkString(OUT_STATE,FIELD_HOST, "127.0.0.1");
   
+  abv_assert(1 == checkScalar(OUT_STATE, FIELD_RECONNECT, 1), "bbci_acquire_bv: Reconnect is no scalar.");
+  abv_bufferOptions(OUT_STATE, &buffer);
+  
   /* Get server name (or use default "brainamp") */
   bv_hostname = getString(OUT_STATE, FIELD_HOST);
 
   /* open connection */
-  result = initConnection(bv_hostname,&pMsgStart);
+  result = initConnection(bv_hostname,&pMsgStart,&ps->server,
+                          1 == (int)getScalar(OUT_STATE, FIELD_RECONNECT), &buffer);
   free(bv_hostname);  
+  
+  /* a handle of zero belongs to no session */
+  setScalar(OUT_STATE, FIELD_HANDLE, 0.0);
+  setScalar(OUT_STATE, FIELD_RUNNING, 0.0);
+  setScalar(OUT_STATE, FIELD_MISSING_SAMPLES, 0.0);
+  setScalar(OUT_STATE, FIELD_OVERFLOW, 0.0);
+  setScalar(OUT_STATE, FIELD_SPILLED, 0.0);
+  setString(OUT_STATE, FIELD_STATUS, abv_statusString(CS_DISCONNECTED));
     
   if (result == IC_OKAY) {
     /* construct connection state structure */
+    current = ps;
+
     int nChans, lag, n;
-    double orig_fs;
+    int up, down;     /* the factors of the resampling */
+    bool resample;    /* true for the polyphase filter of filt_resample */
+    double orig_fs, fs;
     mxArray *pArray;
-    char *pChannelName;
     double *chan_sel;
     double *filter_buffer_sub;
+    double *filter_buffer_resample;
+    int resampleSize;
     double *filter_buffer_a;
     double *filter_buffer_b;
     int iirFilterSize;
+    char *record_name;
+    char *shm_name;
     
     nChans = pMsgStart->nChannels;
     orig_fs = 1000000.0 / ((double) pMsgStart->dSamplingInterval);
@@ -537,13 +869,26 @@ abv_init(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], bool isStru
     /* Check fs */
     checkScalar(OUT_STATE,FIELD_FS,orig_fs);
     
-    lag = (int) (orig_fs / getScalar(OUT_STATE, FIELD_FS));
+    fs = getScalar(OUT_STATE, FIELD_FS);
+    abv_assert(fs > 0, "bbci_acquire_bv: fs has to be positive.");
+    lag = (int) (orig_fs / fs);
     
-    abv_assert(lag * (int)getScalar(OUT_STATE,FIELD_FS) == (int)orig_fs,"bbci_acquire_bv: The base frequency has to be a multiple of the requested frequency.");
+    /* fs is a divisor of the base frequency: the subsample filter of lag
+     * values. Otherwise, or with filt_resample, the polyphase filter
+     * resamples by up / down. */
+    resample = NULL != mxGetField(OUT_STATE, 0, FIELD_FILT_RESAMPLE) || lag * (int)fs != (int)orig_fs;
+    if(resample) {
+      abv_assert(fs == (int)fs && orig_fs == (int)orig_fs, "bbci_acquire_bv: The base frequency and fs have to be integers for the resampling.");
+      filterResampleFactors((int)orig_fs, (int)fs, &up, &down);
+      lag = 0;
+    } else {
+      up = 1;
+      down = lag;
+    }
     
     /* Overwrite the following fields */
     setScalar(OUT_STATE,FIELD_ORIG_FS, orig_fs);
-    setScalar(OUT_STATE,FIELD_LAG, lag);
+    setScalar(OUT_STATE,FIELD_LAG, (double)down / up);
     setScalar(OUT_STATE,FIELD_BLOCK_NO, -1.0);
      /* this odd hack is because pMsgStart contains several variably
        sized arrays, and this is the way to get the channel names 
@@ -553,7 +898,9 @@ abv_init(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], bool isStru
     
     /* Check the following fields */
     checkString(OUT_STATE,FIELD_MARKER_FORMAT, "numeric");
-    abv_assert(1 == checkScalar(OUT_STATE, FIELD_RECONNECT, 1), "bbci_acquire_bv: Reconnect is no scalar.");
+    checkString(OUT_STATE,FIELD_OUTPUT_CLASS, "double");
+    abv_assert(1 == checkScalar(OUT_STATE, FIELD_WAIT_SAMPLES, 0), "bbci_acquire_bv: wait_samples is no scalar.");
+    abv_assert(1 == checkScalar(OUT_STATE, FIELD_WAIT_TIMEOUT, 1000), "bbci_acquire_bv: wait_timeout is no scalar.");
     abv_assert(1 == checkArray(OUT_STATE, FIELD_SCALE, 1, nChans, pMsgStart->dResolutions), "bbci_acquire_bv: Scale is no array or has wrong size.");
     
     chan_sel = (double *) malloc(nChans*sizeof(double));
@@ -563,19 +910,23 @@ abv_init(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], bool isStru
     abv_assert(1 == checkArray(OUT_STATE, FIELD_CHAN_SEL, 1, -nChans, chan_sel), "bbci_acquire_bv: chan_sel is no array.");  
     free(chan_sel);
     
-    /* Create the default filters */
+    /* Create the default filters, with filt_resample filt_subsample is
+     * not used and may have any size */
     
-    filter_buffer_sub = (double *) malloc(lag*sizeof(double));
+    filter_buffer_sub = (double *) malloc((resample ? 1 : lag)*sizeof(double));
     for(n = 0; n < lag; ++n) {
       filter_buffer_sub[n] = 1.0 / (double)lag;
     }
+    if(resample) {
+      filter_buffer_sub[0] = 1.0;
+    }
     filter_buffer_a = (double *) malloc(sizeof(double));
     filter_buffer_a[0] = 1.0;
     filter_buffer_b = (double *) malloc(sizeof(double));
     filter_buffer_b[0] = 1.0;
     
     /* check the filters */
-    abv_assert(1 == checkArray(OUT_STATE, FIELD_FILT_SUBSAMPLE, 1, lag, filter_buffer_sub), "bbci_acquire_bv: Subsample filter is no array or has the wrong size.");
+    abv_assert(1 == checkArray(OUT_STATE, FIELD_FILT_SUBSAMPLE, 1, resample ? -1 : lag, filter_buffer_sub), "bbci_acquire_bv: Subsample filter is no array or has the wrong size.");
     abv_assert(1 == checkArray(OUT_STATE, FIELD_FILT_A, 1, -1, filter_buffer_a), "bbci_acquire_bv: IIR filter aSubsample filter has the wrong size.");
     abv_assert(1 == checkArray(OUT_STATE, FIELD_FILT_B, 1, -1, filter_buffer_b), "bbci_acquire_bv: Subsample filter has the wrong size.");
     
@@ -595,10 +946,78 @@ abv_init(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], bool isStru
     filter_buffer_a = getArray(OUT_STATE, FIELD_FILT_A);
     filter_buffer_b = getArray(OUT_STATE, FIELD_FILT_B);
     
-    filterFIRCreate(filter_buffer_sub, lag,nChans);
-    filterIIRCreate(filter_buffer_a, filter_buffer_b, iirFilterSize, nChans);
+    /* the taps of the polyphase filter, an empty filt_resample is the
+     * default anti-alias filter */
+    filter_buffer_resample = NULL;
+    resampleSize = 0;
+    pArray = mxGetField(OUT_STATE, 0, FIELD_FILT_RESAMPLE);
+    if(NULL != pArray && !mxIsEmpty(pArray)) {
+      abv_assert(1 == checkArray(OUT_STATE, FIELD_FILT_RESAMPLE, 1, -1), "bbci_acquire_bv: filt_resample has to be a vector.");
+      filter_buffer_resample = mxGetPr(pArray);
+      resampleSize = (int)mxGetN(pArray);
+    }
+    
+    pArray = mxGetField(OUT_STATE, 0, FIELD_FILT_SOS);
+    if(NULL != pArray && !mxIsEmpty(pArray)) {
+      /* second order sections instead of filt_a and filt_b */
+      int nSections = (int)mxGetM(pArray);
+      double *sos;
+      
+      abv_assert(1 == checkArray(OUT_STATE, FIELD_FILT_SOS, -1, 6), "bbci_acquire_bv: filt_sos must be a matrix with 6 columns.");
+      abv_assert(1 == iirFilterSize, "bbci_acquire_bv: filt_sos can not be used together with filt_a and filt_b.");
+      sos = mxGetPr(pArray);
+      for(n = 0; n < nSections; ++n) {
+        abv_assert(0.0 != sos[n + 3 * nSections], "bbci_acquire_bv: a0 of a section in filt_sos is zero.");
+      }
+      ps->filter = filterCreateSOS(sos, nSections, filter_buffer_sub, resample ? 1 : lag, nChans);
+    } else {
+      ps->filter = filterCreate(filter_buffer_a, filter_buffer_b, iirFilterSize, filter_buffer_sub, resample ? 1 : lag, nChans);
+    }
+    if(resample && NULL != ps->filter
+       && !filterSetResample(ps->filter, filter_buffer_resample, resampleSize, up, down)) {
+      filterDestroy(ps->filter);
+      ps->filter = NULL;
+    }
+    abv_assert(NULL != ps->filter, "bbci_acquire_bv: Out of memory.");
+    
+    /* the recording, done by the writer thread of recorder.c */
+    abv_assert(1 == checkString(OUT_STATE, FIELD_RECORD, ""), "bbci_acquire_bv: record is no string.");
+    abv_assert(1 == checkScalar(OUT_STATE, FIELD_RECORD_MAX_SIZE, RECORD_DEFAULT_MAX_SIZE), "bbci_acquire_bv: record_max_size is no scalar.");
+    record_name = getString(OUT_STATE, FIELD_RECORD);
+    if(0 != record_name[0]) {
+      struct rdaRecorder *pRecorder = recorderCreate(record_name, pMsgStart, 
+                                                     getScalar(OUT_STATE, FIELD_RECORD_MAX_SIZE) * 1024.0 * 1024.0);
+      free(record_name);
+      abv_assert(NULL != pRecorder, "bbci_acquire_bv: could not open the files for the recording.");
+      setRecorder(ps->server, pRecorder);
+    } else {
+      free(record_name);
+    }
+    
+    /* the real-time options, after the recorder whose ring is locked too */
+    abv_threadOptions(ps, OUT_STATE);
+    
+    ps->handle = ++lastHandle;
+    setScalar(OUT_STATE, FIELD_HANDLE, (double)ps->handle);
+    setScalar(OUT_STATE, FIELD_RUNNING, 1.0);
+    setString(OUT_STATE, FIELD_STATUS, abv_statusString(CS_CONNECTED));
     
-    connected = 1;
+    /* everything the data call needs from the state */
+    abv_configInit(ps, OUT_STATE, nChans, lag, up, down, orig_fs);
+    ps->filterGeneration = ps->config.generation;
+    ps->missingRest = 0;
+    ps->connected = 1;
+    
+    /* the export of the selected channels to shared memory */
+    abv_assert(1 == checkString(OUT_STATE, FIELD_SHM_NAME, ""), "bbci_acquire_bv: shm_name is no string.");
+    shm_name = getString(OUT_STATE, FIELD_SHM_NAME);
+    if(0 != shm_name[0]) {
+      ps->shm = abv_shmCreate(ps, shm_name, pMsgStart);
+      free(shm_name);
+      abv_assert(NULL != ps->shm, "bbci_acquire_bv: could not create the shared memory, shm_name may be used by another acquisition.");
+    } else {
+      free(shm_name);
+    }
   }
   
   plhs[0] = OUT_STATE;
@@ -612,136 +1031,169 @@ abv_init(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[], bool isStru
  ************************************************************/
 
 static void 
-abv_getdata(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+abv_getdata(struct abvSession *ps, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
   
   int result;       /* return values for called function */
-  mxArray *pArray;  /* generic pointer to a matlab array */
-  int lastBlock;    /* the last block which we have seen */
-  int nChannels;    /* number of channels */
-  int blocksize;    /* the size of blocks */
-  int ElementSize;  /* size of one data point. 2 if int16, 4 if int32, etc */
-  int reconnect;    /* if we reconnect on connection loss */
-  char *bv_hostname = 0;  /* if we reconnect wi need the hostname */
-  struct RDA_MessageData *pMsgData;
-  struct RDA_MessageStart *pMsgStart;
+  int status;       /* the state of the connection */
+  double missing;   /* samples lost since the last call */
+  double readTime;  /* the time of getData */
   
   /* init the input and output values */
   const mxArray* IN_STATE = prhs[0];
+  mxArray* IN_RING = (3 == nrhs) ? (mxArray*)prhs[1] : NULL;
   mxArray* OUT_DATA = NULL;
   mxArray* OUT_MRK_TIME = NULL;
   mxArray* OUT_MRK_DESCR = NULL;
   mxArray* OUT_STATE = NULL;
+  mxArray* OUT_BLOCKS = NULL;
+    
+  struct acquiredData *pAcquired = &ps->acquired;
+  struct abvConfig *pc = &ps->config;
+  int ringSize = 0;      /* the rows of the ring of path 6c */
+  int ringPosition = 0;  /* the row of the next sample in the ring */
+  double ringPtr = 0.0;  /* the returned ptr */
+  
+  current = ps;
+    
+  /* get the changes from the state */
+  abv_configUpdate(ps, IN_STATE);
+  
+  if(NULL != IN_RING) {
+    ringPtr = mxGetScalar(prhs[2]);
+    ringPosition = abv_checkRing(pc, IN_RING, prhs[2]);
+    ringSize = (int)mxGetM(IN_RING);
+  }
+  if(ps->filterGeneration != pc->generation) {
+    if(0 != pc->lag) {
+      filterFIRSet(ps->filter, pc->filtSubsample);
+    }
+    ps->filterGeneration = pc->generation;
+  }
+  
+  setReconnect(ps->server, pc->reconnect);
+  
+  abv_assert(NULL == ps->shm || pc->nChansSel == (int)shmRingInfo(ps->shm)->nChannels,
+             "bbci_acquire_bv: chan_sel can not change its size while shm_name is used.");
+  
+  /* wait until the poll thread has enough data for wait_samples new
+   * samples, the resample filter may already have a part of the first */
+  if(pc->waitSamples > 0) {
+    double timeout = pc->waitTimeout;
+    double needed = filterInputCount(ps->filter, pc->waitSamples < MAX_WAIT_SAMPLES ? (int)pc->waitSamples : MAX_WAIT_SAMPLES);
     
-  /* get the information from the state and obtain the data */
-  lastBlock = (int)getScalar(IN_STATE, FIELD_BLOCK_NO);
-  nChannels = getArrayN(IN_STATE, FIELD_CLAB);
+    if(timeout > MAX_WAIT_TIMEOUT) {
+      timeout = MAX_WAIT_TIMEOUT;
+    }
+    if(timeout > 0 && needed > 0) {
+      waitForData(ps->server, (ULONG)needed, (ULONG)timeout);
+    }
+  }
   
-  result = getData(&pMsgData, &blocksize, lastBlock, nChannels, &ElementSize);
+  result = getData(ps->server, pAcquired, pc->nChannels);
+  readTime = monotonicTime();
+  status = getConnectionStatus(ps->server);
+  missing = 0.0;
   
   /* If everything is okay, construct the appropriate output. Else
    * return empty arrays.
    */
   if (result != -1) {
     int n;
-    int nChans_orig, lag, nPoints, nChans_sel, nMarkers, pDstPosition;
-    double *chan_sel, *scale, *pDst0, *pMrkPos, *pSrcDouble;
-    struct RDA_Marker *pMarker;
+    int nPoints, nMarkers;
+    double *pMrkPos, inputTime;
+    struct headerFIFOMarker *pMarker;
     char *pszType, *pszDesc;
-    char* outputTypeDef;
-    int outputType;
     double *pMrkToe;
 
-    /* get necessary information from the current state */
-    nChans_orig = getArrayN(IN_STATE, FIELD_CLAB);
-    lag = (int) getScalar(IN_STATE,FIELD_LAG);
-
-    nPoints = (getFIRPos() + pMsgData->nPoints)/lag;
+    /* the samples the server did not deliver, at the requested rate */
+    ps->missingRest += pAcquired->nMissing * pc->up;
+    missing = (double)(ps->missingRest / pc->down);
+    ps->missingRest %= pc->down;
 
-    chan_sel = getArray(IN_STATE, FIELD_CHAN_SEL);
-    nChans_sel = getArrayN(IN_STATE, FIELD_CHAN_SEL);
-    
-    /* check for the new resample filter */
-    abv_assert(checkArray(IN_STATE, FIELD_FILT_SUBSAMPLE, 1, lag), "bbci_acquire_bv: Resample filter has to be a vector. Resample filter has to correspondent with the sampling rate.");
-    filterFIRSet(getArray(IN_STATE, FIELD_FILT_SUBSAMPLE));
+    nPoints = filterOutputCount(ps->filter, pAcquired->nPoints);
     
-    /* construct the data output matrix. */
-    OUT_DATA = mxCreateDoubleMatrix(nPoints, nChans_sel, mxREAL);
+    /* the time of the first sample in output samples, see
+     * filterInputTime: it depends on the state of the resample filter
+     * before the data of this call */
+    inputTime = filterInputTime(ps->filter, 0);
+
+    if (pAcquired->elementType != ELEMENT_INT16 && pAcquired->elementType != ELEMENT_INT32
+        && pAcquired->elementType != ELEMENT_FLOAT32) {
+        mexErrMsgTxt("bbci_acquire_bv: Unknown element type");
+    }
     
-    pArray = mxGetField(IN_STATE, 0, "scale");
-    scale = mxGetPr(pArray);
-    pDst0= mxGetPr(OUT_DATA);
-    pDstPosition = 0;
-
-    /* convert the source data to double format */
-    pSrcDouble = (double*)malloc(pMsgData->nPoints * nChans_orig * sizeof(double));
-    if (ElementSize==2) {
-        int16_t *pSrc = pMsgData->nData;
-        for(n = 0; n != pMsgData->nPoints * nChans_orig; ++n) {
-          pSrcDouble[n] = (double)pSrc[n];
-        }
-    } else if (ElementSize==4) {
-        int32_t *pSrc = (int32_t*) pMsgData->nData;
-        for(n = 0; n != pMsgData->nPoints * nChans_orig; ++n) {
-          pSrcDouble[n] = (double)pSrc[n];
-        }
+    if (NULL != IN_RING && NULL == ps->shm) {
+      /* path 6c: the samples go straight into the rows of the ring */
+      abv_assert(filterDataRing(ps->filter, pAcquired->data, pAcquired->elementType, pAcquired->nPoints, mxGetData(IN_RING), pc->outputClass, ringSize, ringPosition, pc->chanSel, pc->nChansSel, pc->scale),
+                 "bbci_acquire_bv: Out of memory.");
     } else {
-        mexErrMsgTxt("bbci_acquire_bv: Unknown element size");
+      struct shmRingMarker *shmMarkers = (NULL != ps->shm) ? abv_shmMarkers(ps, inputTime) : NULL;
+      
+      /* construct the data output matrix. */
+      OUT_DATA = abv_createData(pc, nPoints);
+      
+      /* convert, filter, subsample, select and scale the raw data in one
+       * pass straight into the output matrix. The ELEMENT_ types have the
+       * numbers of the FILTER_ types. */
+      abv_assert(filterDataRaw(ps->filter, pAcquired->data, pAcquired->elementType, pAcquired->nPoints, mxGetData(OUT_DATA), pc->outputClass, nPoints, pc->chanSel, pc->nChansSel, pc->scale),
+                 "bbci_acquire_bv: Out of memory.");
+      
+      if (NULL != ps->shm) {
+        abv_shmWrite(ps, OUT_DATA, nPoints, shmMarkers);
+      }
+      
+      /* the shared memory needs the samples in one piece, so with a ring
+       * they are copied in a second step */
+      if (NULL != IN_RING) {
+        abv_ringCopy(OUT_DATA, IN_RING, ringPosition);
+        mxDestroyArray(OUT_DATA);
+        OUT_DATA = NULL;
+      }
     }
     
-    /* filter the data with the filters */
-    filterData(pSrcDouble,pMsgData->nPoints ,pDst0,nPoints, chan_sel, nChans_sel, scale);
-    free(pSrcDouble);
+    if (NULL != IN_RING && nPoints > 0) {
+      ringPtr = (double)((ringPosition + nPoints - 1) % ringSize + 1);
+    }
     
     /* if markers are also requested, construct the appropriate output
        matrices */ 
     if (nlhs >= 2) {
-      nMarkers = pMsgData->nMarkers;
+      nMarkers = pAcquired->nMarkers;
 
       if (nMarkers > 0) {
         /* if markers existed, collect them */
         OUT_MRK_TIME = mxCreateDoubleMatrix(1, nMarkers, mxREAL);
         pMrkPos = mxGetPr(OUT_MRK_TIME);
-        
-        outputTypeDef = getString(IN_STATE, FIELD_MARKER_FORMAT);
-        if(0 == strcmp ("numeric", outputTypeDef)) {
-          outputType = 1;
-        } else if(0 == strcmp ("string", outputTypeDef)) {
-          outputType = 2;
-        } else {
-          mexErrMsgTxt("bbci_acquire_bv: Unknown ouput type.");
-        }
-        free(outputTypeDef);
 
         if (nlhs >= 3) {
-          if(1 == outputType) { /* numeric */
+          if(MARKER_NUMERIC == pc->markerFormat) {
             OUT_MRK_DESCR = mxCreateDoubleMatrix(1, nMarkers, mxREAL);
             pMrkToe = mxGetPr(OUT_MRK_DESCR);
-          } else if(2 == outputType) {/* string */
-            OUT_MRK_DESCR = mxCreateCellMatrix(1,nMarkers);
           } else {
-            mexErrMsgTxt("bbci_acquire_bv: Unknown ouput type for output.");
+            OUT_MRK_DESCR = mxCreateCellMatrix(1,nMarkers);
           }
         }
 
-        pMarker = (struct RDA_Marker*)((char*)pMsgData->nData + pMsgData->nPoints * nChans_orig * ElementSize);
+        pMarker = pAcquired->markers;
 
-        double origFs = getScalar(IN_STATE, FIELD_ORIG_FS);
         for (n = 0; n < nMarkers; n++) {
-          pMrkPos[n]= ((double)pMarker->nPosition+1.0) * 1000.0 /origFs;
+          /* the time at the output rate, the resample filter
+           * compensates its delay, so a marker can be after the
+           * samples of this call */
+          pMrkPos[n]= (inputTime + (double)pMarker->nPosition * pc->up / pc->down + 1.0)
+                      * 1000.0 * pc->down / (pc->origFs * pc->up);
           pszType = pMarker->sTypeDesc;
           pszDesc = pszType + strlen(pszType) + 1;
           if (nlhs >= 3) {
-            if(1 == outputType) { /* numeric */
+            if(MARKER_NUMERIC == pc->markerFormat) {
               pMrkToe[n]= ((*pszDesc =='R') ? -1 : 1) * atoi(pszDesc+1);
-            } else if(2 == outputType) {/* string */
-              mxSetCell(OUT_MRK_DESCR, n, mxCreateString(pszDesc));
             } else {
-              mexErrMsgTxt("bbci_acquire_bv: Unknown ouput type for output.");
+              mxSetCell(OUT_MRK_DESCR, n, mxCreateString(pszDesc));
             }
           }
           
-          pMarker = (struct RDA_Marker*)((char*)pMarker + pMarker->nSize);
+          pMarker++;
         }
 
       }
@@ -755,50 +1207,48 @@ abv_getdata(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     } /* end constructing marker outputs */
   }
   else {
-    int nChans_sel;
-    
-    reconnect = (int) getScalar(IN_STATE, FIELD_RECONNECT);
-    if(1 == reconnect) {
-      printf("bbci_acquire_bv: getData didn't work, reconnecting ");
-
-      /* only close the connection */
-      closeConnection();
-      connected = 0;
-      
-      bv_hostname = (char *) malloc(MAX_CHARS);
-      /* getting the hostname for the new connection */
-      pArray = mxGetField(IN_STATE, 0, "hostname");
-      mxGetString(pArray, bv_hostname, MAX_CHARS);
-      
-      free(pMsgData);
-      /* try reconnecting till we get a new connection */
-      while(IC_OKAY != (result = initConnection(bv_hostname, &pMsgStart))){
-        printf("bbci_acquire_bv: connecting failed, trying again\n");
-        free(pMsgData);
-      }
-      
-      /* cleaning things up */
-      free(bv_hostname);
-      free(pMsgStart);
-      connected = 1;
-    } else {
-      printf("bbci_acquire_bv: getData didn't work, closing connection, returning -2\n ");
-      /* close the connection and clean everything up */
-      abv_close();
-    }
-    
     /* We have an error in the data transmition return an empty datablock. */
-    pArray = mxGetField(IN_STATE, 0, "chan_sel");
-    nChans_sel = mxGetN(pArray);
-
-    OUT_DATA = mxCreateDoubleMatrix(0, nChans_sel, mxREAL);
+    if (NULL == IN_RING) {
+      OUT_DATA = abv_createData(pc, 0);
+    }
 
     if (nlhs >= 2){OUT_MRK_TIME = mxCreateDoubleMatrix(0,0, mxREAL);};
     if (nlhs >= 3){OUT_MRK_DESCR = mxCreateDoubleMatrix(0,0, mxREAL);};
   }
   
-  /* clone the state */
-  if(nlhs >= 4) {OUT_STATE = mxDuplicateArray(IN_STATE);};
+  /* clone the state. Matlab does not allow us to return the input, so
+   * the copy can not be avoided. It has the layout of the input, so the
+   * field numbers of the config are valid for it. */
+  if(nlhs >= 4) {
+    OUT_STATE = mxDuplicateArray(IN_STATE);
+    
+    setStringByNumber(OUT_STATE, pc->fieldNumbers[CF_STATUS], abv_statusString(result != -1 ? status : CS_DISCONNECTED));
+    setScalarByNumber(OUT_STATE, pc->fieldNumbers[CF_RUNNING], result != -1 && CS_DISCONNECTED != status);
+    setScalarByNumber(OUT_STATE, pc->fieldNumbers[CF_MISSING_SAMPLES], missing);
+    setScalarByNumber(OUT_STATE, pc->fieldNumbers[CF_OVERFLOW], result != -1 ? (double)pAcquired->nOverflow : 0.0);
+    setScalarByNumber(OUT_STATE, pc->fieldNumbers[CF_SPILLED], result != -1 ? (double)pAcquired->nSpilled : 0.0);
+    if (result != -1) {
+      setScalarByNumber(OUT_STATE, pc->fieldNumbers[CF_BLOCK_NO], (double)pAcquired->nBlock);
+    }
+  }
+  
+  if(nlhs >= 5) {
+    OUT_BLOCKS = abv_createBlocks(pAcquired, result != -1 ? pAcquired->nBlocks : 0, pc->origFs, readTime);
+  }
+  
+  if (result == -1) {
+    /* The poll thread has given up, either reconnect is not set or the
+     * server sends different data now. Reconnecting is done by the poll
+     * thread, so there is nothing we can do here. */
+    printf("bbci_acquire_bv: getData didn't work, closing connection, returning -2\n ");
+    /* close the connection and clean everything up */
+    abv_close(ps);
+  }
+  
+  if (NULL != IN_RING) {
+    /* path 6c returns the row of the last sample in the ring */
+    OUT_DATA = mxCreateDoubleScalar(ringPtr);
+  }
   
   plhs[0] = OUT_DATA;
   if(nlhs >=2) {
@@ -810,23 +1260,572 @@ abv_getdata(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
   if(nlhs >=4) {
     plhs[3] = OUT_STATE;
   }
-      
+  if(nlhs >=5) {
+    plhs[4] = OUT_BLOCKS;
+  }
+}
+
+/************************************************************
+ *
+ * Creates the shared memory ring for the selected channels at the
+ * requested rate. The labels are the names of the selected channels.
+ *
+ ************************************************************/
+static struct shmRing *abv_shmCreate(struct abvSession *ps, const char *name,
+                                     const struct RDA_MessageStart *pMsgStart) {
+  struct abvConfig *pc = &ps->config;
+  const char *names = (const char *)((double *)pMsgStart->dResolutions + pc->nChannels);
+  const char **channelNames;
+  char *labels, *pLabel;
+  double fs = pc->origFs * pc->up / pc->down;
+  struct shmRing *p;
+  int n;
+  
+  channelNames = (const char **) malloc(pc->nChannels * sizeof(const char *));
+  labels = (char *) malloc(pc->nChansSel * SHM_RING_LABEL_LEN + 1);
+  abv_assert(NULL != channelNames && NULL != labels, "bbci_acquire_bv: Out of memory.");
+  
+  for(n = 0; n < pc->nChannels; n++) {
+    channelNames[n] = names;
+    names += strlen(names) + 1;
+  }
   
-  free(pMsgData);
+  pLabel = labels;
+  for(n = 0; n < pc->nChansSel; n++) {
+    int channel = (int)pc->chanSel[n] - 1;
+    
+    if(channel >= 0 && channel < pc->nChannels) {
+      strncpy(pLabel, channelNames[channel], SHM_RING_LABEL_LEN - 1);
+      pLabel[SHM_RING_LABEL_LEN - 1] = 0;
+    } else {
+      pLabel[0] = 0;
+    }
+    pLabel += strlen(pLabel) + 1;
+  }
+  
+  p = shmRingCreate(name, pc->nChansSel, fs, (uint32_t)(SHM_RING_DEFAULT_SECONDS * fs), labels);
+  
+  free(channelNames);
+  free(labels);
+  return p;
 }
 
 /************************************************************
  *
- * Initialize Connection
+ * Converts the markers of a data call to the shared memory markers. The
+ * position of a marker is the first output sample at or after its time,
+ * inputTime is the time of the first sample of the call in output
+ * samples. Because the resample filter compensates its delay the
+ * position can be after the samples of the call, the reader of the ring
+ * gets the marker with that sample. Returns NULL if there are no markers.
  *
  ************************************************************/
+static struct shmRingMarker *abv_shmMarkers(struct abvSession *ps, double inputTime) {
+  struct abvConfig *pc = &ps->config;
+  struct acquiredData *pAcquired = &ps->acquired;
+  struct shmRingMarker *markers;
+  int n, nMarkers = pAcquired->nMarkers;
+  
+  if(0 == nMarkers) {
+    return NULL;
+  }
+  markers = (struct shmRingMarker *) malloc(nMarkers * sizeof(struct shmRingMarker));
+  abv_assert(NULL != markers, "bbci_acquire_bv: Out of memory.");
+  
+  for(n = 0; n < nMarkers; n++) {
+    const struct headerFIFOMarker *pMarker = pAcquired->markers + n;
+    double position = ceil(inputTime + (double)pMarker->nPosition * pc->up / pc->down);
+    
+    markers[n].position = position > 0.0 ? (uint64_t)position : 0;
+    memcpy(markers[n].sTypeDesc, pMarker->sTypeDesc, SHM_RING_MARKER_DESC_LEN);
+    markers[n].sTypeDesc[SHM_RING_MARKER_DESC_LEN - 1] = 0;
+  }
+  return markers;
+}
+
+/************************************************************
+ *
+ * Writes the data and the markers of abv_shmMarkers of a data call to
+ * the shared memory and frees the markers.
+ *
+ ************************************************************/
+static void abv_shmWrite(struct abvSession *ps, const mxArray *pData, int nPoints,
+                         struct shmRingMarker *markers) {
+  struct abvConfig *pc = &ps->config;
+  
+  shmRingWrite(ps->shm, mxGetData(pData), FILTER_FLOAT32 == pc->outputClass ? SHM_RING_FLOAT32 : SHM_RING_FLOAT64,
+               nPoints, markers, ps->acquired.nMarkers);
+  
+  free(markers);
+}
 
-static void abv_close()
+/************************************************************
+ *
+ * Compiles the state into the config of the session. The numbers of the
+ * fields are looked up once, the values are read by abv_configUpdate.
+ *
+ ************************************************************/
+static void abv_configInit(struct abvSession *ps, const mxArray *pState,
+                           int nChannels, int lag, int up, int down, double origFs) {
+  struct abvConfig *pc = &ps->config;
+  
+  abv_configFree(pc);
+  
+  pc->nChannels = nChannels;
+  pc->lag = lag;
+  pc->up = up;
+  pc->down = down;
+  pc->origFs = origFs;
+  
+  /* forces a lookup of the fields */
+  pc->nFields = -1;
+  abv_configUpdate(ps, pState);
+}
+
+/************************************************************
+ *
+ * Compares the double array with n values in pField with the copy and
+ * updates the copy. Returns 1 if something was changed.
+ *
+ ************************************************************/
+static int abv_configArray(double **ppCopy, int *pSize, const mxArray *pField) {
+  int n = (int)mxGetNumberOfElements(pField);
+  double *values = mxGetPr(pField);
+  
+  if(NULL != *ppCopy && n == *pSize && 0 == memcmp(*ppCopy, values, n * sizeof(double))) {
+    return 0;
+  }
+  
+  if(n != *pSize || NULL == *ppCopy) {
+    double *copy = (double *) realloc(*ppCopy, (n > 0 ? n : 1) * sizeof(double));
+    abv_assert(NULL != copy, "bbci_acquire_bv: Out of memory.");
+    *ppCopy = copy;
+    *pSize = n;
+  }
+  memcpy(*ppCopy, values, n * sizeof(double));
+  
+  return 1;
+}
+
+/************************************************************
+ *
+ * Reads the changes of the state into the config. If the layout of the
+ * state is the same as in the last call the field numbers are reused.
+ * The values are only compared with the copies in the config, there is
+ * no allocation unless something changed.
+ *
+ ************************************************************/
+static void abv_configUpdate(struct abvSession *ps, const mxArray *pState) {
+  struct abvConfig *pc = &ps->config;
+  const mxArray *pField;
+  int k, n, size;
+  
+  /* check the layout */
+  if(pc->nFields == mxGetNumberOfFields(pState)) {
+    for(k = 0; k < CF_COUNT; ++k) {
+      if(0 != strcmp(mxGetFieldNameByNumber(pState, pc->fieldNumbers[k]), CONFIG_FIELDS[k])) {
+        break;
+      }
+    }
+  } else {
+    k = 0;
+  }
+  if(k < CF_COUNT) {
+    for(k = 0; k < CF_COUNT; ++k) {
+      pc->fieldNumbers[k] = mxGetFieldNumber(pState, CONFIG_FIELDS[k]);
+      abv_assert(-1 != pc->fieldNumbers[k], "bbci_acquire_bv: Field dosen't exist.");
+    }
+    pc->nFields = mxGetNumberOfFields(pState);
+  }
+  
+  /* chan_sel */
+  pField = mxGetFieldByNumber(pState, 0, pc->fieldNumbers[CF_CHAN_SEL]);
+  abv_assert(NULL != pField && mxIsDouble(pField) && 1 == mxGetM(pField), "bbci_acquire_bv: chan_sel is no array.");
+  if(abv_configArray(&pc->chanSel, &pc->nChansSel, pField)) {
+    for(n = 0; n < pc->nChansSel; ++n) {
+      abv_assert(pc->chanSel[n] >= 1 && pc->chanSel[n] <= pc->nChannels, "bbci_acquire_bv: chan_sel contains an invalid channel.");
+    }
+    pc->generation++;
+  }
+  
+  /* scale */
+  pField = mxGetFieldByNumber(pState, 0, pc->fieldNumbers[CF_SCALE]);
+  abv_assert(NULL != pField && mxIsDouble(pField) && 1 == mxGetM(pField) && pc->nChannels == (int)mxGetN(pField), "bbci_acquire_bv: Scale is no array or has wrong size.");
+  size = pc->nChannels;
+  if(abv_configArray(&pc->scale, &size, pField)) {
+    pc->generation++;
+  }
+  
+  /* filt_subsample, not used with filt_resample */
+  if(0 != pc->lag) {
+    pField = mxGetFieldByNumber(pState, 0, pc->fieldNumbers[CF_FILT_SUBSAMPLE]);
+    abv_assert(NULL != pField && mxIsDouble(pField) && 1 == mxGetM(pField) && pc->lag == (int)mxGetN(pField), "bbci_acquire_bv: Resample filter has to be a vector. Resample filter has to correspondent with the sampling rate.");
+    size = pc->lag;
+    if(abv_configArray(&pc->filtSubsample, &size, pField)) {
+      pc->generation++;
+    }
+  }
+  
+  /* marker_format */
+  pField = mxGetFieldByNumber(pState, 0, pc->fieldNumbers[CF_MARKER_FORMAT]);
+  abv_assert(NULL != pField, "bbci_acquire_bv: Field dosen't exist.");
+  if(matchString(pField, "numeric")) {
+    pc->markerFormat = MARKER_NUMERIC;
+  } else if(matchString(pField, "string")) {
+    pc->markerFormat = MARKER_STRING;
+  } else {
+    abv_assert(false, "bbci_acquire_bv: Unknown ouput type.");
+  }
+  
+  /* output_class */
+  pField = mxGetFieldByNumber(pState, 0, pc->fieldNumbers[CF_OUTPUT_CLASS]);
+  abv_assert(NULL != pField, "bbci_acquire_bv: Field dosen't exist.");
+  if(matchString(pField, "double")) {
+    pc->outputClass = FILTER_FLOAT64;
+  } else if(matchString(pField, "single")) {
+    pc->outputClass = FILTER_FLOAT32;
+  } else {
+    abv_assert(false, "bbci_acquire_bv: output_class has to be 'double' or 'single'.");
+  }
+  
+  /* the scalars */
+  pField = mxGetFieldByNumber(pState, 0, pc->fieldNumbers[CF_RECONNECT]);
+  abv_assert(NULL != pField && mxIsDouble(pField) && 1 == mxGetNumberOfElements(pField), "bbci_acquire_bv: Reconnect is no scalar.");
+  pc->reconnect = 1 == (int)mxGetScalar(pField);
+  
+  pField = mxGetFieldByNumber(pState, 0, pc->fieldNumbers[CF_WAIT_SAMPLES]);
+  abv_assert(NULL != pField && mxIsDouble(pField) && 1 == mxGetNumberOfElements(pField), "bbci_acquire_bv: wait_samples is no scalar.");
+  pc->waitSamples = mxGetScalar(pField);
+  
+  pField = mxGetFieldByNumber(pState, 0, pc->fieldNumbers[CF_WAIT_TIMEOUT]);
+  abv_assert(NULL != pField && mxIsDouble(pField) && 1 == mxGetNumberOfElements(pField), "bbci_acquire_bv: wait_timeout is no scalar.");
+  pc->waitTimeout = mxGetScalar(pField);
+}
+
+/************************************************************
+ *
+ * Creates the data output with nPoints rows in the class of the config.
+ *
+ ************************************************************/
+static mxArray *abv_createData(const struct abvConfig *pc, int nPoints) {
+  return mxCreateNumericMatrix(nPoints, pc->nChansSel,
+                               FILTER_FLOAT32 == pc->outputClass ? mxSINGLE_CLASS : mxDOUBLE_CLASS,
+                               mxREAL);
+}
+
+/************************************************************
+ *
+ * Checks the ring and the ptr of path 6c and returns the row (starting
+ * with 0) of the next sample. ptr is the row of the last sample as it is
+ * returned, 0 for an empty ring. The ring is written in place like
+ * OPT.data of read_bv, so it has to be a matrix of its own. Nothing was
+ * read yet, so an error leaves the connection open.
+ *
+ ************************************************************/
+static int abv_checkRing(const struct abvConfig *pc, const mxArray *pRing, const mxArray *pPtr) {
+  double ptr;
+  
+  if(!(mxIsDouble(pRing) || mxIsSingle(pRing)) || mxIsComplex(pRing) || mxIsSparse(pRing)
+     || 2 != mxGetNumberOfDimensions(pRing) || 0 == mxGetM(pRing)) {
+    mexErrMsgTxt("bbci_acquire_bv: the ring must be a real double or single matrix.");
+  }
+  if((FILTER_FLOAT32 == pc->outputClass) != (0 != mxIsSingle(pRing))) {
+    mexErrMsgTxt("bbci_acquire_bv: the ring must have the class of output_class.");
+  }
+  if((int)mxGetN(pRing) != pc->nChansSel) {
+    mexErrMsgTxt("bbci_acquire_bv: the ring must have a column for each channel of chan_sel.");
+  }
+  if(!mxIsDouble(pPtr) || mxIsComplex(pPtr) || 1 != mxGetNumberOfElements(pPtr)) {
+    mexErrMsgTxt("bbci_acquire_bv: ptr must be a real scalar.");
+  }
+  
+  ptr = mxGetScalar(pPtr);
+  if(ptr < 0 || ptr > (double)mxGetM(pRing) || ptr != (double)(int)ptr) {
+    mexErrMsgTxt("bbci_acquire_bv: ptr must be a row of the ring or 0.");
+  }
+  
+  return (int)ptr % (int)mxGetM(pRing);
+}
+
+/************************************************************
+ *
+ * Copies the rows of pData into the ring, starting at the row
+ * ringPosition and wrapping around. Of more rows than the ring has only
+ * the last ones are copied, as filterDataRing would have left them.
+ *
+ ************************************************************/
+static void abv_ringCopy(const mxArray *pData, mxArray *pRing, int ringPosition) {
+  size_t elementSize = mxGetElementSize(pData);
+  int nPoints = (int)mxGetM(pData);
+  int ringSize = (int)mxGetM(pRing);
+  int nChans = (int)mxGetN(pData);
+  int skip = 0, first, c;
+  const char *src = (const char *)mxGetData(pData);
+  char *dst = (char *)mxGetData(pRing);
+  
+  if(nPoints > ringSize) {
+    skip = nPoints - ringSize;
+    ringPosition = (ringPosition + skip) % ringSize;
+    nPoints = ringSize;
+  }
+  
+  /* the rows up to the end of the ring, the rest at the start */
+  first = ringSize - ringPosition;
+  if(first > nPoints) {
+    first = nPoints;
+  }
+  
+  for(c = 0; c < nChans; c++) {
+    const char *pSrc = src + ((size_t)c * mxGetM(pData) + skip) * elementSize;
+    char *pDst = dst + (size_t)c * ringSize * elementSize;
+    
+    memcpy(pDst + ringPosition * elementSize, pSrc, first * elementSize);
+    memcpy(pDst, pSrc + first * elementSize, (nPoints - first) * elementSize);
+  }
+}
+
+/************************************************************
+ *
+ * Creates the struct with the blocks of the data call. time is the end of
+ * the block in ms in the same way as marker_time, arrival the time the
+ * block was received and read_time the time of the data call, both in ms
+ * of the monotonic clock of brainserver.c.
+ *
+ ************************************************************/
+static mxArray *abv_createBlocks(const struct acquiredData *pAcquired, int nBlocks,
+                                 double origFs, double readTime) {
+  mxArray *pBlocks;
+  mxArray *pNo, *pTime, *pArrival;
+  double *no, *time, *arrival;
+  int dims[2] = {1,1};
+  int b;
+  
+  pNo = mxCreateDoubleMatrix(1, nBlocks, mxREAL);
+  pTime = mxCreateDoubleMatrix(1, nBlocks, mxREAL);
+  pArrival = mxCreateDoubleMatrix(1, nBlocks, mxREAL);
+  no = mxGetPr(pNo);
+  time = mxGetPr(pTime);
+  arrival = mxGetPr(pArrival);
+  
+  for(b = 0; b < nBlocks; ++b) {
+    no[b] = (double)pAcquired->blocks[b].nBlock;
+    time[b] = (double)pAcquired->blocks[b].endPos * 1000.0 / origFs;
+    arrival[b] = pAcquired->blocks[b].arrival;
+  }
+  
+  pBlocks = mxCreateStructArray(2, dims, 0, NULL);
+  mxSetFieldByNumber(pBlocks, 0, mxAddField(pBlocks, "block_no"), pNo);
+  mxSetFieldByNumber(pBlocks, 0, mxAddField(pBlocks, "time"), pTime);
+  mxSetFieldByNumber(pBlocks, 0, mxAddField(pBlocks, "arrival"), pArrival);
+  setScalar(pBlocks, "read_time", readTime);
+  
+  return pBlocks;
+}
+
+/************************************************************
+ *
+ * Frees the copies in the config.
+ *
+ ************************************************************/
+static void abv_configFree(struct abvConfig *pc) {
+  if(NULL != pc->chanSel) free(pc->chanSel);
+  if(NULL != pc->scale) free(pc->scale);
+  if(NULL != pc->filtSubsample) free(pc->filtSubsample);
+  memset(pc, 0, sizeof(struct abvConfig));
+}
+
+/************************************************************
+ *
+ * Returns the telemetry of a connection as a struct.
+ *
+ ************************************************************/
+
+static void 
+abv_stats(struct abvSession *ps, mxArray *plhs[])
 {
-  closeConnection();
-  connected = 0;
+  struct brainserverStats stats;
+  mxArray *OUT_STATS;
+  double edges[STATS_LATENCY_BINS];
+  double counts[STATS_LATENCY_BINS];
+  int dims[2] = {1,1};
+  int i;
+  
+  getStats(ps->server, &stats);
   
-  filterClose();
+  /* the upper edges of the histogram bins in ms */
+  for(i = 0; i < STATS_LATENCY_BINS; ++i) {
+    edges[i] = (i < STATS_LATENCY_BINS - 1) ? (double)(1 << i) : mxGetInf();
+    counts[i] = (double)stats.drainLatency[i];
+  }
+  
+  OUT_STATS = mxCreateStructArray(2, dims, 0, NULL);
+  setScalar(OUT_STATS, "blocks_received", (double)stats.blocksReceived);
+  setScalar(OUT_STATS, "blocks_dropped", (double)stats.blocksDropped);
+  setScalar(OUT_STATS, "samples_dropped", (double)stats.samplesDropped);
+  setScalar(OUT_STATS, "duplicate_blocks", (double)stats.duplicateBlocks);
+  setScalar(OUT_STATS, "bad_blocks", (double)stats.badBlocks);
+  setScalar(OUT_STATS, "gaps", (double)stats.gaps);
+  setScalar(OUT_STATS, "gap_samples", (double)stats.gapSamples);
+  setScalar(OUT_STATS, "reconnects", (double)stats.reconnects);
+  setScalar(OUT_STATS, "bytes_received", (double)stats.bytesReceived);
+  setScalar(OUT_STATS, "fifo_high_water", (double)stats.highWater);
+  setScalar(OUT_STATS, "fifo_capacity", (double)stats.capacity);
+  setString(OUT_STATS, "overflow_policy", abv_policyString(stats.overflowPolicy));
+  setScalar(OUT_STATS, "blocks_dropped_oldest", (double)stats.droppedOldest);
+  setScalar(OUT_STATS, "blocks_spilled", (double)stats.blocksSpilled);
+  setScalar(OUT_STATS, "spill_waiting", (double)stats.spillWaiting);
+  setArray(OUT_STATS, "drain_latency", counts, 1, STATS_LATENCY_BINS);
+  setArray(OUT_STATS, "drain_latency_edges", edges, 1, STATS_LATENCY_BINS);
+  setString(OUT_STATS, "status", abv_statusString(getConnectionStatus(ps->server)));
+  setString(OUT_STATS, "rt_priority", abv_optionString(stats.priorityResult));
+  setString(OUT_STATS, "cpu_affinity", abv_optionString(stats.affinityResult));
+  setString(OUT_STATS, "mlock", abv_optionString(stats.lockResult));
+  if(stats.recording) {
+    setScalar(OUT_STATS, "record_bytes", (double)stats.recordBytes);
+    setScalar(OUT_STATS, "record_blocks", (double)stats.recordBlocks);
+    setScalar(OUT_STATS, "record_dropped", (double)stats.recordDropped);
+    setScalar(OUT_STATS, "record_files", (double)stats.recordFiles);
+    setString(OUT_STATS, "record_error", stats.recordError ? strerror(stats.recordError) : "");
+  }
+  
+  plhs[0] = OUT_STATS;
+}
+
+/************************************************************
+ *
+ * Reads the size of the buffer and its overflow policy from
+ * the state.
+ *
+ ************************************************************/
+
+static void abv_bufferOptions(mxArray *pState, struct bufferOptions *pBuffer) {
+  const mxArray *pPolicy;
+  
+  abv_assert(1 == checkScalar(pState, FIELD_BUFFER_SECONDS, FIFO_DEFAULT_SECONDS), "bbci_acquire_bv: buffer_seconds is no scalar.");
+  abv_assert(1 == checkScalar(pState, FIELD_BUFFER_SAMPLES, 0), "bbci_acquire_bv: buffer_samples is no scalar.");
+  abv_assert(1 == checkString(pState, FIELD_OVERFLOW_POLICY, abv_policyString(FIFO_DROP_NEWEST)), "bbci_acquire_bv: overflow_policy is no string.");
+  
+  pBuffer->seconds = getScalar(pState, FIELD_BUFFER_SECONDS);
+  abv_assert(getScalar(pState, FIELD_BUFFER_SAMPLES) >= 0, "bbci_acquire_bv: buffer_samples must not be negative.");
+  pBuffer->samples = (ULONG)getScalar(pState, FIELD_BUFFER_SAMPLES);
+  abv_assert(pBuffer->seconds > 0 || pBuffer->samples > 0, "bbci_acquire_bv: the buffer must not be empty.");
+  
+  pPolicy = mxGetField(pState, 0, FIELD_OVERFLOW_POLICY);
+  if(matchString(pPolicy, abv_policyString(FIFO_DROP_OLDEST))) {
+    pBuffer->policy = FIFO_DROP_OLDEST;
+  } else if(matchString(pPolicy, abv_policyString(FIFO_SPILL))) {
+    pBuffer->policy = FIFO_SPILL;
+  } else {
+    abv_assert(matchString(pPolicy, abv_policyString(FIFO_DROP_NEWEST)),
+               "bbci_acquire_bv: overflow_policy must be 'drop_newest', 'drop_oldest' or 'spill'.");
+    pBuffer->policy = FIFO_DROP_NEWEST;
+  }
+}
+
+/************************************************************
+ *
+ * The name of an overflow policy.
+ *
+ ************************************************************/
+static const char *abv_policyString(int policy) {
+  switch(policy) {
+    case FIFO_DROP_OLDEST: return "drop_oldest";
+    case FIFO_SPILL: return "spill";
+    default: return "drop_newest";
+  }
+}
+
+/************************************************************
+ *
+ * Reads the real-time options from the state and applies them
+ * to the thread which receives the data. An option which can
+ * not be applied only gives a warning.
+ *
+ ************************************************************/
+
+static void abv_threadOptions(struct abvSession *ps, mxArray *pState) {
+  struct threadOptions options;
+  const mxArray *pPolicy;
+  struct brainserverStats stats;
+  
+  abv_assert(1 == checkScalar(pState, FIELD_RT_PRIORITY, 0), "bbci_acquire_bv: rt_priority is no scalar.");
+  abv_assert(1 == checkString(pState, FIELD_RT_POLICY, "fifo"), "bbci_acquire_bv: rt_policy is no string.");
+  abv_assert(1 == checkScalar(pState, FIELD_CPU_AFFINITY, -1), "bbci_acquire_bv: cpu_affinity is no scalar.");
+  abv_assert(1 == checkScalar(pState, FIELD_MLOCK, 0), "bbci_acquire_bv: mlock is no scalar.");
+  
+  pPolicy = mxGetField(pState, 0, FIELD_RT_POLICY);
+  abv_assert(matchString(pPolicy, "fifo") || matchString(pPolicy, "rr"),
+             "bbci_acquire_bv: rt_policy must be 'fifo' or 'rr'.");
+  options.policy = matchString(pPolicy, "rr") ? AC_SCHED_RR : AC_SCHED_FIFO;
+  options.priority = (int)getScalar(pState, FIELD_RT_PRIORITY);
+  options.cpu = (int)getScalar(pState, FIELD_CPU_AFFINITY);
+  options.lockMemory = 0 != getScalar(pState, FIELD_MLOCK);
+  
+  setThreadOptions(ps->server, &options);
+  
+  getStats(ps->server, &stats);
+  if(stats.priorityResult > 0) {
+    mexPrintf("bbci_acquire_bv: rt_priority was not applied: %s\n", strerror(stats.priorityResult));
+  }
+  if(stats.affinityResult > 0) {
+    mexPrintf("bbci_acquire_bv: cpu_affinity was not applied: %s\n", strerror(stats.affinityResult));
+  }
+  if(stats.lockResult > 0) {
+    mexPrintf("bbci_acquire_bv: mlock was not applied: %s\n", strerror(stats.lockResult));
+  }
+}
+
+/************************************************************
+ *
+ * The state of a real-time option for the stats.
+ *
+ ************************************************************/
+static const char *abv_optionString(int result) {
+  if(OPTION_NOT_SET == result) return "off";
+  if(0 == result) return "applied";
+  return strerror(result);
+}
+
+/************************************************************
+ *
+ * The name of a connection state for the status field.
+ *
+ ************************************************************/
+static const char *abv_statusString(int status) {
+  switch(status) {
+    case CS_CONNECTED: return "connected";
+    case CS_RECONNECTING: return "reconnecting";
+    default: return "disconnected";
+  }
+}
+
+/************************************************************
+ *
+ * Close Connection
+ *
+ ************************************************************/
+
+static void abv_close(struct abvSession *ps)
+{
+  if(NULL != ps->server) {
+    closeConnection(ps->server);
+    ps->server = NULL;
+  }
+  ps->connected = 0;
+  
+  if(NULL != ps->shm) {
+    shmRingClose(ps->shm);
+    ps->shm = NULL;
+  }
+  
+  freeAcquiredData(&ps->acquired);
+  abv_configFree(&ps->config);
+  filterDestroy(ps->filter);
+  ps->filter = NULL;
+  
+  if(current == ps) {
+    current = NULL;
+  }
 }
 
 /************************************************************
@@ -839,7 +1838,9 @@ static void abv_close()
  ************************************************************/
 static void abv_assert(bool condition,const char *text) {
   if(0 == condition) {
-    abv_close();
+    if(NULL != current) {
+      abv_close(current);
+    }
     
     mexErrMsgTxt(text);
   }
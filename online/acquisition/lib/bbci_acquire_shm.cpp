@@ -0,0 +1,358 @@
+/*
+  bbci_acquire_shm.cpp
+
+  This file defines a mex-Function which reads the data another process
+  exports with bbci_acquire_bv(..., 'shm_name', name) from shared memory.
+  The execution pathes are:
+
+  1. state = bbci_acquire_shm('init', state);
+  2. state = bbci_acquire_shm('init', param1, value1, param2, value2, ...);
+  3. [data, marker_time, marker_descr, state] = bbci_acquire_shm(state);
+  4. bbci_acquire_shm('close');
+  5. bbci_acquire_shm('close', state);
+
+  The first and the second call open the ring with the name in
+  state.shm_name and return fs and clab of the exporting process. The
+  data call returns everything which was written since the last call,
+  like bbci_acquire_bv. A reader which is too slow loses the oldest
+  samples, state.lost_samples counts them. state.running is false after
+  the exporting process has closed the ring.
+
+  - 2026/10/17 - Jonas Reiter
+                 - Written.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mex.h"
+extern "C" {
+  #include "shmring.h"
+}
+
+/*
+ * DEFINES
+ */
+
+#define MAX_SESSIONS 16 /* maximum number of open rings */
+
+/*
+ * GLOBAL DATA
+ */
+
+static struct shmRing *sessions[MAX_SESSIONS];
+
+/* the markers of one data call */
+static struct shmRingMarker markers[SHM_RING_MARKER_CAPACITY];
+
+static const char* FIELD_SHM_NAME = "shm_name";
+static const char* FIELD_FS = "fs";
+static const char* FIELD_CLAB = "clab";
+static const char* FIELD_HANDLE = "handle";
+static const char* FIELD_MARKER_FORMAT = "marker_format";
+static const char* FIELD_OUTPUT_CLASS = "output_class";
+static const char* FIELD_RUNNING = "running";
+static const char* FIELD_LOST_SAMPLES = "lost_samples";
+
+/*
+ * FUNCTION PROTOTYPES
+ */
+
+static void ash_init(mxArray *plhs[], int nrhs, const mxArray *prhs[], bool isStructInit);
+static void ash_getdata(struct shmRing *p, int nlhs, mxArray *plhs[], const mxArray *pState);
+static int ash_getHandle(const mxArray *pState);
+static char *ash_getString(const mxArray *pStruct, const char *fieldname, const char *defaultValue);
+static void ash_setField(mxArray *pStruct, const char *fieldname, mxArray *pValue);
+
+/************************************************************
+ *
+ * mexFunction
+ *
+ ************************************************************/
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  int handle;
+
+  if(0 == nrhs) {
+    mexErrMsgTxt("bbci_acquire_shm: at least one argument required.");
+  }
+
+  if(mxIsChar(prhs[0])) {
+    char command[8];
+
+    mxGetString(prhs[0], command, sizeof(command));
+
+    /* execution path 4 and 5 */
+    if(0 == strcmp(command, "close")) {
+      if(0 != nlhs) {
+        mexErrMsgTxt("bbci_acquire_shm: no output arguments on close.");
+      }
+      if(2 <= nrhs && mxIsStruct(prhs[1])) {
+        handle = ash_getHandle(prhs[1]);
+        if(handle < 0) {
+          mexWarnMsgTxt("bbci_acquire_shm: no open ring to close!");
+        } else {
+          shmRingClose(sessions[handle]);
+          sessions[handle] = NULL;
+        }
+      } else {
+        int closed = 0;
+
+        for(handle = 0; handle < MAX_SESSIONS; ++handle) {
+          if(NULL != sessions[handle]) {
+            shmRingClose(sessions[handle]);
+            sessions[handle] = NULL;
+            closed++;
+          }
+        }
+        if(0 == closed) {
+          mexWarnMsgTxt("bbci_acquire_shm: no open ring to close!");
+        }
+      }
+      return;
+    }
+
+    /* execution path 1 and 2 */
+    if(0 == strcmp(command, "init") || 0 == strcmp(command, "open")) {
+      bool isStructInit = 2 == nrhs && mxIsStruct(prhs[1]);
+
+      if(!isStructInit && 0 != (nrhs - 1) % 2) {
+        mexErrMsgTxt("bbci_acquire_shm: init is only allowed with a struct or a property list as an argument.");
+      }
+      if(1 != nlhs) {
+        mexErrMsgTxt("bbci_acquire_shm: only one output for init.");
+      }
+      ash_init(plhs, nrhs, prhs, isStructInit);
+      return;
+    }
+
+    mexErrMsgTxt("bbci_acquire_shm: unknown command.");
+  }
+
+  /* execution path 3 */
+  if(4 < nlhs) {
+    mexErrMsgTxt("bbci_acquire_shm: Four ouput arguments are maximum.");
+  }
+  if(1 != nrhs || !mxIsStruct(prhs[0])) {
+    mexErrMsgTxt("bbci_acquire_shm: the state is the only input argument of the data call.");
+  }
+
+  handle = ash_getHandle(prhs[0]);
+  if(handle < 0) {
+    mexErrMsgTxt("bbci_acquire_shm: open a ring first!");
+  }
+  ash_getdata(sessions[handle], nlhs, plhs, prhs[0]);
+}
+
+/************************************************************
+ *
+ * Opens the ring and fills in the state
+ *
+ ************************************************************/
+static void ash_init(mxArray *plhs[], int nrhs, const mxArray *prhs[], bool isStructInit)
+{
+  const struct shmRingHeader *pInfo;
+  mxArray *OUT_STATE;
+  mxArray *pClab;
+  char *name, *value;
+  struct shmRing *p;
+  int handle, i;
+
+  for(handle = 0; handle < MAX_SESSIONS && NULL != sessions[handle]; ++handle) {}
+  if(MAX_SESSIONS == handle) {
+    mexErrMsgTxt("bbci_acquire_shm: too many open rings, close one first!");
+  }
+
+  if(isStructInit) {
+    OUT_STATE = mxDuplicateArray(prhs[1]);
+  } else {
+    int dims[2] = {1, 1};
+
+    OUT_STATE = mxCreateStructArray(2, dims, 0, NULL);
+    for(i = 1; i + 1 < nrhs; i += 2) {
+      char fieldname[64];
+
+      if(!mxIsChar(prhs[i])) {
+        mexErrMsgTxt("bbci_acquire_shm: the names of the properties have to be strings.");
+      }
+      mxGetString(prhs[i], fieldname, sizeof(fieldname));
+      ash_setField(OUT_STATE, fieldname, mxDuplicateArray(prhs[i + 1]));
+    }
+  }
+
+  /* the defaults of the formats, checked here so the data call does not have to */
+  value = ash_getString(OUT_STATE, FIELD_MARKER_FORMAT, "numeric");
+  if(0 != strcmp(value, "numeric") && 0 != strcmp(value, "string")) {
+    mexErrMsgTxt("bbci_acquire_shm: marker_format has to be 'numeric' or 'string'.");
+  }
+  mxFree(value);
+  value = ash_getString(OUT_STATE, FIELD_OUTPUT_CLASS, "double");
+  if(0 != strcmp(value, "double") && 0 != strcmp(value, "single")) {
+    mexErrMsgTxt("bbci_acquire_shm: output_class has to be 'double' or 'single'.");
+  }
+  mxFree(value);
+
+  name = ash_getString(OUT_STATE, FIELD_SHM_NAME, "");
+  if(0 == name[0]) {
+    mexErrMsgTxt("bbci_acquire_shm: shm_name is required.");
+  }
+  p = shmRingOpen(name);
+  mxFree(name);
+  if(NULL == p) {
+    mexErrMsgTxt("bbci_acquire_shm: could not open the ring, is bbci_acquire_bv running with shm_name?");
+  }
+  sessions[handle] = p;
+
+  pInfo = shmRingInfo(p);
+  pClab = mxCreateCellMatrix(1, pInfo->nChannels);
+  for(i = 0; i < (int)pInfo->nChannels; ++i) {
+    mxSetCell(pClab, i, mxCreateString(shmRingLabel(p, i)));
+  }
+
+  ash_setField(OUT_STATE, FIELD_FS, mxCreateDoubleScalar(pInfo->fs));
+  ash_setField(OUT_STATE, FIELD_CLAB, pClab);
+  ash_setField(OUT_STATE, FIELD_HANDLE, mxCreateDoubleScalar(handle + 1));
+  ash_setField(OUT_STATE, FIELD_RUNNING, mxCreateDoubleScalar(0 == pInfo->closed));
+  ash_setField(OUT_STATE, FIELD_LOST_SAMPLES, mxCreateDoubleScalar(0.0));
+
+  plhs[0] = OUT_STATE;
+}
+
+/************************************************************
+ *
+ * Reads everything which is in the ring for this reader
+ *
+ ************************************************************/
+static void ash_getdata(struct shmRing *p, int nlhs, mxArray *plhs[], const mxArray *pState)
+{
+  const struct shmRingHeader *pInfo = shmRingInfo(p);
+  mxArray *OUT_DATA, *OUT_MRK_TIME = NULL, *OUT_MRK_DESCR = NULL, *OUT_STATE;
+  uint64_t available, lost;
+  uint32_t nPoints, nMarkers, n;
+  int single, numeric;
+  char *value;
+
+  value = ash_getString(pState, FIELD_OUTPUT_CLASS, "double");
+  single = 0 == strcmp(value, "single");
+  mxFree(value);
+  value = ash_getString(pState, FIELD_MARKER_FORMAT, "numeric");
+  numeric = 0 != strcmp(value, "string");
+  mxFree(value);
+
+  /* more than the capacity is lost anyway */
+  available = shmRingAvailable(p);
+  if(available > pInfo->capacity) {
+    available = pInfo->capacity;
+  }
+
+  OUT_DATA = mxCreateNumericMatrix((mwSize)available, pInfo->nChannels,
+                                   single ? mxSINGLE_CLASS : mxDOUBLE_CLASS, mxREAL);
+  nPoints = shmRingRead(p, mxGetData(OUT_DATA), single ? SHM_RING_FLOAT32 : SHM_RING_FLOAT64,
+                        (uint32_t)available, markers, SHM_RING_MARKER_CAPACITY, &nMarkers, &lost);
+  /* shmRingRead stores [nPoints nChannels], the rest of the memory is unused */
+  mxSetM(OUT_DATA, nPoints);
+
+  if(nlhs >= 2) {
+    if(nMarkers > 0) {
+      double *pMrkPos, *pMrkToe = NULL;
+
+      OUT_MRK_TIME = mxCreateDoubleMatrix(1, nMarkers, mxREAL);
+      pMrkPos = mxGetPr(OUT_MRK_TIME);
+      if(numeric) {
+        OUT_MRK_DESCR = mxCreateDoubleMatrix(1, nMarkers, mxREAL);
+        pMrkToe = mxGetPr(OUT_MRK_DESCR);
+      } else {
+        OUT_MRK_DESCR = mxCreateCellMatrix(1, nMarkers);
+      }
+
+      for(n = 0; n < nMarkers; n++) {
+        const char *pszType = markers[n].sTypeDesc;
+        const char *pszDesc = pszType + strlen(pszType) + 1;
+
+        pMrkPos[n] = ((double)markers[n].position + 1.0) * 1000.0 / pInfo->fs;
+        if(numeric) {
+          pMrkToe[n] = ((*pszDesc == 'R') ? -1 : 1) * atoi(pszDesc + 1);
+        } else {
+          mxSetCell(OUT_MRK_DESCR, n, mxCreateString(pszDesc));
+        }
+      }
+    } else {
+      OUT_MRK_TIME = mxCreateDoubleMatrix(0, 0, mxREAL);
+      OUT_MRK_DESCR = mxCreateDoubleMatrix(0, 0, mxREAL);
+    }
+  }
+
+  plhs[0] = OUT_DATA;
+  if(nlhs >= 2) {
+    plhs[1] = OUT_MRK_TIME;
+  }
+  if(nlhs >= 3) {
+    plhs[2] = OUT_MRK_DESCR;
+  } else if(NULL != OUT_MRK_DESCR) {
+    mxDestroyArray(OUT_MRK_DESCR);
+  }
+  if(nlhs >= 4) {
+    OUT_STATE = mxDuplicateArray(pState);
+    ash_setField(OUT_STATE, FIELD_RUNNING, mxCreateDoubleScalar(0 == pInfo->closed || shmRingAvailable(p) > 0));
+    ash_setField(OUT_STATE, FIELD_LOST_SAMPLES, mxCreateDoubleScalar((double)lost));
+    plhs[3] = OUT_STATE;
+  }
+}
+
+/************************************************************
+ *
+ * Helpers
+ *
+ ************************************************************/
+
+/* The index of the open ring of a state or -1 */
+static int ash_getHandle(const mxArray *pState)
+{
+  mxArray *pField = mxGetField(pState, 0, FIELD_HANDLE);
+  int handle;
+
+  if(NULL == pField || !mxIsDouble(pField) || 1 != mxGetNumberOfElements(pField)) {
+    return -1;
+  }
+  handle = (int)mxGetScalar(pField) - 1;
+  if(handle < 0 || handle >= MAX_SESSIONS || NULL == sessions[handle]) {
+    return -1;
+  }
+
+  return handle;
+}
+
+/* A string field or the default, freed with mxFree */
+static char *ash_getString(const mxArray *pStruct, const char *fieldname, const char *defaultValue)
+{
+  mxArray *pField = mxGetField(pStruct, 0, fieldname);
+  char *value;
+
+  if(NULL == pField) {
+    value = (char *) mxMalloc(strlen(defaultValue) + 1);
+    strcpy(value, defaultValue);
+    return value;
+  }
+  if(!mxIsChar(pField)) {
+    mexErrMsgTxt("bbci_acquire_shm: a field which should be a string is none.");
+  }
+
+  return mxArrayToString(pField);
+}
+
+/* Sets a field of the struct, it is added if it does not exist */
+static void ash_setField(mxArray *pStruct, const char *fieldname, mxArray *pValue)
+{
+  int fieldNumber = mxGetFieldNumber(pStruct, fieldname);
+  mxArray *pOld;
+
+  if(-1 == fieldNumber) {
+    fieldNumber = mxAddField(pStruct, fieldname);
+  }
+  pOld = mxGetFieldByNumber(pStruct, 0, fieldNumber);
+  if(NULL != pOld) {
+    mxDestroyArray(pOld);
+  }
+  mxSetFieldByNumber(pStruct, 0, fieldNumber, pValue);
+}
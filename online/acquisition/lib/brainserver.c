@@ -30,6 +30,51 @@
                    is not needed any longer. The working mexPrintf and prinf
                    functions produced heavy output in the threading part of
                    the file. I documented them out.
+ 
+  - 2026/10/17 - Jonas Reiter
+                 - The global socket, read buffer, ring and thread state
+                   were moved into struct brainserverSession. Every
+                   connection has its own poll thread, which gets the
+                   session as its parameter.
+                 - If reconnect is set the poll thread reconnects on its own
+                   when the connection is lost, with an exponential backoff
+                   between the attempts. Gaps in the block numbers are
+                   counted as missing samples.
+                 - Telemetry: the poll thread counts blocks, bytes, gaps and
+                   duplicates, getData keeps a histogram of the time from
+                   the arrival of a block until it is handed out.
+                 - waitForData: the poll thread signals an event for every
+                   block, so the reader can sleep until enough data is
+                   there.
+                 - DetermineElementType: message type 4 is float32.
+                 - getData hands out the number, end and arrival time of
+                   every block. On linux the arrival is the kernel timestamp
+                   of the socket, which is read with recvmsg.
+                 - AC_REACTOR: on linux the sessions have no poll thread of
+                   their own. Their sockets are non-blocking and read by the
+                   epoll thread of ioreactor.c, which also does the
+                   reconnecting as a state machine driven by timers. The
+                   framing of the messages (rdaReaderNext) and their
+                   processing (handleMessage) are shared with the poll
+                   thread. The address of the server is resolved once.
+                 - setRecorder: handleMessage passes every new data block to
+                   the recorder of the session.
+                 - The threads and events are the ones of acthreads.h on all
+                   platforms, the include of the winunix layer pointed to a
+                   directory which does not exist. The poll thread no longer
+                   has to be polled for a stop request: stopPollThread sets
+                   the quit event, which ends the waits between reconnects,
+                   and shuts down the socket, which ends select, connect and
+                   recv at once, then joins the thread. The socket is only
+                   replaced under socketLock, so the shutdown never hits a
+                   socket which was already closed.
+                 - setThreadOptions: the priority and the cpu of the poll
+                   thread (or of the reactor thread) and locking the rings
+                   in memory.
+                 - The size of the ring and its overflow policy are given to
+                   initConnection. getData holds the read lock of the ring,
+                   which FIFO_DROP_OLDEST needs, and counts the blocks which
+                   overflowed since the last call.
 */
 
 #ifdef _WIN32
@@ -37,27 +82,43 @@
 #  include <winsock2.h>
 #  include <winbase.h>
 #  include <stdio.h>
+#  include <ctype.h>
 
-#  define CLOSESOCKET(s) do { closesocket(s); brainserver_socket = -1; } while(0)
+#  define CLOSESOCKET(s) do { if ((s) >= 0) closesocket(s); (s) = -1; } while(0)
+#  define SHUTDOWNSOCKET(s) shutdown(s, SD_BOTH)
 #else	
 /* UNIX */
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <time.h>
+#include <ctype.h>
 #include <unistd.h>
-#include "../../../online/winunix/winthreads.h" /* These are some portability layers */
-#include "../../../online/winunix/winevents.h"  /* for WinThreads and Events */
-#define CLOSESOCKET(s) do { close(s); brainserver_socket = -1; } while(0)
+#define CLOSESOCKET(s) do { if ((s) >= 0) close(s); (s) = -1; } while(0)
+#define SHUTDOWNSOCKET(s) shutdown(s, SHUT_RDWR)
 
 #endif
 
 #include "brainserver.h"
 #include "headerfifo.h"
+#include "recorder.h"
+#include "acthreads.h"
+
+#ifdef AC_REACTOR
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include "ioreactor.h"
+#endif
 
 /*
   implementation specific data types
@@ -73,24 +134,92 @@ union RDA_Message {
 };
 
 /*
-  forward references of local functions
+  thread state
 */
-void dumpRDAMarker(struct RDA_Marker *pma);
+enum threadStatus {
+    TS_INIT,
+    TS_RUNNING,
+    TS_RECONNECTING,
+    TS_ERROR,
+    TS_STOPPED
+};
 
-/* threading forward references */
-void printThreadState();
-DWORD WINAPI pollThread(LPVOID lpParameter);
-int startPollThread();
-int stopPollThread();
-int beginFIFO();
-int finishedFIFO();
+enum threadRequest {
+    TR_CLEAR,
+    TR_QUIT
+};
+
+#ifdef AC_REACTOR
+/*
+  what the reactor is doing with the socket of a session
+*/
+enum reactorState {
+    RS_RECEIVING,                       /* reading the data messages */
+    RS_BACKOFF,                         /* waiting for the next attempt */
+    RS_CONNECTING,                      /* waiting for connect */
+    RS_STARTING                         /* waiting for the start message */
+};
+#endif
 
+/*
+  One connection to a server
+*/
+struct brainserverSession
+{
+  int socket;                           /* the main socket */
+  struct rdaReader reader;              /* the buffer for reading the messages from the socket */
+  char *host;                           /* the server, needed for reconnecting */
+  struct sockaddr_in addr;              /* resolved by the first connect */
+  ULONG nChannels;                      /* from the start message */
+  double dSamplingInterval;             /* from the start message */
+  volatile int reconnect;               /* reconnect if the connection is lost */
+  ULONG lastBlock;                      /* the number of the last data block */
+  int haveBlock;                        /* lastBlock is valid */
+#ifdef AC_THREADED
+  ULONG missingRead;                    /* missing samples handed out by getData */
+  ULONG overflowRead;                   /* overflowed blocks handed out by getData */
+  ULONG spilledRead;                    /* spilled blocks handed out by getData */
+  volatile ULONG reconnects;            /* written by the poll thread */
+  int priorityResult;                   /* of setThreadOptions */
+  int affinityResult;
+  int lockResult;
+  ULONG drainLatency[STATS_LATENCY_BINS]; /* written by getData */
+  struct headerFIFO fifo;               /* the data received by the poll thread */
+  volatile enum threadStatus threadStatus;
+  volatile enum threadRequest threadRequest;
+  struct acEvent *dataEvent;            /* set for every block and when the thread ends */
+  struct acEvent *quitEvent;            /* set by stopPollThread */
+  struct acThread *thread;              /* the poll thread */
+  struct acMutex *socketLock;           /* held by the poll thread while it replaces the socket */
+  struct rdaRecorder * volatile recorder; /* NULL if we do not record */
+#endif
+#ifdef AC_REACTOR
+  int ioId;                             /* the registration with the reactor */
+  enum reactorState ioState;
+  int retryDelay;                       /* ms until the next attempt */
+#endif
+};
 
 /*
-  the main socket
+  forward references of local functions
 */
+void dumpRDAMarker(struct RDA_Marker *pma);
 
-int brainserver_socket = 0;
+static int connectServer(struct brainserverSession *ps,
+                         struct RDA_MessageStart **pMsgStart, int verbose);
+static void freeSession(struct brainserverSession *ps);
+static int openSocket(struct brainserverSession *ps);
+static void closeSocket(struct brainserverSession *ps);
+static int rdaReaderNext(struct rdaReader *pr, struct RDA_MessageHeader** ppHeader);
+static int readSocket(struct rdaReader *pr, int sock);
+
+/* threading forward references */
+void printThreadState(struct brainserverSession *ps);
+#ifndef AC_REACTOR
+static int pollThread(void *context);
+#endif
+int startPollThread(struct brainserverSession *ps);
+int stopPollThread(struct brainserverSession *ps);
 
 /*----------------------------------------------------------------------
 
@@ -104,13 +233,20 @@ Main Functions
  */
 
 int initConnection(const char *bv_hostname,
-		   struct RDA_MessageStart **pMsgStart)
+		   struct RDA_MessageStart **pMsgStart,
+                   struct brainserverSession **ppSession,
+                   int reconnect,
+                   const struct bufferOptions *pBuffer)
 {
-  struct sockaddr_in addr;                 /* my address information */
-  struct hostent *he;
-  int failed, waiting, nResult;
+  struct brainserverSession *ps;
+  int result;
+#ifdef AC_THREADED
+  double capacity;
+  int policy = pBuffer ? pBuffer->policy : FIFO_DROP_NEWEST;
+#endif
 
   *pMsgStart = NULL;
+  *ppSession = NULL;
 
 #ifdef _WIN32
   /* Setup sockets for windows */
@@ -131,76 +267,226 @@ int initConnection(const char *bv_hostname,
   }
 #endif
 
-  /* get the host info */
-  if ((he = gethostbyname(bv_hostname)) == NULL) {
-      mexWarnMsgTxt("acquire_bv: gethostbyname failed.");
-      CLOSESOCKET(brainserver_socket);
-      return -2;
+  ps = (struct brainserverSession *)calloc(1, sizeof(struct brainserverSession));
+  if (ps) ps->host = (char *)malloc(strlen(bv_hostname) + 1);
+  if (!ps || !ps->host) {
+      mexWarnMsgTxt("acquire_bv: Out of memory.");
+      freeSession(ps);
+      return -1;
+  }
+  strcpy(ps->host, bv_hostname);
+  ps->socket = -1;
+  ps->reconnect = reconnect;
+#ifdef AC_THREADED
+  ps->priorityResult = OPTION_NOT_SET;
+  ps->affinityResult = OPTION_NOT_SET;
+  ps->lockResult = OPTION_NOT_SET;
+#endif
+
+  result = connectServer(ps, pMsgStart, 1);
+  if (result != IC_OKAY) {
+    freeSession(ps);
+    return result;
+  }
+
+  ps->nChannels = (*pMsgStart)->nChannels;
+  ps->dSamplingInterval = (*pMsgStart)->dSamplingInterval;
+
+#ifdef AC_THREADED
+  /* the capacity is counted in samples at the original sampling rate */
+  if (pBuffer && pBuffer->samples > 0) {
+    capacity = pBuffer->samples;
+  } else {
+    capacity = (pBuffer ? pBuffer->seconds : FIFO_DEFAULT_SECONDS)
+      * 1000000.0 / (*pMsgStart)->dSamplingInterval;
+  }
+  if (capacity < 1.0 || capacity > FIFO_MAX_BYTES
+      || headerFIFOcreate(&ps->fifo, (ULONG)capacity, (*pMsgStart)->nChannels, policy) != 0) {
+    mexWarnMsgTxt("acquire_bv: could not allocate the data buffer or the spill file.");
+    freeSession(ps);
+    return -1;
+  }
+
+  *ppSession = ps;
+  if (startPollThread(ps) != 0) {
+    closeConnection(ps);
+    *ppSession = NULL;
+    return -1;
+  }
+  return 0;
+#else
+  *ppSession = ps;
+  return 0;
+#endif
+}
+
+/*
+  Opens the socket to ps->host and reads the start message, which is
+  copied to *pMsgStart. The poll thread calls this function for
+  reconnecting, so it only talks to matlab if verbose is set.
+  On failure the socket is closed again.
+*/
+static int connectServer(struct brainserverSession *ps,
+                         struct RDA_MessageStart **pMsgStart, int verbose)
+{
+  int failed, waiting, nResult;
+
+  *pMsgStart = NULL;
+
+  /* get the host info, a reconnect uses the address of the first connect */
+  if (0 == ps->addr.sin_family) {
+    struct hostent *he;
+
+    if ((he = gethostbyname(ps->host)) == NULL) {
+      if (verbose) mexWarnMsgTxt("acquire_bv: gethostbyname failed.");
+      return IC_GETHOSTBYNAME_FAILED;
+    }
+    ps->addr.sin_family = AF_INET;         /* host byte order */
+    ps->addr.sin_port = htons(BV_PORT);    /* short, network byte order */
+    ps->addr.sin_addr = *((struct in_addr *)he->h_addr);
   }
       
   /* open a socket */
-  if ((brainserver_socket = socket(PF_INET, SOCK_STREAM, 0)) == -1) {
-      mexWarnMsgTxt("acquire_bv: Couldn't open socket.");
-      CLOSESOCKET(brainserver_socket);
-      return -3;
+  if (openSocket(ps) != 0) {
+      if (verbose) mexWarnMsgTxt("acquire_bv: Couldn't open socket.");
+      return IC_OPENSOCKET_FAILED;
   }
   
-  addr.sin_family = AF_INET;         /* host byte order */
-  addr.sin_port = htons(BV_PORT);    /* short, network byte order */
-  addr.sin_addr = *((struct in_addr *)he->h_addr);
-
   /* connect */
-  if (connect(brainserver_socket,
-	      (struct sockaddr *)&addr, 
+  if (connect(ps->socket,
+	      (struct sockaddr *)&ps->addr, 
 	      sizeof(struct sockaddr)) 
       == -1) {
-    mexWarnMsgTxt("acquire_bv: cannot connect to server");
-    CLOSESOCKET(brainserver_socket);
-    return -1;
+    if (verbose) mexWarnMsgTxt("acquire_bv: cannot connect to server");
+    closeSocket(ps);
+    return IC_ERROR;
   }
-  else
-    mexPrintf("connected to %s: %s -> socket [%d]\n", bv_hostname, 
-	      inet_ntoa(addr.sin_addr), brainserver_socket);
+  else if (verbose)
+    mexPrintf("connected to %s: %s -> socket [%d]\n", ps->host, 
+	      inet_ntoa(ps->addr.sin_addr), ps->socket);
   
   /* Keep reading until a whole header was received. */
+  rdaReaderReset(&ps->reader);
   failed = 0;
   waiting = 1;
   while (waiting) {
     struct RDA_MessageHeader *pHeader = 0;
 
-    nResult = getServerMessage(brainserver_socket, &pHeader);
+    nResult = getServerMessage(ps, &pHeader);
     if (nResult > 0) {
       if(pHeader->nType == 1) { /* Header */
-	*pMsgStart = (struct RDA_MessageStart*)pHeader;
-        pHeader = 0;
+        /* the message lives in the read buffer, the caller gets a copy */
+	*pMsgStart = (struct RDA_MessageStart*)malloc(pHeader->nSize);
+        if (*pMsgStart) {
+          memcpy(*pMsgStart, pHeader, pHeader->nSize);
+        } else {
+          failed = 1;
+        }
 	waiting = 0;
       }
       else if(pHeader->nType == 3) { /* Stop signal */
-	mexWarnMsgTxt("transmission was stopped\n");
+	if (verbose) mexWarnMsgTxt("transmission was stopped\n");
 	failed = 1;
 	waiting = 0;
       }
     }
     else if (nResult <= 0) {
-      mexWarnMsgTxt("error in transmission.\n");
+      if (verbose) mexWarnMsgTxt("error in transmission.\n");
       failed = 1;
       waiting = 0;
     }
-    if (pHeader) free(pHeader);
   }
   
   if (failed) { 
-    CLOSESOCKET(brainserver_socket);
-    return -1;
+    closeSocket(ps);
+    return IC_ERROR;
+  }
+
+  return IC_OKAY;
+}
+
+/*
+  Opens ps->socket with the options we want.
+*/
+static int openSocket(struct brainserverSession *ps)
+{
+  int s;
+
+  if ((s = socket(PF_INET, SOCK_STREAM, 0)) == -1) {
+      return -1;
   }
 
 #ifdef AC_THREADED
-  return startPollThread();
+  /* a poll thread which is being stopped must not get a socket which
+     stopPollThread has not shut down */
+  if (ps->socketLock) acMutexLock(ps->socketLock);
+  if (TR_QUIT == ps->threadRequest) {
+    CLOSESOCKET(s);
+    if (ps->socketLock) acMutexUnlock(ps->socketLock);
+    return -1;
+  }
+  ps->socket = s;
+  if (ps->socketLock) acMutexUnlock(ps->socketLock);
 #else
+  ps->socket = s;
+#endif
+
+  /* a large kernel buffer absorbs the blocks which arrive while the poll
+     thread is busy, the Recorder only sends data so Nagle only delays our
+     acknowledgements */
+  {
+    int rcvbuf = RDA_SOCKET_BUFFER;
+    int nodelay = 1;
+    setsockopt(ps->socket, SOL_SOCKET, SO_RCVBUF, (const char *)&rcvbuf, sizeof(rcvbuf));
+    setsockopt(ps->socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+  }
+
+  /* let the kernel stamp the time of arrival on the received data */
+  ps->reader.kernelStamps = 0;
+#ifdef SO_TIMESTAMPNS
+  {
+    int on = 1;
+    if (0 == setsockopt(ps->socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on))) {
+      ps->reader.kernelStamps = 1;
+    }
+  }
+#endif
+
   return 0;
+}
+
+/*
+  Closes ps->socket. The poll thread holds socketLock for it, see
+  stopPollThread.
+*/
+static void closeSocket(struct brainserverSession *ps)
+{
+#ifdef AC_THREADED
+  if (ps->socketLock) acMutexLock(ps->socketLock);
+  CLOSESOCKET(ps->socket);
+  if (ps->socketLock) acMutexUnlock(ps->socketLock);
+#else
+  CLOSESOCKET(ps->socket);
 #endif
 }
 
+/*
+  frees the session, the poll thread must not be running
+*/
+static void freeSession(struct brainserverSession *ps)
+{
+  if (!ps) return;
+
+  CLOSESOCKET(ps->socket);
+  rdaReaderFree(&ps->reader);
+#ifdef AC_THREADED
+  headerFIFOdestroy(&ps->fifo);
+  recorderDestroy(ps->recorder);
+#endif
+  if (ps->host) free(ps->host);
+  free(ps);
+}
+
 int DetermineElementSize(int nType)
 {    
     switch (nType) {
@@ -221,19 +507,83 @@ int DetermineElementSize(int nType)
         default:
             mexErrMsgTxt("Unknown packet type");
     }
+    return 0;
+}
+
+/*
+  The type of the values in a data message, see ELEMENT_INT16.
+*/
+int DetermineElementType(int nType)
+{
+    switch (nType) {
+        case 2:
+            return ELEMENT_INT16;
+        case 4:
+#ifdef RDA_INT32_DATA
+            return ELEMENT_INT32;
+#else
+            return ELEMENT_FLOAT32;
+#endif
+        default:
+            return 0;
+    }
+}
+
+/*
+  reading data
+*/
+
+/*
+  Makes sure that the buffers of pData can take nPoints samples, nMarkers
+  markers and nBlocks blocks. Returns -1 if we are out of memory.
+*/
+static int reserveAcquiredData(struct acquiredData *pData, ULONG dataSize, ULONG nMarkers,
+                               ULONG nBlocks)
+{
+  if (dataSize > pData->dataSize) {
+    char *data = (char *)realloc(pData->data, dataSize);
+    if (!data) return -1;
+    pData->data = data;
+    pData->dataSize = dataSize;
+  }
+  if (nMarkers > pData->markerSize) {
+    struct headerFIFOMarker *markers = (struct headerFIFOMarker *)
+      realloc(pData->markers, nMarkers * sizeof(struct headerFIFOMarker));
+    if (!markers) return -1;
+    pData->markers = markers;
+    pData->markerSize = nMarkers;
+  }
+  if (nBlocks > pData->blockSize) {
+    struct acquiredBlock *blocks = (struct acquiredBlock *)
+      realloc(pData->blocks, nBlocks * sizeof(struct acquiredBlock));
+    if (!blocks) return -1;
+    pData->blocks = blocks;
+    pData->blockSize = nBlocks;
+  }
+  return 0;
 }
 
+
+void freeAcquiredData(struct acquiredData *pData)
+{
+  if (pData->data) free(pData->data);
+  if (pData->markers) free(pData->markers);
+  if (pData->blocks) free(pData->blocks);
+  memset(pData, 0, sizeof(struct acquiredData));
+}
+
+
 /*
   reading data
+
+  The data is copied to the buffers of pData, which are reused by the
+  next call.
 */
 
-int getData(struct RDA_MessageData **pMsgData, int *blocksize,
-        int lastBlock, ULONG nChannels, int *pElementSize)
+int getData(struct brainserverSession *ps, struct acquiredData *pData, ULONG nChannels)
  {
-    int nResult;
-    
 #ifndef AC_THREADED
-    int failed, waiting;
+    int failed, waiting, nResult;
 
     /* read messages till we get a data message */
     failed = 0;
@@ -242,15 +592,51 @@ int getData(struct RDA_MessageData **pMsgData, int *blocksize,
     while (waiting) {
         struct RDA_MessageHeader *pHeader = 0;
 
-        nResult = getServerMessage(brainserver_socket, &pHeader);
+        nResult = getServerMessage(ps, &pHeader);
         if (nResult > 0) {
             if (pHeader->nType == 2 || pHeader->nType == 4) {
-                *pMsgData = (struct RDA_MessageData*)pHeader;
-                if ((*pMsgData)->nBlock != lastBlock) {
-                    pHeader = 0;
+                struct RDA_MessageData *pmd = (struct RDA_MessageData*)pHeader;
+
+                /* a malformed block is skipped like a duplicate */
+                if (headerFIFOcheckBlock(pmd, nChannels, DetermineElementSize(pHeader->nType)) == 0
+                    && (!ps->haveBlock || pmd->nBlock != ps->lastBlock)) {
+                    struct RDA_Marker *pma;
+                    ULONG m, len;
+
+                    ps->lastBlock = pmd->nBlock;
+                    ps->haveBlock = 1;
+
+                    pData->elementSize = DetermineElementSize(pHeader->nType);
+                    pData->elementType = DetermineElementType(pHeader->nType);
+                    pData->nBlock = pmd->nBlock;
+                    pData->nPoints = pmd->nPoints;
+                    pData->nMarkers = pmd->nMarkers;
+                    pData->nMissing = 0;
+                    pData->nOverflow = 0;
+                    pData->nSpilled = 0;
+                    len = pData->elementSize * nChannels * pmd->nPoints;
+                    if (reserveAcquiredData(pData, len, pmd->nMarkers, 1) != 0) return -1;
+                    memcpy(pData->data, pmd->nData, len);
+                    pData->nBlocks = 1;
+                    pData->blocks[0].nBlock = pmd->nBlock;
+                    pData->blocks[0].endPos = pmd->nPoints;
+                    pData->blocks[0].arrival = ps->reader.recvTime;
+
+                    pma = (struct RDA_Marker *)((char *)pmd->nData + len);
+                    for (m = 0; m < pmd->nMarkers; m++) {
+                      struct headerFIFOMarker *pfm = pData->markers + m;
+                      len = pma->nSize - (ULONG)(pma->sTypeDesc - (char *)pma);
+                      if (len > FIFO_MARKER_DESC_LEN - 2) len = FIFO_MARKER_DESC_LEN - 2;
+                      pfm->nPosition = pma->nPosition;
+                      pfm->nPoints = pma->nPoints;
+                      pfm->nChannel = pma->nChannel;
+                      memcpy(pfm->sTypeDesc, pma->sTypeDesc, len);
+                      pfm->sTypeDesc[len] = 0;
+                      pfm->sTypeDesc[len + 1] = 0;
+                      pma = (struct RDA_Marker *)((char *)pma + pma->nSize);
+                    }
                     waiting = 0;
                 }
-                *pElementSize = DetermineElementSize(pHeader->nType);
             }
             else if(pHeader->nType == 3) { /* Stop Signal */
                 mexWarnMsgTxt("transmission was stopped\n");
@@ -263,126 +649,280 @@ int getData(struct RDA_MessageData **pMsgData, int *blocksize,
             failed = 1;
             waiting = 0;
         }
-        if (pHeader) free(pHeader);
     }
 
     if (failed) {
-        CLOSESOCKET(brainserver_socket);
+        CLOSESOCKET(ps->socket);
         return -1;
     }
     else
         return 0;
 #else /* read out data from the thread */
 
-    nResult = beginFIFO();
-    if(nResult == -1) {
-       printf("Thread not running\n");
-       printThreadState();
-       return -1;
-    }
-    else {
-      /* Traverser the FIFO two times:
-       * 1) count Points and Markers
-       * 2) concat everything
-       */
-        struct RDA_MessageHeader *pHeader;
-        struct headerFIFONode *n;
-        struct RDA_MessageData *pmd;
-
-        /* count everything */
-        int nPoints = 0;
-        int nMarkers = 0;
-        int nBlock = 0;
-
-        int m;
-
-        int structSize = sizeof(struct RDA_MessageData);
-	/*  - sizeof(short) - sizeof(struct RDA_Marker); */
-        int markerOffset = 0;
-
-        if (fifo.last)
-            *pElementSize = DetermineElementSize(fifo.last->payload->nType);
-        else
-            *pElementSize = 2;
-
-        for(n = fifo.last; n; n = n->prev) {
-            pHeader = n->payload;
-            if(pHeader->nType == 2 || pHeader->nType == 4) {
-                pmd = (struct RDA_MessageData*)pHeader;
-                nPoints += pmd->nPoints;
-                *blocksize = pmd->nPoints;
-                nMarkers += pmd->nMarkers;        
-                nBlock = pmd->nBlock;
-
-                structSize += *pElementSize * nChannels * pmd->nPoints;
-                for(m = 0; m < pmd->nMarkers; m++) {
-                    struct RDA_Marker *pma = getMarker(pmd, nChannels, m, *pElementSize);
-                    structSize += pma->nSize;
-                }
-            }
-        }
+    /* The poll thread keeps on receiving while we drain the ring. We
+     * take every block which was published up to now. The record of the
+     * last block tells us how many samples and markers that are, so the
+     * data is copied in one go. If the thread has stopped we still hand
+     * out the data it left in the ring before we report the error.
+     */
+    struct headerFIFO *pf = &ps->fifo;
+    ULONG nPoints, nMarkers, nBlocks;
+    int running = (ps->threadStatus == TS_RUNNING 
+                   || ps->threadStatus == TS_RECONNECTING);
+
+    headerFIFObeginRead(pf);
+    nPoints = headerFIFOavailable(pf, &nMarkers, &nBlocks);
+    if (!running && 0 == nBlocks) {
+        headerFIFOendRead(pf);
+        printf("Thread not running\n");
+        printThreadState(ps);
+        return -1;
+    }
 
-        /* allocate a message structure of appropriate size */
-        *pMsgData = malloc(structSize);
-        if(!*pMsgData) {
-            printf("Out of Memory!\n");
-            finishedFIFO();
-            return -1;
-        }
-        
-        (*pMsgData)->nBlock = nBlock;
-        (*pMsgData)->nPoints = nPoints;
-        (*pMsgData)->nMarkers = nMarkers;
-
-        /* Now collect the data */
-        {
-            char *pdst = (char*)(*pMsgData)->nData;
-            struct RDA_Marker *mdst = 
-                (struct RDA_Marker *)(pdst + *pElementSize * nChannels * nPoints);
-
-            while(pHeader = headerFIFOpop(&fifo)) {
-                if(pHeader->nType == 2 || pHeader->nType == 4) {
-                    int psize;
-                    pmd = (struct RDA_MessageData*)pHeader;
-
-                    psize = *pElementSize * nChannels * pmd->nPoints;
-                    memcpy(pdst, pmd->nData, psize);
-                    pdst += psize;
+    pData->elementSize = pf->elementSize ? pf->elementSize : 2;
+    pData->elementType = DetermineElementType(pf->messageType ? pf->messageType : 2);
+    pData->nPoints = nPoints;
+    pData->nMarkers = nMarkers;
+    pData->nMissing = 0;
+    pData->nOverflow = pf->overflowBlocks - ps->overflowRead;
+    ps->overflowRead += pData->nOverflow;
+    pData->nSpilled = pf->spilledBlocks - ps->spilledRead;
+    ps->spilledRead += pData->nSpilled;
+    pData->nBlocks = 0;
+
+    if (reserveAcquiredData(pData, pData->elementSize * nChannels * nPoints, nMarkers, nBlocks) != 0) {
+        headerFIFOendRead(pf);
+        printf("Out of Memory!\n");
+        return -1;
+    }
 
-                    for (m = 0; m < pmd->nMarkers; m++) {
-                        struct RDA_Marker *pm = getMarker(pmd, nChannels, m, *pElementSize);
-                        pm->nPosition += markerOffset;
-                        memcpy(mdst, pm, pm->nSize);
-                        mdst = (struct RDA_Marker*)((char*)mdst + pm->nSize);
-                    }
-                    markerOffset += pmd->nPoints;
-                }
-                free(pHeader);
+    if (nBlocks > 0) {
+        const struct headerFIFOBlock *pfb = headerFIFOblock(pf, nBlocks - 1);
+        double now = monotonicTime();
+        ULONG b;
+
+        pData->nBlock = pfb->nBlock;
+        pData->nMissing = pfb->missing - ps->missingRead;
+        ps->missingRead = pfb->missing;
+
+        /* how long did the blocks wait for us? */
+        for (b = 0; b < nBlocks; b++) {
+            const struct headerFIFOBlock *pb = headerFIFOblock(pf, b);
+            double latency = now - pb->arrival;
+            double edge = 1.0;
+            int bin = 0;
+
+            pData->blocks[b].nBlock = pb->nBlock;
+            pData->blocks[b].endPos = pb->endPos - pf->readPos;
+            pData->blocks[b].arrival = pb->arrival;
+
+            while (bin < STATS_LATENCY_BINS - 1 && latency >= edge) {
+                bin++;
+                edge *= 2.0;
             }
+            ps->drainLatency[bin]++;
         }
+        pData->nBlocks = nBlocks;
+    }
+
+    headerFIFOread(pf, pData->data, nPoints);
+    headerFIFOreadMarkers(pf, pData->markers, nMarkers);
+    headerFIFOconsume(pf, nPoints, nMarkers, nBlocks);
+    headerFIFOendRead(pf);
+
+    return 0;
+#endif
+}
+
+
+/*
+  Waits until at least nPoints samples can be read or timeout ms have
+  passed. Returns at once if the connection is not running, during a
+  reconnect the caller gets what is there and the reconnecting status.
+  Every block the poll thread stores sets the data event, so we wake up
+  right after the block which completes the request, and so does a lost
+  connection.
+  Returns the number of samples which can be read.
+*/
+
+ULONG waitForData(struct brainserverSession *ps, ULONG nPoints, ULONG timeout)
+{
+#ifdef AC_THREADED
+    double deadline = monotonicTime() + timeout;
+    ULONG nAvailable;
+
+    while ((nAvailable = headerFIFOavailable(&ps->fifo, NULL, NULL)) < nPoints
+           && ps->threadStatus == TS_RUNNING) {
+        double left = deadline - monotonicTime();
+
+        if (left <= 0.0) break;
+        acEventWait(ps->dataEvent, (unsigned long)left + 1);
     }
-    finishedFIFO();
 
+    return nAvailable;
+#else
+    /* getData waits for the next block anyway */
     return 0;
 #endif
 }
 
 
 /*
-  closing the connection
+  The state of the connection, one of the CS_ values
+*/
+
+int getConnectionStatus(struct brainserverSession *ps)
+{
+#ifdef AC_THREADED
+    switch (ps->threadStatus) {
+    case TS_INIT:
+    case TS_RUNNING: return CS_CONNECTED;
+    case TS_RECONNECTING: return CS_RECONNECTING;
+    default: return CS_DISCONNECTED;
+    }
+#else
+    return ps->socket >= 0 ? CS_CONNECTED : CS_DISCONNECTED;
+#endif
+}
+
+
+void setReconnect(struct brainserverSession *ps, int reconnect)
+{
+    ps->reconnect = reconnect;
+}
+
+
+void setRecorder(struct brainserverSession *ps, struct rdaRecorder *pRecorder)
+{
+#ifdef AC_THREADED
+    /* the poll thread picks it up with the next block */
+    ps->recorder = pRecorder;
+#else
+    recorderDestroy(pRecorder);
+#endif
+}
+
+
+void setThreadOptions(struct brainserverSession *ps, const struct threadOptions *po)
+{
+#ifdef AC_THREADED
+    if (po->priority > 0) {
+#ifdef AC_REACTOR
+        ps->priorityResult = ioReactorSetPriority(AC_SCHED_RR == po->policy ? SCHED_RR : SCHED_FIFO,
+                                                  po->priority);
+#else
+        ps->priorityResult = acThreadSetPriority(ps->thread, po->policy, po->priority);
+#endif
+    }
+
+    if (po->cpu >= 0) {
+#ifdef AC_REACTOR
+        ps->affinityResult = ioReactorSetAffinity(po->cpu);
+#else
+        ps->affinityResult = acThreadSetAffinity(ps->thread, po->cpu);
+#endif
+    }
+
+    if (po->lockMemory) {
+        ps->lockResult = headerFIFOlock(&ps->fifo);
+        if (0 == ps->lockResult && ps->recorder) {
+            ps->lockResult = recorderLockMemory(ps->recorder);
+        }
+    }
+#endif
+}
+
+
+/*
+  Copies the telemetry counters of the connection. The counters of the
+  poll thread are read while it is running, so they may be a block
+  apart from each other.
+*/
+
+void getStats(struct brainserverSession *ps, struct brainserverStats *pStats)
+{
+    memset(pStats, 0, sizeof(struct brainserverStats));
+
+    pStats->bytesReceived = ps->reader.nBytes;
+#ifdef AC_THREADED
+    pStats->blocksReceived = ps->fifo.pushedBlocks + ps->fifo.overflowBlocks;
+    pStats->blocksDropped = ps->fifo.overflowBlocks;
+    pStats->samplesDropped = ps->fifo.overflowSamples;
+    pStats->duplicateBlocks = ps->fifo.duplicateBlocks;
+    pStats->badBlocks = ps->fifo.badBlocks;
+    pStats->gaps = ps->fifo.gapCount;
+    pStats->gapSamples = ps->fifo.gapSamples;
+    pStats->reconnects = ps->reconnects;
+    pStats->highWater = ps->fifo.highWater;
+    pStats->capacity = ps->fifo.capacity;
+    pStats->overflowPolicy = ps->fifo.policy;
+    pStats->droppedOldest = ps->fifo.droppedOldest;
+    pStats->blocksSpilled = ps->fifo.spilledBlocks;
+    pStats->spillWaiting = ps->fifo.spillBlocks;
+    memcpy(pStats->drainLatency, ps->drainLatency, sizeof(ps->drainLatency));
+    if (ps->recorder) {
+        struct recorderStats rs;
+
+        recorderGetStats(ps->recorder, &rs);
+        pStats->recording = 1;
+        pStats->recordBytes = rs.bytesWritten;
+        pStats->recordBlocks = rs.blocksWritten;
+        pStats->recordDropped = rs.blocksDropped;
+        pStats->recordFiles = rs.files;
+        pStats->recordError = rs.error;
+    }
+    pStats->priorityResult = ps->priorityResult;
+    pStats->affinityResult = ps->affinityResult;
+    pStats->lockResult = ps->lockResult;
+#else
+    pStats->priorityResult = OPTION_NOT_SET;
+    pStats->affinityResult = OPTION_NOT_SET;
+    pStats->lockResult = OPTION_NOT_SET;
+#endif
+}
+
+
+/*
+  A clock for measuring time differences in ms, which is not changed by
+  adjustments of the system time.
+*/
+
+double monotonicTime()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency = { 0 };
+    LARGE_INTEGER counter;
+
+    if (0 == frequency.QuadPart) QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart * 1000.0 / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+#endif
+}
+
+
+/*
+  closing the connection, the session is freed
 */
 
-void closeConnection()
+void closeConnection(struct brainserverSession *ps)
 {
+    if (!ps) return;
+
 #ifdef AC_THREADED
-    stopPollThread();
+    /* a thread which does not stop keeps the session */
+    if (stopPollThread(ps) != 0) return;
 #endif
     
-    if (brainserver_socket>0) {
-      CLOSESOCKET(brainserver_socket);
-    } else {
-      mexPrintf("socket [%d] closed already\n", brainserver_socket);
+    if (ps->socket<0) {
+      mexPrintf("socket [%d] closed already\n", ps->socket);
     }
+
+    freeSession(ps);
 }
 
 
@@ -392,79 +932,178 @@ Auxillary functions
 
 ----------------------------------------------------------------------*/
 
+/*
+  Buffered reading of the messages.
+
+  The socket is read in large chunks into the buffer of the reader and the
+  messages are framed in place. One recv usually delivers several RDA
+  messages, which are then handed out without touching the socket again.
+  The buffer only grows if a message does not fit into it, so there is no
+  allocation per message.
+*/
+
+void rdaReaderReset(struct rdaReader *pr)
+{
+  pr->start = 0;
+  pr->end = 0;
+}
+
+
+void rdaReaderFree(struct rdaReader *pr)
+{
+  if (pr->buffer) free(pr->buffer);
+  pr->buffer = 0;
+  pr->size = 0;
+  rdaReaderReset(pr);
+}
+
+
+/*
+  One recv into the free space of the buffer, which sets recvTime. With
+  kernel timestamps the data is read with recvmsg. The stamp is in the
+  time of the system clock, it is moved to the monotonic clock by its
+  age.
+*/
+static int readSocket(struct rdaReader *pr, int sock)
+{
+#ifdef SO_TIMESTAMPNS
+  if (pr->kernelStamps) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+      char buffer[CMSG_SPACE(sizeof(struct timespec))];
+      struct cmsghdr align;
+    } control;
+    int nResult;
+
+    iov.iov_base = pr->buffer + pr->end;
+    iov.iov_len = pr->size - pr->end;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    nResult = recvmsg(sock, &msg, 0);
+    if (nResult <= 0) return nResult;
+
+    pr->recvTime = monotonicTime();
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (SOL_SOCKET == cmsg->cmsg_level && SCM_TIMESTAMPNS == cmsg->cmsg_type) {
+        struct timespec stamp, now;
+        double age;
+
+        memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+        clock_gettime(CLOCK_REALTIME, &now);
+        age = (double)(now.tv_sec - stamp.tv_sec) * 1000.0
+          + (double)(now.tv_nsec - stamp.tv_nsec) / 1000000.0;
+        if (age > 0) pr->recvTime -= age;
+      }
+    }
+    return nResult;
+  }
+#endif
+  {
+    int nResult = recv(sock, pr->buffer + pr->end, pr->size - pr->end, 0);
+    if (nResult > 0) pr->recvTime = monotonicTime();
+    return nResult;
+  }
+}
+
+
+/*
+  Frames the next message in the buffer. Returns 1 and the message if it
+  is complete, -1 if the data makes no sense. Otherwise 0 is returned and
+  the buffer has room for the rest of the message, so readSocket can be
+  called.
+*/
+static int rdaReaderNext(struct rdaReader *pr, struct RDA_MessageHeader** ppHeader)
+{
+  ULONG nAvail = (ULONG)(pr->end - pr->start);
+  ULONG nRequired = sizeof(struct RDA_MessageHeader);
+
+  /* is a complete message in the buffer? */
+  if (nAvail >= nRequired) {
+    struct RDA_MessageHeader *pHeader 
+      = (struct RDA_MessageHeader *)(pr->buffer + pr->start);
+
+    /* nSize comes from the server, a value out of range means a broken
+       stream and the connection is dropped */
+    if (pHeader->nSize < sizeof(struct RDA_MessageHeader)
+        || pHeader->nSize > RDA_MAX_MESSAGE_SIZE) return -1;
+    nRequired = pHeader->nSize;
+    if (nAvail >= nRequired) {
+      *ppHeader = pHeader;
+      pr->start += (int)nRequired;
+      return 1;
+    }
+  }
+
+  /* move the incomplete message to the front and make room for it */
+  if (pr->start > 0) {
+    memmove(pr->buffer, pr->buffer + pr->start, nAvail);
+    pr->start = 0;
+    pr->end = (int)nAvail;
+  }
+  if (nRequired > (ULONG)pr->size || !pr->buffer) {
+    size_t size = pr->size ? (size_t)pr->size : RDA_READER_SIZE;
+    char *buffer;
+
+    while (size < nRequired) size *= 2;
+    buffer = (char *)realloc(pr->buffer, size);
+    if (!buffer) return -1;
+    pr->buffer = buffer;
+    pr->size = (int)size;
+  }
+
+  return 0;
+}
+
+
 /* Get message from server, if available                               
    returns 0 if no data, -1 if error, -2 if server closed,  > 0 if ok.
+   The returned message points into the read buffer and is valid until
+   the next call of this function.
    e this fcn is slightly adapted from Henning Nordholz (BrainVision)    */
-int getServerMessage(int sock, struct RDA_MessageHeader** ppHeader)
+int getServerMessage(struct brainserverSession *ps, struct RDA_MessageHeader** ppHeader)
 {
-  /* this function basically reads an RDA_MessageHeader, 
-     and then the rest specified 
-   */
+  struct rdaReader *pr = &ps->reader;
+  int sock = ps->socket;
   struct timeval tv; 
   fd_set readfds;
-  struct RDA_MessageHeader header;
-  char* pData;
-  int nResult, nReq;
-  bool bFirstRecv;
-  
-  /* wait for something to happen on the socket or timeout */
-  tv.tv_sec = 5; tv.tv_usec = 0;    /* 5 s. */
-  FD_ZERO(&readfds);
-  FD_SET(sock, &readfds);
-  nResult = select(sock+1, &readfds, NULL, NULL, &tv);
-  if (nResult != 1) return nResult;
-
-  pData = (char*)&header;
-  bFirstRecv = true;
-  nReq = sizeof(header);
-  
-  /* Read out a whole RDA_MessageHeader structure */
-  while (nReq > 0) 
-  {
-    nResult = recv(sock, pData, nReq, 0);
-
-    /* When select() succeeds and recv() returns 0 
-       the server has closed the connection.        */
-    if (nResult == 0 && bFirstRecv)  return -2;
+  int nResult;
 
-    bFirstRecv = false;
-
-    /* still some bytes left? */
-    if (nResult < 0) return nResult;
-    nReq -= nResult;
-    pData += nResult;
-  }
+  while (1) {
+    nResult = rdaReaderNext(pr, ppHeader);
+    if (nResult != 0) return nResult;
 
-  /* copy the header to ppHeader */
-  *ppHeader = (struct RDA_MessageHeader *)malloc(header.nSize);
-  if (!*ppHeader) return -1;
+    /* wait for something to happen on the socket or timeout */
+    tv.tv_sec = RDA_RECEIVE_TIMEOUT / 1000; tv.tv_usec = 0;
+    FD_ZERO(&readfds);
+    FD_SET(sock, &readfds);
+    nResult = select(sock+1, &readfds, NULL, NULL, &tv);
+    if (nResult != 1) return nResult;
 
-  memcpy(*ppHeader, &header, sizeof(header));
+    /* read as much as fits into the buffer */
+    nResult = readSocket(pr, sock);
 
-  /* read the actual data */
-  pData = (char*)*ppHeader + sizeof(header);
+    /* When select() succeeds and recv() returns 0 
+       the server has closed the connection.        */
+    if (nResult == 0) return -2;
+    if (nResult < 0) return nResult;
 
-  nReq = header.nSize - sizeof(header);
-  while (nReq > 0)
-  {
-    nResult = recv(sock, pData, nReq, 0);
-    if (nResult < 0) {
-      free(*ppHeader);
-      *ppHeader = 0;
-      return nResult;
-    }
-    nReq -= nResult;
-    pData += nResult;
+    pr->nBytes += nResult;
+    pr->end += nResult;
   }
-
-  return 1;
 }
 
 
 struct RDA_Marker *getMarker(struct RDA_MessageData *pmd, 
 			     int nChannels, int idx, int ElementSize)
 {
-    if (0 <= idx && idx < pmd->nMarkers) {
+    if (0 <= idx && (ULONG)idx < pmd->nMarkers
+        && headerFIFOcheckBlock(pmd, (ULONG)nChannels, ElementSize) == 0) {
         struct RDA_Marker *pm 
 	  = (struct RDA_Marker *)((char*)pmd->nData + ElementSize * pmd->nPoints * nChannels);
         for(;idx; idx--) {
@@ -499,212 +1138,430 @@ Threading
 
 #ifdef AC_THREADED
 
+void printThreadState(struct brainserverSession *ps)
+{
+    printf("threadStatus: ");
+    switch(ps->threadStatus) {
+    case TS_INIT: printf("TS_INIT"); break;
+    case TS_RUNNING: printf("TS_RUNNING"); break;
+    case TS_RECONNECTING: printf("TS_RECONNECTING"); break;
+    case TS_ERROR: printf("TS_ERROR"); break;
+    case TS_STOPPED: printf("TS_STOPPED"); break;
+    default: printf("UNKNOWN!!!");
+    };
+
+    printf(" threadRequest: ");
+    switch(ps->threadRequest) {
+    case TR_CLEAR: printf("TR_CLEAR"); break;
+    case TR_QUIT: printf("TR_QUIT"); break;
+    default: printf("UNKNOWN!!!");
+    }
+    printf("\n");
+}
+
+
 /*
-  Global variables
+  Processes one message from the server: data blocks are pushed into the
+  ring. Returns -1 if the server stopped the transmission.
 */
-enum {
-    TS_INIT,
-    TS_RUNNING,
-    TS_WAITING,
-    TS_ERROR,
-    TS_STOPPED
-}  threadStatus = TS_INIT;
-
+static int handleMessage(struct brainserverSession *ps, struct RDA_MessageHeader *header)
+{
+  if (header->nType == 2 || header->nType == 4) {
+    struct RDA_MessageData *pmd = (struct RDA_MessageData *)header;
+    ULONG block = pmd->nBlock;
+
+    if (headerFIFOcheckBlock(pmd, ps->fifo.nChannels, DetermineElementSize(header->nType)) != 0) {
+      /* its block number and size can not be trusted either */
+      ps->fifo.badBlocks++;
+    } else if (!ps->haveBlock || block != ps->lastBlock) {
+      /* the server numbers its blocks, everything we did not get in
+         between is missing. If the numbers start again the server
+         was restarted and we can not tell how much we missed. */
+      if (ps->haveBlock && block > ps->lastBlock + 1) {
+        ps->fifo.gapSamples += (block - ps->lastBlock - 1) * pmd->nPoints;
+        ps->fifo.gapCount++;
+      }
+      if (headerFIFOpush(&ps->fifo, pmd, DetermineElementSize(header->nType),
+                         ps->reader.recvTime)) {
+        acEventSet(ps->dataEvent);
+      }
+      if (ps->recorder) recorderPush(ps->recorder, pmd);
+      ps->lastBlock = block;
+      ps->haveBlock = 1;
+    } else {
+      ps->fifo.duplicateBlocks++;
+    }
+  }
+  else if(header->nType == 3) { /* stopped */
+    /*printf("Thread: Read STOP.\n");*/
+    return -1;
+  }
 
-enum {
-    TR_CLEAR,
-    TR_WAIT,
-    TR_QUIT
-} threadRequest = TR_CLEAR;
+  return 0;
+}
 
 
-HANDLE pollThreadWait, pollRequestWait;
+#ifdef AC_REACTOR
 
+/*
+  The sessions are served by the reactor thread. The socket is
+  non-blocking, sessionEvent is called whenever it can be read and when
+  the timer of the session expires. The timer detects a silent server
+  while receiving and paces the attempts while reconnecting. Nothing in
+  here may block, the other sessions are served by the same thread.
+*/
 
-HANDLE threadHandle;
+static void sessionEvent(void *context, int events);
 
+int startPollThread(struct brainserverSession *ps)
+{
+    ps->dataEvent = acEventCreate();
+    ps->threadRequest = TR_CLEAR;
+    ps->ioState = RS_RECEIVING;
+    ps->threadStatus = TS_RUNNING;
+
+    fcntl(ps->socket, F_SETFL, fcntl(ps->socket, F_GETFL) | O_NONBLOCK);
+    ps->ioId = ioReactorAdd(ps->socket, IO_READABLE, sessionEvent, ps);
+    if (ps->ioId < 0) {
+        ps->threadStatus = TS_ERROR;
+        return -1;
+    }
+    ioReactorSetTimer(ps->ioId, ioReactorTime() + RDA_RECEIVE_TIMEOUT);
 
+    return 0;
+}
 
-/*
-  general thread control
-*/
 
-int startPollThread()
+int stopPollThread(struct brainserverSession *ps)
 {
-  /* Create some waiting threads */
-    pollThreadWait = CreateEvent(NULL, FALSE, FALSE, "pollThreadWait");
-    pollRequestWait = CreateEvent(NULL, FALSE, FALSE, "pollRequestWait");
+    ps->threadRequest = TR_QUIT;
+    if (ps->ioId >= 0) ioReactorRemove(ps->ioId);
+    ps->ioId = -1;
+    ps->threadStatus = TS_STOPPED;
 
-    threadRequest = TR_CLEAR;
-    threadHandle = CreateThread(NULL, 0, &pollThread, NULL, 0, NULL);
+    acEventClose(ps->dataEvent);
 
-    WaitForSingleObject(pollRequestWait, INFINITE);
+    return 0;
+}
 
-    if (threadStatus != TS_RUNNING)
-        return -1;
-    else    
-        return 0;
+
+/*
+  Closes the socket. Without reconnect the session is done, otherwise
+  the next attempt is made after retryDelay ms, which doubles with every
+  failed attempt.
+*/
+static void sessionRetry(struct brainserverSession *ps)
+{
+  if (RS_RECEIVING == ps->ioState) ps->retryDelay = RECONNECT_MIN_DELAY;
+  ioReactorModify(ps->ioId, -1, 0);
+  CLOSESOCKET(ps->socket);
+
+  if (!ps->reconnect) {
+    printf("Thread: connection lost. Stopping\n");
+    ps->threadStatus = TS_ERROR;
+    ioReactorSetTimer(ps->ioId, 0.0);
+    acEventSet(ps->dataEvent);
+    return;
+  }
+
+  ps->threadStatus = TS_RECONNECTING;
+  acEventSet(ps->dataEvent);
+  ps->ioState = RS_BACKOFF;
+  ioReactorSetTimer(ps->ioId, ioReactorTime() + ps->retryDelay);
+  ps->retryDelay *= 2;
+  if (ps->retryDelay > RECONNECT_MAX_DELAY) ps->retryDelay = RECONNECT_MAX_DELAY;
 }
- 
 
-int stopPollThread()
+
+/*
+  Starts a non-blocking connect.
+*/
+static void sessionConnect(struct brainserverSession *ps)
 {
-    int numele = 0;
-    int count;
+  if (openSocket(ps) != 0) {
+    sessionRetry(ps);
+    return;
+  }
+  fcntl(ps->socket, F_SETFL, fcntl(ps->socket, F_GETFL) | O_NONBLOCK);
 
-    struct RDA_MessageHeader *header;
+  if (connect(ps->socket, (struct sockaddr *)&ps->addr, sizeof(struct sockaddr)) != 0
+      && EINPROGRESS != errno) {
+    sessionRetry(ps);
+    return;
+  }
 
-    for(count = 2; (count > 0) && (threadStatus != TS_STOPPED); count --) {
-        threadRequest = TR_QUIT;
-        WaitForSingleObject(pollRequestWait, 500);
-    }
+  ps->ioState = RS_CONNECTING;
+  ioReactorModify(ps->ioId, ps->socket, IO_WRITABLE);
+  ioReactorSetTimer(ps->ioId, ioReactorTime() + RDA_RECEIVE_TIMEOUT);
+}
 
-    /* printf("Terminating thread!\n");*/
 
-    if (!count) TerminateThread(threadHandle, 0);
+/*
+  The start message after a reconnect. The data in the ring and the
+  filters depend on the layout, so the server must send the same one.
+  Returns -1 if it does not.
+*/
+static int sessionStarted(struct brainserverSession *ps, struct RDA_MessageHeader *header)
+{
+  struct RDA_MessageStart *pms = (struct RDA_MessageStart *)header;
+
+  if (pms->nChannels != ps->nChannels || pms->dSamplingInterval != ps->dSamplingInterval) {
+    printf("Thread: server changed the channels or the sampling rate. Stopping\n");
+    ioReactorModify(ps->ioId, -1, 0);
+    ioReactorSetTimer(ps->ioId, 0.0);
+    CLOSESOCKET(ps->socket);
+    ps->threadStatus = TS_ERROR;
+    acEventSet(ps->dataEvent);
+    return -1;
+  }
 
-    CloseHandle(pollThreadWait);
-    CloseHandle(pollRequestWait);
+  ps->reconnects++;
+  ps->ioState = RS_RECEIVING;
+  ps->threadStatus = TS_RUNNING;
+  return 0;
+}
 
-    while(header = headerFIFOpop(&fifo)) { free(header); numele++; }; 
 
-    if (threadStatus != TS_STOPPED)
-        return -1;
-    else    
-        return 0;
+/*
+  Processes the complete messages in the read buffer. Returns 0 if more
+  data is needed, -1 if the connection is lost or stopped and -2 if the
+  session is done.
+*/
+static int sessionDrain(struct brainserverSession *ps)
+{
+  struct RDA_MessageHeader *header;
+  int nResult;
+
+  while ((nResult = rdaReaderNext(&ps->reader, &header)) > 0) {
+    if (RS_STARTING == ps->ioState) {
+      if (1 == header->nType && sessionStarted(ps, header) != 0) return -2;
+      if (3 == header->nType) return -1;
+    }
+    else if (handleMessage(ps, header) != 0) {
+      return -1;
+    }
+  }
+
+  return nResult;
 }
 
 
-void printThreadState()
+static void sessionEvent(void *context, int events)
 {
-    printf("threadStatus: ");
-    switch(threadStatus) {
-    case TS_INIT: printf("TS_INIT"); break;
-    case TS_RUNNING: printf("TS_RUNNING"); break;
-    case TS_WAITING: printf("TS_WAITING"); break;
-    case TS_ERROR: printf("TS_ERROR"); break;
-    case TS_STOPPED: printf("TS_STOPPED"); break;
-    default: printf("UNKNOWN!!!");
-    };
+  struct brainserverSession *ps = (struct brainserverSession *)context;
+  struct rdaReader *pr = &ps->reader;
+  int nResult;
+
+  switch (ps->ioState) {
+  case RS_BACKOFF:
+    if (!(events & IO_TIMER)) return;
+    if (ps->reconnect) {
+      sessionConnect(ps);
+    } else {
+      sessionRetry(ps);
+    }
+    return;
+
+  case RS_CONNECTING:
+    if (!(events & IO_TIMER)) {
+      int error = 0;
+      socklen_t len = sizeof(error);
+
+      if (0 == getsockopt(ps->socket, SOL_SOCKET, SO_ERROR, &error, &len) && 0 == error) {
+        rdaReaderReset(pr);
+        ps->ioState = RS_STARTING;
+        ioReactorModify(ps->ioId, ps->socket, IO_READABLE);
+        ioReactorSetTimer(ps->ioId, ioReactorTime() + RDA_RECEIVE_TIMEOUT);
+        return;
+      }
+    }
+    sessionRetry(ps);
+    return;
+
+  case RS_RECEIVING:
+  case RS_STARTING:
+    if (events & IO_TIMER) {
+      /* the server has been silent for too long */
+      sessionRetry(ps);
+      return;
+    }
 
-    printf(" threadRequest: ");
-    switch(threadRequest) {
-    case TR_CLEAR: printf("TR_CLEAR"); break;
-    case TR_WAIT: printf("TR_WAIT"); break;
-    case TR_QUIT: printf("TR_QUIT"); break;
-    default: printf("UNKNOWN!!!");
+    /* the messages left in the buffer by connectServer come first, then
+       one read per event, so a busy server can not starve the others */
+    nResult = sessionDrain(ps);
+    if (0 == nResult) {
+      nResult = readSocket(pr, ps->socket);
+      if (nResult < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno)) return;
+      if (nResult > 0) {
+        pr->nBytes += nResult;
+        pr->end += nResult;
+        nResult = sessionDrain(ps);
+        if (0 == nResult) {
+          ioReactorSetTimer(ps->ioId, ioReactorTime() + RDA_RECEIVE_TIMEOUT);
+          return;
+        }
+      } else {
+        nResult = -1;
+      }
     }
-    printf("\n");
+
+    /* closed, stopped or broken */
+    if (-1 == nResult) sessionRetry(ps);
+    return;
+  }
 }
 
+#else /* AC_REACTOR */
 
 /*
-  FIFO access synchronization
-  
-  Call these two functions when you want to access the fifo. The
-  thread will be blocked until endFIFO() is called.
+  general thread control
 */
 
-int beginFIFO()
+int startPollThread(struct brainserverSession *ps)
 {
-  if (threadStatus != TS_RUNNING) {
-    return -1;
-  }
-  else {
-    threadRequest = TR_WAIT;
-    do {
-      WaitForSingleObject(pollRequestWait, 1000);
-      if (threadStatus == TS_ERROR)
-	return -1;
-    } while(threadStatus != TS_WAITING);
-    
+    /* the thread runs from the start, it already has the socket */
+    ps->dataEvent = acEventCreate();
+    ps->quitEvent = acEventCreate();
+    ps->socketLock = acMutexCreate();
+    ps->threadRequest = TR_CLEAR;
+    ps->threadStatus = TS_RUNNING;
+
+    if (ps->dataEvent && ps->quitEvent && ps->socketLock) {
+        ps->thread = acThreadCreate(&pollThread, ps);
+    }
+    if (!ps->thread) {
+        ps->threadStatus = TS_ERROR;
+        return -1;
+    }
+
     return 0;
-  }
 }
+ 
 
-
-int finishedFIFO()
+/*
+  Stops the poll thread. The thread may wait in select, recv or connect
+  or between two attempts to reconnect. The quit event ends the waiting,
+  the shutdown of the socket makes the socket calls return at once.
+*/
+int stopPollThread(struct brainserverSession *ps)
 {
-  if (threadStatus != TS_WAITING) {
-    return -1;
-  }
-  else {
-    SetEvent(pollThreadWait);
-    WaitForSingleObject(pollRequestWait, INFINITE);
+    int result = 0;
+
+    ps->threadRequest = TR_QUIT;
+    if (ps->thread) {
+        acEventSet(ps->quitEvent);
+
+        acMutexLock(ps->socketLock);
+        if (ps->socket >= 0) SHUTDOWNSOCKET(ps->socket);
+        acMutexUnlock(ps->socketLock);
+
+        if (acThreadJoin(ps->thread, POLL_STOP_TIMEOUT) != AC_WAIT_SIGNALED) {
+            /* the thread still uses the session */
+            mexWarnMsgTxt("acquire_bv: the poll thread does not stop.");
+            result = -1;
+        }
+        ps->thread = NULL;
+    }
+    if (result != 0) return result;
+
+    ps->threadStatus = TS_STOPPED;
+    if (ps->dataEvent) acEventClose(ps->dataEvent);
+    if (ps->quitEvent) acEventClose(ps->quitEvent);
+    if (ps->socketLock) acMutexClose(ps->socketLock);
+    ps->dataEvent = ps->quitEvent = NULL;
+    ps->socketLock = NULL;
+
     return 0;
+}
+
+
+/*
+  Reconnects to the server after the connection was lost. Between the
+  attempts we wait RECONNECT_MIN_DELAY ms, doubling up to
+  RECONNECT_MAX_DELAY ms. A quit request ends the waiting at once.
+
+  Returns 0 if we are connected again and -1 if we should stop, because
+  of a quit request or because the server now sends different data.
+*/
+static int reconnectServer(struct brainserverSession *ps)
+{
+  unsigned long delay = RECONNECT_MIN_DELAY;
+  struct RDA_MessageStart *pMsgStart;
+
+  ps->threadStatus = TS_RECONNECTING;
+  acEventSet(ps->dataEvent);
+  closeSocket(ps);
+
+  while (ps->threadRequest != TR_QUIT && ps->reconnect) {
+    acEventWait(ps->quitEvent, delay);
+    if (ps->threadRequest == TR_QUIT) break;
+
+    if (connectServer(ps, &pMsgStart, 0) == IC_OKAY) {
+      /* the data in the ring and the filters depend on the layout */
+      int same = pMsgStart->nChannels == ps->nChannels
+                 && pMsgStart->dSamplingInterval == ps->dSamplingInterval;
+      free(pMsgStart);
+
+      if (!same) {
+        printf("Thread: server changed the channels or the sampling rate. Stopping\n");
+        closeSocket(ps);
+        return -1;
+      }
+
+      ps->reconnects++;
+      ps->threadStatus = TS_RUNNING;
+      return 0;
+    }
+
+    delay *= 2;
+    if (delay > RECONNECT_MAX_DELAY) delay = RECONNECT_MAX_DELAY;
   }
+
+  return -1;
 }
 
 
 /*
   This is the actual thread.
 
-  It polls the server for data and stores it in a doubly linked list.
+  It polls the server for data and copies it into the ring buffer. If the
+  connection is lost and reconnect is set, it connects again.
 */
 
-DWORD WINAPI pollThread(LPVOID lpParameter)
+static int pollThread(void *context)
 {
-  /* keep polling the server and store everything in a FIFO. */
-  /* after each message wait if somebody wants to read out the whole list. */
-  /* in that case wait. Then proceed. */
-  int lastBlock = -1;
+  /* keep polling the server and store everything in the ring. */
+  /* the reader drains the ring concurrently, so we never have to wait. */
+  struct brainserverSession *ps = (struct brainserverSession *)context;
   int result;
   
   struct RDA_MessageHeader *header = 0;
   
-  /*printf("Thread running!\n");*/
-  
-  threadStatus = TS_RUNNING;
-  SetEvent(pollRequestWait);
-
-  while(1) {
+  while (ps->threadRequest != TR_QUIT) {
     /* read a message and push it into the fifo */
     /* only data packets are pushed */
     header = 0;
+    result = getServerMessage(ps, &header);
     
-    result = getServerMessage(brainserver_socket, &header);
-    
-    if (result > 0) {
-      if (header->nType == 2 || header->nType == 4) {
-	int block = ((struct RDA_MessageData *)header)->nBlock;
-
-	if (block != lastBlock) {
-	  headerFIFOpush(&fifo, header);
-	  header = 0;
-	  block = lastBlock;
-	}
-      }
-      else if(header->nType == 3) { /* stopped */
-	/*printf("Thread: Read STOP. Stopping\n");*/
-	threadStatus = TS_ERROR;
-	return -1;
+    if (result <= 0 || handleMessage(ps, header) != 0) {
+      /* connection lost, stopped or shut down by stopPollThread */
+      if (ps->threadRequest == TR_QUIT) break;
+      if (!ps->reconnect || reconnectServer(ps) != 0) {
+        if (ps->threadRequest == TR_QUIT) break;
+        printf("Thread: connection lost. Stopping\n");
+        ps->threadStatus = TS_ERROR;
+        acEventSet(ps->dataEvent);
+        return -1;
       }
-      if (header) free(header);
-    }
-    else {
-      printf("Thread: getServerMessage return <= 0. Stopping\n");
-      threadStatus = TS_ERROR;
-      return -1;
-    }
-    
-    /* If a wait has been requested, signal the waiting thread to poll */
-    /* the fifo and wait for the signal that polling is over. */
-    if (threadRequest == TR_WAIT) {
-      threadStatus = TS_WAITING;
-      SetEvent(pollRequestWait);
-      WaitForSingleObject(pollThreadWait, INFINITE);
-      threadStatus = TS_RUNNING;
-      threadRequest = TR_CLEAR;
-      SetEvent(pollRequestWait);
-    }
-    if (threadRequest == TR_QUIT) {
-      /*printf("Thread is stopped...\n");*/
-      threadStatus = TS_STOPPED;
-      SetEvent(pollRequestWait);
-      return 0;
     }
   }
+
+  ps->threadStatus = TS_STOPPED;
+  acEventSet(ps->dataEvent);
+  return 0;
 }
 
+#endif /* AC_REACTOR */
+
 #endif /* AC_THREADED */
 /* end of brainserver.c */
@@ -6,14 +6,49 @@
 
   This has been written by Mikio Braun, mikio@first.fhg.de
   (c) Fraunhofer FIRST.IDA 2005
+
+  - 2026/10/17 - Jonas Reiter
+                 - All state of a connection (socket, read buffer, ring and
+                   poll thread) lives in a struct brainserverSession, so
+                   several servers can be read at the same time.
+                 - Reconnecting is done by the poll thread.
+                 - Telemetry counters, see getStats.
+                 - waitForData.
+                 - Message type 4 carries float32 values, the type of the
+                   values is handed out in acquiredData.elementType.
+                 - The arrival time of every block is handed out in
+                   acquiredData.blocks. On linux the time is taken from the
+                   kernel timestamp of the socket (SO_TIMESTAMPNS).
+                 - On linux all sessions are served by one epoll thread
+                   (ioreactor.h) instead of a poll thread each, see
+                   AC_REACTOR.
+                 - setRecorder: the data blocks can be recorded to files by
+                   the writer thread of recorder.c.
+                 - The threads and events are the ones of acthreads.h. The
+                   poll thread is stopped by shutting down its socket
+                   instead of being polled and terminated.
+                 - setThreadOptions: real-time priority, cpu and locked
+                   buffers for the thread which receives the data. getStats
+                   reports whether they were applied.
+                 - initConnection takes the size of the ring and the policy
+                   for blocks which do not fit (bufferOptions). getData
+                   counts the blocks which overflowed.
 */
 
 #ifndef BRAINSERVER_H
 #define BRAINSERVER_H
 
 #include "myRDA.h"
+#include "headerfifo.h"
+#include "acthreads.h"
 #include "mex.h"
 
+#ifdef _MSC_VER
+#include "../../../fileio/private/msvc_stdint.h"
+#else
+#include <stdint.h>
+#endif
+
 /*
   The brainvision server port number
  */
@@ -21,6 +56,51 @@
 #define BV_PORT 51234
 #endif
 
+/*
+  Size of the read buffer for the messages and of the kernel receive
+  buffer of the socket
+*/
+#define RDA_READER_SIZE             (256 * 1024)
+#define RDA_SOCKET_BUFFER           (1024 * 1024)
+
+/*
+  The largest message which is accepted from a server. A bigger nSize in
+  a message header means a broken stream and the connection is dropped.
+  A data block of 1024 float channels over 40 ms at 100 kHz has 16 MB.
+  The read buffer never grows beyond RDA_MAX_MESSAGE_SIZE rounded up to
+  RDA_READER_SIZE times a power of two, which fits into an int.
+*/
+#define RDA_MAX_MESSAGE_SIZE        (64 * 1024 * 1024)
+
+/*
+  Waiting times in ms between the attempts to reconnect. The delay starts
+  with the minimum and doubles with every failed attempt.
+*/
+#define RECONNECT_MIN_DELAY         100
+#define RECONNECT_MAX_DELAY         5000
+
+/*
+  A connection is lost if the server sends nothing for this many ms.
+*/
+#define RDA_RECEIVE_TIMEOUT         5000
+
+/*
+  Longest wait in ms for the poll thread to stop. It is woken up at once,
+  so this is only reached if the thread hangs. The session is then left
+  to the thread instead of being freed.
+*/
+#define POLL_STOP_TIMEOUT           10000
+
+/*
+  The types of the values in the data blocks, the numbers are the same as
+  the FILTER_ types of filter.h. Message type 2 carries int16 values,
+  message type 4 float32 values as sent by the recorder. For old servers
+  which send int32 values as type 4 compile with -DRDA_INT32_DATA.
+*/
+#define ELEMENT_INT16               1
+#define ELEMENT_INT32               2
+#define ELEMENT_FLOAT32             3
+
 /*
   Error codes
 */
@@ -31,30 +111,205 @@
 #define IC_OPENSOCKET_FAILED        -3
 
 /*
-  external variables
+  The state of a connection, see getConnectionStatus
+*/
+
+#define CS_CONNECTED                0
+#define CS_RECONNECTING             1
+#define CS_DISCONNECTED             2
+
+/*
+  Number of bins of the drain latency histogram. Bin 0 counts the blocks
+  which were handed out less than 1 ms after they arrived, bin i > 0 those
+  between 2^(i-1) and 2^i ms, the last bin everything above.
 */
-extern int brainserver_socket;
+#define STATS_LATENCY_BINS          14
 
 /*
-  The main access functions
+  The read buffer. Messages are framed in place between start and end.
+  recvTime is the time of the last recv, i.e. the arrival time of the
+  messages which were completed by it. If kernelStamps is set the time
+  is the one the kernel stamped on the received data, so the time the
+  poll thread needed to get to the socket is not included.
 */
-int initConnection(const char *bv_hostname, struct RDA_MessageStart **pMsgStart);
+struct rdaReader
+{
+  char *buffer;
+  int size;
+  int start;
+  int end;
+  int kernelStamps;                     /* SO_TIMESTAMPNS is enabled */
+  double recvTime;                      /* in ms, see monotonicTime */
+  uint64_t nBytes;                      /* bytes received */
+};
 
-int getData(struct RDA_MessageData **pMsgData, int *blocksize, 
-	int lastBlock, ULONG nChannels, int *pElementSize);
+/*
+  The telemetry of one connection, see getStats. The poll thread keeps
+  the counters, each one has only one writer so no locking is needed.
+*/
+struct brainserverStats
+{
+  ULONG blocksReceived;                 /* data blocks from the server */
+  ULONG blocksDropped;                  /* blocks dropped because the ring was full */
+  ULONG samplesDropped;                 /* samples in the dropped blocks */
+  ULONG duplicateBlocks;                /* blocks which were received twice */
+  ULONG badBlocks;                      /* malformed blocks, which were dropped */
+  ULONG gaps;                           /* gaps in the block numbers */
+  ULONG gapSamples;                     /* samples in the gaps */
+  ULONG reconnects;                     /* successful reconnects */
+  uint64_t bytesReceived;
+  ULONG highWater;                      /* most samples ever waiting in the ring */
+  ULONG capacity;                       /* size of the ring in samples */
+  ULONG drainLatency[STATS_LATENCY_BINS]; /* time from arrival to getData */
+  int recording;                        /* a recorder is set, the fields below are valid */
+  uint64_t recordBytes;                 /* written to the .eeg files */
+  ULONG recordBlocks;
+  ULONG recordDropped;                  /* blocks which were not recorded */
+  ULONG recordFiles;
+  int recordError;                      /* errno of the first failed write */
+  int overflowPolicy;                   /* FIFO_DROP_NEWEST, ... */
+  ULONG droppedOldest;                  /* blocks dropped to make room, also in blocksDropped */
+  ULONG blocksSpilled;                  /* blocks which went through the spill file */
+  ULONG spillWaiting;                   /* blocks which wait in the spill file now */
+  int priorityResult;                   /* of setThreadOptions, see OPTION_NOT_SET */
+  int affinityResult;
+  int lockResult;
+};
+
+/* the result of an option which was not asked for, 0 is applied, else an errno */
+#define OPTION_NOT_SET -1
+
+/*
+  The real-time options of the thread which receives the data, see
+  setThreadOptions.
+*/
+struct threadOptions
+{
+  int policy;                           /* AC_SCHED_FIFO or AC_SCHED_RR */
+  int priority;                         /* 0 leaves the scheduling alone */
+  int cpu;                              /* -1 runs on any cpu */
+  int lockMemory;                       /* lock the buffers of the session */
+};
 
-void closeConnection();
+/*
+  One received block in acquiredData. endPos is the number of samples
+  up to the end of the block, counted from the first sample in
+  acquiredData.data. arrival is the time the block was received in ms of
+  monotonicTime.
+*/
+struct acquiredBlock
+{
+  ULONG nBlock;
+  ULONG endPos;
+  double arrival;
+};
+
+/*
+  The data handed out by getData: all samples and markers received since
+  the last call. The buffers are owned by the caller and reused by every
+  call, they only grow if more data arrives than ever before.
+*/
+struct acquiredData
+{
+  ULONG nBlock;                         /* number of the last block */
+  ULONG nPoints;
+  ULONG nMarkers;
+  ULONG nMissing;                       /* samples lost since the last call */
+  ULONG nOverflow;                      /* blocks dropped since the last call */
+  ULONG nSpilled;                       /* blocks which went to the spill file since the last call */
+  int   elementSize;                    /* 2 or 4 bytes */
+  int   elementType;                    /* ELEMENT_INT16, _INT32 or _FLOAT32 */
+  char *data;                           /* nPoints * nChannels values, multiplexed */
+  struct headerFIFOMarker *markers;     /* nPosition relative to the first sample */
+  ULONG nBlocks;
+  struct acquiredBlock *blocks;         /* the blocks in data */
+  ULONG dataSize;                       /* allocated bytes in data */
+  ULONG markerSize;                     /* allocated entries in markers */
+  ULONG blockSize;                      /* allocated entries in blocks */
+};
+
+/*
+  One connection to a server. The struct is private to brainserver.c,
+  initConnection creates it and closeConnection frees it.
+*/
+struct brainserverSession;
+struct rdaRecorder;
+
+/*
+  The size of the ring of a session and what happens to the blocks which
+  do not fit into it.
+*/
+struct bufferOptions
+{
+  double seconds;                       /* the capacity at the rate of the server */
+  ULONG samples;                        /* the capacity in samples, used instead if not 0 */
+  int policy;                           /* FIFO_DROP_NEWEST, FIFO_DROP_OLDEST or FIFO_SPILL */
+};
+
+/*
+  The main access functions. pBuffer may be NULL for a ring of
+  FIFO_DEFAULT_SECONDS which drops the newest blocks.
+*/
+int initConnection(const char *bv_hostname, struct RDA_MessageStart **pMsgStart,
+                   struct brainserverSession **ppSession, int reconnect,
+                   const struct bufferOptions *pBuffer);
+
+int getData(struct brainserverSession *ps, struct acquiredData *pData, ULONG nChannels);
+
+void freeAcquiredData(struct acquiredData *pData);
+
+ULONG waitForData(struct brainserverSession *ps, ULONG nPoints, ULONG timeout);
+
+int getConnectionStatus(struct brainserverSession *ps);
+
+void getStats(struct brainserverSession *ps, struct brainserverStats *pStats);
+
+double monotonicTime();
+
+void setReconnect(struct brainserverSession *ps, int reconnect);
+
+/*
+  Applies the options to the thread which receives the data of the
+  session. On linux this is the reactor thread, which is shared by all
+  sessions, so the options of the last session win. lockMemory locks the
+  ring of the session and the one of the recorder, so setRecorder has to
+  be called first. The results are reported by getStats.
+*/
+void setThreadOptions(struct brainserverSession *ps, const struct threadOptions *po);
+
+/*
+  Hands every data block received from now on to the recorder, see
+  recorder.h. The session owns the recorder, closeConnection destroys it.
+  Can only be set once.
+*/
+void setRecorder(struct brainserverSession *ps, struct rdaRecorder *pRecorder);
+
+void closeConnection(struct brainserverSession *ps);
 
 /*
   Functions for more specific messages.
 */
 
 extern int 
-getServerMessage(int sock, struct RDA_MessageHeader** ppHeader);
+getServerMessage(struct brainserverSession *ps, struct RDA_MessageHeader** ppHeader);
+
+extern int DetermineElementType(int nType);
+
+extern void rdaReaderReset(struct rdaReader *pr);
+extern void rdaReaderFree(struct rdaReader *pr);
 
 extern struct RDA_Marker *
 getMarker(struct RDA_MessageData *pmd, int nChannels, int idx, int ElementSize);
 
 #define AC_THREADED
 
+/*
+  On linux the sockets of all sessions are read by the thread of
+  ioreactor.c. Define AC_NO_REACTOR to get a poll thread per session as
+  on windows.
+*/
+#if defined(AC_THREADED) && defined(__linux__) && !defined(AC_NO_REACTOR)
+#define AC_REACTOR
+#endif
+
 #endif
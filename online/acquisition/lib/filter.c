@@ -17,46 +17,255 @@
  *              you got an invalid memory access exception
  * 2010/08/26 - Max Sagebaum
  *              - Added a function to get the filter size of the fir filter.
+ * 2026/10/17 - Jonas Reiter
+ *              - filterDataRaw: one pass from the raw amplifier data to the
+ *                output matrix, which only filters the selected channels.
+ *              - The static variables were moved into struct filterState.
+ *              - filterDataRaw reads int16, int32 and float32 values and
+ *                writes double or single output. If the first channels are
+ *                selected in their order a sample is converted in a row.
+ *              - filterDataRing writes into a ring buffer matrix, starting
+ *                at a given row and wrapping around. filterDataRaw is the
+ *                case of a ring which starts at row 0.
+ *              - The file is compiled on its own. All functions take the
+ *                filter they work on, which is created with filterCreate
+ *                and freed with filterDestroy, so any number of filters can
+ *                be used at the same time, also in several threads (one
+ *                filter per thread).
+ *              - The IIR filter of all channels is one kernel, which works
+ *                on the interleaved state of the channels. It uses AVX2 or
+ *                AVX-512 if the cpu has it, which is checked at runtime.
+ *                zBuffer is interleaved like selZBuffer. The results are
+ *                the same as before to the last bit.
+ *              - filterCreateSOS: a cascade of second order sections
+ *                instead of a and b, with kernels like the ones of the IIR
+ *                filter.
+ *              - The resample filter is a polyphase FIR filter with any
+ *                number of taps, which upsamples by L and downsamples by M.
+ *                It keeps the last IIR outputs and only computes the output
+ *                samples. The FIR filter of lag values is the case
+ *                L = 1, M = lag and gives the same results as before.
+ *                filterOutputCount and filterInputCount replace
+ *                filterGetFIRPos.
+ *              - The filter bank applies several IIR or SOS filters to the
+ *                same channels in one pass, a block of samples at a time,
+ *                for online_filterbank and proc_filterbank.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _MSC_VER
+#include "../../../fileio/private/msvc_stdint.h"
+#else
+#include <stdint.h>
+#endif
+
 #include "filter.h"
 
-/* the values for the IIR filter */
-static int filterSize = 0;            /* the size of the IIR filter */
-static int channelCount;              /* the number of bci channels */
-static double *bFilter;               /* the b part of the IIR filter */
-static double *aFilter;               /* the a part of the IIR filter */
+/* the SIMD kernels exist only on x86, FILTER_NO_SIMD switches them off */
+#if !defined(FILTER_NO_SIMD) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#  define FILTER_SIMD
+#  include <immintrin.h>
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#    define FILTER_TARGET(x)
+#  elif defined(__clang__)
+#    include <cpuid.h>
+#    define FILTER_TARGET(x) __attribute__((target(x)))
+#  else
+     /* gcc would fuse the multiplies and adds to FMA */
+#    include <cpuid.h>
+#    define FILTER_TARGET(x) __attribute__((target(x), optimize("fp-contract=off")))
+#  endif
+#endif
+
+/*
+ * The IIR filter of one sample for the channels k0 to n - 1, see
+ * filterIIRScalar.
+ */
+typedef void (*filterIIRKernel)(const double *a, const double *b, int fSize,
+                                const double *x, double *y, double *z, int n, int k0);
+
+/*
+ * The second order sections of one sample for the channels k0 to n - 1,
+ * see filterSOSScalar.
+ */
+typedef void (*filterSOSKernel)(const double *sos, int nSections,
+                                const double *x, double *y, double *z, int n, int k0);
+
+/*
+ * The state of one filter. Everything which was a static variable of this
+ * file before lives in this struct. The users only see the pointer.
+ */
+struct filterState {
+  /* the values for the IIR filter */
+  int filterSize;                /* the size of the IIR filter */
+  int channelCount;              /* the number of bci channels */
+  double *bFilter;               /* the b part of the IIR filter */
+  double *aFilter;               /* the a part of the IIR filter */
+
+  double *zBuffer;               /* the internal buffer for the filter, interleaved like selZBuffer */
+  filterIIRKernel iir;           /* the fastest kernel of the cpu */
+
+  /* the second order sections, which replace a and b if sosCount > 0 */
+  int    sosCount;               /* the number of sections */
+  double *sos;                   /* b0 b1 b2 a1 a2 of each section, divided by a0 */
+  filterSOSKernel sosKernel;     /* the fastest kernel of the cpu */
+  int    stateSize;              /* delays per channel, filterSize or 2 * sosCount */
+
+  /* the values for the resampling of the data. The IIR output is
+   * upsampled by reSampleUp (zeros in between), filtered with
+   * reSampleFilter and downsampled by reSampleDown. Only the output
+   * samples are computed, each one from the last inputs in the history.
+   * The history is interleaved like zBuffer: row i has the IIR output of
+   * every channel at one time, the newest row is reSampleHistoryPos. */
+  double *reSampleFilter;        /* the taps of the filter at the upsampled rate */
+  int    reSampleFilterSize;     /* the number of taps */
+  int    reSampleUp;             /* the upsampling factor L */
+  int    reSampleDown;           /* the downsampling factor M */
+  int    reSamplePhase;          /* upsampled time of the next output minus the one of the next input */
+  int    reSampleDelay;          /* the delay of the taps which is compensated, 0 for the FIR filter of lag values */
+  int    reSampleHistorySize;    /* the rows of the history, about taps / L */
+  int    reSampleHistoryPos;     /* the row of the newest input */
+  double *reSampleHistory;       /* the history of filterData, all channels */
+  double *reSampleFilterValues;  /* the output values of filterData */
 
-static double *zBuffer;               /* the internal buffer for the filter, one buffer for each row */
+  /* the values for filterDataRaw, which only keeps state for the selected
+   * channels. The IIR state is interleaved: selZBuffer[i * selCount + k] is
+   * the i-th delay of the k-th selected channel, so the loops over the
+   * channels run over contiguous memory. */
+  int    selCount;               /* the number of selected channels */
+  int    *selChannels;           /* the selected channels (c indices) */
+  int    selContiguous;          /* 1 if selChannels[k] == k for all k */
+  double *selZBuffer;            /* stateSize * selCount IIR delays */
+  double *selHistory;            /* reSampleHistorySize * selCount IIR outputs */
+  double *selReSampleValues;     /* selCount output values */
+  double *selX;                  /* the current input values */
+};
 
+static int filterSelectChannels(struct filterState *p, double* chan_sel, int chan_selSize);
 
-/* the values for the resampling of the data */
-static double *reSampleFilter;        /* a filter for the resampling of the data */
-static int    reSampleFilterPosition; /* the position in the filter */
-static int    reSampleFilterSize;     /* the size of the filter */
-static double *reSampleFilterValues;  /* the current values for the resampling */
+/* The modified Bessel function of order zero, for the Kaiser window */
+static double filterBesselI0(double x) {
+  double sum = 1.0, term = 1.0;
+  int k;
+  
+  for(k = 1; term > 1e-16 * sum; ++k) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
 
 /************************************************************
  *
- * Creates the FIR filter and sets all reSampleFilter* values.
- * INPUT: filter   - the values for the FIR filter
- *        size     - The size of the FIR filter
- *        nChans   - The number of channels we have to filter
+ * Computes the anti-alias filter which the resampling uses if no taps
+ * are given, like resample of matlab: a lowpass at the lower of the two
+ * Nyquist frequencies, windowed with a Kaiser window (beta 5) to
+ * 10 * max(up, down) taps on each side and scaled to a gain of up.
+ * Returns NULL if there is not enough memory.
  *
  ************************************************************/
-static void filterFIRCreate(double* filter, int size, int nChans) {
-  int i;
+static double *filterResampleDesign(int up, int down, int *size) {
+  const double pi = 3.14159265358979323846;
+  const double beta = 5.0;
+  int m = up > down ? up : down;
+  int half = 10 * m;
+  double *h, sum, i0Beta;
+  int k;
+  
+  *size = 2 * half + 1;
+  h = (double*)malloc(*size * sizeof(double));
+  if(NULL == h) {
+    return NULL;
+  }
   
-  reSampleFilterSize = size;
-  reSampleFilterPosition = 0;
+  i0Beta = filterBesselI0(beta);
+  sum = 0.0;
+  for(k = 0; k < *size; ++k) {
+    double x = (double)(k - half) / m;
+    double r = (double)(k - half) / half;
+    double sinc = (0 == k - half) ? 1.0 : sin(pi * x) / (pi * x);
+    
+    h[k] = sinc * filterBesselI0(beta * sqrt(1.0 - r * r)) / i0Beta;
+    sum += h[k];
+  }
+  for(k = 0; k < *size; ++k) {
+    h[k] *= up / sum;
+  }
+  return h;
+}
 
-  reSampleFilter = (double*)malloc(reSampleFilterSize * sizeof(double));
-  memcpy(reSampleFilter,filter,reSampleFilterSize * sizeof(double));
+/************************************************************
+ *
+ * Sets up the resample filter and all reSample* values and clears the
+ * history. With reverse the taps are stored in the reversed order, which
+ * makes the old FIR filter of lag values the filter with up = 1 and
+ * down = lag: its value i belongs to the i-th sample of a block. Without
+ * reverse the taps are a linear phase filter and their delay of
+ * (size - 1) / 2 upsampled values is compensated.
+ * INPUT: filter   - the taps, NULL for the filter of filterResampleDesign
+ *        size     - the number of taps
+ *        up, down - the factors L and M
+ *        reverse  - 1 if the taps are in the reversed order
+ * Returns 0 if there is not enough memory.
+ *
+ ************************************************************/
+static int filterResampleCreate(struct filterState *p, const double* filter, int size, int up, int down, int reverse) {
+  double *taps, *history, *values, *selHistory = NULL;
+  int historySize, delay, start, k;
   
-  reSampleFilterValues = (double*)malloc(nChans * sizeof(double));
-  for(i = 0; i < nChans;++i) {
-    reSampleFilterValues[i] = 0;
-  } 
+  if(NULL == filter) {
+    taps = filterResampleDesign(up, down, &size);
+  } else {
+    taps = (double*)malloc(size * sizeof(double));
+    if(NULL != taps) {
+      for(k = 0; k < size; ++k) {
+        taps[k] = reverse ? filter[size - 1 - k] : filter[k];
+      }
+    }
+  }
+  /* output m is the filtered signal at the upsampled time
+   * m * down + down - up, for up = 1 the time of the last input of its
+   * block like the old FIR filter which wrote after lag samples. Because
+   * of the delay of the taps it is computed delay values later. If that
+   * is still before the first input (short taps), the newest inputs do
+   * not count for the first outputs and the history reaches back further. */
+  delay = reverse ? 0 : (size - 1) / 2;
+  start = delay + down - up;
+  historySize = (size - 1 + (start < 0 ? -start : 0)) / up + 1;
+  history = (double*)calloc((size_t)historySize * p->channelCount, sizeof(double));
+  values = (double*)calloc(p->channelCount, sizeof(double));
+  if(0 != p->selCount) {
+    selHistory = (double*)calloc((size_t)historySize * p->selCount, sizeof(double));
+  }
+  if(NULL == taps || NULL == history || NULL == values || (0 != p->selCount && NULL == selHistory)) {
+    if(NULL != taps) free(taps);
+    if(NULL != history) free(history);
+    if(NULL != values) free(values);
+    if(NULL != selHistory) free(selHistory);
+    return 0;
+  }
+  
+  if(NULL != p->reSampleFilter) free(p->reSampleFilter);
+  if(NULL != p->reSampleHistory) free(p->reSampleHistory);
+  if(NULL != p->reSampleFilterValues) free(p->reSampleFilterValues);
+  if(NULL != p->selHistory) free(p->selHistory);
+  
+  p->reSampleFilter = taps;
+  p->reSampleFilterSize = size;
+  p->reSampleUp = up;
+  p->reSampleDown = down;
+  p->reSampleDelay = delay;
+  p->reSampleHistorySize = historySize;
+  p->reSampleHistory = history;
+  p->reSampleFilterValues = values;
+  p->selHistory = selHistory;
+  p->reSamplePhase = start;
+  p->reSampleHistoryPos = 0;
+  return 1;
 }
 
 /************************************************************
@@ -70,20 +279,24 @@ static void filterFIRCreate(double* filter, int size, int nChans) {
  *  If you want to create a default filter with a = [1] and b = [1] you
  *  can pass for aFilterPtr and bFilterPtr NULL. The function assumes in
  *  this situation that fSize is equal to one.
+ *  Returns 0 if there is not enough memory.
  *
  ************************************************************/
-static void filterIIRCreate(double* aFilterPtr, double* bFilterPtr,int fSize, int nChans) {
-  int i;
-  
-  filterSize = fSize;
-  channelCount = nChans;
+static int filterIIRCreate(struct filterState *p, const double* aFilterPtr, const double* bFilterPtr,int fSize, int nChans) {
+  p->filterSize = fSize;
+  p->channelCount = nChans;
+  p->stateSize = (0 != p->sosCount) ? 2 * p->sosCount : fSize;
   
-  bFilter = (double*)malloc(filterSize * sizeof(double));
-  aFilter = (double*)malloc(filterSize * sizeof(double));
+  p->bFilter = (double*)malloc(p->filterSize * sizeof(double));
+  p->aFilter = (double*)malloc(p->filterSize * sizeof(double));
+  p->zBuffer = (double*)calloc(p->stateSize * p->channelCount, sizeof(double));
+  if(NULL == p->bFilter || NULL == p->aFilter || NULL == p->zBuffer) {
+    return 0;
+  }
   
   if(NULL != aFilterPtr) {
-    memcpy(bFilter, bFilterPtr, filterSize*sizeof(double));
-    memcpy(aFilter, aFilterPtr, filterSize*sizeof(double));
+    memcpy(p->bFilter, bFilterPtr, p->filterSize*sizeof(double));
+    memcpy(p->aFilter, aFilterPtr, p->filterSize*sizeof(double));
   } else {
     /* if the a filter is the null pointer we have to initialize the default
      * filter.
@@ -91,46 +304,69 @@ static void filterIIRCreate(double* aFilterPtr, double* bFilterPtr,int fSize, in
      * size is assumend to be 1
      */
     
-     bFilter[0] = 1.0;
-     aFilter[0] = 1.0;
+     p->bFilter[0] = 1.0;
+     p->aFilter[0] = 1.0;
   }
+  return 1;
+}
+
+/************************************************************
+ *
+ * Copies the second order sections. sos is the nSections x 6 matrix of
+ * matlab (column major), each row is b0 b1 b2 a0 a1 a2 of one section.
+ * The values are divided by a0 like matlab does it. Returns 0 if there
+ * is not enough memory.
+ *
+ ************************************************************/
+static int filterSOSCreate(struct filterState *p, const double* sos, int nSections) {
+  int s, j;
   
+  p->sos = (double*)malloc(5 * nSections * sizeof(double));
+  if(NULL == p->sos) {
+    return 0;
+  }
+  p->sosCount = nSections;
   
-  zBuffer = (double*)malloc(filterSize * channelCount * sizeof(double));
-  
-  for(i = 0; i < channelCount * filterSize;++i) {
-    zBuffer[i] = 0.0;
+  for(s = 0; s < nSections; ++s) {
+    double a0 = sos[s + 3 * nSections];
+    
+    for(j = 0; j < 3; ++j) {
+      p->sos[5 * s + j] = sos[s + j * nSections] / a0;
+    }
+    for(j = 1; j < 3; ++j) {
+      p->sos[5 * s + 2 + j] = sos[s + (3 + j) * nSections] / a0;
+    }
   }
+  return 1;
 }
 
 /************************************************************
  *
- * Calculates the value from the IIR filter and updates the 
- * filter for the next value in the same channel
+ * Calculates the value from the IIR filter for the channels k0 to n - 1
+ * of one sample and updates the filter for the next sample.
  *
- * The data in the both buffer is packed liked;
+ * The state of the channels is interleaved:
  *
- *  1. Channel data0       data1       data2       ... dataK
- *  2. Channel datak+1     datak+2     datak+3     ... dataK*2
+ *  z[0 * n + 0] z[0 * n + 1] ... z[0 * n + n - 1]   delay 1 of each channel
+ *  z[1 * n + 0] z[1 * n + 1] ... z[1 * n + n - 1]   delay 2 of each channel
  *  .
- *  . 
  *  .
- *  n. Channel data(n-1)+1 data(n-1)+2 data(n-1)+3 ... data(n-1)*K
+ *  z[(fSize - 1) * n + 0] ...                       always zero
  *
- * where K is the filterSiyze-1
- * and n is the nummber of channels
+ * so the same delay of neighbouring channels is in neighbouring memory
+ * and the SIMD kernels below compute 4 or 8 channels with one
+ * instruction.
  *
- * The latest dataPoint for each channel is at the position
- * filterOffset. The oldest dataPoint for each channel is at the
- * position filterOffset - 1.
+ * INPUT: a, b   - The IIR filter with fSize values, a[0] = 1
+ *        x      - The input value of each of the n channels
+ *        y      - Gets the output value of each channel
+ *        z      - The state, fSize * n values
  *
  ************************************************************/
-static double filterDataIIR(double value, int channel) {
-  int channelOffset;
-  double yValue;
-  int i;
-  
-  double* zBufferThisChannel; /* The pointer to the z buffer for the current channel */
+static void filterIIRScalar(const double *a, const double *b, int fSize,
+                            const double *x, double *y, double *z, int n, int k0) {
+  int i, k;
+  double *zPrev, *zThis;
   
   /* updates the filter in assumtion of aFilter[0] = 1
    * the expression for an IIR filter is
@@ -138,32 +374,414 @@ static double filterDataIIR(double value, int channel) {
    *                       - a(2)*y(n-1) - ... - a(na+1)*y(n-na)
    * see matlab: help filter for more information
    *
-   * We do not need the extra case for the last element because zBuffer[filterSize - 1] will always be zero
+   * We do not need the extra case for the last element because the last
+   * delay will always be zero
    */
+  for(k = k0; k < n; ++k) {
+    y[k] = b[0] * x[k] + z[k];
+  }
+  for(i = 1; i < fSize; ++i) {
+    zPrev = z + (i - 1) * n;
+    zThis = z + i * n;
+    for(k = k0; k < n; ++k) {
+      zPrev[k] = b[i] * x[k] + zThis[k] - a[i] * y[k];
+    }
+  }
+}
+
+/************************************************************
+ *
+ * Runs one sample of the channels k0 to n - 1 through the cascade of
+ * second order sections. Each section is a transposed direct form II
+ * like filterIIRScalar with three values, the output of a section is
+ * the input of the next one. The state has two delays per section:
+ *
+ *  z[(2 * s + 0) * n + k]   delay 1 of section s of channel k
+ *  z[(2 * s + 1) * n + k]   delay 2 of section s of channel k
+ *
+ * INPUT: sos    - b0 b1 b2 a1 a2 of each section, a0 = 1
+ *        x      - The input value of each of the n channels
+ *        y      - Gets the output value of each channel
+ *        z      - The state, 2 * nSections * n values
+ *
+ ************************************************************/
+static void filterSOSScalar(const double *sos, int nSections,
+                            const double *x, double *y, double *z, int n, int k0) {
+  int s, k;
+  double in, out;
   
+  for(k = k0; k < n; ++k) {
+    y[k] = x[k];
+  }
+  for(s = 0; s < nSections; ++s) {
+    const double *c = sos + 5 * s;
+    double *z1 = z + 2 * s * n;
+    double *z2 = z1 + n;
+    
+    for(k = k0; k < n; ++k) {
+      in = y[k];
+      out = c[0] * in + z1[k];
+      z1[k] = c[1] * in + z2[k] - c[3] * out;
+      z2[k] = c[2] * in - c[4] * out;
+      y[k] = out;
+    }
+  }
+}
+
+#ifdef FILTER_SIMD
 
-  channelOffset = channel * filterSize;
-  zBufferThisChannel = zBuffer + channelOffset;
+/*
+ * The SIMD kernels compute the same expressions in the same order as
+ * filterIIRScalar, with separate multiplies and adds (no FMA), so the
+ * results are the same to the last bit. The rest of the channels which
+ * do not fill a register is done by the smaller kernel.
+ */
+FILTER_TARGET("avx2")
+static void filterIIRAvx2(const double *a, const double *b, int fSize,
+                          const double *x, double *y, double *z, int n, int k0) {
+  int i, k;
   
-  yValue = bFilter[0] * value + zBuffer[channelOffset];  
-  for(i = 1; i < filterSize; ++i) {
-    zBufferThisChannel[i - 1] = bFilter[i] * value + zBufferThisChannel[i] - aFilter[i] * yValue;    
+  for(k = k0; k + 4 <= n; k += 4) {
+    __m256d vx = _mm256_loadu_pd(x + k);
+    __m256d vy = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(b[0]), vx), _mm256_loadu_pd(z + k));
+    
+    for(i = 1; i < fSize; ++i) {
+      __m256d v = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(b[i]), vx), _mm256_loadu_pd(z + i * n + k));
+      _mm256_storeu_pd(z + (i - 1) * n + k, _mm256_sub_pd(v, _mm256_mul_pd(_mm256_set1_pd(a[i]), vy)));
+    }
+    _mm256_storeu_pd(y + k, vy);
   }
+  filterIIRScalar(a, b, fSize, x, y, z, n, k);
+}
 
-  return yValue;
+FILTER_TARGET("avx512f")
+static void filterIIRAvx512(const double *a, const double *b, int fSize,
+                            const double *x, double *y, double *z, int n, int k0) {
+  int i, k;
+  
+  for(k = k0; k + 8 <= n; k += 8) {
+    __m512d vx = _mm512_loadu_pd(x + k);
+    __m512d vy = _mm512_add_pd(_mm512_mul_pd(_mm512_set1_pd(b[0]), vx), _mm512_loadu_pd(z + k));
+    
+    for(i = 1; i < fSize; ++i) {
+      __m512d v = _mm512_add_pd(_mm512_mul_pd(_mm512_set1_pd(b[i]), vx), _mm512_loadu_pd(z + i * n + k));
+      _mm512_storeu_pd(z + (i - 1) * n + k, _mm512_sub_pd(v, _mm512_mul_pd(_mm512_set1_pd(a[i]), vy)));
+    }
+    _mm512_storeu_pd(y + k, vy);
+  }
+  filterIIRAvx2(a, b, fSize, x, y, z, n, k);
+}
+
+/*
+ * The sections keep the values of a block of channels in registers, only
+ * the delays go to memory.
+ */
+FILTER_TARGET("avx2")
+static void filterSOSAvx2(const double *sos, int nSections,
+                          const double *x, double *y, double *z, int n, int k0) {
+  int s, k;
+  
+  for(k = k0; k + 4 <= n; k += 4) {
+    __m256d v = _mm256_loadu_pd(x + k);
+    
+    for(s = 0; s < nSections; ++s) {
+      const double *c = sos + 5 * s;
+      double *z1 = z + 2 * s * n + k;
+      double *z2 = z1 + n;
+      __m256d out = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(c[0]), v), _mm256_loadu_pd(z1));
+      
+      _mm256_storeu_pd(z1, _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(c[1]), v), _mm256_loadu_pd(z2)),
+                                         _mm256_mul_pd(_mm256_set1_pd(c[3]), out)));
+      _mm256_storeu_pd(z2, _mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(c[2]), v),
+                                         _mm256_mul_pd(_mm256_set1_pd(c[4]), out)));
+      v = out;
+    }
+    _mm256_storeu_pd(y + k, v);
+  }
+  filterSOSScalar(sos, nSections, x, y, z, n, k);
+}
+
+FILTER_TARGET("avx512f")
+static void filterSOSAvx512(const double *sos, int nSections,
+                            const double *x, double *y, double *z, int n, int k0) {
+  int s, k;
+  
+  for(k = k0; k + 8 <= n; k += 8) {
+    __m512d v = _mm512_loadu_pd(x + k);
+    
+    for(s = 0; s < nSections; ++s) {
+      const double *c = sos + 5 * s;
+      double *z1 = z + 2 * s * n + k;
+      double *z2 = z1 + n;
+      __m512d out = _mm512_add_pd(_mm512_mul_pd(_mm512_set1_pd(c[0]), v), _mm512_loadu_pd(z1));
+      
+      _mm512_storeu_pd(z1, _mm512_sub_pd(_mm512_add_pd(_mm512_mul_pd(_mm512_set1_pd(c[1]), v), _mm512_loadu_pd(z2)),
+                                         _mm512_mul_pd(_mm512_set1_pd(c[3]), out)));
+      _mm512_storeu_pd(z2, _mm512_sub_pd(_mm512_mul_pd(_mm512_set1_pd(c[2]), v),
+                                         _mm512_mul_pd(_mm512_set1_pd(c[4]), out)));
+      v = out;
+    }
+    _mm512_storeu_pd(y + k, v);
+  }
+  filterSOSAvx2(sos, nSections, x, y, z, n, k);
+}
+
+/*
+ * Returns 2 if the cpu and the os support AVX-512, 1 for AVX2, else 0.
+ * The os has to save the registers, which xgetbv tells.
+ */
+static int filterSimdLevel(void) {
+  unsigned int eax, ebx, ecx, edx;
+  unsigned long long xcr0;
+  
+#ifdef _MSC_VER
+  int regs[4];
+  
+  __cpuid(regs, 0);
+  if(regs[0] < 7) return 0;
+  __cpuid(regs, 1);
+  ecx = (unsigned int)regs[2];
+  if(!(ecx & (1u << 27)) || !(ecx & (1u << 28))) return 0;  /* OSXSAVE, AVX */
+  xcr0 = _xgetbv(0);
+  __cpuidex(regs, 7, 0);
+  ebx = (unsigned int)regs[1];
+#else
+  if(__get_cpuid_max(0, NULL) < 7) return 0;
+  __cpuid(1, eax, ebx, ecx, edx);
+  if(!(ecx & (1u << 27)) || !(ecx & (1u << 28))) return 0;  /* OSXSAVE, AVX */
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  xcr0 = ((unsigned long long)edx << 32) | eax;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+#endif
+  
+  if((xcr0 & 0x06) != 0x06) return 0;                       /* SSE and AVX state */
+  if((ebx & (1u << 16)) && (xcr0 & 0xe6) == 0xe6) return 2; /* AVX-512F and its state */
+  if(ebx & (1u << 5)) return 1;                             /* AVX2 */
+  return 0;
+}
+
+#endif
+
+/* Sets the fastest kernels of the cpu */
+static void filterSelectKernels(struct filterState *p) {
+  p->iir = filterIIRScalar;
+  p->sosKernel = filterSOSScalar;
+#ifdef FILTER_SIMD
+  switch(filterSimdLevel()) {
+    case 2:
+      p->iir = filterIIRAvx512;
+      p->sosKernel = filterSOSAvx512;
+      break;
+    case 1:
+      p->iir = filterIIRAvx2;
+      p->sosKernel = filterSOSAvx2;
+      break;
+  }
+#endif
+}
+
+/* The IIR filter or the sections of one sample of n channels */
+static void filterStep(const struct filterState *p, const double *x, double *y, double *z, int n) {
+  if(0 != p->sosCount) {
+    p->sosKernel(p->sos, p->sosCount, x, y, z, n, 0);
+  } else {
+    p->iir(p->aFilter, p->bFilter, p->filterSize, x, y, z, n, 0);
+  }
+}
+
+/************************************************************
+ *
+ * Computes the output of the resample filter for n channels at the
+ * current phase. The output is at the upsampled time of the newest input
+ * (row pos of the history) plus phase, so tap phase + j * L falls on the
+ * input j samples back; the taps in between fall on the zeros of the
+ * upsampling. The phase is only negative for the first outputs of short
+ * taps, the newest inputs are then after the output. The sum starts with
+ * the oldest input, for the old FIR filter this is the order in which the
+ * values were added.
+ *
+ ************************************************************/
+static void filterResampleSum(const struct filterState *p, const double *history, int pos, int n, double *sums) {
+  const double *taps = p->reSampleFilter;
+  int up = p->reSampleUp;
+  int phase = p->reSamplePhase;
+  int historySize = p->reSampleHistorySize;
+  int j, jFirst, k, row;
+  
+  for(k = 0; k < n; ++k) {
+    sums[k] = 0;
+  }
+  if(phase >= p->reSampleFilterSize) {
+    return;
+  }
+  
+  j = (p->reSampleFilterSize - 1 - phase) / up;
+  jFirst = phase < 0 ? (up - 1 - phase) / up : 0;
+  row = pos - j;
+  if(row < 0) {
+    row += historySize;
+  }
+  for(; j >= jFirst; --j) {
+    const double *y = history + (size_t)row * n;
+    double tap = taps[phase + j * up];
+    
+    for(k = 0; k < n; ++k) {
+      sums[k] += y[k] * tap;
+    }
+    if(++row == historySize) {
+      row = 0;
+    }
+  }
+}
+
+/************************************************************
+ *
+ * Creates a filter: the IIR filter with the a and b values and the FIR
+ * filter for the resampling, each one for nChans channels. Returns NULL
+ * if there is not enough memory.
+ * INPUT: aFilterPtr   - The values for the a component of the IIR filter
+ *        bFilterPtr   - The values for the b component of the IIR filter
+ *        fSize        - The size of the IIR filter
+ *        firFilter    - The values for the FIR filter
+ *        firSize      - The size of the FIR filter
+ *        nChans       - The number of channels we have to filter
+ *
+ *  With NULL for aFilterPtr and bFilterPtr the IIR filter is a = [1] and
+ *  b = [1], fSize has to be one.
+ *
+ ************************************************************/
+struct filterState *filterCreate(const double* aFilterPtr, const double* bFilterPtr, int fSize,
+                                 const double* firFilter, int firSize, int nChans) {
+  struct filterState *p = (struct filterState*)calloc(1, sizeof(struct filterState));
+  
+  if(NULL == p) {
+    return NULL;
+  }
+  filterSelectKernels(p);
+  if(!filterIIRCreate(p, aFilterPtr, bFilterPtr, fSize, nChans)
+     || !filterResampleCreate(p, firFilter, firSize, 1, firSize, 1)) {
+    filterDestroy(p);
+    return NULL;
+  }
+  return p;
+}
+
+/************************************************************
+ *
+ * Like filterCreate, but with a cascade of second order sections instead
+ * of a and b. High order filters are more stable this way.
+ * INPUT: sos          - The nSections x 6 matrix of matlab (column major),
+ *                       each row b0 b1 b2 a0 a1 a2, a0 must not be 0
+ *        nSections    - The number of sections
+ *        the other arguments are the ones of filterCreate
+ *
+ ************************************************************/
+struct filterState *filterCreateSOS(const double* sos, int nSections,
+                                    const double* firFilter, int firSize, int nChans) {
+  struct filterState *p = (struct filterState*)calloc(1, sizeof(struct filterState));
+  
+  if(NULL == p) {
+    return NULL;
+  }
+  filterSelectKernels(p);
+  if(!filterSOSCreate(p, sos, nSections)
+     || !filterIIRCreate(p, NULL, NULL, 1, nChans)
+     || !filterResampleCreate(p, firFilter, firSize, 1, firSize, 1)) {
+    filterDestroy(p);
+    return NULL;
+  }
+  return p;
+}
+
+/************************************************************
+ *
+ * Clears the delays of the IIR filter and the sums of the FIR filter,
+ * the filter starts again as if it was new. The coefficients and the
+ * channel selection remain.
+ *
+ ************************************************************/
+void filterReset(struct filterState *p) {
+  memset(p->zBuffer, 0, p->stateSize * p->channelCount * sizeof(double));
+  memset(p->reSampleHistory, 0, (size_t)p->reSampleHistorySize * p->channelCount * sizeof(double));
+  p->reSamplePhase = p->reSampleDelay + p->reSampleDown - p->reSampleUp;
+  p->reSampleHistoryPos = 0;
+  
+  if(0 != p->selCount) {
+    memset(p->selZBuffer, 0, p->stateSize * p->selCount * sizeof(double));
+    memset(p->selHistory, 0, (size_t)p->reSampleHistorySize * p->selCount * sizeof(double));
+  }
+}
+
+/************************************************************
+ *
+ * Replaces the resample filter by a polyphase filter which upsamples by
+ * up, filters with the taps and downsamples by down, like
+ * upfirdn(x, filter, up, down) of matlab. The taps are at the upsampled
+ * rate and have any length, a long anti-alias filter costs only for the
+ * output samples. Like resample of matlab the delay of (size - 1) / 2
+ * upsampled values of the taps is compensated: output m is the value of
+ * the filtered signal at the upsampled time m * down + down - up, so the
+ * output sample k is at the time k / fs like the input sample k (both
+ * counted from 1). For up = 1 it is the time of the last sample of its
+ * block, like for the FIR filter of filterCreate. Because of the delay
+ * the output samples come (size - 1) / 2 / up input samples later, see
+ * filterInputTime.
+ * INPUT: filter   - The taps of a linear phase filter, NULL for a
+ *                   lowpass like the one of resample of matlab (Kaiser
+ *                   window, 10 * max(up, down) taps on each side, gain up)
+ *        size     - The number of taps
+ *        up, down - The factors, the output rate is the input rate
+ *                   * up / down
+ * The history of the filter is cleared, the IIR filter is kept.
+ * Returns 0 if there is not enough memory, the old filter remains then.
+ *
+ ************************************************************/
+int filterSetResample(struct filterState *p, const double* filter, int size, int up, int down) {
+  return filterResampleCreate(p, filter, size, up, down, 0);
 }
 
 /************************************************************
  *
- * Deletes all values for the two filters
+ * The factors of the resampling from the rate fsIn to fsOut, both in
+ * Hz: fsOut / fsIn reduced to up / down.
+ *
+ ************************************************************/
+void filterResampleFactors(int fsIn, int fsOut, int *up, int *down) {
+  int a = fsIn, b = fsOut;
+  
+  while(0 != b) {
+    int r = a % b;
+    a = b;
+    b = r;
+  }
+  *up = fsOut / a;
+  *down = fsIn / a;
+}
+
+/************************************************************
+ *
+ * Deletes all values for the two filters and the filter itself.
  * 
  ************************************************************/
-static void filterClose() {
-  if(NULL != zBuffer) {free(zBuffer); zBuffer = NULL;}
-  if(NULL != aFilter) {free(aFilter); aFilter = NULL;}
-  if(NULL != bFilter) {free(bFilter); bFilter = NULL;}
-  if(NULL != reSampleFilter) {free(reSampleFilter); reSampleFilter = NULL;}
-  if(NULL != reSampleFilterValues) {free(reSampleFilterValues); reSampleFilterValues = NULL;}
+void filterDestroy(struct filterState *p) {
+  if(NULL == p) {
+    return;
+  }
+
+  if(NULL != p->zBuffer) {free(p->zBuffer); p->zBuffer = NULL;}
+  if(NULL != p->sos) {free(p->sos); p->sos = NULL;}
+  if(NULL != p->aFilter) {free(p->aFilter); p->aFilter = NULL;}
+  if(NULL != p->bFilter) {free(p->bFilter); p->bFilter = NULL;}
+  if(NULL != p->reSampleFilter) {free(p->reSampleFilter); p->reSampleFilter = NULL;}
+  if(NULL != p->reSampleHistory) {free(p->reSampleHistory); p->reSampleHistory = NULL;}
+  if(NULL != p->reSampleFilterValues) {free(p->reSampleFilterValues); p->reSampleFilterValues = NULL;}
+  
+  if(NULL != p->selChannels) {free(p->selChannels); p->selChannels = NULL;}
+  if(NULL != p->selZBuffer) {free(p->selZBuffer); p->selZBuffer = NULL;}
+  if(NULL != p->selHistory) {free(p->selHistory); p->selHistory = NULL;}
+  if(NULL != p->selReSampleValues) {free(p->selReSampleValues); p->selReSampleValues = NULL;}
+  if(NULL != p->selX) {free(p->selX); p->selX = NULL;}
+  free(p);
 }
 
 /************************************************************
@@ -181,15 +799,20 @@ static void filterClose() {
  *        chanl_sel       - The rearangement of channels
  *        chanl_selSize   - The size of the channel selection array
  *        scale           - The scale for the cahnnels
+ * Returns the number of data sets written to filterData, which is
+ * filterOutputCount(p, sourceDataSize) before the call.
  *
  ************************************************************/
-static void filterData(double* sourceData, int sourceDataSize, double* filterData, int filterDataSize,double* chan_sel, int chan_selSize, double* scale) {
+int filterData(struct filterState *p, const double* sourceData, int sourceDataSize, double* filterData, int filterDataSize,double* chan_sel, int chan_selSize, double* scale) {
   int t;
   int n;
   int c;
   int pDstPosition;
-  double* pSrc;
+  const double* pSrc;
   double* pDst;
+  double* y;
+  double* sums = p->reSampleFilterValues;
+  int pos = p->reSampleHistoryPos;
   
   pSrc = sourceData;
   pDstPosition = 0;
@@ -199,55 +822,545 @@ static void filterData(double* sourceData, int sourceDataSize, double* filterDat
      the channels according to chan_sel, scaling the values
      according to scale) */
   for(t = 0; t < sourceDataSize; ++t) {
-    /* IIR filter and resample filter  */
-    for(n = 0;n < channelCount; ++n) {
-     reSampleFilterValues[n] += filterDataIIR(pSrc[n],n) * reSampleFilter[reSampleFilterPosition];
+    /* IIR filter, the output is the newest row of the history */
+    if(++pos == p->reSampleHistorySize) {
+      pos = 0;
     }
-    reSampleFilterPosition++;
+    y = p->reSampleHistory + (size_t)pos * p->channelCount;
+    filterStep(p, pSrc, y, p->zBuffer, p->channelCount);
 
-    /* flush the resample filter and write to dest  */
-    if(reSampleFilterPosition == reSampleFilterSize) {
-      reSampleFilterPosition = 0;
+    /* the output samples of the resample filter which are due now */
+    while(p->reSamplePhase < p->reSampleUp) {
+      filterResampleSum(p, p->reSampleHistory, pos, p->channelCount, sums);
 
       /* write to dest */
       pDst = filterData + pDstPosition;
       for(n = 0; n < chan_selSize; ++n) {
         c = (int)chan_sel[n] - 1; /* we have matlab indices here so we need to substract one */
-        *pDst = scale[c] * reSampleFilterValues[c];
+        *pDst = scale[c] * sums[c];
         pDst+= filterDataSize;
       }
       
-      /* flush the data */
-      for(n = 0;n < channelCount; ++n) {        
-        reSampleFilterValues[n] = 0;
+      p->reSamplePhase += p->reSampleDown;
+      pDstPosition++;
+    }
+    p->reSamplePhase -= p->reSampleUp;
+
+    pSrc += p->channelCount;
+  }
+  p->reSampleHistoryPos = pos;
+  
+  return pDstPosition;
+}
+
+/************************************************************
+ *
+ * Sets up the state for the selected channels of filterDataRaw. If the
+ * selection is the same as in the last call nothing is done. Otherwise
+ * channels which were already selected keep their filter state, newly
+ * selected channels start with an empty filter. Returns 0 if there is
+ * not enough memory, the old selection remains then.
+ *
+ ************************************************************/
+static int filterSelectChannels(struct filterState *p, double* chan_sel, int chan_selSize) {
+  int *channels;
+  double *zBuffer, *history, *values, *x;
+  int i, k, j;
+  
+  if(chan_selSize == p->selCount) {
+    for(k = 0; k < p->selCount; ++k) {
+      if((int)chan_sel[k] - 1 != p->selChannels[k]) break;
+    }
+    if(k == p->selCount) return 1;
+  }
+  
+  /* the +1 keeps calloc from returning NULL for an empty state */
+  channels = (int*)malloc((chan_selSize + 1) * sizeof(int));
+  zBuffer = (double*)calloc((size_t)p->stateSize * chan_selSize + 1, sizeof(double));
+  history = (double*)calloc((size_t)p->reSampleHistorySize * chan_selSize + 1, sizeof(double));
+  values = (double*)malloc((chan_selSize + 1) * sizeof(double));
+  x = (double*)malloc((chan_selSize + 1) * sizeof(double));
+  if(NULL == channels || NULL == zBuffer || NULL == history || NULL == values || NULL == x) {
+    free(channels);
+    free(zBuffer);
+    free(history);
+    free(values);
+    free(x);
+    return 0;
+  }
+  
+  for(k = 0; k < chan_selSize; ++k) {
+    channels[k] = (int)chan_sel[k] - 1; /* we have matlab indices here so we need to substract one */
+    
+    /* take over the state if the channel was selected before */
+    for(j = 0; j < p->selCount; ++j) {
+      if(p->selChannels[j] == channels[k]) {
+        for(i = 0; i < p->stateSize; ++i) {
+          zBuffer[i * chan_selSize + k] = p->selZBuffer[i * p->selCount + j];
+        }
+        for(i = 0; i < p->reSampleHistorySize; ++i) {
+          history[(size_t)i * chan_selSize + k] = p->selHistory[(size_t)i * p->selCount + j];
+        }
+        break;
+      }
+    }
+  }
+  
+  if(NULL != p->selChannels) free(p->selChannels);
+  if(NULL != p->selZBuffer) free(p->selZBuffer);
+  if(NULL != p->selHistory) free(p->selHistory);
+  if(NULL != p->selReSampleValues) free(p->selReSampleValues);
+  if(NULL != p->selX) free(p->selX);
+  
+  p->selContiguous = 1;
+  for(k = 0; k < chan_selSize; ++k) {
+    if(channels[k] != k) p->selContiguous = 0;
+  }
+  
+  p->selCount = chan_selSize;
+  p->selChannels = channels;
+  p->selZBuffer = zBuffer;
+  p->selHistory = history;
+  p->selReSampleValues = values;
+  p->selX = x;
+  
+  return 1;
+}
+
+/************************************************************
+ *
+ * Filters the raw multiplexed data of the amplifier in one pass. Each
+ * value of a selected channel is read once from the source, converted,
+ * run through the IIR and the resample filter and the result is scaled
+ * and written directly to the output matrix. Channels which are not in
+ * chan_sel are not touched at all.
+ *
+ * The arithmetic is the same as in filterData, so both give the same
+ * results.
+ *
+ * INPUT: sourceData      - The unfiltered data points as int16, int32 or
+ *                          float32. We assume that the size of the array
+ *                          is sourceDataSize * nChans
+ *        elementType     - FILTER_INT16, FILTER_INT32 or FILTER_FLOAT32
+ *        sourceDataSize  - The number of data sets in the array
+ *        filterData      - The array for the return data (column major)
+ *                          We assume that the size of the array is 
+ *                          filterDataSize * chanl_selSize
+ *        outputType      - FILTER_FLOAT64 (double) or FILTER_FLOAT32
+ *                          (single) values in filterData
+ *        filterDataSize  - The number of data sets in the array
+ *        chanl_sel       - The rearangement of channels
+ *        chanl_selSize   - The size of the channel selection array
+ *        scale           - The scale for the cahnnels
+ *
+ * Returns 0 if there is not enough memory for a new channel selection,
+ * nothing is written then.
+ *
+ ************************************************************/
+int filterDataRaw(struct filterState *p, const void* sourceData, int elementType, int sourceDataSize, void* filterData, int outputType, int filterDataSize, double* chan_sel, int chan_selSize, double* scale) {
+  return filterDataRing(p, sourceData, elementType, sourceDataSize, filterData, outputType, filterDataSize, 0, chan_sel, chan_selSize, scale);
+}
+
+/************************************************************
+ *
+ * Like filterDataRaw, but the output matrix is a ring buffer with
+ * ringSize rows. The first output sample is written to the row
+ * ringPosition, the following ones to the next rows, after the last row
+ * it continues with row 0. If more samples come than the ring has rows
+ * only the last ringSize remain.
+ *
+ * INPUT: ringData        - The ring buffer (column major) with the size
+ *                          ringSize * chanl_selSize
+ *        ringSize        - The number of rows of the ring
+ *        ringPosition    - The row (starting with 0) of the first sample
+ *        the other arguments are the ones of filterDataRaw
+ *
+ * Returns 0 like filterDataRaw.
+ *
+ ************************************************************/
+/* reads the selected channels of sample t, as one row if possible */
+#define FILTER_READ_SAMPLE(TYPE) {                                  \
+    const TYPE* pSrc = (const TYPE*)sourceData + t * nChans;        \
+    if(contiguous) {                                                \
+      for(k = 0; k < nSel; ++k) {                                   \
+        x[k] = (double)pSrc[k];                                     \
+      }                                                             \
+    } else {                                                        \
+      for(k = 0; k < nSel; ++k) {                                   \
+        x[k] = (double)pSrc[channels[k]];                           \
+      }                                                             \
+    }                                                               \
+  }
+
+int filterDataRing(struct filterState *p, const void* sourceData, int elementType, int sourceDataSize, void* ringData, int outputType, int ringSize, int ringPosition, double* chan_sel, int chan_selSize, double* scale) {
+  int t;
+  int k;
+  int pDstPosition;
+  int nSel, nChans, contiguous;
+  int *channels;
+  int pos, historySize;
+  double *x, *y, *z, *history, *sums;
+  
+  if(!filterSelectChannels(p, chan_sel, chan_selSize)) {
+    return 0;
+  }
+  pDstPosition = ringPosition;
+  
+  /* local copies, so the compiler knows that nothing changes in the loops */
+  nSel = p->selCount;
+  nChans = p->channelCount;
+  channels = p->selChannels;
+  contiguous = p->selContiguous;
+  x = p->selX;
+  z = p->selZBuffer;
+  history = p->selHistory;
+  historySize = p->reSampleHistorySize;
+  pos = p->reSampleHistoryPos;
+  sums = p->selReSampleValues;
+  
+  for(t = 0; t < sourceDataSize; ++t) {
+    /* read the selected channels of this sample */
+    switch(elementType) {
+      case FILTER_INT16:
+        FILTER_READ_SAMPLE(int16_t);
+        break;
+      case FILTER_INT32:
+        FILTER_READ_SAMPLE(int32_t);
+        break;
+      default:
+        FILTER_READ_SAMPLE(float);
+        break;
+    }
+    
+    /* IIR filter or sections of all selected channels, the output is
+     * the newest row of the history */
+    if(++pos == historySize) {
+      pos = 0;
+    }
+    y = history + (size_t)pos * nSel;
+    filterStep(p, x, y, z, nSel);
+    
+    /* the output samples of the resample filter which are due now */
+    while(p->reSamplePhase < p->reSampleUp) {
+      filterResampleSum(p, history, pos, nSel, sums);
+      
+      if(FILTER_FLOAT32 == outputType) {
+        float *pDst = (float*)ringData + pDstPosition;
+        for(k = 0; k < nSel; ++k) {
+          pDst[(size_t)k * ringSize] = (float)(scale[channels[k]] * sums[k]);
+        }
+      } else {
+        double *pDst = (double*)ringData + pDstPosition;
+        for(k = 0; k < nSel; ++k) {
+          pDst[(size_t)k * ringSize] = scale[channels[k]] * sums[k];
+        }
       }
+      p->reSamplePhase += p->reSampleDown;
       pDstPosition++;
+      if(pDstPosition == ringSize) {
+        pDstPosition = 0;
+      }
+    }
+    p->reSamplePhase -= p->reSampleUp;
+  }
+  p->reSampleHistoryPos = pos;
+  
+  return 1;
+}
+
+#undef FILTER_READ_SAMPLE
+
+/************************************************************
+ *
+ * The number of output samples which the next nInput input samples give.
+ * You can use it to determine how big the filterData has to be for the
+ * filterData method.
+ *
+ ************************************************************/
+int filterOutputCount(const struct filterState *p, int nInput) {
+  int64_t v;
+  
+  if(nInput <= 0) {
+    return 0;
+  }
+  v = (int64_t)p->reSampleUp * nInput - p->reSamplePhase;
+  return v > 0 ? (int)((v + p->reSampleDown - 1) / p->reSampleDown) : 0;
+}
+
+/************************************************************
+ *
+ * The number of input samples which are needed for the next nOutput
+ * output samples.
+ *
+ ************************************************************/
+int filterInputCount(const struct filterState *p, int nOutput) {
+  int64_t v;
+  
+  if(nOutput <= 0) {
+    return 0;
+  }
+  /* the first outputs can be before the first input */
+  v = (int64_t)(nOutput - 1) * p->reSampleDown + p->reSamplePhase;
+  return v > 0 ? (int)(v / p->reSampleUp + 1) : 1;
+}
+
+/************************************************************
+ *
+ * The time of the input sample nInput (0 is the first one of the next
+ * call) in output samples, counted from the next output sample: the
+ * output sample filterInputTime(p, n) is at the time of the input
+ * sample n. With the delay of the resampler of filterSetResample this
+ * can be an output which the next call does not give yet. Markers at
+ * input samples are put with it on the output samples.
+ *
+ ************************************************************/
+double filterInputTime(const struct filterState *p, int nInput) {
+  return ((double)p->reSampleUp * nInput - p->reSamplePhase + p->reSampleDelay) / p->reSampleDown;
+}
+
+/************************************************************
+ *
+ * Set the values of the FIR filter of filterCreate. We assusme that the
+ * array has the same size as the initial FIR filter.
+ *
+ ************************************************************/
+void filterFIRSet(struct filterState *p, const double* filter) {
+  int k;
+  
+  for(k = 0; k < p->reSampleFilterSize; ++k) {
+    p->reSampleFilter[k] = filter[p->reSampleFilterSize - 1 - k];
+  }
+}
+
+int filterGetFIRSize(const struct filterState *p) {
+  return p->reSampleFilterSize;
+}
+
+/************************************************************
+ *
+ * The filter bank: nBands filters on the same channels, each one an IIR
+ * filter or a cascade of second order sections with its own state. The
+ * output of all bands is computed in one pass over the input.
+ *
+ ************************************************************/
+
+/* the samples of a block, the input and the output of a band stay in the cache */
+#define FILTERBANK_BLOCK 64
+
+struct filterBank {
+  int bandCount;                 /* the number of bands */
+  int channelCount;              /* the number of channels */
+  struct filterState **bands;    /* the filter of each band, its FIR filter is [1] */
+  int *stateRows;                /* the delays per channel and section of each band */
+  double *x;                     /* a block of input samples, one row per sample */
+  double *y;                     /* a block of output samples of one band */
+};
+
+/************************************************************
+ *
+ * Creates a filter bank with nBands bands for nChans channels. All bands
+ * pass the data unchanged until they get a filter with filterBankSetIIR
+ * or filterBankSetSOS. Returns NULL if there is not enough memory.
+ *
+ ************************************************************/
+struct filterBank *filterBankCreate(int nBands, int nChans) {
+  struct filterBank *p = (struct filterBank*)calloc(1, sizeof(struct filterBank));
+  double one = 1.0;
+  int b;
+  
+  if(NULL == p) {
+    return NULL;
+  }
+  p->bandCount = nBands;
+  p->channelCount = nChans;
+  p->bands = (struct filterState**)calloc(nBands, sizeof(struct filterState*));
+  p->stateRows = (int*)calloc(nBands, sizeof(int));
+  p->x = (double*)malloc((size_t)FILTERBANK_BLOCK * nChans * sizeof(double));
+  p->y = (double*)malloc((size_t)FILTERBANK_BLOCK * nChans * sizeof(double));
+  if(NULL == p->bands || NULL == p->stateRows || NULL == p->x || NULL == p->y) {
+    filterBankDestroy(p);
+    return NULL;
+  }
+  for(b = 0; b < nBands; ++b) {
+    p->bands[b] = filterCreate(NULL, NULL, 1, &one, 1, nChans);
+    if(NULL == p->bands[b]) {
+      filterBankDestroy(p);
+      return NULL;
+    }
+  }
+  return p;
+}
+
+/* Deletes the filters of all bands and the filter bank itself */
+void filterBankDestroy(struct filterBank *p) {
+  int b;
+  
+  if(NULL == p) {
+    return;
+  }
+  if(NULL != p->bands) {
+    for(b = 0; b < p->bandCount; ++b) {
+      filterDestroy(p->bands[b]);
     }
+    free(p->bands);
+  }
+  if(NULL != p->stateRows) {free(p->stateRows);}
+  if(NULL != p->x) {free(p->x);}
+  if(NULL != p->y) {free(p->y);}
+  free(p);
+}
 
-    pSrc += channelCount;
+/************************************************************
+ *
+ * Sets the IIR filter of a band, like filter(b, a, ...) of matlab: the
+ * shorter one of a and b is padded with zeros and both are divided by
+ * a[0]. The state of the band is cleared. Returns 0 if there is not
+ * enough memory, the old filter remains then.
+ *
+ ************************************************************/
+int filterBankSetIIR(struct filterBank *p, int band, const double* b, int nb, const double* a, int na) {
+  int fSize = nb > na ? nb : na;
+  double *buffer = (double*)calloc(2 * fSize, sizeof(double));
+  double *aFilter = buffer, *bFilter = buffer + fSize;
+  double one = 1.0;
+  struct filterState *f;
+  int i;
+  
+  if(NULL == buffer) {
+    return 0;
   }
+  for(i = 0; i < na; ++i) {
+    aFilter[i] = a[i] / a[0];
+  }
+  for(i = 0; i < nb; ++i) {
+    bFilter[i] = b[i] / a[0];
+  }
+  f = filterCreate(aFilter, bFilter, fSize, &one, 1, p->channelCount);
+  free(buffer);
+  if(NULL == f) {
+    return 0;
+  }
+  filterDestroy(p->bands[band]);
+  p->bands[band] = f;
+  p->stateRows[band] = fSize - 1;
+  return 1;
 }
 
 /************************************************************
  *
- * Get the position of the FIR filter. You can use it to determine
- * how big the filterData has to be for the filterData method.
+ * Sets a cascade of second order sections as the filter of a band. sos
+ * is the nSections x 6 matrix of filterCreateSOS. The state of the band
+ * is cleared. Returns 0 if there is not enough memory, the old filter
+ * remains then.
  *
  ************************************************************/
-static int getFIRPos() {
-  return reSampleFilterPosition;
+int filterBankSetSOS(struct filterBank *p, int band, const double* sos, int nSections) {
+  double one = 1.0;
+  struct filterState *f = filterCreateSOS(sos, nSections, &one, 1, p->channelCount);
+  
+  if(NULL == f) {
+    return 0;
+  }
+  filterDestroy(p->bands[band]);
+  p->bands[band] = f;
+  p->stateRows[band] = 2;
+  return 1;
 }
 
 /************************************************************
  *
- * Set the values of the FIR filter. We assusme that the array has the same
- * size as the initial FIR filter.
+ * The shape of the state of a band in the layout of filterBankGetState:
+ * rows x nChans x sections. An IIR filter has order rows and one
+ * section, second order sections have two rows each.
  *
  ************************************************************/
-static void filterFIRSet(double* filter) {
-  memcpy(reSampleFilter,filter,reSampleFilterSize * sizeof(double));
+void filterBankStateShape(const struct filterBank *p, int band, int *rows, int *sections) {
+  const struct filterState *f = p->bands[band];
+  
+  *rows = p->stateRows[band];
+  *sections = 0 != f->sosCount ? f->sosCount : 1;
+}
+
+/************************************************************
+ *
+ * Copies the state of a band from or to state, in the layout of matlab:
+ * for an IIR filter the zf of filter (order x nChans), for second order
+ * sections 2 x nChans x nSections like online_filt. Internally the
+ * channels are interleaved, see filterIIRScalar.
+ *
+ ************************************************************/
+static void filterBankCopyState(const struct filterBank *p, int band, double *state, int toState) {
+  const struct filterState *f = p->bands[band];
+  int n = p->channelCount;
+  int rows, sections;
+  int s, i, k;
+  
+  filterBankStateShape(p, band, &rows, &sections);
+  for(s = 0; s < sections; ++s) {
+    for(k = 0; k < n; ++k) {
+      for(i = 0; i < rows; ++i) {
+        double *m = state + i + (size_t)rows * (k + (size_t)n * s);
+        double *z = f->zBuffer + (size_t)(s * rows + i) * n + k;
+        
+        if(toState) {
+          *m = *z;
+        } else {
+          *z = *m;
+        }
+      }
+    }
+  }
+}
+
+void filterBankGetState(const struct filterBank *p, int band, double *state) {
+  filterBankCopyState(p, band, state, 1);
 }
 
-static int filterGetFIRSize() {
-  return reSampleFilterSize;
+void filterBankSetState(struct filterBank *p, int band, const double *state) {
+  filterBankCopyState(p, band, (double*)state, 0);
+}
+
+/************************************************************
+ *
+ * Filters the data with all bands.
+ * INPUT: sourceData   - nSamples x nChans, column major like matlab
+ *        nSamples     - The number of samples
+ *        filterData   - Gets nSamples x (nBands * nChans), column major:
+ *                       channel k of band b is column b * nChans + k
+ *
+ * The samples are done in blocks. The input block is read once and
+ * transposed into rows, then each band filters the whole block with its
+ * state in the cache and writes its columns of the output.
+ *
+ ************************************************************/
+void filterBankData(struct filterBank *p, const double* sourceData, int nSamples, double* filterData) {
+  int n = p->channelCount;
+  int t0, t, k, b, m;
+  
+  for(t0 = 0; t0 < nSamples; t0 += FILTERBANK_BLOCK) {
+    m = nSamples - t0 < FILTERBANK_BLOCK ? nSamples - t0 : FILTERBANK_BLOCK;
+    
+    for(k = 0; k < n; ++k) {
+      const double *src = sourceData + (size_t)k * nSamples + t0;
+      
+      for(t = 0; t < m; ++t) {
+        p->x[t * n + k] = src[t];
+      }
+    }
+    
+    for(b = 0; b < p->bandCount; ++b) {
+      struct filterState *f = p->bands[b];
+      
+      for(t = 0; t < m; ++t) {
+        filterStep(f, p->x + t * n, p->y + t * n, f->zBuffer, n);
+      }
+      for(k = 0; k < n; ++k) {
+        double *dst = filterData + ((size_t)b * n + k) * nSamples + t0;
+        
+        for(t = 0; t < m; ++t) {
+          dst[t] = p->y[t * n + k];
+        }
+      }
+    }
+  }
 }
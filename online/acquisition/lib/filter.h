@@ -2,9 +2,11 @@
  * filter.h
  *
  * This is the header filer for filter.c. It contains the declarations for 
- * the functions in filter.h and hides the static variables in filter.c
+ * the functions in filter.c. The state of a filter is hidden behind the
+ * pointer which filterCreate returns.
  *
- * The file is currently used in acquire_bv.c, acquire_gtec.c and read_bv.c
+ * The file is currently used in bbci_acquire_bv.cpp, read_bv.c and
+ * apply_filterbank.c, all compile filter.c with them.
  *
  * 2009/01/09 - Max Sagebaum
  *              - file created
@@ -14,20 +16,69 @@
  *              - The signature of the method filterData was changed
  * 2010/08/26 - Max Sagebaum
  *              - Added a function to get the filter size of the fir filter.
+ * 2026/10/17 - Jonas Reiter
+ *              - Added filterDataRaw.
+ *              - Added filterSetState.
+ *              - filterDataRaw reads float32 values and can write single
+ *                precision output.
+ *              - Added filterDataRing.
+ *              - filterDataRaw and filterDataRing return 0 if there is not
+ *                enough memory for a new channel selection.
+ *              - filter.c is no longer included here but compiled on its
+ *                own. filterCreate, filterReset and filterDestroy replace
+ *                filterFIRCreate, filterIIRCreate, filterClose and
+ *                filterSetState, all other functions take the filter.
+ *                getFIRPos is now filterGetFIRPos.
+ *              - Added filterCreateSOS.
+ *              - Added filterSetResample and filterResampleFactors, the
+ *                resample filter can be a polyphase decimator or a rational
+ *                resampler. filterOutputCount and filterInputCount replace
+ *                filterGetFIRPos, filterData returns the number of samples
+ *                it wrote. filterInputTime gives the position of a marker.
+ *              - Added the filter bank: filterBankCreate, filterBankSetIIR,
+ *                filterBankSetSOS, filterBankData and the state functions.
  */
 
 #ifndef FILTER_H
 #define FILTER_H
 
-#include "filter.c"
+/* The types of the values for filterDataRaw. The numbers are the same as
+ * for HDR.BinaryFormat of read_bv. */
+#define FILTER_INT16    1
+#define FILTER_INT32    2
+#define FILTER_FLOAT32  3
+#define FILTER_FLOAT64  4
 
-static void filterFIRCreate(double* filter, int size, int nChans);
-static void filterIIRCreate(double* aFilterPtr, double* bFilterPtr,int fSize, int nChans);
-static void filterClose();
-static double filterDataIIR(double value, int channel);
-static void filterData(double* sourceData, int sourceDataSize, double* filterData, int filterDataSize,double* chan_sel, int chan_selSize, double* scale);
-static int getFIRPos();
-static void filterFIRSet(double* filter);
-static int filterGetFIRSize();
+/* an IIR and a resample filter for a number of channels */
+struct filterState;
+
+struct filterState *filterCreate(const double* aFilterPtr, const double* bFilterPtr, int fSize,
+                                 const double* firFilter, int firSize, int nChans);
+struct filterState *filterCreateSOS(const double* sos, int nSections,
+                                    const double* firFilter, int firSize, int nChans);
+void filterReset(struct filterState *p);
+void filterDestroy(struct filterState *p);
+int filterData(struct filterState *p, const double* sourceData, int sourceDataSize, double* filterData, int filterDataSize,double* chan_sel, int chan_selSize, double* scale);
+int filterDataRaw(struct filterState *p, const void* sourceData, int elementType, int sourceDataSize, void* filterData, int outputType, int filterDataSize, double* chan_sel, int chan_selSize, double* scale);
+int filterDataRing(struct filterState *p, const void* sourceData, int elementType, int sourceDataSize, void* ringData, int outputType, int ringSize, int ringPosition, double* chan_sel, int chan_selSize, double* scale);
+int filterSetResample(struct filterState *p, const double* filter, int size, int up, int down);
+void filterResampleFactors(int fsIn, int fsOut, int *up, int *down);
+int filterOutputCount(const struct filterState *p, int nInput);
+int filterInputCount(const struct filterState *p, int nOutput);
+double filterInputTime(const struct filterState *p, int nInput);
+void filterFIRSet(struct filterState *p, const double* filter);
+int filterGetFIRSize(const struct filterState *p);
+
+/* several IIR or SOS filters on the same channels, see filterBankData */
+struct filterBank;
+
+struct filterBank *filterBankCreate(int nBands, int nChans);
+void filterBankDestroy(struct filterBank *p);
+int filterBankSetIIR(struct filterBank *p, int band, const double* b, int nb, const double* a, int na);
+int filterBankSetSOS(struct filterBank *p, int band, const double* sos, int nSections);
+void filterBankStateShape(const struct filterBank *p, int band, int *rows, int *sections);
+void filterBankGetState(const struct filterBank *p, int band, double *state);
+void filterBankSetState(struct filterBank *p, int band, const double *state);
+void filterBankData(struct filterBank *p, const double* sourceData, int nSamples, double* filterData);
 
 #endif
\ No newline at end of file
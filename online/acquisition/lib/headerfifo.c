@@ -4,64 +4,503 @@
 */
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include "headerfifo.h"
+#include "acthreads.h"
 
-struct headerFIFO fifo = { 0, 0, 0 };
+#ifdef _WIN32
+#  include <windows.h>
+#  define FIFO_BARRIER() MemoryBarrier()
+#  define FIFO_CAS(p, old, new) (InterlockedCompareExchange((p), (new), (old)) == (old))
+#else
+#  define FIFO_BARRIER() __sync_synchronize()
+#  define FIFO_CAS(p, old, new) __sync_bool_compare_and_swap((p), (old), (new))
+#endif
 
-void headerFIFOpush(struct headerFIFO *p, RMH *h)
+/* the states of readLock */
+#define FIFO_LOCK_FREE      0
+#define FIFO_LOCK_READING   1     /* the consumer is between beginRead and endRead */
+#define FIFO_LOCK_DROPPING  2     /* the producer moves the read positions */
+
+/* the record in front of every block in the spill file */
+struct fifoSpillRecord
+{
+  double arrival;
+  ULONG missing;                  /* of the block record */
+  ULONG size;                     /* of the message */
+  ULONG nPoints;
+  ULONG nMarkers;
+};
+
+/* the sizes of the rings as allocated by headerFIFOcreate */
+#define FIFO_DATA_BYTES(p)    ((size_t)(p)->capacity * (p)->nChannels * FIFO_MAX_ELEMENT_SIZE)
+#define FIFO_MARKER_BYTES(p)  ((size_t)(p)->markerCapacity * sizeof(struct headerFIFOMarker))
+#define FIFO_BLOCK_BYTES(p)   ((size_t)(p)->blockCapacity * sizeof(struct headerFIFOBlock))
+
+/*
+  Allocates the sample and the marker ring. capacity is the number of
+  samples (of all channels) the ring can hold, it is rounded up to a power
+  of two so that the positions can wrap around. policy is one of the
+  FIFO_ values, FIFO_SPILL opens the spill file.
+  Returns 0 on success and -1 if the ring is larger than FIFO_MAX_BYTES or
+  the memory or the file could not be allocated.
+*/
+int headerFIFOcreate(struct headerFIFO *p, ULONG capacity, ULONG nChannels, int policy)
 {
-  if(FIFOMAXLEN > 0 && p->length > FIFOMAXLEN) {
-    /* dropping a packet! */
-    free(h);
+  ULONG size = 1;
+
+  memset(p, 0, sizeof(struct headerFIFO));
+
+  if (0 == nChannels || capacity > FIFO_MAX_BYTES / (nChannels * FIFO_MAX_ELEMENT_SIZE)) return -1;
+  while (size < capacity) size <<= 1;
+  if (size > FIFO_MAX_BYTES / (nChannels * FIFO_MAX_ELEMENT_SIZE)) return -1;
+  capacity = size;
+
+  p->data = (char *)malloc((size_t)capacity * nChannels * FIFO_MAX_ELEMENT_SIZE);
+  p->markers = (struct headerFIFOMarker *)
+    malloc(FIFO_MARKER_CAPACITY * sizeof(struct headerFIFOMarker));
+  p->blocks = (struct headerFIFOBlock *)
+    malloc(FIFO_BLOCK_CAPACITY * sizeof(struct headerFIFOBlock));
+  if (!p->data || !p->markers || !p->blocks) {
+    headerFIFOdestroy(p);
+    return -1;
   }
-  else {
-    struct headerFIFONode *n = malloc(sizeof(struct headerFIFONode));
-    n->prev = 0;
-    n->next = 0;
-    n->payload = h;
 
-    /* 1st case: list is empty */
-    if (!p->first && !p->last) {
-        p->first = n;
-        p->last = n;
+  p->capacity = capacity;
+  p->nChannels = nChannels;
+  p->markerCapacity = FIFO_MARKER_CAPACITY;
+  p->blockCapacity = FIFO_BLOCK_CAPACITY;
+
+  p->policy = policy;
+  if (FIFO_SPILL == policy) {
+    p->spill = tmpfile();
+    if (!p->spill) {
+      headerFIFOdestroy(p);
+      return -1;
     }
-    else {
-      /* 2nd case: at least one element in list -> everything is easy. */
-        p->first->prev = n;
-        n->next = p->first;
-        p->first = n;
+  }
+
+  return 0;
+}
+
+
+void headerFIFOdestroy(struct headerFIFO *p)
+{
+  if (p->locked) {
+    acUnlockMemory(p->data, FIFO_DATA_BYTES(p));
+    acUnlockMemory(p->markers, FIFO_MARKER_BYTES(p));
+    acUnlockMemory(p->blocks, FIFO_BLOCK_BYTES(p));
+  }
+  if (p->data) free(p->data);
+  if (p->markers) free(p->markers);
+  if (p->blocks) free(p->blocks);
+  if (p->spill) fclose(p->spill);
+  if (p->spillMessage) free(p->spillMessage);
+  memset(p, 0, sizeof(struct headerFIFO));
+}
+
+
+/*
+  Locks the rings in memory, so the poll thread never waits for a page
+  fault when it stores a block. Returns 0 or an errno value.
+*/
+int headerFIFOlock(struct headerFIFO *p)
+{
+  int result;
+
+  if (p->locked) return 0;
+  result = acLockMemory(p->data, FIFO_DATA_BYTES(p));
+  if (0 == result) result = acLockMemory(p->markers, FIFO_MARKER_BYTES(p));
+  if (0 == result) result = acLockMemory(p->blocks, FIFO_BLOCK_BYTES(p));
+  if (0 != result) {
+    acUnlockMemory(p->data, FIFO_DATA_BYTES(p));
+    acUnlockMemory(p->markers, FIFO_MARKER_BYTES(p));
+    return result;
+  }
+
+  p->locked = 1;
+  return 0;
+}
+
+
+/* does a block with nPoints samples and nMarkers markers fit into the rings? */
+static int fifoFits(struct headerFIFO *p, ULONG nPoints, ULONG nMarkers)
+{
+  return nPoints <= p->capacity - (p->writePos - p->readPos)
+    && nMarkers <= p->markerCapacity - (p->markerWritePos - p->markerReadPos)
+    && p->blockWritePos - p->blockReadPos < p->blockCapacity;
+}
+
+
+/*
+  Checks that the samples and all markers of a data block lie within the
+  message, the sizes come from the socket. Returns 0 if they do and -1 if
+  the block is malformed or truncated.
+*/
+int headerFIFOcheckBlock(const struct RDA_MessageData *pmd, ULONG nChannels, int elementSize)
+{
+  ULONG offset = (ULONG)offsetof(struct RDA_MessageData, nData);
+  ULONG blockSize = nChannels * (ULONG)elementSize;
+  ULONG m;
+
+  if (pmd->nSize < offset) return -1;
+  if (blockSize > 0 && pmd->nPoints > (pmd->nSize - offset) / blockSize) return -1;
+  offset += pmd->nPoints * blockSize;
+
+  for (m = 0; m < pmd->nMarkers; m++) {
+    const struct RDA_Marker *pma;
+
+    if (pmd->nSize - offset < (ULONG)offsetof(struct RDA_Marker, sTypeDesc)) return -1;
+    pma = (const struct RDA_Marker *)((const char *)pmd + offset);
+    if (pma->nSize < (ULONG)offsetof(struct RDA_Marker, sTypeDesc)
+        || pma->nSize > pmd->nSize - offset) {
+      return -1;
     }
+    offset += pma->nSize;
+  }
 
-    p->length++;
+  return 0;
+}
+
+
+/* counts a block which is lost */
+static void fifoDrop(struct headerFIFO *p, ULONG nPoints, ULONG nMarkers)
+{
+  p->overflowBlocks++;
+  p->overflowSamples += nPoints;
+  p->overflowMarkers += nMarkers;
+}
+
+
+/*
+  Copies the samples and markers of one data block into the rings and
+  publishes it. The block has to fit and to be checked with
+  headerFIFOcheckBlock. missing goes into the block record.
+*/
+static void fifoStore(struct headerFIFO *p, struct RDA_MessageData *pmd, double arrival,
+                      ULONG missing)
+{
+  ULONG w = p->writePos;
+  ULONG mw = p->markerWritePos;
+  ULONG bw = p->blockWritePos;
+  ULONG nPoints = pmd->nPoints;
+  ULONG blockSize = p->nChannels * p->elementSize;
+  ULONG start, first, m;
+  struct RDA_Marker *pma;
+  struct headerFIFOBlock *pfb;
+
+  /* the samples, in at most two pieces if we wrap around */
+  start = w & (p->capacity - 1);
+  first = p->capacity - start;
+  if (first > nPoints) first = nPoints;
+  memcpy(p->data + start * blockSize, pmd->nData, first * blockSize);
+  if (first < nPoints) {
+    memcpy(p->data, (char *)pmd->nData + first * blockSize,
+           (nPoints - first) * blockSize);
+  }
+
+  /* the markers, with positions relative to the start of the stream */
+  pma = (struct RDA_Marker *)((char *)pmd->nData + nPoints * blockSize);
+  for (m = 0; m < pmd->nMarkers; m++) {
+    struct headerFIFOMarker *pfm = p->markers + ((mw + m) & (p->markerCapacity - 1));
+    ULONG len = pma->nSize - (ULONG)(pma->sTypeDesc - (char *)pma);
+
+    if (len > FIFO_MARKER_DESC_LEN - 2) len = FIFO_MARKER_DESC_LEN - 2;
+    pfm->nPosition = w + pma->nPosition;
+    pfm->nPoints = pma->nPoints;
+    pfm->nChannel = pma->nChannel;
+    memcpy(pfm->sTypeDesc, pma->sTypeDesc, len);
+    pfm->sTypeDesc[len] = 0;
+    pfm->sTypeDesc[len + 1] = 0;
+
+    pma = (struct RDA_Marker *)((char *)pma + pma->nSize);
   }
+
+  p->writePos = w + nPoints;
+  p->markerWritePos = mw + pmd->nMarkers;
+
+  pfb = p->blocks + (bw & (p->blockCapacity - 1));
+  pfb->nBlock = pmd->nBlock;
+  pfb->nPoints = nPoints;
+  pfb->endPos = p->writePos;
+  pfb->endMarker = p->markerWritePos;
+  pfb->missing = missing;
+  pfb->arrival = arrival;
+
+  if (p->writePos - p->readPos > p->highWater) {
+    p->highWater = p->writePos - p->readPos;
+  }
+  p->pushedBlocks++;
+
+  /* make the data visible before the block */
+  FIFO_BARRIER();
+  p->blockWritePos = bw + 1;
 }
 
 
+/*
+  FIFO_DROP_OLDEST: moves the read positions past the oldest blocks
+  until nPoints samples and nMarkers markers fit. The dropped samples
+  are counted as overflow, so they are in the missing count of the next
+  block. Returns -1 if the block can never fit or if the consumer is
+  reading.
+*/
+static int fifoDropOldest(struct headerFIFO *p, ULONG nPoints, ULONG nMarkers)
+{
+  if (nPoints > p->capacity || nMarkers > p->markerCapacity) return -1;
+  if (!FIFO_CAS(&p->readLock, FIFO_LOCK_FREE, FIFO_LOCK_DROPPING)) return -1;
+
+  while (!fifoFits(p, nPoints, nMarkers) && p->blockReadPos != p->blockWritePos) {
+    const struct headerFIFOBlock *pfb = p->blocks + (p->blockReadPos & (p->blockCapacity - 1));
+
+    fifoDrop(p, pfb->nPoints, pfb->endMarker - p->markerReadPos);
+    p->droppedOldest++;
+    p->readPos = pfb->endPos;
+    p->markerReadPos = pfb->endMarker;
+    p->blockReadPos++;
+  }
+
+  FIFO_BARRIER();
+  p->readLock = FIFO_LOCK_FREE;
+  return 0;
+}
 
-RMH *headerFIFOpop(struct headerFIFO *p)
+
+/*
+  FIFO_SPILL: appends the block to the spill file. Returns -1 if the file
+  is full or can not be written.
+*/
+static int fifoSpill(struct headerFIFO *p, struct RDA_MessageData *pmd, double arrival)
 {
-    RMH *h = 0;
-    struct headerFIFONode *n = p->last;
+  struct fifoSpillRecord r;
+
+  if (pmd->nPoints > p->capacity || pmd->nMarkers > p->markerCapacity
+      || p->spillWrite + (long)(sizeof(r) + pmd->nSize) > FIFO_SPILL_MAX_BYTES) {
+    return -1;
+  }
+
+  r.arrival = arrival;
+  r.missing = p->overflowSamples + p->gapSamples;
+  r.size = pmd->nSize;
+  r.nPoints = pmd->nPoints;
+  r.nMarkers = pmd->nMarkers;
+  if (fseek(p->spill, p->spillWrite, SEEK_SET) != 0
+      || fwrite(&r, sizeof(r), 1, p->spill) != 1
+      || fwrite(pmd, pmd->nSize, 1, p->spill) != 1) {
+    return -1;
+  }
 
-    /* case 1: empty fifo */
-    if (!n) return 0;
+  p->spillWrite += (long)(sizeof(r) + pmd->nSize);
+  p->spillSamples += pmd->nPoints;
+  p->spillBlocks++;
+  p->spilledBlocks++;
+  return 0;
+}
+
+
+/*
+  FIFO_SPILL: moves the blocks from the spill file into the ring as long
+  as they fit. If the file can not be read the waiting blocks are lost.
+  Returns the number of blocks which were stored.
+*/
+static int fifoUnspill(struct headerFIFO *p)
+{
+  struct fifoSpillRecord r;
+  int stored = 0;
 
-    /* case 2: only one element */
-    else if(p->first == n) {
-        h = n->payload;
-        free(n);
-        p->first = 0;
-        p->last = 0;
+  while (p->spillBlocks > 0) {
+    if (fseek(p->spill, p->spillRead, SEEK_SET) != 0
+        || fread(&r, sizeof(r), 1, p->spill) != 1) {
+      break;
     }
-    /* case 3: more than one element */
-    else {
-        h = n->payload;
-        p->last = n->prev;
-        n->prev->next = 0;
-        free(n);
+    if (!fifoFits(p, r.nPoints, r.nMarkers)) return stored;
+
+    if (r.size > p->spillMessageSize) {
+      char *message = (char *)realloc(p->spillMessage, r.size);
+
+      if (!message) break;
+      p->spillMessage = message;
+      p->spillMessageSize = r.size;
     }
+    if (fread(p->spillMessage, r.size, 1, p->spill) != 1) break;
+
+    fifoStore(p, (struct RDA_MessageData *)p->spillMessage, r.arrival, r.missing);
+    p->spillRead += (long)(sizeof(r) + r.size);
+    p->spillSamples -= r.nPoints;
+    p->spillBlocks--;
+    stored++;
+  }
+
+  if (p->spillBlocks > 0) {
+    /* the file is broken */
+    p->overflowBlocks += p->spillBlocks;
+    p->overflowSamples += p->spillSamples;
+    p->spillBlocks = 0;
+    p->spillSamples = 0;
+  }
+  p->spillRead = 0;
+  p->spillWrite = 0;
+
+  return stored;
+}
+
+
+/*
+  Stores one data block. A block which does not fit is handled as the
+  policy says, a malformed one is dropped and counted in badBlocks.
+  Returns 1 if blocks were stored, i.e. the consumer has something new,
+  0 if not.
+
+  Only the poll thread calls this function.
+*/
+int headerFIFOpush(struct headerFIFO *p, struct RDA_MessageData *pmd, int elementSize,
+                   double arrival)
+{
+  int stored = 0;
+
+  /* nothing of it can be trusted, not even the counts for fifoDrop */
+  if (headerFIFOcheckBlock(pmd, p->nChannels, elementSize) != 0) {
+    p->badBlocks++;
+    return 0;
+  }
+
+  if (0 == p->elementSize) {
+    p->elementSize = elementSize;
+    p->messageType = pmd->nType;
+  }
 
-    p->length--;
+  if (elementSize != p->elementSize || pmd->nType != p->messageType) {
+    fifoDrop(p, pmd->nPoints, pmd->nMarkers);
+    return 0;
+  }
+
+  /* the blocks which wait on disk go first */
+  if (p->spillBlocks > 0) stored = fifoUnspill(p);
+
+  if (0 == p->spillBlocks && fifoFits(p, pmd->nPoints, pmd->nMarkers)) {
+    fifoStore(p, pmd, arrival, p->overflowSamples + p->gapSamples);
+    return 1;
+  }
+
+  if (FIFO_DROP_OLDEST == p->policy && 0 == fifoDropOldest(p, pmd->nPoints, pmd->nMarkers)) {
+    fifoStore(p, pmd, arrival, p->overflowSamples + p->gapSamples);
+    return 1;
+  }
+  if (FIFO_SPILL == p->policy && 0 == fifoSpill(p, pmd, arrival)) {
+    return stored > 0;
+  }
+
+  /* dropping a packet! */
+  fifoDrop(p, pmd->nPoints, pmd->nMarkers);
+  return stored > 0;
+}
+
+
+/*
+  The consumer holds the read lock while it reads and consumes, so that
+  FIFO_DROP_OLDEST does not move the data away under its feet. The
+  producer only holds the lock while it drops a few block records.
+*/
+void headerFIFObeginRead(struct headerFIFO *p)
+{
+  while (!FIFO_CAS(&p->readLock, FIFO_LOCK_FREE, FIFO_LOCK_READING)) {
+    /* spin, the producer is done in a moment */
+  }
+}
+
+
+void headerFIFOendRead(struct headerFIFO *p)
+{
+  FIFO_BARRIER();
+  p->readLock = FIFO_LOCK_FREE;
+}
 
-    return h;
+
+/*
+  Returns the number of samples which can be read. If pMarkers is not null
+  it is set to the number of markers which belong to these samples, pBlocks
+  likewise to the number of blocks. Everything is taken from the record of
+  the last published block, there is no need to walk through the blocks.
+
+  Only the consumer calls this function and the following ones.
+*/
+ULONG headerFIFOavailable(struct headerFIFO *p, ULONG *pMarkers, ULONG *pBlocks)
+{
+  ULONG bw = p->blockWritePos;
+  ULONG br = p->blockReadPos;
+  const struct headerFIFOBlock *pfb;
+
+  FIFO_BARRIER();
+
+  if (pBlocks) *pBlocks = bw - br;
+  if (bw == br) {
+    if (pMarkers) *pMarkers = 0;
+    return 0;
+  }
+
+  pfb = p->blocks + ((bw - 1) & (p->blockCapacity - 1));
+  if (pMarkers) *pMarkers = pfb->endMarker - p->markerReadPos;
+  return pfb->endPos - p->readPos;
+}
+
+
+/*
+  Copies nPoints samples from the start of the ring to dst.
+*/
+void headerFIFOread(struct headerFIFO *p, void *dst, ULONG nPoints)
+{
+  ULONG blockSize = p->nChannels * p->elementSize;
+  ULONG start = p->readPos & (p->capacity - 1);
+  ULONG first = p->capacity - start;
+
+  if (first > nPoints) first = nPoints;
+  memcpy(dst, p->data + start * blockSize, first * blockSize);
+  if (first < nPoints) {
+    memcpy((char *)dst + first * blockSize, p->data, (nPoints - first) * blockSize);
+  }
+}
+
+
+/*
+  Copies the next nMarkers markers to dst. The positions are made relative
+  to the first unread sample.
+*/
+void headerFIFOreadMarkers(struct headerFIFO *p, struct headerFIFOMarker *dst, ULONG nMarkers)
+{
+  ULONG start = p->markerReadPos & (p->markerCapacity - 1);
+  ULONG first = p->markerCapacity - start;
+  ULONG m;
+
+  if (first > nMarkers) first = nMarkers;
+  memcpy(dst, p->markers + start, first * sizeof(struct headerFIFOMarker));
+  if (first < nMarkers) {
+    memcpy(dst + first, p->markers, (nMarkers - first) * sizeof(struct headerFIFOMarker));
+  }
+
+  for (m = 0; m < nMarkers; m++) {
+    dst[m].nPosition -= p->readPos;
+  }
+}
+
+
+/*
+  Returns the record of the idx-th unread block.
+*/
+const struct headerFIFOBlock *headerFIFOblock(struct headerFIFO *p, ULONG idx)
+{
+  return p->blocks + ((p->blockReadPos + idx) & (p->blockCapacity - 1));
+}
+
+
+/*
+  Releases nPoints samples, nMarkers markers and nBlocks blocks to the
+  producer.
+*/
+void headerFIFOconsume(struct headerFIFO *p, ULONG nPoints, ULONG nMarkers, ULONG nBlocks)
+{
+  FIFO_BARRIER();
+  p->blockReadPos += nBlocks;
+  p->markerReadPos += nMarkers;
+  p->readPos += nPoints;
 }
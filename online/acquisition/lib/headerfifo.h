@@ -7,34 +7,186 @@
   Written by Mikio Braun, mikio@first.fhg.de
 
   (c) Fraunhofer FIRST.IDA 2005
+
+  - 2026/10/17 - Jonas Reiter
+                 - The linked list of messages was replaced by a
+                   preallocated single-producer/single-consumer ring. The
+                   poll thread copies the samples of every data block into
+                   one contiguous buffer of capacity * nChannels values and
+                   the markers into a second ring of fixed size records.
+                   Nothing is allocated per block. Blocks which do not fit
+                   into the ring are dropped and counted in the overflow
+                   counters.
+                 - Blocks whose samples or markers do not lie within the
+                   message are dropped and counted.
+                 - The block records carry the number of samples which were
+                   lost before the block, so the reader knows where gaps
+                   are.
+                 - Counters for the telemetry: pushed blocks, gaps,
+                   duplicates and the high-water mark of the ring. The block
+                   records carry the arrival time of the block.
+                 - The message type of the first block is kept, blocks of
+                   another type are dropped.
+                 - headerFIFOlock keeps the rings in memory.
+                 - The capacity is given at creation and the policy for
+                   blocks which do not fit: drop the newest block as before,
+                   drop the oldest blocks or write the block to a spill file
+                   until there is room again.
 */
 
 #ifndef HEADER_FIFO_H
 #define HEADER_FIFO_H
 
+#include <stdio.h>
 #include "myRDA.h"
 
 /* fifo data structures */
 typedef struct RDA_MessageHeader RMH;
 
-struct headerFIFONode
+/* The largest size of one value in a data block (int32) */
+#define FIFO_MAX_ELEMENT_SIZE     4
+
+/* Default capacity of the sample ring in seconds */
+#define FIFO_DEFAULT_SECONDS      10
+
+/* The largest sample ring in bytes, the offsets into it are ULONG */
+#define FIFO_MAX_BYTES            0x80000000UL
+
+/* What headerFIFOpush does with a block which does not fit into the ring */
+#define FIFO_DROP_NEWEST          0   /* the block is dropped */
+#define FIFO_DROP_OLDEST          1   /* the oldest blocks are dropped to make room */
+#define FIFO_SPILL                2   /* the block waits in a file until there is room */
+
+/* The most bytes which may wait in the spill file, then blocks are dropped */
+#define FIFO_SPILL_MAX_BYTES      (1024L * 1024L * 1024L)
+
+/* Number of marker records in the marker ring */
+#define FIFO_MARKER_CAPACITY      4096
+
+/* Space for the type and description string of one marker */
+#define FIFO_MARKER_DESC_LEN      64
+
+/* Number of block records in the block ring */
+#define FIFO_BLOCK_CAPACITY       4096
+
+/*
+  One marker in the marker ring. nPosition is the absolute position of
+  the marker in the sample stream, i.e. it is directly comparable with
+  readPos and writePos of the fifo.
+*/
+struct headerFIFOMarker
 {
-        struct headerFIFONode *prev, *next;
-        RMH *payload;
+  ULONG nPosition;
+  ULONG nPoints;
+  long  nChannel;
+  char  sTypeDesc[FIFO_MARKER_DESC_LEN]; /* type and description delimited by '\0' */
 };
 
-struct headerFIFO
+/*
+  One record per pushed data block. endPos and endMarker are the write
+  positions of the sample and the marker ring after the block, so one
+  record gives the reader a consistent view of both rings. missing is the
+  number of samples which were lost up to this block, in dropped blocks
+  and in gaps of the block numbers. arrival is the time in ms at which the
+  block was received.
+*/
+struct headerFIFOBlock
 {
-    int length;
-    struct headerFIFONode *first;
-    struct headerFIFONode *last;
+  ULONG nBlock;
+  ULONG nPoints;
+  ULONG endPos;
+  ULONG endMarker;
+  ULONG missing;
+  double arrival;
 };
 
-extern struct headerFIFO fifo;
+/*
+  The ring. readPos and writePos count the samples which were consumed and
+  written since the start of the connection. The producer (the poll
+  thread) only writes the write positions, the consumer only writes the
+  read positions. A block becomes visible to the consumer when its record
+  is published with blockWritePos. The overflow counters are only written
+  by the producer, like all the other counters.
+
+  FIFO_DROP_OLDEST is the exception: there the producer moves the read
+  positions past the oldest blocks. It may only do so while it owns
+  readLock, which the consumer holds from headerFIFObeginRead to
+  headerFIFOendRead. If the consumer is reading just then, the producer
+  does not wait but drops the new block.
+
+  With FIFO_SPILL the blocks which do not fit are appended to a
+  temporary file as they came from the server. Every push first moves
+  as many of them back into the ring as fit, new blocks go to the file
+  as long as older ones wait there, so the order is kept. The file is
+  written and read with blocking stdio calls in headerFIFOpush, i.e. on
+  the thread which receives the data, also if it runs with real-time
+  priority. While blocks are spilled each push may wait for the disk,
+  and the socket is not read in that time. The spill is meant for
+  consumers which are late for seconds, the kernel socket buffer has to
+  bridge the stalls. overflowBlocks only counts the blocks which are
+  lost, spilledBlocks the ones which went through the file.
+*/
+struct headerFIFO
+{
+  char *data;                         /* capacity * nChannels values */
+  ULONG capacity;                     /* size of the ring in samples */
+  ULONG nChannels;
+  int   elementSize;                  /* set with the first data block */
+  ULONG messageType;                  /* likewise, the type of the data messages */
+  volatile ULONG writePos;
+  volatile ULONG readPos;
+
+  struct headerFIFOMarker *markers;
+  ULONG markerCapacity;
+  volatile ULONG markerWritePos;
+  volatile ULONG markerReadPos;
+
+  struct headerFIFOBlock *blocks;
+  ULONG blockCapacity;
+  volatile ULONG blockWritePos;
+  volatile ULONG blockReadPos;
+
+  volatile ULONG overflowBlocks;      /* blocks dropped because the ring was full */
+  volatile ULONG overflowSamples;     /* samples in the dropped blocks */
+  volatile ULONG overflowMarkers;     /* markers in the dropped blocks */
+  volatile ULONG badBlocks;           /* malformed blocks, which were dropped */
+  volatile ULONG gapSamples;          /* samples the server never sent us */
+  volatile ULONG gapCount;            /* gaps in the block numbers */
+  volatile ULONG duplicateBlocks;     /* blocks which were received twice */
+  volatile ULONG pushedBlocks;        /* blocks stored in the ring */
+  volatile ULONG highWater;           /* most samples ever waiting in the ring */
+  int locked;                         /* the rings are locked in memory */
+
+  int policy;                         /* FIFO_DROP_NEWEST, _DROP_OLDEST or _SPILL */
+  volatile long readLock;             /* see FIFO_DROP_OLDEST above */
+  volatile ULONG droppedOldest;       /* blocks dropped to make room, also in overflowBlocks */
+
+  FILE *spill;                        /* FIFO_SPILL: the blocks which did not fit */
+  long spillRead;                     /* the offset of the first waiting block */
+  long spillWrite;                    /* the end of the waiting blocks */
+  char *spillMessage;                 /* one block read back from the file */
+  ULONG spillMessageSize;
+  volatile ULONG spillBlocks;         /* blocks waiting in the file */
+  ULONG spillSamples;                 /* samples in these blocks */
+  volatile ULONG spilledBlocks;       /* blocks which went through the file */
+};
 
-#define FIFOMAXLEN	1024
+/* producer and life cycle */
+extern int  headerFIFOcreate(struct headerFIFO *p, ULONG capacity, ULONG nChannels, int policy);
+extern void headerFIFOdestroy(struct headerFIFO *p);
+extern int  headerFIFOlock(struct headerFIFO *p);
+extern int  headerFIFOpush(struct headerFIFO *p, struct RDA_MessageData *pmd, int elementSize,
+                           double arrival);
+extern int  headerFIFOcheckBlock(const struct RDA_MessageData *pmd, ULONG nChannels,
+                                 int elementSize);
 
-extern void headerFIFOpush(struct headerFIFO *p, RMH *h);
-extern RMH *headerFIFOpop(struct headerFIFO *p);
+/* consumer */
+extern void  headerFIFObeginRead(struct headerFIFO *p);
+extern void  headerFIFOendRead(struct headerFIFO *p);
+extern ULONG headerFIFOavailable(struct headerFIFO *p, ULONG *pMarkers, ULONG *pBlocks);
+extern void  headerFIFOread(struct headerFIFO *p, void *dst, ULONG nPoints);
+extern void  headerFIFOreadMarkers(struct headerFIFO *p, struct headerFIFOMarker *dst, ULONG nMarkers);
+extern const struct headerFIFOBlock *headerFIFOblock(struct headerFIFO *p, ULONG idx);
+extern void  headerFIFOconsume(struct headerFIFO *p, ULONG nPoints, ULONG nMarkers, ULONG nBlocks);
 
 #endif
@@ -0,0 +1,360 @@
+/*
+  ioreactor.c
+
+  The epoll reactor, see ioreactor.h.
+
+  The registrations live in a fixed table. The epoll data of a socket is
+  the index of its entry and a generation, which is incremented whenever
+  the entry changes. Events which were returned by epoll_wait for an old
+  socket of the entry are recognized by the generation and dropped.
+
+  The handlers are called with ioLock held, so the other threads only
+  have to take the lock to be sure that no handler is running. A handler
+  which calls ioReactorModify or ioReactorSetTimer already holds the
+  lock, these functions check on which thread they run.
+
+  The file uses pthreads directly: it only exists on linux, its thread
+  is started by the first registration, so the locks have to be
+  initialized statically, and a call has to tell whether it comes from
+  the thread of the reactor.
+
+  - 2026/10/17 - Jonas Reiter
+                 - Written.
+                 - The scheduling of the thread can be set.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                     /* pthread_setaffinity_np */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "ioreactor.h"
+
+/* the epoll data of the wake up event */
+#define IO_WAKE_DATA    UINT64_MAX
+
+/* the most events handled per epoll_wait */
+#define IO_MAX_EVENTS   IO_MAX_ENTRIES
+
+struct ioEntry
+{
+  int used;
+  uint32_t generation;                  /* incremented with every change */
+  int fd;
+  int events;                           /* IO_READABLE, IO_WRITABLE */
+  int inEpoll;                          /* fd is registered with epoll */
+  double timer;                         /* 0 or the time the timer fires */
+  ioReactorHandler handler;
+  void *context;
+};
+
+static pthread_mutex_t ioLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t ioLifeLock = PTHREAD_MUTEX_INITIALIZER; /* start and stop */
+static struct ioEntry ioEntries[IO_MAX_ENTRIES];
+static int ioCount = 0;                 /* used entries */
+static int ioEpoll = -1;
+static int ioWake = -1;                 /* eventfd to wake up the thread */
+static volatile int ioQuit = 0;
+static volatile int ioRunning = 0;
+static pthread_t ioThread;
+
+static void *ioReactorThread(void *arg);
+
+
+double ioReactorTime()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+/* are we called by a handler? */
+static int onReactorThread()
+{
+  return ioRunning && pthread_equal(pthread_self(), ioThread);
+}
+
+static void ioLockOutside(int *locked)
+{
+  *locked = !onReactorThread();
+  if (*locked) pthread_mutex_lock(&ioLock);
+}
+
+static void ioUnlockOutside(int locked)
+{
+  if (locked) pthread_mutex_unlock(&ioLock);
+}
+
+/* lets the thread compute its timeout again */
+static void ioWakeUp()
+{
+  uint64_t one = 1;
+
+  if (ioWake >= 0 && write(ioWake, &one, sizeof(one)) < 0) {
+    /* the counter is full, the thread wakes up anyway */
+  }
+}
+
+/* registers the entry with epoll as it is now, ioLock is held */
+static int ioUpdateEpoll(int id, int fd, int events)
+{
+  struct ioEntry *pe = ioEntries + id;
+  struct epoll_event ev;
+
+  if (pe->inEpoll) {
+    epoll_ctl(ioEpoll, EPOLL_CTL_DEL, pe->fd, NULL);
+    pe->inEpoll = 0;
+  }
+
+  pe->generation++;
+  pe->fd = fd;
+  pe->events = events;
+  if (fd < 0 || 0 == events) return 0;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = ((events & IO_READABLE) ? EPOLLIN : 0) | ((events & IO_WRITABLE) ? EPOLLOUT : 0);
+  ev.data.u64 = ((uint64_t)pe->generation << 32) | (uint64_t)id;
+  if (epoll_ctl(ioEpoll, EPOLL_CTL_ADD, fd, &ev) != 0) return -1;
+  pe->inEpoll = 1;
+
+  return 0;
+}
+
+/* creates epoll and the thread, ioLifeLock is held */
+static int ioStart()
+{
+  struct epoll_event ev;
+
+  ioEpoll = epoll_create1(EPOLL_CLOEXEC);
+  ioWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (ioEpoll < 0 || ioWake < 0) goto failed;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = IO_WAKE_DATA;
+  if (epoll_ctl(ioEpoll, EPOLL_CTL_ADD, ioWake, &ev) != 0) goto failed;
+
+  ioQuit = 0;
+  if (pthread_create(&ioThread, NULL, ioReactorThread, NULL) != 0) goto failed;
+  ioRunning = 1;
+  return 0;
+
+ failed:
+  if (ioEpoll >= 0) close(ioEpoll);
+  if (ioWake >= 0) close(ioWake);
+  ioEpoll = ioWake = -1;
+  return -1;
+}
+
+/* stops the thread, ioLifeLock is held but not ioLock */
+static void ioStop()
+{
+  ioQuit = 1;
+  ioWakeUp();
+  pthread_join(ioThread, NULL);
+  ioRunning = 0;
+
+  close(ioEpoll);
+  close(ioWake);
+  ioEpoll = ioWake = -1;
+}
+
+
+int ioReactorAdd(int fd, int events, ioReactorHandler handler, void *context)
+{
+  int id, locked;
+
+  pthread_mutex_lock(&ioLifeLock);
+  if (ioEpoll < 0 && ioStart() != 0) {
+    pthread_mutex_unlock(&ioLifeLock);
+    return -1;
+  }
+
+  ioLockOutside(&locked);
+  for (id = 0; id < IO_MAX_ENTRIES && ioEntries[id].used; id++);
+  if (id < IO_MAX_ENTRIES) {
+    struct ioEntry *pe = ioEntries + id;
+
+    pe->used = 1;
+    pe->inEpoll = 0;
+    pe->timer = 0.0;
+    pe->handler = handler;
+    pe->context = context;
+    if (ioUpdateEpoll(id, fd, events) != 0) {
+      pe->used = 0;
+      id = -1;
+    } else {
+      ioCount++;
+    }
+  } else {
+    id = -1;
+  }
+  ioUnlockOutside(locked);
+
+  if (0 == ioCount) ioStop();
+  pthread_mutex_unlock(&ioLifeLock);
+
+  return id;
+}
+
+
+int ioReactorModify(int id, int fd, int events)
+{
+  int result, locked;
+
+  ioLockOutside(&locked);
+  result = ioUpdateEpoll(id, fd, events);
+  ioUnlockOutside(locked);
+
+  return result;
+}
+
+
+void ioReactorSetTimer(int id, double when)
+{
+  int locked;
+
+  ioLockOutside(&locked);
+  ioEntries[id].timer = when;
+  ioUnlockOutside(locked);
+
+  /* the thread sleeps with the old timeout */
+  if (locked) ioWakeUp();
+}
+
+
+void ioReactorRemove(int id)
+{
+  struct ioEntry *pe = ioEntries + id;
+
+  pthread_mutex_lock(&ioLifeLock);
+  pthread_mutex_lock(&ioLock);
+  if (pe->used) {
+    ioUpdateEpoll(id, -1, 0);
+    pe->used = 0;
+    pe->timer = 0.0;
+    pe->handler = NULL;
+    pe->context = NULL;
+    ioCount--;
+  }
+  pthread_mutex_unlock(&ioLock);
+
+  if (0 == ioCount && ioRunning) ioStop();
+  pthread_mutex_unlock(&ioLifeLock);
+}
+
+
+int ioReactorSetPriority(int policy, int priority)
+{
+  struct sched_param param;
+  int result = ESRCH;
+
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = priority;
+
+  pthread_mutex_lock(&ioLifeLock);
+  if (ioRunning) result = pthread_setschedparam(ioThread, policy, &param);
+  pthread_mutex_unlock(&ioLifeLock);
+
+  return result;
+}
+
+
+int ioReactorSetAffinity(int cpu)
+{
+  cpu_set_t set;
+  int result = ESRCH;
+
+  if (cpu < 0 || cpu >= CPU_SETSIZE) return EINVAL;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  pthread_mutex_lock(&ioLifeLock);
+  if (ioRunning) result = pthread_setaffinity_np(ioThread, sizeof(set), &set);
+  pthread_mutex_unlock(&ioLifeLock);
+
+  return result;
+}
+
+
+/*
+  The thread. It sleeps in epoll_wait until a socket has an event, the
+  next timer expires or it is woken up.
+*/
+static void *ioReactorThread(void *arg)
+{
+  struct epoll_event events[IO_MAX_EVENTS];
+  int nEvents, i;
+
+  (void)arg;
+
+  while (!ioQuit) {
+    double now, next = 0.0;
+    int timeout = -1;
+
+    /* sleep until the next timer */
+    pthread_mutex_lock(&ioLock);
+    for (i = 0; i < IO_MAX_ENTRIES; i++) {
+      if (ioEntries[i].used && ioEntries[i].timer > 0.0
+          && (0.0 == next || ioEntries[i].timer < next)) {
+        next = ioEntries[i].timer;
+      }
+    }
+    pthread_mutex_unlock(&ioLock);
+    if (next > 0.0) {
+      double left = next - ioReactorTime();
+      timeout = left > 0.0 ? (int)left + 1 : 0;
+    }
+
+    nEvents = epoll_wait(ioEpoll, events, IO_MAX_EVENTS, timeout);
+    if (nEvents < 0 && EINTR != errno) break;
+
+    pthread_mutex_lock(&ioLock);
+    for (i = 0; i < nEvents; i++) {
+      uint64_t data = events[i].data.u64;
+      struct ioEntry *pe;
+      int what = 0;
+
+      if (IO_WAKE_DATA == data) {
+        uint64_t count;
+        if (read(ioWake, &count, sizeof(count)) < 0) {
+          /* nothing to read */
+        }
+        continue;
+      }
+
+      pe = ioEntries + (data & 0xffffffff);
+      if (!pe->used || pe->generation != (uint32_t)(data >> 32)) continue;
+
+      if (events[i].events & EPOLLIN) what |= IO_READABLE;
+      if (events[i].events & EPOLLOUT) what |= IO_WRITABLE;
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) what |= IO_ERROR;
+      pe->handler(pe->context, what);
+    }
+
+    /* the timers */
+    now = ioReactorTime();
+    for (i = 0; i < IO_MAX_ENTRIES; i++) {
+      struct ioEntry *pe = ioEntries + i;
+
+      if (pe->used && pe->timer > 0.0 && pe->timer <= now) {
+        pe->timer = 0.0;
+        pe->handler(pe->context, IO_TIMER);
+      }
+    }
+    pthread_mutex_unlock(&ioLock);
+  }
+
+  return NULL;
+}
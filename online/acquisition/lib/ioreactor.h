@@ -0,0 +1,76 @@
+/*
+  ioreactor.h
+
+  One thread which serves the sockets of all connections of a mex file
+  with epoll (linux only).
+
+  Every user registers a handler with ioReactorAdd and gets an id. The
+  handler is called from the reactor thread when its socket is readable
+  or writable or when its timer has expired. The handlers of all users
+  run one after the other, so a handler must never block. While a
+  handler runs it may change its own registration with ioReactorModify
+  and ioReactorSetTimer.
+
+  After ioReactorRemove returns the handler is not running and will
+  never be called again, so the context can be freed. The thread is
+  started with the first registration and stopped with the last one.
+
+  - 2026/10/17 - Jonas Reiter
+                 - Written.
+                 - ioReactorSetPriority and ioReactorSetAffinity.
+*/
+
+#ifndef IO_REACTOR_H
+#define IO_REACTOR_H
+
+/* the events for the handler, can be or'ed */
+#define IO_READABLE     1
+#define IO_WRITABLE     2
+#define IO_ERROR        4               /* error or hang up on the socket */
+#define IO_TIMER        8               /* the timer has expired */
+
+/* the maximum number of registrations */
+#define IO_MAX_ENTRIES  64
+
+typedef void (*ioReactorHandler)(void *context, int events);
+
+/*
+  Registers fd for the events (IO_READABLE, IO_WRITABLE) with the
+  handler. fd may be -1 if only the timer is used. Returns the id or -1.
+*/
+extern int ioReactorAdd(int fd, int events, ioReactorHandler handler, void *context);
+
+/*
+  Changes the socket and the events of a registration. A socket which is
+  closed has to be replaced with -1 before it is closed.
+*/
+extern int ioReactorModify(int id, int fd, int events);
+
+/*
+  Sets the timer of a registration to the absolute time when, in ms of
+  ioReactorTime. 0 switches the timer off. The timer fires once.
+*/
+extern void ioReactorSetTimer(int id, double when);
+
+/*
+  Removes the registration. Waits until the handler has returned if it
+  is running.
+*/
+extern void ioReactorRemove(int id);
+
+/*
+  The scheduling of the reactor thread: the posix policy (SCHED_FIFO,
+  SCHED_RR) with the priority and the cpu it runs on. The thread is
+  shared, so the last call wins, and a thread which is started again
+  after the last registration was removed has the default scheduling.
+  Return 0 or an errno value, ESRCH if the thread is not running.
+*/
+extern int ioReactorSetPriority(int policy, int priority);
+extern int ioReactorSetAffinity(int cpu);
+
+/*
+  The monotonic clock of the timers in ms.
+*/
+extern double ioReactorTime();
+
+#endif
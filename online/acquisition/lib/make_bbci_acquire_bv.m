@@ -6,12 +6,16 @@ end
 clear functions
 
 if isunix
-    params = {'../winunix/winthreads.c' '../winunix/winevents.c' '-lrt'};
+    params = {'-lrt' '-lpthread' 'CXXFLAGS=$CXXFLAGS -std=c++11'};
+    if ~ismac
+        % the epoll thread which reads all connections
+        params = ['ioreactor.c' params];
+    end
 else
     params = {'WS2_32.lib'};
 end
 
-params = ['bbci_acquire_bv.cpp' 'brainserver.c' 'headerfifo.c' params];
+params = ['bbci_acquire_bv.cpp' 'brainserver.c' 'headerfifo.c' 'recorder.c' 'shmring.c' 'acthreads.cpp' 'filter.c' params];
 
 if nargin>= 1 && 1 == debug
   params = ['-g' '-v' params];
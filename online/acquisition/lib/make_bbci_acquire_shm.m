@@ -0,0 +1,24 @@
+function make_bbci_acquire_shm(debug)
+
+try
+    bbci_acquire_shm('close');
+end
+clear functions
+
+if isunix && ~ismac
+    params = {'-lrt'};
+else
+    params = {};
+end
+
+params = ['bbci_acquire_shm.cpp' 'shmring.c' params];
+
+if nargin>= 1 && 1 == debug
+  params = ['-g' '-v' params];
+end
+
+params = ['-compatibleArrayDims' params];
+
+mex(params{:})
+
+disp('Build completed.')
@@ -6,12 +6,28 @@
      Remote Data Access (RDA) structs and constants
 
    Adapted by Guido Dornhege, Mikio Braun
+
+   2026/10/17 - Jonas Reiter
+                - The fields are 32 bits wide on 64 bit unix, too.
 */
 
 #ifndef MY_RDA_H
 #define MY_RDA_H
 
+#ifdef _MSC_VER
+#include "../../../fileio/private/msvc_stdint.h"
+#else
+#include <stdint.h>
+#endif
+
+/* The protocol has 32 bit fields. unsigned long is 64 bits wide on 64 bit
+   unix, there we have to use uint32_t. windows.h defines ULONG as unsigned
+   long, which is 32 bits wide on windows. */
+#ifdef _WIN32
 typedef unsigned long ULONG;
+#else
+typedef uint32_t ULONG;
+#endif
  
 /*
 #endif
@@ -35,7 +51,7 @@ struct RDA_Marker
   ULONG  nSize;          /* Size of this struct. */
   ULONG  nPosition;      /* Relative position in the data block. */
   ULONG  nPoints;        /* Number of points of this marker */
-  long   nChannel;       /* Associated channel number (-1 = all). */
+  int32_t nChannel;      /* Associated channel number (-1 = all). */
   char   sTypeDesc[1];   /* Type, description in ASCII delimited by '\0'. */
 };
 
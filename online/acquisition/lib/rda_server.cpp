@@ -0,0 +1,809 @@
+/*
+  rda_server.cpp
+
+  A simulator of the remote data access (RDA) server of the BrainVision
+  Recorder for linux. It sends the messages of myRDA.h on BV_PORT, so
+  bbci_acquire_bv and brainserver.c can be tested and benchmarked without
+  a recorder.
+
+  The data is replayed from a .vhdr/.eeg/.vmrk triple or, without a file,
+  sine waves are sent. The stream runs in real time, speed times faster
+  or as fast as possible. Like the recorder the stream runs on while no
+  client is connected, all clients get the same blocks.
+
+  Compile with
+
+    g++ -O2 -std=c++11 -pthread -o rda_server rda_server.cpp
+
+  and call it with -h for the options. For example
+
+    ./rda_server -f data.vhdr -s 2 -t int32 -m 1000 -g 100:3
+
+  replays data.vhdr at twice the speed with 32 bit integers, adds a
+  marker every second and drops 3 blocks every 100 blocks.
+
+  Payloads: int16 is sent as message type 2, int32 and float as message
+  type 4. All values are sent such that value * resolution is the signal
+  in microvolts. Like the recorder brainserver.c reads type 4 as float,
+  int32 needs a client compiled with -DRDA_INT32_DATA.
+
+  2026/10/17 - Jonas Reiter
+               - Written.
+*/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+#include "myRDA.h"
+
+/*
+ * The brainvision server port number
+ */
+#ifndef BV_PORT
+#define BV_PORT 51234
+#endif
+
+#define MSG_START 1
+#define MSG_DATA16 2
+#define MSG_STOP 3
+#define MSG_DATA32 4
+
+enum { PAYLOAD_INT16, PAYLOAD_INT32, PAYLOAD_FLOAT };
+
+static const unsigned char GUID_RDAHeader[16] = {
+  0x8E, 0x45, 0x58, 0x43, 0x96, 0xC9, 0x86, 0x4C,
+  0xAF, 0x4A, 0x98, 0xBB, 0xF6, 0xC9, 0x14, 0x50
+};
+
+/*
+ * OPTIONS
+ */
+
+struct serverOptions {
+  const char *vhdr;           /* the file to replay, NULL for sine waves */
+  int port;
+  double speed;               /* 1 is real time, 0 as fast as possible */
+  int blockSize;              /* samples per block, 0 for 40 ms */
+  int nChannels;              /* for the sine waves */
+  double fs;                  /* for the sine waves */
+  int payload;                /* PAYLOAD_ */
+  double markerInterval;      /* ms between the injected markers, 0 for none */
+  int gapEvery, gapBlocks;    /* skip gapBlocks block numbers every gapEvery blocks */
+  int stallEvery, stallMs;    /* stop sending for stallMs every stallEvery blocks */
+  int dropEvery;              /* close the connections every dropEvery blocks */
+  long maxBlocks;             /* stop after that many blocks, 0 for no limit */
+  int loop;                   /* start the file again at its end */
+  int verbose;
+};
+
+/*
+ * THE SIGNAL
+ */
+
+struct rdaMarker {
+  unsigned long position;     /* in samples from the start of the file */
+  std::string type;
+  std::string desc;
+};
+
+struct signalSource {
+  int nChannels;
+  double samplingInterval;    /* in microseconds */
+  std::vector<double> resolutions;
+  std::vector<std::string> names;
+  std::vector<rdaMarker> markers;
+
+  /* the file */
+  FILE *eeg;
+  int fileFormat;             /* PAYLOAD_ */
+  int fileElementSize;
+  std::vector<char> fileBuffer;
+  unsigned long filePos;      /* samples read since the last rewind */
+  size_t nextMarker;
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+
+/************************************************************
+ *
+ * Small helpers
+ *
+ ************************************************************/
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -f file.vhdr   replay the file (default: sine waves)\n"
+          "  -c n           channels of the sine waves (default 32)\n"
+          "  -r fs          sampling rate of the sine waves in Hz (default 1000)\n"
+          "  -p port        port (default %d)\n"
+          "  -s speed       1 real time, 2 twice as fast, 0 as fast as possible\n"
+          "  -b n           samples per block (default 40 ms)\n"
+          "  -t type        int16, int32 or float (default int16)\n"
+          "  -m ms          inject a stimulus marker every ms milliseconds\n"
+          "  -g n:k         skip k block numbers every n blocks\n"
+          "  -S n:ms        stall for ms milliseconds every n blocks\n"
+          "  -d n           close all connections every n blocks\n"
+          "  -n n           send a stop message after n blocks\n"
+          "  -l             loop the file\n"
+          "  -v             verbose\n",
+          name, BV_PORT);
+}
+
+static void onSignal(int)
+{
+  stopRequested = 1;
+}
+
+static std::string trim(const std::string &s)
+{
+  size_t b = s.find_first_not_of(" \t\r\n");
+  size_t e = s.find_last_not_of(" \t\r\n");
+
+  if (b == std::string::npos) return "";
+  return s.substr(b, e - b + 1);
+}
+
+/* splits a line at the commas, "\1" is a comma in brainvision files */
+static std::vector<std::string> splitFields(const std::string &s)
+{
+  std::vector<std::string> fields;
+  std::string field;
+  size_t i;
+
+  for (i = 0; i < s.size(); i++) {
+    if (s[i] == ',') {
+      fields.push_back(field);
+      field.clear();
+    } else if (s[i] == '\\' && i + 1 < s.size() && s[i + 1] == '1') {
+      field += ',';
+      i++;
+    } else {
+      field += s[i];
+    }
+  }
+  fields.push_back(field);
+
+  return fields;
+}
+
+static std::string directoryOf(const std::string &path)
+{
+  size_t slash = path.rfind('/');
+
+  return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+static int parsePair(const char *arg, int *a, int *b)
+{
+  return 2 == sscanf(arg, "%d:%d", a, b) && *a > 0 && *b >= 0 ? 0 : -1;
+}
+
+/************************************************************
+ *
+ * Reads the header and the marker file. Returns 0 on success.
+ *
+ ************************************************************/
+static int readHeader(const char *vhdr, signalSource *src)
+{
+  FILE *f = fopen(vhdr, "r");
+  char line[4096];
+  std::string section, dataFile, markerFile;
+  std::string orientation = "MULTIPLEXED", format = "BINARY", binary = "INT_16";
+
+  if (!f) {
+    fprintf(stderr, "rda_server: can not open %s: %s\n", vhdr, strerror(errno));
+    return -1;
+  }
+
+  src->nChannels = 0;
+  src->samplingInterval = 0;
+  while (fgets(line, sizeof(line), f)) {
+    std::string l = trim(line);
+    size_t eq;
+
+    if (l.empty() || l[0] == ';') continue;
+    if (l[0] == '[') {
+      section = l;
+      continue;
+    }
+    eq = l.find('=');
+    if (eq == std::string::npos) continue;
+
+    std::string key = trim(l.substr(0, eq));
+    std::string value = trim(l.substr(eq + 1));
+
+    if (section == "[Common Infos]") {
+      if (key == "DataFile") dataFile = value;
+      else if (key == "MarkerFile") markerFile = value;
+      else if (key == "DataFormat") format = value;
+      else if (key == "DataOrientation") orientation = value;
+      else if (key == "NumberOfChannels") src->nChannels = atoi(value.c_str());
+      else if (key == "SamplingInterval") src->samplingInterval = atof(value.c_str());
+    } else if (section == "[Binary Infos]") {
+      if (key == "BinaryFormat") binary = value;
+    } else if (section == "[Channel Infos]" && key.compare(0, 2, "Ch") == 0) {
+      std::vector<std::string> fields = splitFields(value);
+      double resolution = fields.size() > 2 && !fields[2].empty() ? atof(fields[2].c_str()) : 1.0;
+
+      src->names.push_back(fields[0]);
+      src->resolutions.push_back(resolution);
+    }
+  }
+  fclose(f);
+
+  if (src->nChannels <= 0 || src->samplingInterval <= 0 || dataFile.empty()) {
+    fprintf(stderr, "rda_server: %s has no channels, sampling interval or data file\n", vhdr);
+    return -1;
+  }
+  if (format != "BINARY" || orientation != "MULTIPLEXED") {
+    fprintf(stderr, "rda_server: only multiplexed binary files are supported\n");
+    return -1;
+  }
+  if (binary == "INT_16") {
+    src->fileFormat = PAYLOAD_INT16;
+    src->fileElementSize = 2;
+  } else if (binary == "INT_32") {
+    src->fileFormat = PAYLOAD_INT32;
+    src->fileElementSize = 4;
+  } else if (binary == "IEEE_FLOAT_32") {
+    src->fileFormat = PAYLOAD_FLOAT;
+    src->fileElementSize = 4;
+  } else {
+    fprintf(stderr, "rda_server: unknown binary format %s\n", binary.c_str());
+    return -1;
+  }
+
+  /* channels without an entry in [Channel Infos] */
+  while ((int)src->names.size() < src->nChannels) {
+    char name[32];
+    snprintf(name, sizeof(name), "Ch%d", (int)src->names.size() + 1);
+    src->names.push_back(name);
+    src->resolutions.push_back(1.0);
+  }
+  src->names.resize(src->nChannels);
+  src->resolutions.resize(src->nChannels);
+
+  dataFile = directoryOf(vhdr) + dataFile;
+  src->eeg = fopen(dataFile.c_str(), "rb");
+  if (!src->eeg) {
+    fprintf(stderr, "rda_server: can not open %s: %s\n", dataFile.c_str(), strerror(errno));
+    return -1;
+  }
+
+  if (markerFile.empty()) return 0;
+
+  /* the markers, Mk<n>=<type>,<description>,<position>,<points>,<channel>[,<date>] */
+  markerFile = directoryOf(vhdr) + markerFile;
+  f = fopen(markerFile.c_str(), "r");
+  if (!f) {
+    fprintf(stderr, "rda_server: can not open %s, no markers\n", markerFile.c_str());
+    return 0;
+  }
+  section.clear();
+  while (fgets(line, sizeof(line), f)) {
+    std::string l = trim(line);
+    size_t eq;
+
+    if (l.empty() || l[0] == ';') continue;
+    if (l[0] == '[') {
+      section = l;
+      continue;
+    }
+    eq = l.find('=');
+    if (section != "[Marker Infos]" || eq == std::string::npos) continue;
+
+    std::vector<std::string> fields = splitFields(trim(l.substr(eq + 1)));
+    if (fields.size() < 3 || atol(fields[2].c_str()) < 1) continue;
+
+    rdaMarker m;
+    m.type = fields[0];
+    m.desc = fields[1];
+    m.position = atol(fields[2].c_str()) - 1;
+    src->markers.push_back(m);
+  }
+  fclose(f);
+
+  std::stable_sort(src->markers.begin(), src->markers.end(),
+                   [](const rdaMarker &a, const rdaMarker &b) { return a.position < b.position; });
+
+  return 0;
+}
+
+/************************************************************
+ *
+ * Sets up the sine waves.
+ *
+ ************************************************************/
+static void sineSource(const serverOptions *opt, signalSource *src)
+{
+  int c;
+
+  src->nChannels = opt->nChannels;
+  src->samplingInterval = 1000000.0 / opt->fs;
+  src->eeg = NULL;
+  src->fileFormat = PAYLOAD_FLOAT;
+  src->fileElementSize = 4;
+  for (c = 0; c < src->nChannels; c++) {
+    char name[32];
+    snprintf(name, sizeof(name), "Ch%d", c + 1);
+    src->names.push_back(name);
+    src->resolutions.push_back(0.1);
+  }
+}
+
+/************************************************************
+ *
+ * Gets the next nPoints samples in the units of the resolution. Markers
+ * which fall into the block are appended to pMarkers with positions
+ * relative to the block. Returns the number of samples, which is smaller
+ * than nPoints at the end of the file.
+ *
+ ************************************************************/
+static int nextSamples(signalSource *src, const serverOptions *opt, unsigned long streamPos,
+                       int nPoints, std::vector<double> &values, std::vector<rdaMarker> &blockMarkers)
+{
+  int nChannels = src->nChannels;
+  int n, c, got;
+
+  values.resize((size_t)nPoints * nChannels);
+
+  if (NULL == src->eeg) {
+    double dt = src->samplingInterval / 1000000.0;
+    for (n = 0; n < nPoints; n++) {
+      double t = (streamPos + n) * dt;
+      for (c = 0; c < nChannels; c++) {
+        values[n * nChannels + c] = 500.0 * sin(2.0 * M_PI * (1.0 + c) * t);
+      }
+    }
+    return nPoints;
+  }
+
+  got = 0;
+  while (got < nPoints) {
+    size_t want = nPoints - got;
+    size_t count;
+    const char *p;
+
+    src->fileBuffer.resize(want * nChannels * src->fileElementSize);
+    count = fread(&src->fileBuffer[0], (size_t)nChannels * src->fileElementSize, want, src->eeg);
+
+    /* the values */
+    p = &src->fileBuffer[0];
+    for (n = 0; n < (int)count * nChannels; n++) {
+      double v;
+      if (PAYLOAD_INT16 == src->fileFormat) {
+        int16_t x;
+        memcpy(&x, p, 2);
+        v = x;
+      } else if (PAYLOAD_INT32 == src->fileFormat) {
+        int32_t x;
+        memcpy(&x, p, 4);
+        v = x;
+      } else {
+        float x;
+        memcpy(&x, p, 4);
+        v = x;
+      }
+      values[(size_t)got * nChannels + n] = v;
+      p += src->fileElementSize;
+    }
+
+    /* the markers of the file */
+    while (src->nextMarker < src->markers.size()
+           && src->markers[src->nextMarker].position < src->filePos + count) {
+      rdaMarker m = src->markers[src->nextMarker++];
+      m.position = got + (m.position - src->filePos);
+      blockMarkers.push_back(m);
+    }
+
+    got += count;
+    src->filePos += count;
+
+    /* the end of the file, an empty file is not looped */
+    if (count < want) {
+      if (!opt->loop || 0 == src->filePos) break;
+      rewind(src->eeg);
+      src->filePos = 0;
+      src->nextMarker = 0;
+    }
+  }
+
+  return got;
+}
+
+/************************************************************
+ *
+ * Building of the messages
+ *
+ ************************************************************/
+
+static void putHeader(std::vector<char> &msg, ULONG nType)
+{
+  struct RDA_MessageHeader *pHeader = (struct RDA_MessageHeader *)&msg[0];
+
+  memcpy(pHeader->guid, GUID_RDAHeader, sizeof(GUID_RDAHeader));
+  pHeader->nSize = (ULONG)msg.size();
+  pHeader->nType = nType;
+}
+
+static void buildStart(const signalSource *src, std::vector<char> &msg)
+{
+  size_t namesSize = 0;
+  size_t size, pos;
+  int c;
+  struct RDA_MessageStart *pStart;
+
+  for (c = 0; c < src->nChannels; c++) namesSize += src->names[c].size() + 1;
+
+  size = offsetof(struct RDA_MessageStart, dResolutions) + src->nChannels * sizeof(double) + namesSize;
+  msg.assign(size, 0);
+  putHeader(msg, MSG_START);
+
+  pStart = (struct RDA_MessageStart *)&msg[0];
+  pStart->nChannels = src->nChannels;
+  pStart->dSamplingInterval = src->samplingInterval;
+  memcpy(pStart->dResolutions, &src->resolutions[0], src->nChannels * sizeof(double));
+
+  pos = offsetof(struct RDA_MessageStart, dResolutions) + src->nChannels * sizeof(double);
+  for (c = 0; c < src->nChannels; c++) {
+    memcpy(&msg[pos], src->names[c].c_str(), src->names[c].size() + 1);
+    pos += src->names[c].size() + 1;
+  }
+}
+
+static void buildData(ULONG nBlock, int payload, int nChannels, int nPoints,
+                      const std::vector<double> &values, const std::vector<rdaMarker> &markers,
+                      std::vector<char> &msg)
+{
+  size_t elementSize = PAYLOAD_INT16 == payload ? 2 : 4;
+  size_t dataSize = elementSize * nChannels * nPoints;
+  size_t headSize = offsetof(struct RDA_MessageData, nData);
+  size_t markerHead = offsetof(struct RDA_Marker, sTypeDesc);
+  size_t size = headSize + dataSize;
+  size_t i, pos;
+  struct RDA_MessageData *pData;
+
+  for (i = 0; i < markers.size(); i++) {
+    size += markerHead + markers[i].type.size() + markers[i].desc.size() + 2;
+  }
+
+  msg.assign(size, 0);
+  putHeader(msg, PAYLOAD_INT16 == payload ? MSG_DATA16 : MSG_DATA32);
+
+  pData = (struct RDA_MessageData *)&msg[0];
+  pData->nBlock = nBlock;
+  pData->nPoints = nPoints;
+  pData->nMarkers = (ULONG)markers.size();
+
+  /* the values, clipped to the range of the integer types */
+  pos = headSize;
+  for (i = 0; i < (size_t)nChannels * nPoints; i++) {
+    double v = values[i];
+    if (PAYLOAD_INT16 == payload) {
+      int16_t x = (int16_t)(v < -32768.0 ? -32768.0 : v > 32767.0 ? 32767.0 : floor(v + 0.5));
+      memcpy(&msg[pos], &x, 2);
+    } else if (PAYLOAD_INT32 == payload) {
+      int32_t x = (int32_t)(v < -2147483648.0 ? -2147483648.0 : v > 2147483647.0 ? 2147483647.0 : floor(v + 0.5));
+      memcpy(&msg[pos], &x, 4);
+    } else {
+      float x = (float)v;
+      memcpy(&msg[pos], &x, 4);
+    }
+    pos += elementSize;
+  }
+
+  for (i = 0; i < markers.size(); i++) {
+    struct RDA_Marker m;
+    size_t mSize = markerHead + markers[i].type.size() + markers[i].desc.size() + 2;
+
+    m.nSize = (ULONG)mSize;
+    m.nPosition = (ULONG)markers[i].position;
+    m.nPoints = 1;
+    m.nChannel = -1;
+    memcpy(&msg[pos], &m, markerHead);
+    memcpy(&msg[pos + markerHead], markers[i].type.c_str(), markers[i].type.size() + 1);
+    memcpy(&msg[pos + markerHead + markers[i].type.size() + 1], markers[i].desc.c_str(),
+           markers[i].desc.size() + 1);
+    pos += mSize;
+  }
+}
+
+/************************************************************
+ *
+ * The clients. The accept thread sends the start message and adds the
+ * client, the main loop sends the blocks to all clients.
+ *
+ ************************************************************/
+
+static std::mutex clientLock;
+static std::vector<int> clients;
+static std::vector<char> startMessage;
+
+static int sendAll(int s, const char *p, size_t n)
+{
+  while (n > 0) {
+    ssize_t sent = send(s, p, n, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (EINTR == errno) continue;
+      return -1;
+    }
+    p += sent;
+    n -= sent;
+  }
+  return 0;
+}
+
+static void acceptClients(int listenSocket, int verbose)
+{
+  while (!stopRequested) {
+    int s = accept(listenSocket, NULL, NULL);
+    int one = 1;
+
+    if (s < 0) {
+      if (EINTR == errno) continue;
+      break;
+    }
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    std::lock_guard<std::mutex> guard(clientLock);
+    if (0 != sendAll(s, &startMessage[0], startMessage.size())) {
+      close(s);
+      continue;
+    }
+    clients.push_back(s);
+    if (verbose) fprintf(stderr, "rda_server: client connected, %d clients\n", (int)clients.size());
+  }
+}
+
+/* sends msg to all clients and drops the ones which have gone */
+static void broadcast(const std::vector<char> &msg, int verbose)
+{
+  std::lock_guard<std::mutex> guard(clientLock);
+  size_t i = 0;
+
+  while (i < clients.size()) {
+    if (0 != sendAll(clients[i], &msg[0], msg.size())) {
+      close(clients[i]);
+      clients.erase(clients.begin() + i);
+      if (verbose) fprintf(stderr, "rda_server: client lost, %d clients\n", (int)clients.size());
+    } else {
+      i++;
+    }
+  }
+}
+
+static void dropClients(int verbose)
+{
+  std::lock_guard<std::mutex> guard(clientLock);
+  size_t i;
+
+  for (i = 0; i < clients.size(); i++) {
+    shutdown(clients[i], SHUT_RDWR);
+    close(clients[i]);
+  }
+  if (verbose && clients.size() > 0) fprintf(stderr, "rda_server: dropped %d clients\n", (int)clients.size());
+  clients.clear();
+}
+
+static size_t clientCount()
+{
+  std::lock_guard<std::mutex> guard(clientLock);
+  return clients.size();
+}
+
+/************************************************************
+ *
+ * MAIN
+ *
+ ************************************************************/
+int main(int argc, char *argv[])
+{
+  serverOptions opt;
+  signalSource src;
+  struct sockaddr_in addr;
+  int listenSocket, one = 1, c;
+
+  memset(&opt, 0, sizeof(opt));
+  opt.port = BV_PORT;
+  opt.speed = 1.0;
+  opt.nChannels = 32;
+  opt.fs = 1000.0;
+  opt.payload = PAYLOAD_INT16;
+
+  while ((c = getopt(argc, argv, "f:c:r:p:s:b:t:m:g:S:d:n:lvh")) != -1) {
+    switch (c) {
+    case 'f': opt.vhdr = optarg; break;
+    case 'c': opt.nChannels = atoi(optarg); break;
+    case 'r': opt.fs = atof(optarg); break;
+    case 'p': opt.port = atoi(optarg); break;
+    case 's': opt.speed = atof(optarg); break;
+    case 'b': opt.blockSize = atoi(optarg); break;
+    case 't':
+      if (0 == strcmp(optarg, "int16")) opt.payload = PAYLOAD_INT16;
+      else if (0 == strcmp(optarg, "int32")) opt.payload = PAYLOAD_INT32;
+      else if (0 == strcmp(optarg, "float")) opt.payload = PAYLOAD_FLOAT;
+      else { usage(argv[0]); return 1; }
+      break;
+    case 'm': opt.markerInterval = atof(optarg); break;
+    case 'g':
+      if (parsePair(optarg, &opt.gapEvery, &opt.gapBlocks)) { usage(argv[0]); return 1; }
+      break;
+    case 'S':
+      if (parsePair(optarg, &opt.stallEvery, &opt.stallMs)) { usage(argv[0]); return 1; }
+      break;
+    case 'd': opt.dropEvery = atoi(optarg); break;
+    case 'n': opt.maxBlocks = atol(optarg); break;
+    case 'l': opt.loop = 1; break;
+    case 'v': opt.verbose = 1; break;
+    default: usage(argv[0]); return 'h' == c ? 0 : 1;
+    }
+  }
+
+  if (opt.nChannels <= 0 || opt.fs <= 0 || opt.speed < 0 || opt.blockSize < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  /* the signal */
+  src.filePos = 0;
+  src.nextMarker = 0;
+  if (opt.vhdr) {
+    if (readHeader(opt.vhdr, &src)) return 1;
+  } else {
+    sineSource(&opt, &src);
+  }
+  if (0 == opt.blockSize) {
+    opt.blockSize = (int)(40000.0 / src.samplingInterval + 0.5);
+    if (opt.blockSize < 1) opt.blockSize = 1;
+  }
+  buildStart(&src, startMessage);
+
+  /* the socket */
+  listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenSocket < 0) {
+    perror("rda_server: socket");
+    return 1;
+  }
+  setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(opt.port);
+  if (bind(listenSocket, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenSocket, 16) < 0) {
+    perror("rda_server: bind");
+    return 1;
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  fprintf(stderr, "rda_server: %d channels at %g Hz, %d samples per block on port %d\n",
+          src.nChannels, 1000000.0 / src.samplingInterval, opt.blockSize, opt.port);
+
+  std::thread acceptor(acceptClients, listenSocket, opt.verbose);
+
+  /*
+   * The stream. In real time the block number and the samples advance
+   * with the clock, as fast as possible we wait for the first client.
+   */
+  {
+    typedef std::chrono::steady_clock clock;
+    double blockSeconds = opt.blockSize * src.samplingInterval / 1000000.0;
+    double markerSamples = opt.markerInterval * 1000.0 / src.samplingInterval;
+    double nextMarker = markerSamples;
+    unsigned long streamPos = 0;
+    ULONG nBlock = 0;
+    long blocks = 0, blocksSent = 0;
+    unsigned long bytesSent = 0;
+    std::vector<double> values;
+    std::vector<rdaMarker> blockMarkers;
+    std::vector<char> msg;
+    clock::time_point start;
+    int markerCount = 0;
+
+    if (0 == opt.speed) {
+      while (!stopRequested && 0 == clientCount()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+    }
+    start = clock::now();
+
+    while (!stopRequested && (0 == opt.maxBlocks || blocks < opt.maxBlocks)) {
+      int nPoints;
+
+      blockMarkers.clear();
+      nPoints = nextSamples(&src, &opt, streamPos, opt.blockSize, values, blockMarkers);
+      if (0 == nPoints) break;
+
+      /* the injected markers */
+      while (markerSamples > 0 && nextMarker < streamPos + nPoints) {
+        char desc[16];
+        rdaMarker m;
+
+        markerCount = markerCount % 15 + 1;
+        snprintf(desc, sizeof(desc), "S%3d", markerCount);
+        m.type = "Stimulus";
+        m.desc = desc;
+        m.position = (unsigned long)(nextMarker - streamPos);
+        blockMarkers.push_back(m);
+        nextMarker += markerSamples;
+      }
+
+      /* wait for the time of the block */
+      if (opt.speed > 0) {
+        std::chrono::duration<double> due((blocks + 1) * blockSeconds / opt.speed);
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<clock::duration>(due));
+      }
+
+      nBlock++;
+      if (opt.gapEvery > 0 && blocks > 0 && 0 == blocks % opt.gapEvery) {
+        /* the skipped blocks are never sent */
+        nBlock += opt.gapBlocks;
+        if (opt.verbose) fprintf(stderr, "rda_server: gap of %d blocks at block %lu\n",
+                                 opt.gapBlocks, (unsigned long)nBlock);
+      }
+
+      buildData(nBlock, opt.payload, src.nChannels, nPoints, values, blockMarkers, msg);
+      {
+        size_t n = clientCount();
+        broadcast(msg, opt.verbose);
+        if (n > 0) {
+          blocksSent++;
+          bytesSent += msg.size();
+        }
+      }
+
+      streamPos += nPoints;
+      blocks++;
+
+      if (opt.stallEvery > 0 && 0 == blocks % opt.stallEvery) {
+        if (opt.verbose) fprintf(stderr, "rda_server: stall of %d ms\n", opt.stallMs);
+        std::this_thread::sleep_for(std::chrono::milliseconds(opt.stallMs));
+      }
+      if (opt.dropEvery > 0 && 0 == blocks % opt.dropEvery) {
+        dropClients(opt.verbose);
+      }
+      if (nPoints < opt.blockSize) break;
+    }
+
+    /* the end of the stream */
+    msg.assign(sizeof(struct RDA_MessageStop), 0);
+    putHeader(msg, MSG_STOP);
+    broadcast(msg, opt.verbose);
+
+    {
+      double seconds = std::chrono::duration<double>(clock::now() - start).count();
+      fprintf(stderr, "rda_server: %ld blocks, %ld sent, %lu bytes in %.3f s (%.1f MB/s)\n",
+              blocks, blocksSent, bytesSent, seconds,
+              seconds > 0 ? bytesSent / seconds / 1000000.0 : 0.0);
+    }
+  }
+
+  stopRequested = 1;
+  shutdown(listenSocket, SHUT_RDWR);
+  close(listenSocket);
+  acceptor.join();
+  dropClients(0);
+  if (src.eeg) fclose(src.eeg);
+
+  return 0;
+}
@@ -0,0 +1,620 @@
+/*
+  recorder.c
+
+  The writer thread of the recording, see recorder.h.
+
+  The ring holds the data messages exactly as they were received, one
+  after the other. The positions are counted in bytes and wrap around
+  like the ones of headerfifo.c, only the receiving thread writes
+  writePos and only the writer thread writes readPos.
+
+  - 2026/10/17 - Jonas Reiter
+                 - Written.
+                 - The writer thread and its event are the ones of
+                   acthreads.h. recorderDestroy joins the thread, a thread
+                   which hangs on the disk is left running with the recorder
+                   instead of being terminated.
+                 - recorderLockMemory.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#  include <io.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  define RECORD_BARRIER() MemoryBarrier()
+#  define RECORD_OPEN(name) _open(name, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE)
+#  define RECORD_WRITE(fd, buffer, size) _write(fd, buffer, (unsigned int)(size))
+#  define RECORD_SYNC(fd) _commit(fd)
+#  define RECORD_CLOSE(fd) _close(fd)
+#  define RECORD_FILENO(f) _fileno(f)
+#  define RECORD_ALIGNED_ALLOC(size) _aligned_malloc(size, RECORD_ALIGNMENT)
+#  define RECORD_ALIGNED_FREE(p) _aligned_free(p)
+#else
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  define RECORD_BARRIER() __sync_synchronize()
+#  define RECORD_OPEN(name) open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+#  define RECORD_WRITE(fd, buffer, size) write(fd, buffer, size)
+#  define RECORD_SYNC(fd) fsync(fd)
+#  define RECORD_CLOSE(fd) close(fd)
+#  define RECORD_FILENO(f) fileno(f)
+#  define RECORD_ALIGNED_ALLOC(size) recordAlignedAlloc(size)
+#  define RECORD_ALIGNED_FREE(p) free(p)
+#endif
+
+#include "brainserver.h"
+#include "recorder.h"
+#include "acthreads.h"
+
+#ifndef _WIN32
+static void *recordAlignedAlloc(size_t size)
+{
+  void *p;
+  return 0 == posix_memalign(&p, RECORD_ALIGNMENT, size) ? p : NULL;
+}
+#endif
+
+/* room for the running number and the extension */
+#define RECORD_NAME_EXTRA           16
+
+struct rdaRecorder
+{
+  /* the ring, written by recorderPush */
+  char *ring;
+  ULONG capacity;                       /* a power of two */
+  volatile ULONG writePos;
+  volatile ULONG readPos;
+  volatile ULONG blocksDropped;         /* by recorderPush */
+  int locked;                           /* the ring is locked in memory */
+
+  /* the writer thread */
+  struct acEvent *wakeEvent;            /* set by recorderPush */
+  struct acThread *thread;
+  volatile int quit;
+
+  /* everything below belongs to the writer thread */
+  struct RDA_MessageStart *pMsgStart;   /* for the headers */
+  char *baseName;                       /* without extension */
+  char *fileName;                       /* of the current files */
+  double maxFileSize;
+  char *message;                        /* one message out of the ring */
+  ULONG messageSize;
+  char *chunk;                          /* aligned, RECORD_CHUNK_SIZE bytes */
+  ULONG chunkFill;
+  int eegFile;
+  FILE *markerFile;
+  int elementType;                      /* of the data in the files, 0 before the first block */
+  uint64_t fileBytes;                   /* bytes in the current .eeg file */
+  ULONG fileSamples;                    /* samples in the current .eeg file */
+  ULONG nMarkers;                       /* markers in the current .vmrk file */
+  ULONG segmentPosition;                /* of the last New Segment marker */
+  ULONG lastBlock;
+  int haveBlock;
+  double lastSync;
+
+  /* the statistics */
+  volatile uint64_t bytesWritten;
+  volatile ULONG blocksWritten;
+  volatile ULONG blocksSkipped;         /* by the writer thread */
+  volatile ULONG files;
+  volatile int error;
+};
+
+static int recorderThread(void *context);
+static int recorderOpenFiles(struct rdaRecorder *pr);
+static void recorderCloseFiles(struct rdaRecorder *pr);
+
+
+struct rdaRecorder *recorderCreate(const char *fileName,
+                                   const struct RDA_MessageStart *pMsgStart,
+                                   double maxFileSize)
+{
+  struct rdaRecorder *pr;
+  double bytesPerSecond;
+  ULONG size, capacity;
+  size_t len;
+
+  pr = (struct rdaRecorder *)calloc(1, sizeof(struct rdaRecorder));
+  if (!pr) return NULL;
+  pr->eegFile = -1;
+  pr->maxFileSize = maxFileSize;
+
+  /* the ring takes RECORD_BUFFER_SECONDS of float32 data */
+  bytesPerSecond = 1000000.0 / pMsgStart->dSamplingInterval * pMsgStart->nChannels * 4;
+  size = RECORD_MIN_BUFFER;
+  if (bytesPerSecond * RECORD_BUFFER_SECONDS > size) size = (ULONG)(bytesPerSecond * RECORD_BUFFER_SECONDS);
+  for (capacity = 1; capacity < size; capacity <<= 1);
+  pr->capacity = capacity;
+
+  len = strlen(fileName);
+  pr->ring = (char *)malloc(capacity);
+  pr->chunk = (char *)RECORD_ALIGNED_ALLOC(RECORD_CHUNK_SIZE);
+  pr->pMsgStart = (struct RDA_MessageStart *)malloc(pMsgStart->nSize);
+  pr->baseName = (char *)malloc(len + 1);
+  pr->fileName = (char *)malloc(len + RECORD_NAME_EXTRA);
+  if (!pr->ring || !pr->chunk || !pr->pMsgStart || !pr->baseName || !pr->fileName) {
+    recorderDestroy(pr);
+    return NULL;
+  }
+  memcpy(pr->pMsgStart, pMsgStart, pMsgStart->nSize);
+
+  /* the name without extension */
+  strcpy(pr->baseName, fileName);
+  if (len > 5 && 0 == strcmp(pr->baseName + len - 5, ".vhdr")) pr->baseName[len - 5] = 0;
+  else if (len > 5 && 0 == strcmp(pr->baseName + len - 5, ".vmrk")) pr->baseName[len - 5] = 0;
+  else if (len > 4 && 0 == strcmp(pr->baseName + len - 4, ".eeg")) pr->baseName[len - 4] = 0;
+
+  /* the first files are opened here, so a bad name is noticed at once */
+  if (recorderOpenFiles(pr) != 0) {
+    recorderDestroy(pr);
+    return NULL;
+  }
+
+  pr->lastSync = monotonicTime();
+  pr->wakeEvent = acEventCreate();
+  if (pr->wakeEvent) pr->thread = acThreadCreate(&recorderThread, pr);
+  if (!pr->thread) {
+    recorderCloseFiles(pr);
+    recorderDestroy(pr);
+    return NULL;
+  }
+
+  return pr;
+}
+
+
+int recorderPush(struct rdaRecorder *pr, const struct RDA_MessageData *pmd)
+{
+  ULONG w = pr->writePos;
+  ULONG size = pmd->nSize;
+  ULONG offset, first;
+
+  RECORD_BARRIER();
+  if (pr->error || size > pr->capacity - (w - pr->readPos)) {
+    pr->blocksDropped++;
+    return 0;
+  }
+
+  offset = w & (pr->capacity - 1);
+  first = pr->capacity - offset;
+  if (first > size) first = size;
+  memcpy(pr->ring + offset, pmd, first);
+  memcpy(pr->ring, (const char *)pmd + first, size - first);
+
+  /* make the message visible before the position */
+  RECORD_BARRIER();
+  pr->writePos = w + size;
+  acEventSet(pr->wakeEvent);
+
+  return 1;
+}
+
+
+void recorderGetStats(struct rdaRecorder *pr, struct recorderStats *pStats)
+{
+  pStats->bytesWritten = pr->bytesWritten;
+  pStats->blocksWritten = pr->blocksWritten;
+  pStats->blocksDropped = pr->blocksDropped + pr->blocksSkipped;
+  pStats->files = pr->files;
+  pStats->error = pr->error;
+}
+
+
+int recorderLockMemory(struct rdaRecorder *pr)
+{
+  int result = pr->locked ? 0 : acLockMemory(pr->ring, pr->capacity);
+
+  if (0 == result) pr->locked = 1;
+  return result;
+}
+
+
+void recorderDestroy(struct rdaRecorder *pr)
+{
+  if (!pr) return;
+
+  if (pr->thread) {
+    pr->quit = 1;
+    acEventSet(pr->wakeEvent);
+    if (acThreadJoin(pr->thread, RECORD_CLOSE_TIMEOUT) != AC_WAIT_SIGNALED) {
+      /* the disk hangs, the thread keeps the recorder */
+      return;
+    }
+  }
+  if (pr->wakeEvent) acEventClose(pr->wakeEvent);
+
+  if (pr->locked) acUnlockMemory(pr->ring, pr->capacity);
+  if (pr->ring) free(pr->ring);
+  if (pr->chunk) RECORD_ALIGNED_FREE(pr->chunk);
+  if (pr->message) free(pr->message);
+  if (pr->pMsgStart) free(pr->pMsgStart);
+  if (pr->baseName) free(pr->baseName);
+  if (pr->fileName) free(pr->fileName);
+  free(pr);
+}
+
+
+/*----------------------------------------------------------------------
+
+The writer thread
+
+----------------------------------------------------------------------*/
+
+/* the name of the current files without the directory */
+static const char *recorderShortName(const struct rdaRecorder *pr)
+{
+  const char *name = pr->fileName + strlen(pr->fileName);
+
+  while (name > pr->fileName && '/' != name[-1] && '\\' != name[-1]) name--;
+  return name;
+}
+
+
+static void recorderFailed(struct rdaRecorder *pr)
+{
+  if (!pr->error) pr->error = errno ? errno : EIO;
+}
+
+
+/*
+  Writes size bytes of the chunk buffer to the .eeg file and moves the
+  rest to the front.
+*/
+static void recorderWriteChunk(struct rdaRecorder *pr, ULONG size)
+{
+  ULONG written = 0;
+
+  while (written < size && !pr->error) {
+    int nResult = RECORD_WRITE(pr->eegFile, pr->chunk + written, size - written);
+    if (nResult <= 0) {
+      if (nResult < 0 && EINTR == errno) continue;
+      recorderFailed(pr);
+      return;
+    }
+    written += nResult;
+  }
+
+  memmove(pr->chunk, pr->chunk + size, pr->chunkFill - size);
+  pr->chunkFill -= size;
+}
+
+
+/*
+  Writes the buffered data. If aligned is set only whole multiples of
+  RECORD_ALIGNMENT are written, so the file offset stays aligned.
+*/
+static void recorderFlush(struct rdaRecorder *pr, int aligned)
+{
+  ULONG size = pr->chunkFill;
+
+  if (aligned) size -= size % RECORD_ALIGNMENT;
+  if (size > 0) recorderWriteChunk(pr, size);
+  if (pr->markerFile && fflush(pr->markerFile) != 0) recorderFailed(pr);
+}
+
+
+static void recorderSync(struct rdaRecorder *pr)
+{
+  recorderFlush(pr, 1);
+  if (pr->eegFile >= 0) RECORD_SYNC(pr->eegFile);
+  if (pr->markerFile) RECORD_SYNC(RECORD_FILENO(pr->markerFile));
+}
+
+
+/*
+  Commas in names and descriptions are written as \1 like the Recorder
+  does.
+*/
+static void recorderWriteEscaped(FILE *f, const char *text)
+{
+  for (; *text; text++) {
+    if (',' == *text) fputs("\\1", f);
+    else fputc(*text, f);
+  }
+}
+
+
+/*
+  A marker line.
+*/
+static void recorderWriteMarker(struct rdaRecorder *pr, const char *type, const char *desc,
+                                ULONG position, ULONG nPoints, long channel, const char *date)
+{
+  pr->nMarkers++;
+  fprintf(pr->markerFile, "Mk%lu=%s,", (unsigned long)pr->nMarkers, type);
+  recorderWriteEscaped(pr->markerFile, desc);
+  fprintf(pr->markerFile, ",%lu,%lu,%ld", (unsigned long)position, (unsigned long)nPoints, channel);
+  if (date) fprintf(pr->markerFile, ",%s", date);
+  fputs("\r\n", pr->markerFile);
+}
+
+
+/*
+  A New Segment marker at the next sample, at the start of every file and
+  after a gap in the block numbers.
+*/
+static void recorderNewSegment(struct rdaRecorder *pr)
+{
+  char date[32];
+  time_t now = time(NULL);
+  struct tm *ptm = localtime(&now);
+
+  if (!ptm || 0 == strftime(date, sizeof(date), "%Y%m%d%H%M%S000000", ptm)) {
+    strcpy(date, "00000000000000000000");
+  }
+  pr->segmentPosition = pr->fileSamples + 1;
+  recorderWriteMarker(pr, "New Segment", "", pr->segmentPosition, 1, 0, date);
+}
+
+
+/*
+  The header file, which can only be written when the type of the values
+  is known from the first block.
+*/
+static int recorderWriteHeader(struct rdaRecorder *pr)
+{
+  const struct RDA_MessageStart *pms = pr->pMsgStart;
+  const char *names;
+  size_t len = strlen(pr->fileName);
+  ULONG c;
+  FILE *f;
+
+  strcat(pr->fileName, ".vhdr");
+  f = fopen(pr->fileName, "wb");
+  pr->fileName[len] = 0;
+  if (!f) return -1;
+
+  fputs("Brain Vision Data Exchange Header File Version 1.0\r\n", f);
+  fputs("; Data recorded by bbci_acquire_bv\r\n", f);
+  fputs("\r\n[Common Infos]\r\n", f);
+  fputs("Codepage=UTF-8\r\n", f);
+  fprintf(f, "DataFile=%s.eeg\r\n", recorderShortName(pr));
+  fprintf(f, "MarkerFile=%s.vmrk\r\n", recorderShortName(pr));
+  fputs("DataFormat=BINARY\r\n", f);
+  fputs("DataOrientation=MULTIPLEXED\r\n", f);
+  fprintf(f, "NumberOfChannels=%lu\r\n", (unsigned long)pms->nChannels);
+  fprintf(f, "SamplingInterval=%.17g\r\n", pms->dSamplingInterval);
+  fputs("\r\n[Binary Infos]\r\n", f);
+  switch (pr->elementType) {
+  case ELEMENT_INT16: fputs("BinaryFormat=INT_16\r\n", f); break;
+  case ELEMENT_INT32: fputs("BinaryFormat=INT_32\r\n", f); break;
+  default: fputs("BinaryFormat=IEEE_FLOAT_32\r\n", f); break;
+  }
+  fputs("\r\n[Channel Infos]\r\n", f);
+
+  /* the channel names follow the resolutions, delimited by '\0' */
+  names = (const char *)(pms->dResolutions + pms->nChannels);
+  for (c = 0; c < pms->nChannels; c++) {
+    fprintf(f, "Ch%lu=", (unsigned long)(c + 1));
+    recorderWriteEscaped(f, names);
+    fprintf(f, ",,%.17g,\xC2\xB5V\r\n", pms->dResolutions[c]);
+    names += strlen(names) + 1;
+  }
+
+  if (fclose(f) != 0) return -1;
+  return 0;
+}
+
+
+/*
+  Opens the .eeg and the .vmrk file with the next number.
+*/
+static int recorderOpenFiles(struct rdaRecorder *pr)
+{
+  size_t len;
+
+  if (0 == pr->files) {
+    strcpy(pr->fileName, pr->baseName);
+  } else {
+    sprintf(pr->fileName, "%s_%03lu", pr->baseName, (unsigned long)(pr->files + 1));
+  }
+  len = strlen(pr->fileName);
+
+  strcat(pr->fileName, ".eeg");
+  pr->eegFile = RECORD_OPEN(pr->fileName);
+  pr->fileName[len] = 0;
+  if (pr->eegFile < 0) return -1;
+
+  strcat(pr->fileName, ".vmrk");
+  pr->markerFile = fopen(pr->fileName, "wb");
+  pr->fileName[len] = 0;
+  if (!pr->markerFile) {
+    RECORD_CLOSE(pr->eegFile);
+    pr->eegFile = -1;
+    return -1;
+  }
+
+  fputs("Brain Vision Data Exchange Marker File, Version 1.0\r\n", pr->markerFile);
+  fputs("\r\n[Common Infos]\r\n", pr->markerFile);
+  fputs("Codepage=UTF-8\r\n", pr->markerFile);
+  fprintf(pr->markerFile, "DataFile=%s.eeg\r\n", recorderShortName(pr));
+  fputs("\r\n[Marker Infos]\r\n", pr->markerFile);
+
+  pr->files++;
+  pr->fileBytes = 0;
+  pr->fileSamples = 0;
+  pr->nMarkers = 0;
+  recorderNewSegment(pr);
+
+  if (pr->elementType && recorderWriteHeader(pr) != 0) return -1;
+
+  return 0;
+}
+
+
+static void recorderCloseFiles(struct rdaRecorder *pr)
+{
+  if (pr->eegFile >= 0) {
+    recorderFlush(pr, 0);
+    RECORD_SYNC(pr->eegFile);
+    RECORD_CLOSE(pr->eegFile);
+    pr->eegFile = -1;
+  }
+  if (pr->markerFile) {
+    fflush(pr->markerFile);
+    RECORD_SYNC(RECORD_FILENO(pr->markerFile));
+    fclose(pr->markerFile);
+    pr->markerFile = NULL;
+  }
+}
+
+
+/*
+  Writes one data message to the files.
+*/
+static void recorderWriteMessage(struct rdaRecorder *pr, const struct RDA_MessageData *pmd)
+{
+  int elementType = DetermineElementType(pmd->nType);
+  ULONG elementSize = ELEMENT_INT16 == elementType ? 2 : 4;
+  ULONG size = pmd->nPoints * pr->pMsgStart->nChannels * elementSize;
+  const char *data = (const char *)pmd->nData;
+  const struct RDA_Marker *pma;
+  ULONG m, done;
+
+  /* the files have one type of values, like the ring of headerfifo.c,
+     and a malformed block is skipped like there */
+  if (0 == elementType || (pr->elementType && elementType != pr->elementType)
+      || headerFIFOcheckBlock(pmd, pr->pMsgStart->nChannels, (int)elementSize) != 0) {
+    pr->blocksSkipped++;
+    return;
+  }
+  if (0 == pr->elementType) {
+    pr->elementType = elementType;
+    if (recorderWriteHeader(pr) != 0) {
+      recorderFailed(pr);
+      return;
+    }
+  }
+
+  /* start new files if this one is full */
+  if (pr->maxFileSize > 0 && pr->fileBytes > 0 && pr->fileBytes + size > pr->maxFileSize) {
+    recorderCloseFiles(pr);
+    if (recorderOpenFiles(pr) != 0) {
+      recorderFailed(pr);
+      return;
+    }
+  } else if (pr->haveBlock && pmd->nBlock > pr->lastBlock + 1) {
+    /* the time jumps here */
+    recorderNewSegment(pr);
+  }
+  pr->lastBlock = pmd->nBlock;
+  pr->haveBlock = 1;
+
+  /* the markers, their position is relative to the block */
+  pma = (const struct RDA_Marker *)(data + size);
+  for (m = 0; m < pmd->nMarkers; m++) {
+    const char *type = pma->sTypeDesc;
+    const char *end = (const char *)pma + pma->nSize;
+    const char *desc = (const char *)memchr(type, 0, end - type);
+    ULONG position = pr->fileSamples + pma->nPosition + 1;
+
+    /* both strings have to end within the marker, else it is left out.
+       The New Segment of the server is already there, with the date. */
+    desc = desc ? desc + 1 : end;
+    if (desc < end && memchr(desc, 0, end - desc)
+        && (position != pr->segmentPosition || 0 != strcmp(type, "New Segment"))) {
+      recorderWriteMarker(pr, type, desc, position, pma->nPoints,
+                          pma->nChannel < 0 ? 0 : (long)pma->nChannel + 1, NULL);
+    }
+    pma = (const struct RDA_Marker *)((const char *)pma + pma->nSize);
+  }
+
+  /* the values as they are */
+  for (done = 0; done < size && !pr->error; ) {
+    ULONG n = size - done;
+
+    if (n > RECORD_CHUNK_SIZE - pr->chunkFill) n = RECORD_CHUNK_SIZE - pr->chunkFill;
+    memcpy(pr->chunk + pr->chunkFill, data + done, n);
+    pr->chunkFill += n;
+    done += n;
+    if (RECORD_CHUNK_SIZE == pr->chunkFill) recorderWriteChunk(pr, RECORD_CHUNK_SIZE);
+  }
+
+  pr->fileBytes += size;
+  pr->fileSamples += pmd->nPoints;
+  pr->bytesWritten += size;
+  pr->blocksWritten++;
+}
+
+
+/*
+  Takes all messages out of the ring.
+*/
+static void recorderDrain(struct rdaRecorder *pr)
+{
+  ULONG w = pr->writePos;
+  ULONG r = pr->readPos;
+
+  RECORD_BARRIER();
+  while (r != w) {
+    struct RDA_MessageHeader header;
+    ULONG offset, first, i;
+
+    /* the header may wrap around, too */
+    offset = r & (pr->capacity - 1);
+    for (i = 0; i < sizeof(header); i++) {
+      ((char *)&header)[i] = pr->ring[(offset + i) & (pr->capacity - 1)];
+    }
+
+    if (header.nSize > pr->messageSize) {
+      char *message = (char *)realloc(pr->message, header.nSize);
+      if (!message) {
+        recorderFailed(pr);
+        pr->readPos = w;
+        return;
+      }
+      pr->message = message;
+      pr->messageSize = header.nSize;
+    }
+
+    first = pr->capacity - offset;
+    if (first > header.nSize) first = header.nSize;
+    memcpy(pr->message, pr->ring + offset, first);
+    memcpy(pr->message + first, pr->ring, header.nSize - first);
+
+    r += header.nSize;
+    RECORD_BARRIER();
+    pr->readPos = r;
+
+    if (pr->error) {
+      pr->blocksSkipped++;
+    } else {
+      recorderWriteMessage(pr, (const struct RDA_MessageData *)pr->message);
+    }
+  }
+}
+
+
+static int recorderThread(void *context)
+{
+  struct rdaRecorder *pr = (struct rdaRecorder *)context;
+
+  while (1) {
+    int quit = pr->quit;
+    double now;
+
+    if (!quit) acEventWait(pr->wakeEvent, RECORD_SYNC_INTERVAL);
+    recorderDrain(pr);
+
+    now = monotonicTime();
+    if (now - pr->lastSync >= RECORD_SYNC_INTERVAL) {
+      recorderSync(pr);
+      pr->lastSync = now;
+    }
+
+    /* everything pushed before the quit request has been written */
+    if (quit) break;
+  }
+
+  recorderCloseFiles(pr);
+
+  return 0;
+}
@@ -0,0 +1,94 @@
+/*
+  recorder.h
+
+  Records the data of a connection to BrainVision files (.vhdr, .vmrk
+  and .eeg) in a thread of its own.
+
+  The receiving thread hands every data message to recorderPush, which
+  copies the message as it came from the server into a ring and returns.
+  The writer thread takes the messages out of the ring, writes the values
+  unchanged to the .eeg file and the markers to the .vmrk file. So the
+  recording is bit-exact with what the Recorder sent, and neither the
+  receiving nor the matlab thread ever waits for the disk.
+
+  The .eeg file is written in chunks of RECORD_CHUNK_SIZE bytes from a
+  buffer aligned to RECORD_ALIGNMENT, every RECORD_SYNC_INTERVAL ms the
+  files are synced to the disk. When the .eeg file would grow beyond the
+  maximum size, a new set of files is started with a running number in
+  the name: name.eeg, name_002.eeg, name_003.eeg, ...
+
+  - 2026/10/17 - Jonas Reiter
+                 - Written.
+*/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "myRDA.h"
+
+#ifdef _MSC_VER
+#include "../../../fileio/private/msvc_stdint.h"
+#else
+#include <stdint.h>
+#endif
+
+/* size of the writes to the .eeg file */
+#define RECORD_CHUNK_SIZE           (1024 * 1024)
+
+/* alignment of the write buffer and of the file offsets */
+#define RECORD_ALIGNMENT            4096
+
+/* ms between two syncs of the files */
+#define RECORD_SYNC_INTERVAL        1000
+
+/* the ring holds this many seconds of data, at least RECORD_MIN_BUFFER bytes */
+#define RECORD_BUFFER_SECONDS       10
+#define RECORD_MIN_BUFFER           (8 * 1024 * 1024)
+
+/* longest wait in ms for the writer thread to finish the files */
+#define RECORD_CLOSE_TIMEOUT        10000
+
+struct recorderStats
+{
+  uint64_t bytesWritten;                /* to the .eeg files */
+  ULONG blocksWritten;
+  ULONG blocksDropped;                  /* because the ring was full or after an error */
+  ULONG files;                          /* number of .eeg files started */
+  int error;                            /* errno of the first failed write, 0 if none */
+};
+
+struct rdaRecorder;
+
+/*
+  Opens the first files of the recording and starts the writer thread.
+  fileName is the name of the files without extension, an extension
+  .vhdr, .vmrk or .eeg is removed. maxFileSize is the maximum size of an
+  .eeg file in bytes, 0 for no limit. Returns NULL if the files can not
+  be opened.
+*/
+extern struct rdaRecorder *recorderCreate(const char *fileName,
+                                          const struct RDA_MessageStart *pMsgStart,
+                                          double maxFileSize);
+
+/*
+  Queues a data message for the writer thread. Never blocks. Returns 0 if
+  the message was dropped because the ring is full. Only one thread may
+  push.
+*/
+extern int recorderPush(struct rdaRecorder *pr, const struct RDA_MessageData *pmd);
+
+extern void recorderGetStats(struct rdaRecorder *pr, struct recorderStats *pStats);
+
+/*
+  Locks the ring in memory, see acLockMemory. Returns 0 or an errno
+  value.
+*/
+extern int recorderLockMemory(struct rdaRecorder *pr);
+
+/*
+  Writes everything which is still queued, closes the files and frees the
+  recorder. No message may be pushed any more.
+*/
+extern void recorderDestroy(struct rdaRecorder *pr);
+
+#endif
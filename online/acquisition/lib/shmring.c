@@ -0,0 +1,539 @@
+/*
+  shmring.c
+
+  The shared memory ring, see shmring.h.
+
+  The positions are counted in samples and markers since the start of the
+  ring and never wrap, the slot of a position is the position modulo the
+  capacity. Only the writer writes the header, every reader writes only
+  its own cursor.
+
+  - 2026/10/17 - Jonas Reiter
+                 - Written.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#  define SHM_BARRIER() MemoryBarrier()
+#  define SHM_LOAD64(p) ((uint64_t)InterlockedCompareExchange64((volatile LONG64 *)(p), 0, 0))
+#  define SHM_STORE64(p, v) InterlockedExchange64((volatile LONG64 *)(p), (LONG64)(v))
+#  define SHM_CLAIM(p, pid) (0 == InterlockedCompareExchange((volatile LONG *)(p), (LONG)(pid), 0))
+#  define SHM_PID() ((int32_t)GetCurrentProcessId())
+#else
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <signal.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  define SHM_BARRIER() __sync_synchronize()
+#  define SHM_LOAD64(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#  define SHM_STORE64(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#  define SHM_CLAIM(p, pid) __sync_bool_compare_and_swap(p, 0, pid)
+#  define SHM_PID() ((int32_t)getpid())
+#endif
+
+#include "shmring.h"
+
+/* the suffix of the name of the cursor table */
+#define SHM_READERS_SUFFIX          ".readers"
+
+/* a reader copies at most this often before it gives up for this call */
+#define SHM_READ_ATTEMPTS           4
+
+struct shmRing
+{
+  int writer;
+  char *name;
+  char *readersName;
+  struct shmRingHeader *header;
+  size_t size;
+  struct shmRingCursor *cursors;        /* SHM_RING_MAX_READERS of them */
+  struct shmRingCursor *cursor;         /* of this reader */
+  int createdData;                      /* the writer created the objects, */
+  int createdReaders;                   /* so it removes them */
+#ifdef _WIN32
+  HANDLE hData;
+  HANDLE hReaders;
+#endif
+};
+
+
+/*
+  The names as the system wants them: posix names start with a slash,
+  windows names must not contain a backslash.
+*/
+static int shmMakeNames(struct shmRing *p, const char *name)
+{
+  size_t len;
+
+  while ('/' == *name) name++;
+  len = strlen(name);
+  if (0 == len) return -1;
+
+  p->name = (char *)malloc(len + 2);
+  p->readersName = (char *)malloc(len + 2 + strlen(SHM_READERS_SUFFIX));
+  if (!p->name || !p->readersName) return -1;
+
+#ifdef _WIN32
+  strcpy(p->name, name);
+#else
+  p->name[0] = '/';
+  strcpy(p->name + 1, name);
+#endif
+  strcpy(p->readersName, p->name);
+  strcat(p->readersName, SHM_READERS_SUFFIX);
+
+  return 0;
+}
+
+/* creates or opens the memory of name and maps it, size 0 means as it is */
+static void *shmMap(struct shmRing *p, const char *name, size_t size, int create, int writable)
+{
+#ifdef _WIN32
+  HANDLE h;
+  void *pv;
+
+  if (create) {
+    h = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                           (DWORD)((uint64_t)size >> 32), (DWORD)size, name);
+    /* the mapping lives as long as a handle is open, so it is in use */
+    if (h && ERROR_ALREADY_EXISTS == GetLastError()) {
+      CloseHandle(h);
+      return NULL;
+    }
+  } else {
+    h = OpenFileMappingA(writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, FALSE, name);
+  }
+  if (!h) return NULL;
+
+  pv = MapViewOfFile(h, writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, size);
+  if (!pv) {
+    CloseHandle(h);
+    return NULL;
+  }
+  if (name == p->name) p->hData = h;
+  else p->hReaders = h;
+
+  return pv;
+#else
+  void *pv;
+  int fd;
+
+  if (create) {
+    /* never take over the ring of another writer, see shmRemoveStale */
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return NULL;
+    if (name == p->name) p->createdData = 1;
+    else p->createdReaders = 1;
+    if (ftruncate(fd, (off_t)size) != 0) {
+      close(fd);
+      return NULL;
+    }
+  } else {
+    struct stat st;
+
+    fd = shm_open(name, writable ? O_RDWR : O_RDONLY, 0);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < size) {
+      close(fd);
+      return NULL;
+    }
+    if (0 == size) size = (size_t)st.st_size;
+  }
+
+  pv = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (MAP_FAILED == pv) return NULL;
+  if (name == p->name) p->size = size;
+
+  return pv;
+#endif
+}
+
+static void shmUnmap(void *pv, size_t size)
+{
+#ifdef _WIN32
+  UnmapViewOfFile(pv);
+#else
+  munmap(pv, size);
+#endif
+}
+
+/* is the process of a cursor still there? */
+static int shmAlive(int32_t pid)
+{
+#ifdef _WIN32
+  HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+  int alive;
+
+  if (!h) return 0;
+  alive = WAIT_TIMEOUT == WaitForSingleObject(h, 0);
+  CloseHandle(h);
+  return alive;
+#else
+  return 0 == kill((pid_t)pid, 0) || EPERM == errno;
+#endif
+}
+
+/*
+  Removes the objects of name if they were left behind by a writer which
+  has gone without shmRingClose. Returns -1 if a living writer uses the
+  name. The objects of windows go away with their last handle.
+*/
+static int shmRemoveStale(struct shmRing *p)
+{
+#ifndef _WIN32
+  struct shmRingHeader *h;
+  struct stat st;
+  int fd, stale;
+
+  fd = shm_open(p->name, O_RDONLY, 0);
+  if (fd >= 0) {
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct shmRingHeader)) {
+      /* a writer which is just creating it or one which died doing so */
+      close(fd);
+      return -1;
+    }
+    h = (struct shmRingHeader *)mmap(NULL, sizeof(struct shmRingHeader), PROT_READ,
+                                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == h) return -1;
+    stale = h->closed || !shmAlive(h->writerPid);
+    munmap(h, sizeof(struct shmRingHeader));
+    if (!stale) return -1;
+    shm_unlink(p->name);
+  }
+  /* the cursors are of no use without the data */
+  shm_unlink(p->readersName);
+#else
+  (void)p;
+#endif
+  return 0;
+}
+
+static void shmFree(struct shmRing *p)
+{
+  if (p->cursors) shmUnmap(p->cursors, sizeof(struct shmRingCursor) * SHM_RING_MAX_READERS);
+  if (p->header) shmUnmap(p->header, p->size);
+#ifdef _WIN32
+  if (p->hData) CloseHandle(p->hData);
+  if (p->hReaders) CloseHandle(p->hReaders);
+#endif
+  free(p->name);
+  free(p->readersName);
+  free(p);
+}
+
+
+struct shmRing *shmRingCreate(const char *name, uint32_t nChannels, double fs,
+                              uint32_t capacity, const char *labels)
+{
+  struct shmRing *p;
+  struct shmRingHeader *h;
+  uint32_t dataOffset, markerOffset, labelOffset, size, n, c;
+
+  if (0 == nChannels || capacity > 0x40000000) return NULL;
+  for (n = 1; n < capacity; n <<= 1);
+  capacity = n;
+
+  /* the layout, every part aligned to 64 bytes */
+  dataOffset = (sizeof(struct shmRingHeader) + 63) & ~63;
+  markerOffset = dataOffset + ((capacity * (uint64_t)nChannels * sizeof(double) + 63) & ~63);
+  labelOffset = markerOffset + SHM_RING_MARKER_CAPACITY * sizeof(struct shmRingMarker);
+  if ((uint64_t)dataOffset + capacity * (uint64_t)nChannels * sizeof(double)
+      + SHM_RING_MARKER_CAPACITY * sizeof(struct shmRingMarker)
+      + nChannels * (uint64_t)SHM_RING_LABEL_LEN + 128 > 0xffffffffu) {
+    return NULL;
+  }
+  size = labelOffset + nChannels * SHM_RING_LABEL_LEN;
+
+  p = (struct shmRing *)calloc(1, sizeof(struct shmRing));
+  if (!p) return NULL;
+  p->writer = 1;
+  if (shmMakeNames(p, name) != 0 || shmRemoveStale(p) != 0) {
+    shmFree(p);
+    return NULL;
+  }
+
+  p->header = (struct shmRingHeader *)shmMap(p, p->name, size, 1, 1);
+  if (p->header) {
+    p->cursors = (struct shmRingCursor *)shmMap(p, p->readersName,
+                                                sizeof(struct shmRingCursor) * SHM_RING_MAX_READERS, 1, 1);
+  }
+  if (!p->header || !p->cursors) {
+    shmRingClose(p);
+    return NULL;
+  }
+  p->size = size;
+  memset(p->cursors, 0, sizeof(struct shmRingCursor) * SHM_RING_MAX_READERS);
+
+  h = p->header;
+  memset(h, 0, sizeof(struct shmRingHeader));
+  h->version = SHM_RING_VERSION;
+  h->nChannels = nChannels;
+  h->capacity = capacity;
+  h->markerCapacity = SHM_RING_MARKER_CAPACITY;
+  h->dataOffset = dataOffset;
+  h->markerOffset = markerOffset;
+  h->labelOffset = labelOffset;
+  h->fs = fs;
+  h->writerPid = SHM_PID();
+
+  for (c = 0; c < nChannels; c++) {
+    char *label = (char *)h + labelOffset + c * SHM_RING_LABEL_LEN;
+
+    memset(label, 0, SHM_RING_LABEL_LEN);
+    if (labels) {
+      strncpy(label, labels, SHM_RING_LABEL_LEN - 1);
+      labels += strlen(labels) + 1;
+    }
+  }
+
+  /* the magic tells a reader that the header is complete */
+  SHM_BARRIER();
+  h->magic = SHM_RING_MAGIC;
+
+  return p;
+}
+
+
+void shmRingWrite(struct shmRing *p, const void *data, int type, uint32_t nPoints,
+                  const struct shmRingMarker *markers, uint32_t nMarkers)
+{
+  struct shmRingHeader *h = p->header;
+  double *ring = (double *)((char *)h + h->dataOffset);
+  struct shmRingMarker *markerRing = (struct shmRingMarker *)((char *)h + h->markerOffset);
+  uint32_t nChannels = h->nChannels;
+  uint32_t mask = h->capacity - 1;
+  uint64_t w = h->writePos, mw = h->markerWritePos;
+  uint32_t i, c, first = 0;
+
+  /* announce which slots are overwritten */
+  SHM_STORE64(&h->reservePos, w + nPoints);
+  SHM_STORE64(&h->markerReservePos, mw + nMarkers);
+  SHM_BARRIER();
+
+  /* of a write larger than the ring only the end remains */
+  if (nPoints > h->capacity) first = nPoints - h->capacity;
+
+  for (i = first; i < nPoints; i++) {
+    double *row = ring + (size_t)((w + i) & mask) * nChannels;
+
+    if (SHM_RING_FLOAT32 == type) {
+      const float *pf = (const float *)data + i;
+      for (c = 0; c < nChannels; c++) row[c] = pf[(size_t)c * nPoints];
+    } else {
+      const double *pd = (const double *)data + i;
+      for (c = 0; c < nChannels; c++) row[c] = pd[(size_t)c * nPoints];
+    }
+  }
+
+  for (i = 0; i < nMarkers; i++) {
+    struct shmRingMarker *pm = markerRing + ((mw + i) & (h->markerCapacity - 1));
+
+    pm->position = w + markers[i].position;
+    memcpy(pm->sTypeDesc, markers[i].sTypeDesc, SHM_RING_MARKER_DESC_LEN);
+  }
+
+  /* the markers before the samples, so a reader which sees the samples sees their markers */
+  SHM_BARRIER();
+  SHM_STORE64(&h->markerWritePos, mw + nMarkers);
+  SHM_STORE64(&h->writePos, w + nPoints);
+  SHM_STORE64(&h->sequence, h->sequence + 1);
+}
+
+
+struct shmRing *shmRingOpen(const char *name)
+{
+  struct shmRing *p;
+  struct shmRingHeader *h;
+  int32_t pid = SHM_PID();
+  int i;
+
+  p = (struct shmRing *)calloc(1, sizeof(struct shmRing));
+  if (!p) return NULL;
+  if (shmMakeNames(p, name) != 0) {
+    shmFree(p);
+    return NULL;
+  }
+
+  p->header = (struct shmRingHeader *)shmMap(p, p->name, 0, 0, 0);
+  if (p->header) {
+    p->cursors = (struct shmRingCursor *)shmMap(p, p->readersName,
+                                                sizeof(struct shmRingCursor) * SHM_RING_MAX_READERS, 0, 1);
+  }
+  if (!p->header || !p->cursors) {
+    shmFree(p);
+    return NULL;
+  }
+
+  h = p->header;
+#ifdef _WIN32
+  {
+    MEMORY_BASIC_INFORMATION mbi;
+    p->size = VirtualQuery(h, &mbi, sizeof(mbi)) ? mbi.RegionSize : 0;
+  }
+#endif
+  SHM_BARRIER();
+  if (h->magic != SHM_RING_MAGIC || h->version != SHM_RING_VERSION
+      || h->labelOffset + (uint64_t)h->nChannels * SHM_RING_LABEL_LEN > p->size) {
+    shmFree(p);
+    return NULL;
+  }
+
+  /* a free cursor or one of a process which has gone */
+  for (i = 0; i < SHM_RING_MAX_READERS && !p->cursor; i++) {
+    struct shmRingCursor *pc = p->cursors + i;
+    int32_t owner = pc->pid;
+
+    if (owner != 0 && owner != pid && !shmAlive(owner)) {
+      /* only one of the readers which try gets it */
+#ifdef _WIN32
+      InterlockedCompareExchange((volatile LONG *)&pc->pid, 0, (LONG)owner);
+#else
+      __sync_bool_compare_and_swap(&pc->pid, owner, 0);
+#endif
+    }
+    if (SHM_CLAIM(&pc->pid, pid)) p->cursor = pc;
+  }
+  if (!p->cursor) {
+    shmFree(p);
+    return NULL;
+  }
+
+  p->cursor->markerReadPos = SHM_LOAD64(&h->markerWritePos);
+  p->cursor->readPos = SHM_LOAD64(&h->writePos);
+  p->cursor->lost = 0;
+
+  return p;
+}
+
+
+uint64_t shmRingAvailable(struct shmRing *p)
+{
+  return SHM_LOAD64(&p->header->writePos) - p->cursor->readPos;
+}
+
+
+uint32_t shmRingRead(struct shmRing *p, void *data, int type, uint32_t maxPoints,
+                     struct shmRingMarker *markers, uint32_t maxMarkers,
+                     uint32_t *pMarkers, uint64_t *pLost)
+{
+  const struct shmRingHeader *h = p->header;
+  const double *ring = (const double *)((const char *)h + h->dataOffset);
+  const struct shmRingMarker *markerRing =
+    (const struct shmRingMarker *)((const char *)h + h->markerOffset);
+  struct shmRingCursor *pc = p->cursor;
+  uint32_t nChannels = h->nChannels;
+  uint64_t capacity = h->capacity, markerCapacity = h->markerCapacity;
+  uint64_t r = pc->readPos, lost = 0, w, limit, mw, mr, mStart;
+  uint32_t n = 0, i, c, nMarkers = 0, attempt;
+
+  for (attempt = 0; attempt < SHM_READ_ATTEMPTS; attempt++) {
+    w = SHM_LOAD64(&h->writePos);
+    if (w - r > capacity) {
+      lost += w - r - capacity;
+      r = w - capacity;
+    }
+    n = w - r < maxPoints ? (uint32_t)(w - r) : maxPoints;
+
+    for (i = 0; i < n; i++) {
+      const double *row = ring + (size_t)((r + i) & (capacity - 1)) * nChannels;
+
+      if (SHM_RING_FLOAT32 == type) {
+        float *pf = (float *)data + i;
+        for (c = 0; c < nChannels; c++) pf[(size_t)c * n] = (float)row[c];
+      } else {
+        double *pd = (double *)data + i;
+        for (c = 0; c < nChannels; c++) pd[(size_t)c * n] = row[c];
+      }
+    }
+
+    /* were some of the slots overwritten while they were copied? */
+    SHM_BARRIER();
+    limit = SHM_LOAD64(&h->reservePos);
+    if (limit <= capacity || limit - capacity <= r) break;
+    lost += limit - capacity - r;
+    r = limit - capacity;
+    n = 0;
+  }
+
+  /* the markers of the samples read, the ones of lost samples are skipped */
+  mw = SHM_LOAD64(&h->markerWritePos);
+  mr = pc->markerReadPos;
+  if (mw - mr > markerCapacity) mr = mw - markerCapacity;
+  mStart = mr;
+  while (mr != mw && nMarkers < maxMarkers) {
+    const struct shmRingMarker *pm = markerRing + (mr & (markerCapacity - 1));
+    uint64_t position = pm->position;
+
+    if (position >= r + n) break;
+    mr++;
+    if (position < r) continue;
+    markers[nMarkers].position = position - r;
+    memcpy(markers[nMarkers].sTypeDesc, pm->sTypeDesc, SHM_RING_MARKER_DESC_LEN);
+    markers[nMarkers].sTypeDesc[SHM_RING_MARKER_DESC_LEN - 1] = 0;
+    nMarkers++;
+  }
+
+  /* drop the markers which may have been overwritten while they were copied */
+  SHM_BARRIER();
+  limit = SHM_LOAD64(&h->markerReservePos);
+  if (limit > markerCapacity && limit - markerCapacity > mStart) {
+    uint64_t bad = limit - markerCapacity - mStart;
+
+    if (bad > mr - mStart) bad = mr - mStart;
+    /* the bad ones are the first which were looked at, at most that many were copied */
+    if (bad >= nMarkers) {
+      nMarkers = 0;
+    } else {
+      memmove(markers, markers + bad, (nMarkers - (size_t)bad) * sizeof(struct shmRingMarker));
+      nMarkers -= (uint32_t)bad;
+    }
+  }
+
+  SHM_STORE64(&pc->readPos, r + n);
+  SHM_STORE64(&pc->markerReadPos, mr);
+  SHM_STORE64(&pc->lost, pc->lost + lost);
+
+  if (pMarkers) *pMarkers = nMarkers;
+  if (pLost) *pLost = lost;
+  return n;
+}
+
+
+const struct shmRingHeader *shmRingInfo(struct shmRing *p)
+{
+  return p->header;
+}
+
+
+const char *shmRingLabel(struct shmRing *p, uint32_t channel)
+{
+  return (const char *)p->header + p->header->labelOffset + channel * SHM_RING_LABEL_LEN;
+}
+
+
+void shmRingClose(struct shmRing *p)
+{
+  if (!p) return;
+
+  if (p->writer) {
+    if (p->header) {
+      p->header->closed = 1;
+      SHM_BARRIER();
+    }
+#ifndef _WIN32
+    if (p->createdData) shm_unlink(p->name);
+    if (p->createdReaders) shm_unlink(p->readersName);
+#endif
+  } else if (p->cursor) {
+    p->cursor->pid = 0;
+  }
+
+  shmFree(p);
+}
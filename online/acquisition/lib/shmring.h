@@ -0,0 +1,151 @@
+/*
+  shmring.h
+
+  A ring of samples and markers in named shared memory, so other
+  processes can read the data of one acquisition without a connection of
+  their own.
+
+  There is one writer and up to SHM_RING_MAX_READERS readers. The writer
+  creates two objects: name holds the header, the samples and the
+  markers and is mapped read-only by the readers, name.readers holds one
+  cursor per reader. The writer never waits for a reader. A reader which
+  falls more than the capacity of the ring behind loses the oldest
+  samples and is told how many.
+
+  The samples are stored as double, one row of nChannels values per
+  sample. Before a write the writer announces the positions it is going
+  to overwrite in reservePos, after the write it publishes writePos and
+  increments the sequence counter. A reader copies first and checks
+  reservePos afterwards, so it never hands out a sample which was
+  overwritten while it was copied.
+
+  - 2026/10/17 - Jonas Reiter
+                 - Written.
+*/
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#ifdef _MSC_VER
+#include "../../../fileio/private/msvc_stdint.h"
+#else
+#include <stdint.h>
+#endif
+
+#define SHM_RING_MAGIC              0x49434242 /* "BBCI" */
+#define SHM_RING_VERSION            1
+
+#define SHM_RING_MAX_READERS        16
+#define SHM_RING_LABEL_LEN          32
+#define SHM_RING_MARKER_DESC_LEN    64
+#define SHM_RING_MARKER_CAPACITY    4096
+
+/* default capacity of the ring in seconds */
+#define SHM_RING_DEFAULT_SECONDS    10
+
+/* the types of the values for shmRingWrite and shmRingRead */
+#define SHM_RING_FLOAT32            3
+#define SHM_RING_FLOAT64            4
+
+/*
+  The start of the shared memory. The samples, the markers and the
+  channel labels follow at the given offsets.
+*/
+struct shmRingHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nChannels;
+  uint32_t capacity;                    /* samples, a power of two */
+  uint32_t markerCapacity;              /* a power of two */
+  uint32_t dataOffset;                  /* capacity * nChannels doubles */
+  uint32_t markerOffset;                /* markerCapacity struct shmRingMarker */
+  uint32_t labelOffset;                 /* nChannels * SHM_RING_LABEL_LEN chars */
+  double fs;
+  volatile uint64_t sequence;           /* number of writes */
+  volatile uint64_t writePos;           /* samples written since the start */
+  volatile uint64_t markerWritePos;     /* markers written since the start */
+  volatile uint64_t reservePos;         /* writePos at the end of the current write */
+  volatile uint64_t markerReservePos;   /* markerWritePos likewise */
+  volatile uint32_t closed;             /* the writer has gone */
+  int32_t writerPid;                    /* the process of the writer */
+};
+
+/*
+  A marker. In the ring position is the number of the sample it belongs
+  to, counted like writePos. shmRingWrite takes and shmRingRead returns
+  the position relative to the first sample of the call.
+*/
+struct shmRingMarker
+{
+  uint64_t position;
+  char sTypeDesc[SHM_RING_MARKER_DESC_LEN]; /* type and description delimited by '\0' */
+};
+
+/*
+  The cursor of a reader in name.readers. pid is 0 if the slot is free.
+*/
+struct shmRingCursor
+{
+  volatile int32_t pid;
+  uint32_t reserved;
+  volatile uint64_t readPos;
+  volatile uint64_t markerReadPos;
+  volatile uint64_t lost;               /* samples the reader lost */
+};
+
+struct shmRing;
+
+/*
+  The writer. labels are the channel names delimited by '\0', capacity is
+  rounded up to a power of two. Both objects are only accessible by the
+  user of the writer. A ring of the same name which was left behind by a
+  writer which has gone is removed first. Returns NULL if the memory can
+  not be created or a living writer already uses the name.
+*/
+extern struct shmRing *shmRingCreate(const char *name, uint32_t nChannels, double fs,
+                                     uint32_t capacity, const char *labels);
+
+/*
+  Appends nPoints samples. data has the layout of a matlab matrix
+  [nPoints nChannels] of the type SHM_RING_FLOAT32 or SHM_RING_FLOAT64.
+*/
+extern void shmRingWrite(struct shmRing *p, const void *data, int type, uint32_t nPoints,
+                         const struct shmRingMarker *markers, uint32_t nMarkers);
+
+/*
+  The reader. Maps the ring read-only and takes a cursor which starts at
+  the current end of the data. Returns NULL if there is no such ring or
+  all cursors are taken.
+*/
+extern struct shmRing *shmRingOpen(const char *name);
+
+/*
+  The number of samples a reader can read, including the ones which will
+  turn out to be lost.
+*/
+extern uint64_t shmRingAvailable(struct shmRing *p);
+
+/*
+  Reads at most maxPoints samples into data as a matlab matrix
+  [nPoints nChannels] of the given type and at most maxMarkers markers.
+  *pLost is set to the samples which were overwritten before they could
+  be read. Returns the number of samples read.
+*/
+extern uint32_t shmRingRead(struct shmRing *p, void *data, int type, uint32_t maxPoints,
+                            struct shmRingMarker *markers, uint32_t maxMarkers,
+                            uint32_t *pMarkers, uint64_t *pLost);
+
+/* the header of the ring, for the readers the mapped one */
+extern const struct shmRingHeader *shmRingInfo(struct shmRing *p);
+
+/* the label of a channel */
+extern const char *shmRingLabel(struct shmRing *p, uint32_t channel);
+
+/*
+  Closes the ring. The writer removes the names, readers which still have
+  the ring mapped see closed set.
+*/
+extern void shmRingClose(struct shmRing *p);
+
+#endif
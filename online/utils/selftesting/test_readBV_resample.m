@@ -0,0 +1,93 @@
+% Resampling in read_bv to a rate which is no divisor of the raw rate,
+% without OPT.filt_resample (the default lowpass), with an empty one and
+% with own taps. The result is compared with upsampling, filtering with
+% the same taps and downsampling in matlab, like upfirdn, with the delay
+% (length(h)-1)/2 of the taps compensated like in resample: output sample
+% k is at the time k/fs_out like input sample k at k/fs, so the markers
+% of file_readBVmarkers (time= pos*1000/fs) stay at their samples. This
+% is checked with impulses at the marker positions.
+
+C= 4;
+T= 5000;
+fs= 1000;
+fs_out= 300;
+x= round(1000*randn(C, T));
+% impulses at the markers, the first three at the time of an output sample
+mrk_pos= [1000 2000 3330 4321];
+x(1, mrk_pos)= 30000;
+
+file= [tempname '.eeg'];
+fid= fopen(file, 'w', 'l');
+fwrite(fid, x, 'int16');
+fclose(fid);
+
+% read_bv is private to fileio
+old_dir= cd(fullfile(fileparts(which('file_readBV')), 'private'));
+read_bv_fcn= @read_bv;
+cd(old_dir);
+
+hdr= struct('fs',fs, 'nChans',C, 'scale',ones(1,C), 'endian','l', ...
+            'BinaryFormat',1);
+p= fs_out/gcd(fs, fs_out);
+q= fs/gcd(fs, fs_out);
+nOut= floor(T*p/q);
+
+% the lowpass of read_bv: Kaiser window (beta 5), gain p
+m= max(p, q);
+k= -10*m:10*m;
+h_default= sin(pi*k/m)./(pi*k/m);
+h_default(k==0)= 1;
+h_default= h_default .* besseli(0, 5*sqrt(1-(k/(10*m)).^2)) / besseli(0, 5);
+h_default= h_default * p / sum(h_default);
+% own taps: a Hamming window
+h_own= 0.54 - 0.46*cos(2*pi*(0:8*m)/(8*m));
+h_own= h_own * p / sum(h_own);
+
+for filt= {'none', 'empty', 'own'},
+  opt= struct('chanidx',1:C, 'fs',fs_out);
+  switch(filt{1}),
+   case 'none',
+    h= h_default;
+   case 'empty',
+    opt.filt_resample= [];
+    h= h_default;
+   case 'own',
+    opt.filt_resample= h_own;
+    h= h_own;
+  end
+
+  % upsampled by p and filtered, with zeros after the data for the delay
+  D= floor((length(h)-1)/2);
+  xu= zeros(T*p+D+q, C);
+  xu(1:p:T*p,:)= x';
+  yu= filter(h, 1, xu);
+  % output sample k at the upsampled time k*q-p+1 (1-based), D later
+  ref= yu((1:nOut)*q-p+1+D,:);
+
+  opt.data= zeros(nOut, C);
+  opt.dataPos= [0 nOut-1 0 nOut-1];
+  read_bv_fcn(file, hdr, opt);
+  isequal(size(opt.data), size(ref))
+  max(abs(opt.data(:)-ref(:)))
+
+  % without opt.data read_bv returns the same samples
+  opt= rmfield(opt, {'data', 'dataPos'});
+  data= read_bv_fcn(file, hdr, opt);
+  isequal(size(data), size(ref))
+  max(abs(data(:)-ref(:)))
+
+  % the impulses are at the samples of the markers: the taps of the
+  % default lowpass are zero at the other output samples
+  if ~isequal(filt{1}, 'own'),
+    mrk_sample= mrk_pos*1000/fs * fs_out/1000;
+    peak= zeros(size(mrk_pos));
+    for i= 1:length(mrk_pos),
+      ival= round(mrk_sample(i)) + (-5:5);
+      [dmy, j]= max(data(ival, 1));
+      peak(i)= ival(j);
+    end
+    isequal(peak, round(mrk_sample))
+  end
+end
+
+delete(file);
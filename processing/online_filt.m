@@ -3,11 +3,15 @@ function [dat,state]= online_filt(dat, state, b, a, varargin)
 %
 %Synopsis:
 %[cnt,state]= online_filt(cnt, state, b, a, <b2, a2, ...>)
+%[cnt,state]= online_filt(cnt, state, sos)
 %
 %Arguments:
 %   cnt:    data structure of continuous data
 %   state:  filter state 
 %   b, a:    DOUBLE [1xN] - filter coefficients
+%   sos:     DOUBLE [nSections 6] - second order sections, each row
+%            [b0 b1 b2 a0 a1 a2] (e.g. from zp2sos), used instead of b
+%            and a. High order filters are stable this way.
 %
 %Returns:  
 %   cnt:    updated data structure
@@ -23,4 +27,16 @@ function [dat,state]= online_filt(dat, state, b, a, varargin)
 
 % Benjamin Blankertz
 
-[dat.x, state] = filter(b, a, dat.x, state, 1);
+if nargin<4 || isempty(a),
+  % cascade of second order sections, one state for each section
+  sos= b;
+  if isempty(state),
+    state= zeros([2, size(dat.x,2), size(sos,1)]);
+  end
+  for ss= 1:size(sos,1),
+    [dat.x, state(:,:,ss)]= ...
+        filter(sos(ss,1:3), sos(ss,4:6), dat.x, state(:,:,ss), 1);
+  end
+else
+  [dat.x, state] = filter(b, a, dat.x, state, 1);
+end
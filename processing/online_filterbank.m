@@ -18,6 +18,11 @@ function [cnt,state]= online_filterbank(cnt, state, filt_b, filt_a)
 % This function applies forward frequency filtering to online data. 
 % Those filters and the corresponding filter coefficients (a,b) can 
 % be generated with e.g. Butterworth or Chebyshev filter design.
+% If filt_a{i} is empty, filt_b{i} are second order sections (see
+% online_filt).
+% All bands are filtered in one pass over the data by the mex file
+% apply_filterbank if it is compiled, else band by band with filter.
+% The state is the same in both cases.
 %
 %Example:
 %
@@ -25,16 +30,18 @@ function [cnt,state]= online_filterbank(cnt, state, filt_b, filt_a)
 % SEE butters, online_filt, proc_filterbank
 
 % Benjamin Blankertz
+% 2026/10/17 - Jonas Reiter
+%              - single pass filter bank (apply_filterbank), the output is
+%                allocated for each block, which may change its length
 
 
 if isempty(state),
   state.nFilters= length(filt_b);
   state.filt_b= filt_b;
   state.filt_a= filt_a;
-  persistent xo;       %% reserve memory only once
-  [T, state.nChans]= size(cnt.x);
-  xo= zeros([T, state.nChans*state.nFilters]);
+  state.nChans= size(cnt.x, 2);
   state.filtstate= cell([1 state.nFilters]);
+  state.use_mex= (exist('apply_filterbank','file')==3);
 %  state.clab= cell(1, state.nChans*state.nFilters);
 %  cc= 1:state.nChans;
 %  for ii= 1:state.nFilters,
@@ -43,10 +50,23 @@ if isempty(state),
 %  end
 end
 
+if state.use_mex,
+  [cnt.x, state.filtstate]= ...
+      apply_filterbank(cnt.x, state.filt_b, state.filt_a, state.filtstate);
+  return;
+end
+
+xo= zeros([size(cnt.x,1), state.nChans*state.nFilters], class(cnt.x));
 cc= 1:state.nChans;
 for ii= 1:state.nFilters,
-  [xo(:,cc), state.filtstate{ii}]= ...
-     filter(state.filt_b{ii}, state.filt_a{ii}, cnt.x, state.filtstate{ii}, 1);
+  if isempty(state.filt_a{ii}),
+    [band, state.filtstate{ii}]= ...
+        online_filt(cnt, state.filtstate{ii}, state.filt_b{ii});
+    xo(:,cc)= band.x;
+  else
+    [xo(:,cc), state.filtstate{ii}]= ...
+        filter(state.filt_b{ii}, state.filt_a{ii}, cnt.x, state.filtstate{ii}, 1);
+  end
   cc= cc + state.nChans;
 end
 cnt.x= xo;
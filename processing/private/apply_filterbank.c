@@ -0,0 +1,240 @@
+/*
+  apply_filterbank.c
+
+  This file defines a mex-Function which applies a bank of IIR filters to
+  the same data, see apply_filterbank.m.
+
+  [y, zf] = apply_filterbank(x, filt_b, filt_a, zi);
+
+  Arguments:
+      x      - The data [T nChans], double or single
+      filt_b - Cell array with the b part of the filter of each band
+      filt_a - Cell array with the a part of the filter of each band. If
+               filt_a{i} is empty filt_b{i} are second order sections
+               [nSections 6], each row b0 b1 b2 a0 a1 a2
+      zi     - Cell array with the state of each band (optional), double
+               or single. Empty cells start with a state of zeros.
+
+  Returns:
+      y      - The filtered data [T nChans*nBands] of the class of x,
+               columns 1 to nChans are band 1 and so on
+      zf     - Cell array with the state of each band, of the class of
+               x: for an IIR filter [order nChans] like the zf of filter,
+               for second order sections [2 nChans nSections] like
+               online_filt
+
+  The bands are filtered by the filter bank of filter.c, which computes
+  all bands in one pass over the data. It only computes in double: single
+  data and a single state are converted to double and the results are
+  rounded to single. Unlike filter of matlab, which computes single data
+  in single, y is therefore as exact as for double data, so it can differ
+  from the result of filter in the last bits.
+
+  2026/10/17 - Jonas Reiter
+               - file created
+               - zi may be single, zf has the class of x
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "mex.h"
+#include "../../online/acquisition/lib/filter.h"
+
+static struct filterBank *afbBank;  /* the filter bank of the current call */
+static double *afbBuffer;           /* double copies of single data */
+static double *afbState;            /* double copy of a single state */
+
+static void afb_init(int nrhs, const mxArray *prhs[], int nChans);
+static void afb_filter(int nlhs, mxArray *plhs[], const mxArray *x, int nBands, int nChans);
+static void afb_cleanup(void);
+static void afb_assert(bool aValue, const char* text);
+
+/************************************************************
+ *
+ * mexFunction
+ *
+ ************************************************************/
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  int nChans;
+
+  afb_assert(nrhs == 3 || nrhs == 4, "Three or four input arguments required.");
+  afb_assert(nlhs <= 2, "One or two output arguments required.");
+  afb_assert((mxIsDouble(prhs[0]) || mxIsSingle(prhs[0])) && !mxIsComplex(prhs[0])
+             && mxGetNumberOfDimensions(prhs[0]) == 2,
+             "x has to be a real double or single matrix.");
+  nChans = (int)mxGetN(prhs[0]);
+
+  afb_init(nrhs, prhs, nChans);
+  afb_filter(nlhs, plhs, prhs[0], (int)mxGetNumberOfElements(prhs[1]), nChans);
+  afb_cleanup();
+}
+
+/************************************************************
+ *
+ * Creates the filter bank with the filters of filt_b and filt_a and sets
+ * the state of each band from zi.
+ *
+ ************************************************************/
+static void afb_init(int nrhs, const mxArray *prhs[], int nChans)
+{
+  const mxArray *filtB = prhs[1];
+  const mxArray *filtA = prhs[2];
+  const mxArray *zi = nrhs == 4 ? prhs[3] : NULL;
+  int nBands, band;
+
+  afb_assert(mxIsCell(filtB) && mxIsCell(filtA), "filt_b and filt_a have to be cell arrays.");
+  nBands = (int)mxGetNumberOfElements(filtB);
+  afb_assert(nBands > 0 && (int)mxGetNumberOfElements(filtA) == nBands,
+             "filt_b and filt_a need the same number of filters.");
+  afb_assert(NULL == zi || mxIsEmpty(zi)
+             || (mxIsCell(zi) && (int)mxGetNumberOfElements(zi) == nBands),
+             "zi has to be a cell array with a state for each filter.");
+
+  afbBank = filterBankCreate(nBands, nChans);
+  afb_assert(NULL != afbBank, "Out of memory.");
+
+  for(band = 0; band < nBands; ++band) {
+    const mxArray *b = mxGetCell(filtB, band);
+    const mxArray *a = mxGetCell(filtA, band);
+    const mxArray *z = (NULL == zi || mxIsEmpty(zi)) ? NULL : mxGetCell(zi, band);
+    int ok;
+
+    afb_assert(NULL != b && mxIsDouble(b) && !mxIsComplex(b) && !mxIsEmpty(b),
+               "filt_b has to contain real double values.");
+    if(NULL == a || mxIsEmpty(a)) {
+      /* second order sections */
+      afb_assert(mxGetN(b) == 6, "Second order sections have to be [nSections 6].");
+      ok = filterBankSetSOS(afbBank, band, mxGetPr(b), (int)mxGetM(b));
+    } else {
+      afb_assert(mxIsDouble(a) && !mxIsComplex(a) && 0 != mxGetPr(a)[0],
+                 "filt_a has to contain real double values with a(1) ~= 0.");
+      ok = filterBankSetIIR(afbBank, band, mxGetPr(b), (int)mxGetNumberOfElements(b),
+                            mxGetPr(a), (int)mxGetNumberOfElements(a));
+    }
+    afb_assert(ok, "Out of memory.");
+
+    if(NULL != z && !mxIsEmpty(z)) {
+      int rows, sections;
+
+      filterBankStateShape(afbBank, band, &rows, &sections);
+      afb_assert((mxIsDouble(z) || mxIsSingle(z)) && !mxIsComplex(z)
+                 && (int)mxGetNumberOfElements(z) == rows * sections * nChans,
+                 "A state in zi does not fit to its filter and the channels of x.");
+      if(mxIsDouble(z)) {
+        filterBankSetState(afbBank, band, mxGetPr(z));
+      } else {
+        const float *src = (const float*)mxGetData(z);
+        size_t i, n = mxGetNumberOfElements(z);
+
+        afbState = (double*)mxMalloc(n * sizeof(double));
+        for(i = 0; i < n; ++i) {
+          afbState[i] = src[i];
+        }
+        filterBankSetState(afbBank, band, afbState);
+        mxFree(afbState);
+        afbState = NULL;
+      }
+    }
+  }
+}
+
+/************************************************************
+ *
+ * Filters x with all bands and creates the output: y and the cell array
+ * with the final states.
+ *
+ ************************************************************/
+static void afb_filter(int nlhs, mxArray *plhs[], const mxArray *x, int nBands, int nChans)
+{
+  int nSamples = (int)mxGetM(x);
+  size_t nOut = (size_t)nSamples * nChans * nBands;
+  size_t i;
+  int band;
+
+  if(mxIsDouble(x)) {
+    plhs[0] = mxCreateDoubleMatrix(nSamples, nChans * nBands, mxREAL);
+    filterBankData(afbBank, mxGetPr(x), nSamples, mxGetPr(plhs[0]));
+  } else {
+    /* single data is filtered in double, see above */
+    const float *src = (const float*)mxGetData(x);
+    float *dst;
+
+    afbBuffer = (double*)mxMalloc((nOut + (size_t)nSamples * nChans) * sizeof(double));
+    for(i = 0; i < (size_t)nSamples * nChans; ++i) {
+      afbBuffer[nOut + i] = src[i];
+    }
+    filterBankData(afbBank, afbBuffer + nOut, nSamples, afbBuffer);
+
+    plhs[0] = mxCreateNumericMatrix(nSamples, nChans * nBands, mxSINGLE_CLASS, mxREAL);
+    dst = (float*)mxGetData(plhs[0]);
+    for(i = 0; i < nOut; ++i) {
+      dst[i] = (float)afbBuffer[i];
+    }
+  }
+
+  if(nlhs == 2) {
+    plhs[1] = mxCreateCellMatrix(1, nBands);
+    for(band = 0; band < nBands; ++band) {
+      int rows, sections;
+      mwSize dims[3];
+      mxArray *z;
+
+      filterBankStateShape(afbBank, band, &rows, &sections);
+      dims[0] = rows;
+      dims[1] = nChans;
+      dims[2] = sections;
+      if(mxIsDouble(x)) {
+        z = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
+        filterBankGetState(afbBank, band, mxGetPr(z));
+      } else {
+        /* the state keeps the class of x, like the one of filter */
+        float *dst;
+
+        z = mxCreateNumericArray(3, dims, mxSINGLE_CLASS, mxREAL);
+        dst = (float*)mxGetData(z);
+        afbState = (double*)mxMalloc((size_t)rows * nChans * sections * sizeof(double));
+        filterBankGetState(afbBank, band, afbState);
+        for(i = 0; i < (size_t)rows * nChans * sections; ++i) {
+          dst[i] = (float)afbState[i];
+        }
+        mxFree(afbState);
+        afbState = NULL;
+      }
+      mxSetCell(plhs[1], band, z);
+    }
+  }
+}
+
+/************************************************************
+ *
+ * frees the filter bank and the buffers
+ *
+ ************************************************************/
+static void afb_cleanup(void)
+{
+  filterBankDestroy(afbBank);
+  afbBank = NULL;
+
+  if(NULL != afbBuffer) {
+    mxFree(afbBuffer);
+    afbBuffer = NULL;
+  }
+  if(NULL != afbState) {
+    mxFree(afbState);
+    afbState = NULL;
+  }
+}
+
+/************************************************************
+ *
+ * checks for errors and does some cleanup before returning to matlab
+ *
+ ************************************************************/
+static void afb_assert(bool aValue, const char *text) {
+  if(!aValue) {
+    afb_cleanup();
+
+    mexErrMsgTxt(text);
+  }
+}
@@ -0,0 +1,47 @@
+function apply_filterbank
+% apply_filterbank - apply a bank of IIR filters to the same data
+%
+% SYNOPSIS
+%    [y, zf] = apply_filterbank(x, filt_b, filt_a, zi);
+%
+% ARGUMENTS
+%                x      - Data [T nChans], double or single
+%                filt_b - CELL [1 nBands] - b part of the filter of each band
+%                filt_a - CELL [1 nBands] - a part of the filter of each
+%                         band. If filt_a{i} is empty, filt_b{i} are second
+%                         order sections [nSections 6], each row
+%                         [b0 b1 b2 a0 a1 a2]
+%                zi     - CELL [1 nBands] - state of each band (optional),
+%                         double or single, empty cells start with a state
+%                         of zeros
+%
+% RETURNS
+%                y      - [T nChans*nBands] filtered data of the class of x,
+%                         columns 1:nChans are band 1 and so on
+%                zf     - CELL [1 nBands] - state of each band, of the
+%                         class of x: the zf of filter ([order nChans]), for
+%                         second order sections [2 nChans nSections] like
+%                         online_filt
+%
+% DESCRIPTION
+%    The result is the one of filter(filt_b{i}, filt_a{i}, x, zi{i}, 1)
+%    for each band. The bands are computed by the filter bank of filter.c
+%    in one pass over the data: a block of samples is read once and then
+%    filtered by all bands.
+%
+%    The filter bank computes in double. Single data is converted to
+%    double and the result is rounded to single, while filter computes
+%    single data in single. So for single data y can differ from the one
+%    of filter in the last bits, it is as exact as for double data. The
+%    state zf has the class of x like the one of filter, so online_filterbank
+%    can go on with it with or without the mex file.
+%
+%    This file only holds the documentation. If the mex file is missing
+%    online_filterbank and proc_filterbank use filter.
+%
+% COMPILE WITH
+%    mex apply_filterbank.c ../../online/acquisition/lib/filter.c
+%
+% SEE online_filterbank, proc_filterbank
+
+error('The mex file apply_filterbank is missing, see the help for compiling it.');
@@ -12,9 +12,16 @@ function dat= proc_filterbank(dat, filt_b, filt_a)
 %
 %Description:
 % apply a bank of digital (FIR or IIR) forward filter(s)
+% All filters are applied in one pass over the data by the mex file
+% apply_filterbank if it is compiled, else one after the other with
+% filter. If a{i} is empty, b{i} are second order sections (see
+% online_filt).
 %
 % SEE online_filterbank, butters
 
+% 2026/10/17 - Jonas Reiter
+%              - single pass filter bank (apply_filterbank)
+
 dat = misc_history(dat);
 
 misc_checkType(filt_b,'CELL');
@@ -23,13 +30,27 @@ misc_checkType(filt_a,'CELL');
 nFilters= length(filt_b);
 [T, nChans, nEpochs]= size(dat.x);
 nCE= nChans*nEpochs;
-xo= zeros([T, nCE*nFilters]);
 clab= cell(1, nChans*nFilters);
-cc= 1:nCE;
+cc= 1:nChans;
 for ii= 1:nFilters,
   clab(cc)= strcat(dat.clab, ['_flt' int2str(ii)]);
-  xo(:,cc)= filter(filt_b{ii}, filt_a{ii}, dat.x(:,:));
-  cc= cc + nCE;
+  cc= cc + nChans;
+end
+
+if exist('apply_filterbank','file')==3,
+  xo= apply_filterbank(dat.x(:,:), filt_b, filt_a);
+else
+  xo= zeros([T, nCE*nFilters], class(dat.x));
+  cc= 1:nCE;
+  for ii= 1:nFilters,
+    if isempty(filt_a{ii}),
+      band= online_filt(struct('x', dat.x(:,:)), [], filt_b{ii});
+      xo(:,cc)= band.x;
+    else
+      xo(:,cc)= filter(filt_b{ii}, filt_a{ii}, dat.x(:,:));
+    end
+    cc= cc + nCE;
+  end
 end
 dat.x= xo;
 dat.clab= clab;